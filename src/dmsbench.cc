@@ -0,0 +1,679 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/bulkupload.hh>
+#include <wersi/cartridgeregistry.hh>
+#include <wersi/checksum.hh>
+#include <wersi/deviceemulator.hh>
+#include <wersi/dx10device.hh>
+#include <wersi/fieldcodec.hh>
+#include <wersi/icb.hh>
+#include <wersi/instrumentstore.hh>
+#include <wersi/libraryindex.hh>
+#include <wersi/mk1writer.hh>
+#include <wersi/similarityindex.hh>
+#include <wersi/storeconverter.hh>
+#include <wersi/storesnapshot.hh>
+#include <wersi/sysex.hh>
+#include <wersi/sysexqueue.hh>
+#include <wersi/wave.hh>
+#include <exceptions.hh>
+#include <mappedfile.hh>
+#include <status.hh>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace DMSToolbox;
+using namespace DMSToolbox::Wersi;
+
+/// Output format
+enum class Format {
+    Text,                                   ///< Human readable table
+    Json                                    ///< JSON object with one entry per benchmark
+};
+
+/// Exit status codes
+enum ExitStatus {
+    Success = 0,                            ///< All benchmarks run
+    Usage = 1,                              ///< Invalid command line
+    OpenFailed = 2,                         ///< Input file could not be opened or is no known cartridge
+    VerifyFailed = 3                        ///< Vectorised and reference implementations differ
+};
+
+/// Seed of the synthetic images, fixed so results are comparable between runs
+static const uint32_t s_seed = 1;
+
+/// SysEx device type of DX10/EX10R messages
+static const uint8_t s_dx10Device = 1;
+
+/// Size of an MK1 cartridge image
+static const size_t s_mk1Size = 16384;
+
+/// Number of device images in the similarity search library
+static const size_t s_numLibraryFiles = 1000;
+
+/// Number of heap allocations, counted by the replaced global operator new
+static atomic<uint64_t> s_allocations(0);
+
+/// Sink for computed values, keeps the compiler from optimizing benchmarked code away
+static volatile uint32_t s_sink = 0;
+
+// Count heap allocations, array allocations end up here as well
+void* operator new(size_t size)
+{
+    s_allocations.fetch_add(1, memory_order_relaxed);
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+// Release memory allocated by counting operator new
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+/// Benchmark result
+struct Result {
+    Result()
+        : m_name()
+        , m_iterations(0)
+        , m_nsPerOp(0)
+        , m_mbPerSec(0)
+        , m_allocsPerOp(0) {
+    }
+
+    string      m_name;                     ///< Benchmark name
+    uint64_t    m_iterations;               ///< Operations per repetition
+    double      m_nsPerOp;                  ///< Median time per operation in nanoseconds
+    double      m_mbPerSec;                 ///< Throughput in MB/s, 0 if the operation has no data size
+    double      m_allocsPerOp;              ///< Heap allocations per operation
+};
+
+/// Benchmark input image
+struct Image {
+    Image()
+        : m_name()
+        , m_data() {
+    }
+
+    string                      m_name;     ///< Image name used in benchmark names
+    vector<uint8_t>             m_data;     ///< Image data
+};
+
+/// Benchmark settings
+struct Settings {
+    Settings()
+        : m_minTime(200)
+        , m_repetitions(5)
+        , m_filter()
+#ifdef HAVE_RTMIDI
+        , m_emulator()
+#endif // HAVE_RTMIDI
+    {
+#ifdef HAVE_RTMIDI
+        // Unlimited wire speed by default, so the benchmark measures the transfer code rather than the wire
+        m_emulator.m_byteRate = 0;
+#endif // HAVE_RTMIDI
+    }
+
+    chrono::milliseconds    m_minTime;      ///< Minimum duration of one repetition
+    size_t                  m_repetitions;  ///< Number of repetitions, the median is reported
+    string                  m_filter;       ///< Only run benchmarks containing this string
+#ifdef HAVE_RTMIDI
+    DeviceEmulator::Config  m_emulator;     ///< Emulated device behaviour for transfer benchmarks
+#endif // HAVE_RTMIDI
+};
+
+// Escape string for JSON output
+static string jsonString(const string& str)
+{
+    ostringstream out;
+    out << '"';
+    for (auto c : str) {
+        uint8_t u = uint8_t(c);
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (u < 0x20 || u >= 0x7f) {
+            out << "\\u" << hex << setw(4) << setfill('0') << uint16_t(u) << dec << setfill(' ');
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+// Run operation the given number of times, returns elapsed time in nanoseconds
+static double timeOperation(const function<void()>& op, uint64_t iterations)
+{
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; ++i) {
+        op();
+    }
+    return double(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+}
+
+// Run benchmark. The iteration count is doubled until a repetition takes the minimum time, then the median of all
+// repetitions is taken, which is robust against single disturbed runs.
+static void runBenchmark(const Settings& settings, vector<Result>& results, const string& name, size_t bytes,
+                         const function<void()>& op)
+{
+    if (name.find(settings.m_filter) == string::npos) {
+        return;
+    }
+
+    double minTime = double(chrono::duration_cast<chrono::nanoseconds>(settings.m_minTime).count());
+    uint64_t iterations = 1;
+    while (timeOperation(op, iterations) < minTime && iterations < (uint64_t(1) << 40)) {
+        iterations *= 2;
+    }
+
+    // Reserve the result list, so only allocations of the operation are counted
+    vector<double> times;
+    times.reserve(settings.m_repetitions);
+    uint64_t allocations = s_allocations.load(memory_order_relaxed);
+    for (size_t i = 0; i < settings.m_repetitions; ++i) {
+        times.push_back(timeOperation(op, iterations) / iterations);
+    }
+    allocations = s_allocations.load(memory_order_relaxed) - allocations;
+    sort(times.begin(), times.end());
+
+    Result result;
+    result.m_name = name;
+    result.m_iterations = iterations;
+    result.m_nsPerOp = times[times.size() / 2];
+    result.m_mbPerSec = bytes > 0 && result.m_nsPerOp > 0 ? bytes * 1000.0 / result.m_nsPerOp : 0;
+    result.m_allocsPerOp = double(allocations) / (iterations * settings.m_repetitions);
+    results.push_back(result);
+}
+
+// Create synthetic DX10/EX10R device image with random envelopes, waves and names but valid block links
+static void makeDeviceImage(Image& image, mt19937& random)
+{
+    image.m_name = "synthetic-dx10";
+    image.m_data.resize(Dx10Device::s_bufferSize);
+    Dx10Device device(&(image.m_data[0]), image.m_data.size());
+    for (size_t i = 0; i < 20; ++i) {
+        for (size_t j = 10; j < 16; ++j) {
+            image.m_data[i * 16 + j] = uint8_t('A' + random() % 26);
+        }
+    }
+    for (size_t i = 20 * 16; i < image.m_data.size(); ++i) {
+        image.m_data[i] = uint8_t(random());
+    }
+}
+
+// Create synthetic MK1 cartridge image holding the instruments of the given device image
+static void makeMk1Image(Image& image, Image& device)
+{
+    vector<uint8_t> buffer(device.m_data.size());
+    Dx10Device source(&(buffer[0]), buffer.size());
+    memcpy(&(buffer[0]), &(device.m_data[0]), buffer.size());
+    source.dissect();
+
+    Mk1Writer writer;
+    writer.addInstruments(source);
+    image.m_name = "synthetic-mk1";
+    image.m_data.resize(s_mk1Size);
+    writer.write(&(image.m_data[0]));
+}
+
+// Read cartridge image, the data is copied so it can be dissected any number of times
+static bool readImage(const string& fileName, Image& image)
+{
+    try {
+        MappedFile file(fileName);
+        auto data = static_cast<const uint8_t*>(file.getData());
+        image.m_data.assign(data, data + file.getSize());
+    }
+    catch (Exception& e) {
+        cerr << "Cannot open input file " << fileName << ": " << e.what() << endl;
+        return false;
+    }
+    size_t pos = fileName.find_last_of("/\\");
+    image.m_name = pos == string::npos ? fileName : fileName.substr(pos + 1);
+    return true;
+}
+
+// Run benchmarks of a cartridge image
+static bool benchmarkCartridge(const Settings& settings, vector<Result>& results, Image& image)
+{
+    unique_ptr<InstrumentStore> store;
+    string format;
+    try {
+        store.reset(CartridgeRegistry::open(&(image.m_data[0]), image.m_data.size(), false, format));
+    }
+    catch (Exception& e) {
+        cerr << "Cannot open cartridge " << image.m_name << ": " << e.what() << endl;
+        return false;
+    }
+
+    runBenchmark(settings, results, "dissect/" + image.m_name, image.m_data.size(), [&]() {
+        store->dissect();
+    });
+
+    vector<uint8_t> buffer(Dx10Device::s_bufferSize);
+    Dx10Device device(&(buffer[0]), buffer.size());
+    device.dissect();
+    runBenchmark(settings, results, "copyContents/" + image.m_name, 0, [&]() {
+        device.copyContents(*store);
+    });
+
+    // Conversion with the converter set up once
+    StoreLayout sourceLayout;
+    StoreLayout layout;
+    store->getLayout(sourceLayout);
+    device.getLayout(layout);
+    StoreConverter converter(sourceLayout, layout);
+    runBenchmark(settings, results, "convert/" + image.m_name, 0, [&]() {
+        converter.convert(store->getBuffer(), store->getBufferSize(), &(buffer[0]), buffer.size());
+    });
+
+    // One field across all ICBs, read in place versus dissecting every ICB
+    vector<int16_t> values(sourceLayout.m_icb.size());
+    const FieldCodec::Field& transpose = Icb::getField(Icb::Field::Transpose);
+    runBenchmark(settings, results, "extract/" + image.m_name, 0, [&]() {
+        FieldCodec::extract(store->getBuffer(), store->getBufferSize(), sourceLayout.m_icb, transpose, &(values[0]));
+        s_sink += uint32_t(values[0]);
+    });
+    runBenchmark(settings, results, "extract-dissect/" + image.m_name, 0, [&]() {
+        size_t j = 0;
+        for (auto i = store->begin(); i != store->end() && j < values.size(); ++i, ++j) {
+            i->second.dissect();
+            values[j] = i->second.getTranspose();
+        }
+        s_sink += uint32_t(values[0]);
+    });
+
+    // Read-only snapshots, published by the editing thread and picked up by readers
+    runBenchmark(settings, results, "snapshot/publish/" + image.m_name, image.m_data.size(), [&]() {
+        s_sink += uint32_t(store->publishSnapshot()->getVersion());
+    });
+    runBenchmark(settings, results, "snapshot/get/" + image.m_name, 0, [&]() {
+        s_sink += uint32_t(store->getSnapshot()->getSize());
+    });
+    return true;
+}
+
+// Run all benchmarks of basic operations
+static void benchmarkBasics(const Settings& settings, vector<Result>& results, Image& device, mt19937& random)
+{
+    // Device dissect
+    {
+        vector<uint8_t> buffer(device.m_data.size());
+        Dx10Device store(&(buffer[0]), buffer.size());
+        memcpy(&(buffer[0]), &(device.m_data[0]), buffer.size());
+        runBenchmark(settings, results, "dissect/" + device.m_name, buffer.size(), [&]() {
+            store.dissect();
+        });
+    }
+
+    // Checksum over a full MK1 image
+    vector<uint8_t> data(s_mk1Size);
+    for (auto& i : data) {
+        i = uint8_t(random());
+    }
+    runBenchmark(settings, results, "checksum/16k", data.size(), [&]() {
+        s_sink = Checksum::sum(&(data[0]), data.size());
+    });
+
+    // Nibble encoding and decoding of the largest block, the frame to decode is encoded up front, as the encoding
+    // benchmark may be filtered out
+    const uint8_t length = 212;
+    vector<unsigned char> encoded;
+    SysEx::encode(s_dx10Device, SysEx::BlockType::FixWaveBlock, 65, &(data[0]), length, encoded);
+    vector<unsigned char> buffer;
+    buffer.reserve(SysEx::s_maxMessageSize);
+    runBenchmark(settings, results, "sysex/encode", length, [&]() {
+        s_sink = SysEx::encode(s_dx10Device, SysEx::BlockType::FixWaveBlock, 65, &(data[0]), length, buffer);
+    });
+    vector<uint8_t> decoded(sizeof(SysEx::Message) + 255);
+    auto message = reinterpret_cast<SysEx::Message*>(&(decoded[0]));
+    auto sysEx = reinterpret_cast<const SysEx::SysExMessage*>(&(encoded[0]));
+    runBenchmark(settings, results, "sysex/decode", length, [&]() {
+        SysEx::fromSysEx(s_dx10Device, *sysEx, *message, encoded.size());
+        s_sink = message->m_length;
+    });
+
+    // Rejecting a stray frame, as seen under MIDI noise, by exception and by status
+    vector<unsigned char> stray(encoded);
+    stray[9 + length] ^= 0x40;
+    auto straySysEx = reinterpret_cast<const SysEx::SysExMessage*>(&(stray[0]));
+    runBenchmark(settings, results, "sysex/reject-throw", length, [&]() {
+        try {
+            SysEx::fromSysEx(s_dx10Device, *straySysEx, *message, stray.size());
+        }
+        catch (Exception&) {
+            ++s_sink;
+        }
+    });
+    Status status;
+    runBenchmark(settings, results, "sysex/reject-status", length, [&]() {
+        s_sink += SysEx::fromSysEx(s_dx10Device, *straySysEx, *message, stray.size(), status) ? 0 : 1;
+    });
+
+    // Rejecting a file that looks like an MK1 image but fails dissection, like many files of a directory scan
+    vector<uint8_t> unknown(data.begin(), data.end());
+    unknown[0] = 0xff;
+    unknown[1] = 0xff;
+    for (size_t i = 2; i < 12; i += 2) {
+        unknown[i] = 0x01;
+        unknown[i + 1] = 0x00;
+    }
+    memset(&(unknown[0x100]), 0, 20 * 2);
+    string format;
+    runBenchmark(settings, results, "open/reject-throw", unknown.size(), [&]() {
+        try {
+            delete CartridgeRegistry::open(&(unknown[0]), unknown.size(), true, format);
+        }
+        catch (Exception&) {
+            ++s_sink;
+        }
+    });
+    runBenchmark(settings, results, "open/reject-status", unknown.size(), [&]() {
+        InstrumentStore* store = CartridgeRegistry::open(&(unknown[0]), unknown.size(), true, format, status);
+        s_sink += store == nullptr ? 1 : 0;
+        delete store;
+    });
+
+    // Wave parsing
+    Wave wave(65, &(data[0]), length);
+    runBenchmark(settings, results, "wave/dissect", length, [&]() {
+        wave.dissect();
+    });
+
+    // Nearest wave query over a library of random devices sharing the layout of the synthetic device
+    {
+        vector<uint8_t> buffer(device.m_data);
+        Dx10Device store(&(buffer[0]), buffer.size());
+        store.dissect();
+        LibraryIndex::Entry entry;
+        LibraryIndex::describe(entry, store, "DX10/EX10R");
+        SimilarityIndex index;
+        for (size_t i = 0; i < s_numLibraryFiles; ++i) {
+            for (auto& j : buffer) {
+                j = uint8_t(random());
+            }
+            entry.m_path = "library/" + to_string(i);
+            entry.m_hash = i;
+            index.add(entry, &(buffer[0]), buffer.size());
+        }
+        SimilarityIndex::Features query;
+        SimilarityIndex::Kind kind;
+        SimilarityIndex::getFeatures(SysEx::BlockType::FixWaveBlock, &(data[0]), length, kind, query);
+        vector<SimilarityIndex::Match> matches;
+        size_t size = index.size(SimilarityIndex::Kind::Wave);
+        runBenchmark(settings, results, "similarity/" + to_string(size) + "-waves", 0, [&]() {
+            index.findNearest(SimilarityIndex::Kind::Wave, query, 10, matches);
+            s_sink += matches[0].m_distance;
+        });
+    }
+}
+
+#ifdef HAVE_RTMIDI
+// Parse emulator configuration given as <latency us>:<jitter us>:<bytes per second>:<loss probability>
+static bool parseEmulator(const char* spec, DeviceEmulator::Config& config)
+{
+    unsigned long latency = 0;
+    unsigned long jitter = 0;
+    unsigned long rate = 0;
+    double loss = 0;
+    char end = 0;
+    if (sscanf(spec, "%lu:%lu:%lu:%lf%c", &latency, &jitter, &rate, &loss, &end) != 4 || loss < 0 || loss >= 1) {
+        return false;
+    }
+    config.m_latency = chrono::microseconds(latency);
+    config.m_jitter = chrono::microseconds(jitter);
+    config.m_byteRate = uint32_t(rate);
+    config.m_loss = loss;
+    return true;
+}
+
+// Run device transfer benchmarks against an emulated device holding the given image
+static void benchmarkTransfers(const Settings& settings, vector<Result>& results, Image& device)
+{
+    vector<uint8_t> deviceBuffer(device.m_data.size());
+    Dx10Device emulated(&(deviceBuffer[0]), deviceBuffer.size());
+    memcpy(&(deviceBuffer[0]), &(device.m_data[0]), deviceBuffer.size());
+    emulated.dissect();
+
+    vector<uint8_t> buffer(device.m_data.size());
+    Dx10Device store(&(buffer[0]), buffer.size());
+    SysExQueue queue(&store, s_dx10Device);
+    DeviceEmulator emulator(emulated, s_dx10Device);
+    emulator.setConfig(settings.m_emulator);
+    emulator.setCallback(SysEx::rtMidiCallback, &queue);
+
+    // Pipelined read of all blocks, the store ends up holding the image for the upload
+    runBenchmark(settings, results, "emulator/read", buffer.size(), [&]() {
+        store.readFromDevice(nullptr, emulator.getOutPort(), nullptr, nullptr);
+    });
+    runBenchmark(settings, results, "emulator/upload", buffer.size(), [&]() {
+        BulkUpload upload(store, s_dx10Device);
+        upload.setByteRate(settings.m_emulator.m_byteRate);
+        upload.run(emulator.getOutPort(), nullptr, nullptr);
+    });
+    runBenchmark(settings, results, "emulator/upload-verify", buffer.size(), [&]() {
+        BulkUpload upload(store, s_dx10Device);
+        upload.setByteRate(settings.m_emulator.m_byteRate);
+        upload.setVerify(true);
+        upload.run(emulator.getOutPort(), nullptr, nullptr);
+    });
+    emulator.cancelCallback();
+}
+#endif // HAVE_RTMIDI
+
+// Run random and corrupted frames through the vectorised and reference SysEx codec
+static bool verifyCodec(size_t frames, mt19937& random)
+{
+    // Buffers are larger than a frame, so frames can be placed at any alignment
+    vector<uint8_t> data(255 + 16);
+    vector<uint8_t> pairs(2 * 255 + 16);
+    vector<unsigned char> message;
+    for (size_t i = 0; i < frames; ++i) {
+        uint8_t length = uint8_t(random() % 256);
+        uint8_t* raw = &data[random() % 16];
+        uint8_t* in = &pairs[random() % 16];
+        for (size_t j = 0; j < length; ++j) {
+            raw[j] = uint8_t(random());
+        }
+
+        // Valid frames, frames with a single corrupted byte and frames of random bytes
+        SysEx::encode(s_dx10Device, SysEx::BlockType::FixWaveBlock, 0, raw, length, message);
+        memcpy(in, &message[9], 2 * size_t(length));
+        switch (i % 3) {
+            case 0:
+                break;
+            case 1:
+                if (length > 0) {
+                    in[random() % (2 * size_t(length))] ^= uint8_t(1 << (random() % 8));
+                }
+                break;
+            default:
+                for (size_t j = 0; j < 2 * size_t(length); ++j) {
+                    in[j] = uint8_t(random());
+                }
+                break;
+        }
+
+        Status status;
+        if (!SysEx::verifyCodec(raw, in, length, status)) {
+            cerr << "Frame " << i << ", " << int(length) << " bytes: " << status.getMessage() << endl;
+            return false;
+        }
+    }
+    cerr << frames << " frames verified" << endl;
+    return true;
+}
+
+// Print results as text table
+static void printText(const vector<Result>& results)
+{
+    cout << left << setw(32) << "Benchmark" << right << setw(12) << "Iterations" << setw(14) << "ns/op"
+         << setw(12) << "MB/s" << setw(12) << "allocs/op" << endl;
+    cout << fixed;
+    for (auto& i : results) {
+        cout << left << setw(32) << i.m_name << right << setw(12) << i.m_iterations << setw(14) << setprecision(1)
+             << i.m_nsPerOp << setw(12) << setprecision(1) << i.m_mbPerSec << setw(12) << setprecision(2)
+             << i.m_allocsPerOp << endl;
+    }
+}
+
+// Print results as JSON object
+static void printJson(const vector<Result>& results, const Settings& settings)
+{
+    cout << "{\"seed\": " << s_seed << ", \"min_time_ms\": " << settings.m_minTime.count() << ", \"repetitions\": "
+         << settings.m_repetitions << ", \"benchmarks\": [" << endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        cout << "{\"name\": " << jsonString(r.m_name) << ", \"iterations\": " << r.m_iterations
+             << ", \"ns_per_op\": " << r.m_nsPerOp << ", \"mb_per_s\": " << r.m_mbPerSec
+             << ", \"allocs_per_op\": " << r.m_allocsPerOp << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    cout << "]}" << endl;
+}
+
+// Main function
+int main(int argc, char** argv)
+{
+    // Check arguments
+    Format format = Format::Text;
+    Settings settings;
+    vector<string> paths;
+    size_t verify = 0;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            settings.m_minTime = chrono::milliseconds(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            settings.m_repetitions = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            verify = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            settings.m_filter = argv[++i];
+        }
+#ifdef HAVE_RTMIDI
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            valid = parseEmulator(argv[++i], settings.m_emulator) && valid;
+        }
+#endif // HAVE_RTMIDI
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "text") == 0) {
+                format = Format::Text;
+            }
+            else if (strcmp(argv[i], "json") == 0) {
+                format = Format::Json;
+            }
+            else {
+                valid = false;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            valid = false;
+        }
+        else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (!valid || settings.m_repetitions == 0) {
+        cerr << "Usage: " << argv[0] << " -v <frames>" << endl
+             << "       " << argv[0] << " [-f text|json] [-t <ms>] [-r <repetitions>] [-b <filter>]"
+#ifdef HAVE_RTMIDI
+             << " [-e <latency us>:<jitter us>:<bytes/s>:<loss>]"
+#endif // HAVE_RTMIDI
+             << " [<cartridge>...]" << endl;
+        return Usage;
+    }
+
+    // Synthetic images come first, so results of different image sets can be compared
+    mt19937 random(s_seed);
+    if (verify > 0) {
+        return verifyCodec(verify, random) ? Success : VerifyFailed;
+    }
+    vector<Image> images(2);
+    makeDeviceImage(images[0], random);
+    makeMk1Image(images[1], images[0]);
+    for (auto& i : paths) {
+        Image image;
+        if (!readImage(i, image)) {
+            return OpenFailed;
+        }
+        images.push_back(image);
+    }
+
+    vector<Result> results;
+    benchmarkBasics(settings, results, images[0], random);
+#ifdef HAVE_RTMIDI
+    benchmarkTransfers(settings, results, images[0]);
+#endif // HAVE_RTMIDI
+    for (size_t i = 1; i < images.size(); ++i) {
+        if (!benchmarkCartridge(settings, results, images[i])) {
+            return OpenFailed;
+        }
+    }
+
+    if (format == Format::Json) {
+        printJson(results, settings);
+    }
+    else {
+        printText(results);
+    }
+    return Success;
+}
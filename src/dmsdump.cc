@@ -35,121 +35,1141 @@
   Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
  */
 
-#include <wersi/mk1cartridge.hh>
+#include <wersi/blockpool.hh>
+#include <wersi/cartridgeregistry.hh>
+#include <wersi/checksum.hh>
 #include <wersi/dx10cartridge.hh>
+#include <wersi/dx10device.hh>
+#include <wersi/instrumentstore.hh>
 #include <wersi/icb.hh>
+#include <wersi/libraryindex.hh>
+#include <wersi/mk1writer.hh>
+#include <wersi/similarityindex.hh>
+#include <wersi/storepatch.hh>
+#include <wersi/sysexstream.hh>
 #include <wersi/vcf.hh>
+#include <wersi/wave.hh>
+#include <wersi/voicerenderer.hh>
+#include <wersi/transferstats.hh>
 #include <exceptions.hh>
+#include <logger.hh>
+#include <mappedfile.hh>
+#include <status.hh>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <iomanip>
-#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else // _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif // _WIN32
 
 using namespace std;
 using namespace DMSToolbox;
 using namespace DMSToolbox::Wersi;
 
-int main(int argc, char** argv)
+/// Output format
+enum class Format {
+    Text,                                   ///< Human readable text
+    Json                                    ///< JSON array with one object per file
+};
+
+/// Output type of batch conversion
+enum class OutputType {
+    SysEx,                                  ///< DX10/EX10R SysEx messages
+    Mk1,                                    ///< MK1 cartridge image
+    Dx10                                    ///< DX10/DX5 cartridge image
+};
+
+/// Exit status codes
+enum ExitStatus {
+    Success = 0,                            ///< All files dumped
+    Usage = 1,                              ///< Invalid command line
+    OpenFailed = 2,                         ///< Input file could not be opened
+    TooLarge = 3,                           ///< Input file too large
+    UnknownFormat = 4                       ///< Input file is no known cartridge, or any file failed in batch mode
+};
+
+/// SysEx device type of DX10/EX10R messages
+static const uint8_t s_dx10Device = 1;
+
+/// Result of dumping one file
+struct Result {
+    Result()
+        : m_output()
+        , m_status(Success)
+        , m_done(false) {
+    }
+
+    string      m_output;                   ///< Formatted output
+    int         m_status;                   ///< Exit status for this file
+    bool        m_done;                     ///< Set when the file has been processed
+};
+
+// Escape string for JSON output, cartridge names are 8 bit data
+static string jsonString(const string& str)
 {
-    // Check arguments
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <filename>" << endl;
-        return 1;
+    ostringstream out;
+    out << '"';
+    for (auto c : str) {
+        uint8_t u = uint8_t(c);
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (u < 0x20 || u >= 0x7f) {
+            out << "\\u" << hex << setw(4) << setfill('0') << uint16_t(u) << dec << setfill(' ');
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+// Dump instrument store as text
+static void dumpText(InstrumentStore* is, ostream& out)
+{
+    for (auto& i : *is) {
+        Icb& icb = i.second;
+        out << "ICB " << setw(3) << uint16_t(i.first)
+            << " (" << setw(6) << icb.getName() << ")"
+            << ": Next " << setw(3) << uint16_t(icb.getNextIcb())
+            << " V " << setw(3) << uint16_t(icb.getVcfBlock())
+            << " A " << setw(3) << uint16_t(icb.getAmplBlock())
+            << " F " << setw(3) << uint16_t(icb.getFreqBlock())
+            << " W " << setw(3) << uint16_t(icb.getWaveBlock())
+            << " D " << setw(1) << uint16_t(icb.getDynamics())
+            << (icb.getLowSelect() ? 'L' : '-')
+            << (icb.getHighSelect() ? 'H' : '-')
+            << " O " << (icb.getLeft() ? 'L' : '-')
+            << (icb.getRight() ? 'R' : '-')
+            << (icb.getVcf() ? 'V' : '-')
+            << (icb.getWersiVoice() ? 'W' : '-')
+            << (icb.getBright() ? 'B' : '-')
+            << " T " << setw(4) << int16_t(icb.getTranspose())
+            << " D " << setw(4) << int16_t(icb.getDetune())
+            << " WV " << setw(10) << icb.getWvModeName(icb.getWvMode())
+            << " " << (icb.getWvLeft() ? 'L' : '-')
+            << (icb.getWvRight() ? 'R' : '-')
+            << (icb.getWvFbFlat() ? 'F' : '-')
+            << (icb.getWvFbDeep() ? 'D' : '-')
+            << " U " << hex << setw(2) << uint16_t(icb.getUnknownBits()) << dec
+            << endl;
+        Vcf* vcf = is->getVcf(icb.getVcfBlock());
+        if (vcf != nullptr) {
+            out << "   VCF " << (vcf->getLeft() ? 'L' : '-')
+                << (vcf->getRight() ? 'R' : '-')
+                << (vcf->getWersiVoice() ? 'W' : '-')
+                << (vcf->getNoise() ? 'N' : '-')
+                << (vcf->getDistortion() ? 'D' : '-')
+                << (vcf->getLowPass() ? " LP" : " BP")
+                << (vcf->getFourPoles() ? '4' : '2')
+                << " F " << setw(4) << int16_t(vcf->getFrequency())
+                << " Q " << setw(3) << uint16_t(vcf->getQuality())
+                << " NT " << setw(5) << vcf->getNoiseTypeName(vcf->getNoiseType())
+                << " " << (vcf->getRetrigger() ? 'R' : '-')
+                << (vcf->getTracking() ? 'T' : '-')
+                << " ENV " << setw(15) << vcf->getEnvelopeModeName(vcf->getEnvelopeMode())
+                << " T1 T " << setw(3) << uint16_t(vcf->getT1Time())
+                << " I " << setw(4) << int16_t(vcf->getT1Intensity())
+                << " O " << setw(4) << int16_t(vcf->getT1Offset())
+                << " T2 T " << setw(3) << uint16_t(vcf->getT2Time())
+                << " I " << setw(4) << int16_t(vcf->getT2Intensity())
+                << " O " << setw(4) << int16_t(vcf->getT2Offset())
+                << " U " << hex << setw(2) << uint16_t(vcf->getUnknownBits()) << dec
+                << endl;
+        }
+    }
+}
+
+// Dump instrument store as JSON object members
+static void dumpJson(InstrumentStore* is, ostream& out)
+{
+    out << ", \"icbs\": [";
+    bool first = true;
+    for (auto& i : *is) {
+        Icb& icb = i.second;
+        out << (first ? "" : ", ")
+            << "{\"block\": " << uint16_t(i.first)
+            << ", \"name\": " << jsonString(icb.getName())
+            << ", \"next\": " << uint16_t(icb.getNextIcb())
+            << ", \"vcf\": " << uint16_t(icb.getVcfBlock())
+            << ", \"ampl\": " << uint16_t(icb.getAmplBlock())
+            << ", \"freq\": " << uint16_t(icb.getFreqBlock())
+            << ", \"wave\": " << uint16_t(icb.getWaveBlock())
+            << ", \"transpose\": " << int16_t(icb.getTranspose())
+            << ", \"detune\": " << int16_t(icb.getDetune())
+            << ", \"wvMode\": " << jsonString(icb.getWvModeName(icb.getWvMode()));
+        Vcf* vcf = is->getVcf(icb.getVcfBlock());
+        if (vcf != nullptr) {
+            out << ", \"filter\": {\"lowPass\": " << (vcf->getLowPass() ? "true" : "false")
+                << ", \"fourPoles\": " << (vcf->getFourPoles() ? "true" : "false")
+                << ", \"frequency\": " << int16_t(vcf->getFrequency())
+                << ", \"quality\": " << uint16_t(vcf->getQuality())
+                << ", \"envelope\": " << jsonString(vcf->getEnvelopeModeName(vcf->getEnvelopeMode())) << "}";
+        }
+        out << "}";
+        first = false;
+    }
+    out << "]";
+}
+
+// Check for SysEx input, which is read from stdin for "-"
+static bool isSysExFile(const string& fileName)
+{
+    if (fileName == "-") {
+        return true;
+    }
+    if (fileName.size() < 4) {
+        return false;
+    }
+    string ext = fileName.substr(fileName.size() - 4);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".syx";
+}
+
+// Stream SysEx file into a DX10/EX10R device store, returns exit status and fills error message on failure
+static int readSysExFile(const string& fileName, vector<uint8_t>& buffer, unique_ptr<InstrumentStore>& is,
+                         string& type, string& error)
+{
+    buffer.resize(Dx10Device::s_bufferSize);
+    is.reset(new Dx10Device(&buffer[0], buffer.size()));
+    SysExReader reader(*is, s_dx10Device);
+    try {
+        if (fileName == "-") {
+            reader.read(cin);
+        }
+        else {
+            ifstream in(fileName.c_str(), ios::binary);
+            if (!in) {
+                error = "Cannot open input file";
+                return OpenFailed;
+            }
+            reader.read(in);
+        }
+    }
+    catch (Exception& e) {
+        error = string("Cannot read input file: ") + e.what();
+        return OpenFailed;
+    }
+    if (reader.getNumApplied() == 0) {
+        error = "No DX10/EX10R blocks in SysEx data";
+        return UnknownFormat;
+    }
+    type = "DX10/EX10R SysEx";
+    return Success;
+}
+
+// Map file and detect cartridge type, returns exit status and fills error message on failure. SysEx files are
+// streamed into the given buffer instead, so their size is not limited.
+static int openFile(const string& fileName, unique_ptr<MappedFile>& file, vector<uint8_t>& buffer,
+                    unique_ptr<InstrumentStore>& is, string& type, string& error)
+{
+    if (isSysExFile(fileName)) {
+        return readSysExFile(fileName, buffer, is, type, error);
     }
 
-    // Open and check input file
-    ifstream f(argv[1], ios::binary);
-    if (!f) {
-        cerr << "Cannot open input file" << endl;
-        return 2;
+    // Map and check input file
+    try {
+        file.reset(new MappedFile(fileName));
     }
-    f.seekg(0, ios::end);
-    size_t size = size_t(f.tellg());
-    f.seekg(0, ios::beg);
+    catch (Exception& e) {
+        error = string("Cannot open input file: ") + e.what();
+        return OpenFailed;
+    }
+    size_t size = file->getSize();
     if (size > 1024 * 1024) {
-        cerr << "Input file too large" << endl;
-        return 3;
+        error = "Input file too large";
+        return TooLarge;
     }
 
-    char* buf = new char[size];
-    f.read(buf, size);
+    // Files of unknown format are routine in directory scans, so they are reported without throwing
+    Status status;
+    is.reset(CartridgeRegistry::open(file->getData(), size, true, type, status));
+    if (!status.isOk()) {
+        error = status.getMessage();
+        return UnknownFormat;
+    }
+    return Success;
+}
+
+// Detect cartridge type and dump a single file, optionally followed by the transfer statistics of SysEx input
+static int dumpFile(const string& fileName, Format format, ostream& out, ostream& err, bool stats = false)
+{
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    int status = openFile(fileName, file, buffer, is, type, error);
+
+    if (format == Format::Json) {
+        out << "{\"file\": " << jsonString(fileName);
+        if (status == Success) {
+            out << ", \"format\": " << jsonString(type);
+            dumpJson(is.get(), out);
+        }
+        else {
+            out << ", \"error\": " << jsonString(error);
+        }
+        out << "}";
+    }
+    else {
+        if (status == Success) {
+            out << "Detected " << type << " cartridge" << endl;
+            dumpText(is.get(), out);
+        }
+        else {
+            err << error << endl;
+        }
+    }
+
+    if (stats && is && is->getStats() != nullptr) {
+        TransferStats::Snapshot snapshot;
+        is->getStats()->getSnapshot(snapshot);
+        TransferStats::print(err, snapshot);
+    }
+
+    return status;
+}
+
+// Get output file name in directory for an input file
+static string getOutputName(const string& dir, const string& fileName, const string& extension)
+{
+    size_t slash = fileName.find_last_of("/\\");
+    return dir + "/" + (slash != string::npos ? fileName.substr(slash + 1) : fileName) + extension;
+}
+
+// Write instrument store as DX10/EX10R SysEx, cartridges are converted to the device layout
+static void writeSysEx(InstrumentStore& is, ostream& out)
+{
+    vector<uint8_t> deviceBuffer;
+    unique_ptr<InstrumentStore> device;
+    if (dynamic_cast<Dx10Device*>(&is) == nullptr) {
+        deviceBuffer.resize(Dx10Device::s_bufferSize);
+        device.reset(new Dx10Device(&deviceBuffer[0], deviceBuffer.size()));
+        device->copyContents(is);
+    }
+    SysExWriter writer(out, s_dx10Device);
+    writer.write(device ? *device : is);
+}
+
+// Detect cartridge type and write a single file as DX10/EX10R SysEx, cartridges are converted to the device layout
+static int exportFile(const string& fileName, ostream& out, ostream& err)
+{
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    int status = openFile(fileName, file, buffer, is, type, error);
+    if (status != Success) {
+        err << error << endl;
+        return status;
+    }
 
-    InstrumentStore* is = nullptr;
     try {
-        is = new Mk1Cartridge(buf);
-        cout << "Detected MK1 cartridge" << endl;
+        writeSysEx(*is, out);
+        out.flush();
     }
-    catch (DataFormatException& e) {
-        string mk1Error = e.what();
-        try {
-            is = new Dx10Cartridge(buf, size);
-            cout << "Detected DX10/DX5 cartridge" << endl;
+    catch (Exception& e) {
+        err << e.what() << endl;
+        return OpenFailed;
+    }
+    return Success;
+}
+
+// Detect cartridge type and convert a single file into the output directory
+static int convertFile(const string& fileName, const string& dir, OutputType type, ostream& err)
+{
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string inputType;
+    string error;
+    int status = openFile(fileName, file, buffer, is, inputType, error);
+    if (status != Success) {
+        err << fileName << ": " << error << endl;
+        return status;
+    }
+
+    // Converted images are built in memory and written as a whole
+    ostringstream out;
+    string extension;
+    try {
+        vector<uint8_t> image;
+        switch (type) {
+            case OutputType::SysEx:
+                writeSysEx(*is, out);
+                extension = ".syx";
+                break;
+            case OutputType::Mk1: {
+                Mk1Writer writer;
+                // Instruments not fitting the cartridge are left out with a warning only
+                size_t added = writer.addInstruments(*is);
+                size_t primary = is->getNumIcbs();
+                if (primary > Mk1Writer::s_numSlots) {
+                    primary = Mk1Writer::s_numSlots;
+                }
+                if (added < primary) {
+                    err << fileName << ": Only " << added << " of " << primary << " instruments fit" << endl;
+                }
+                image.resize(16384);
+                writer.write(&image[0]);
+                extension = ".mk1";
+                break;
+            }
+            case OutputType::Dx10: {
+                // The cartridge starts out empty, only its checksum needs to be valid for dissecting it
+                image.resize(8192);
+                Checksum::store(&image[0], 0x0f64, &image[0x0f64], 0x3131);
+                Dx10Cartridge cartridge(&image[0], image.size());
+                cartridge.copyContents(*is);
+                extension = ".dx10";
+                break;
+            }
         }
-        catch (DataFormatException& e) {
-            cerr << "Cartridge is neither MK1 nor DX10/DX5 format" << endl;
-            cerr << "MK1 error: " << mk1Error << endl;
-            cerr << "DX10/DX5 error: " << e.what() << endl;
+        if (!image.empty()) {
+            out.write(reinterpret_cast<const char*>(&image[0]), image.size());
         }
     }
     catch (Exception& e) {
-        cerr << "Other exception: " << e.what() << endl;
-    }
-    if (is != nullptr) {
-        for (auto& i : *is) {
-            Icb& icb = i.second;
-            cout << "ICB " << setw(3) << uint16_t(i.first)
-                 << " (" << setw(6) << icb.getName() << ")"
-                 << ": Next " << setw(3) << uint16_t(icb.getNextIcb())
-                 << " V " << setw(3) << uint16_t(icb.getVcfBlock())
-                 << " A " << setw(3) << uint16_t(icb.getAmplBlock())
-                 << " F " << setw(3) << uint16_t(icb.getFreqBlock())
-                 << " W " << setw(3) << uint16_t(icb.getWaveBlock())
-                 << " D " << setw(1) << uint16_t(icb.getDynamics())
-                 << (icb.getLowSelect() ? 'L' : '-')
-                 << (icb.getHighSelect() ? 'H' : '-')
-                 << " O " << (icb.getLeft() ? 'L' : '-')
-                 << (icb.getRight() ? 'R' : '-')
-                 << (icb.getVcf() ? 'V' : '-')
-                 << (icb.getWersiVoice() ? 'W' : '-')
-                 << (icb.getBright() ? 'B' : '-')
-                 << " T " << setw(4) << int16_t(icb.getTranspose())
-                 << " D " << setw(4) << int16_t(icb.getDetune())
-                 << " WV " << setw(10) << icb.getWvModeName(icb.getWvMode())
-                 << " " << (icb.getWvLeft() ? 'L' : '-')
-                 << (icb.getWvRight() ? 'R' : '-')
-                 << (icb.getWvFbFlat() ? 'F' : '-')
-                 << (icb.getWvFbDeep() ? 'D' : '-')
-                 << " U " << hex << setw(2) << uint16_t(icb.getUnknownBits()) << dec
-                 << endl;
-            Vcf* vcf = is->getVcf(icb.getVcfBlock());
-            if (vcf != nullptr) {
-                cout << "   VCF " << (vcf->getLeft() ? 'L' : '-')
-                     << (vcf->getRight() ? 'R' : '-')
-                     << (vcf->getWersiVoice() ? 'W' : '-')
-                     << (vcf->getNoise() ? 'N' : '-')
-                     << (vcf->getDistortion() ? 'D' : '-')
-                     << (vcf->getLowPass() ? " LP" : " BP")
-                     << (vcf->getFourPoles() ? '4' : '2')
-                     << " F " << setw(4) << int16_t(vcf->getFrequency())
-                     << " Q " << setw(3) << uint16_t(vcf->getQuality())
-                     << " NT " << setw(5) << vcf->getNoiseTypeName(vcf->getNoiseType())
-                     << " " << (vcf->getRetrigger() ? 'R' : '-')
-                     << (vcf->getTracking() ? 'T' : '-')
-                     << " ENV " << setw(15) << vcf->getEnvelopeModeName(vcf->getEnvelopeMode())
-                     << " T1 T " << setw(3) << uint16_t(vcf->getT1Time())
-                     << " I " << setw(4) << int16_t(vcf->getT1Intensity())
-                     << " O " << setw(4) << int16_t(vcf->getT1Offset())
-                     << " T2 T " << setw(3) << uint16_t(vcf->getT2Time())
-                     << " I " << setw(4) << int16_t(vcf->getT2Intensity())
-                     << " O " << setw(4) << int16_t(vcf->getT2Offset())
-                     << " U " << hex << setw(2) << uint16_t(vcf->getUnknownBits()) << dec
-                     << endl;
-            }
-        }
-
-        delete is;
-    }
-
-    delete[] buf;
-
-    return 0;
+        err << fileName << ": " << e.what() << endl;
+        return UnknownFormat;
+    }
+
+    string outputName = getOutputName(dir, fileName, extension);
+    ofstream output(outputName.c_str(), ios::binary | ios::trunc);
+    output << out.str();
+    if (!output) {
+        err << outputName << ": Cannot write output file" << endl;
+        return OpenFailed;
+    }
+    return Success;
+}
+
+// Detect cartridge type and add all blocks of a single file to the duplicate block index
+static int poolFile(const string& fileName, size_t owner, BlockPool& pool, ostream& err)
+{
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    int status = openFile(fileName, file, buffer, is, type, error);
+    if (status == Success) {
+        try {
+            pool.add(owner, *is);
+        }
+        catch (Exception& e) {
+            error = e.what();
+            status = UnknownFormat;
+        }
+    }
+    if (status != Success) {
+        err << fileName << ": " << error << endl;
+    }
+    return status;
+}
+
+// Get block type name
+static const char* getTypeName(SysEx::BlockType type)
+{
+    switch (type) {
+        case SysEx::BlockType::IcBlock:
+            return "ICB";
+        case SysEx::BlockType::VcfBlock:
+            return "VCF";
+        case SysEx::BlockType::AmplBlock:
+            return "AMPL";
+        case SysEx::BlockType::FreqBlock:
+            return "FREQ";
+        case SysEx::BlockType::FixWaveBlock:
+            return "FIXWAVE";
+        case SysEx::BlockType::RelWaveBlock:
+            return "RELWAVE";
+        default:
+            return "unknown";
+    }
+}
+
+// Print all duplicate blocks of the duplicate block index
+static void dumpDuplicates(const BlockPool& pool, const vector<string>& files, Format format)
+{
+    vector<BlockPool::Duplicate> duplicates;
+    pool.getDuplicates(duplicates);
+
+    if (format == Format::Json) {
+        cout << "[";
+        for (size_t i = 0; i < duplicates.size(); ++i) {
+            auto& dup = duplicates[i];
+            cout << (i > 0 ? "," : "") << endl << "{\"type\": \"" << getTypeName(dup.m_type) << "\", \"size\": "
+                 << dup.m_size << ", \"blocks\": [";
+            for (size_t j = 0; j < dup.m_references.size(); ++j) {
+                auto& ref = dup.m_references[j];
+                cout << (j > 0 ? ", " : "") << "{\"file\": " << jsonString(files[ref.m_owner]) << ", \"block\": "
+                     << int(ref.m_block) << "}";
+            }
+            cout << "]}";
+        }
+        cout << endl << "]" << endl;
+    }
+    else {
+        for (auto& i : duplicates) {
+            cout << getTypeName(i.m_type) << " block, " << i.m_size << " bytes, " << i.m_references.size()
+                 << " copies:" << endl;
+            for (auto& j : i.m_references) {
+                cout << "    " << files[j.m_owner] << " #" << int(j.m_block) << endl;
+            }
+        }
+    }
+
+    cerr << pool.getNumReferences() << " blocks, " << pool.getNumBlocks() << " distinct, "
+         << pool.getReferencedSize() << " bytes, " << pool.getDistinctSize() << " bytes distinct" << endl;
+}
+
+// Detect cartridge type and add all waves and envelopes of a single file to the similarity index
+static int indexFile(const string& fileName, SimilarityIndex& index, ostream& err)
+{
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    int status = openFile(fileName, file, buffer, is, type, error);
+    if (status == Success) {
+        try {
+            LibraryIndex::Entry entry;
+            entry.m_path = fileName;
+            LibraryIndex::describe(entry, *is, type);
+            index.add(entry, is->getBuffer(), is->getBufferSize());
+        }
+        catch (Exception& e) {
+            error = e.what();
+            status = UnknownFormat;
+        }
+    }
+    if (status != Success) {
+        err << fileName << ": " << error << endl;
+    }
+    return status;
+}
+
+// Calculate the features of the wave given as <file>:<block>
+static int getWaveFeatures(const string& spec, SimilarityIndex::Features& features, ostream& err)
+{
+    size_t colon = spec.rfind(':');
+    if (colon == string::npos || colon == 0 || colon + 1 == spec.size()) {
+        err << "Invalid wave " << spec << ", expected <file>:<block>" << endl;
+        return Usage;
+    }
+    string fileName(spec, 0, colon);
+    uint8_t block = uint8_t(strtoul(spec.c_str() + colon + 1, nullptr, 10));
+
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    int status = openFile(fileName, file, buffer, is, type, error);
+    if (status != Success) {
+        err << fileName << ": " << error << endl;
+        return status;
+    }
+    Wave* wave = is->getWave(block);
+    SimilarityIndex::Kind kind;
+    if (wave == nullptr || !SimilarityIndex::getFeatures(SysEx::getBlockType(*wave),
+                                                         static_cast<const uint8_t*>(wave->getBuffer()),
+                                                         wave->getBufferSize(), kind, features)) {
+        err << fileName << ": No wave block " << int(block) << endl;
+        return UnknownFormat;
+    }
+    return Success;
+}
+
+// Print the blocks most similar to a query
+static void dumpSimilar(const vector<SimilarityIndex::Match>& matches, Format format)
+{
+    if (format == Format::Json) {
+        cout << "[";
+        for (size_t i = 0; i < matches.size(); ++i) {
+            cout << (i > 0 ? "," : "") << endl << "{\"file\": " << jsonString(matches[i].m_path) << ", \"block\": "
+                 << int(matches[i].m_block) << ", \"distance\": " << matches[i].m_distance << "}";
+        }
+        cout << endl << "]" << endl;
+    }
+    else {
+        for (auto& i : matches) {
+            cout << setw(8) << i.m_distance << "  " << i.m_path << " #" << int(i.m_block) << endl;
+        }
+    }
+}
+
+// Print changed block of a patch, WAVE slots are recorded as FIXWAVE, whatever wave they currently hold
+static void printChange(const StorePatch::Change& change, Format format, ostream& out)
+{
+    const char* type = change.m_type == SysEx::BlockType::FixWaveBlock ? "WAVE" : getTypeName(change.m_type);
+    if (format == Format::Json) {
+        out << "{\"type\": \"" << type << "\", \"block\": " << int(change.m_block) << ", \"offset\": "
+            << change.m_offset << ", \"length\": " << int(change.m_length) << "}";
+    }
+    else {
+        out << setw(4) << type << " " << setw(3) << int(change.m_block) << " at 0x" << hex << setw(4) << setfill('0')
+            << change.m_offset << dec << setfill(' ') << ", " << int(change.m_length) << " bytes" << endl;
+    }
+}
+
+// Compare a file with the source store and print the blocks of the source differing from it, optionally writing
+// them as patch file into the patch directory
+static int diffFile(const string& fileName, const InstrumentStore& source, const string& patchDir, Format format,
+                    ostream& out)
+{
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    int status = openFile(fileName, file, buffer, is, type, error);
+    StorePatch patch;
+    if (status == Success) {
+        try {
+            source.diffContents(*is, patch);
+            if (!patchDir.empty()) {
+                patch.save(getOutputName(patchDir, fileName, ".dmsp"));
+            }
+        }
+        catch (Exception& e) {
+            error = e.what();
+            status = UnknownFormat;
+        }
+    }
+
+    const vector<StorePatch::Change>& changes = patch.getChanges();
+    if (format == Format::Json) {
+        out << "{\"file\": " << jsonString(fileName);
+        if (status == Success) {
+            out << ", \"changes\": [";
+            for (size_t i = 0; i < changes.size(); ++i) {
+                out << (i > 0 ? ", " : "");
+                printChange(changes[i], format, out);
+            }
+            out << "]";
+        }
+        else {
+            out << ", \"error\": " << jsonString(error);
+        }
+        out << "}";
+    }
+    else if (status == Success) {
+        out << changes.size() << " changed blocks" << endl;
+        for (auto& i : changes) {
+            printChange(i, format, out);
+        }
+    }
+    else {
+        out << error << endl;
+    }
+    return status;
+}
+
+// Apply patch to a cartridge image file in place, blocks changed on both sides are reported and leave the file alone
+static int patchFile(const string& fileName, const StorePatch& patch, Format format, ostream& out)
+{
+    // The file is read into memory, as it is replaced afterwards
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    vector<size_t> conflicts;
+    int status = Success;
+    if (isSysExFile(fileName)) {
+        error = "Patches can only be applied to cartridge images";
+        status = UnknownFormat;
+    }
+    else {
+        ifstream in(fileName.c_str(), ios::binary);
+        if (in) {
+            buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        if (buffer.empty()) {
+            error = "Cannot read input file";
+            status = OpenFailed;
+        }
+        else {
+            Status open;
+            is.reset(CartridgeRegistry::open(&buffer[0], buffer.size(), true, type, open));
+            if (!open.isOk()) {
+                error = open.getMessage();
+                status = UnknownFormat;
+            }
+        }
+    }
+    if (status == Success) {
+        try {
+            StoreLayout layout;
+            is->getLayout(layout);
+            if (!patch.check(layout, &buffer[0], buffer.size(), conflicts)) {
+                error = "Patch conflicts with changed blocks";
+                status = UnknownFormat;
+            }
+            else {
+                is->applyPatch(patch);
+                ofstream file(fileName.c_str(), ios::binary | ios::trunc);
+                file.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size());
+                if (!file) {
+                    error = "Cannot write output file";
+                    status = OpenFailed;
+                }
+            }
+        }
+        catch (Exception& e) {
+            error = e.what();
+            status = UnknownFormat;
+        }
+    }
+
+    const vector<StorePatch::Change>& changes = patch.getChanges();
+    if (format == Format::Json) {
+        out << "{\"file\": " << jsonString(fileName);
+        if (status == Success) {
+            out << ", \"applied\": " << changes.size();
+        }
+        else {
+            out << ", \"error\": " << jsonString(error);
+            if (!conflicts.empty()) {
+                out << ", \"conflicts\": [";
+                for (size_t i = 0; i < conflicts.size(); ++i) {
+                    out << (i > 0 ? ", " : "");
+                    printChange(changes[conflicts[i]], format, out);
+                }
+                out << "]";
+            }
+        }
+        out << "}";
+    }
+    else if (status == Success) {
+        out << changes.size() << " blocks applied" << endl;
+    }
+    else {
+        out << error << endl;
+        for (auto i : conflicts) {
+            printChange(changes[i], format, out);
+        }
+    }
+    return status;
+}
+
+// Write little endian integer to stream
+static void writeLE(ostream& out, uint32_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        out.put(char((value >> (i * 8)) & 0xff));
+    }
+}
+
+// Write stereo samples as 16 bit PCM WAV file
+static bool writeWave(const string& fileName, const vector<float>& left, const vector<float>& right,
+                      uint32_t sampleRate)
+{
+    ofstream out(fileName.c_str(), ios::binary);
+    uint32_t dataSize = uint32_t(left.size() * 4);
+    out.write("RIFF", 4);
+    writeLE(out, 36 + dataSize, 4);
+    out.write("WAVEfmt ", 8);
+    writeLE(out, 16, 4);
+    writeLE(out, 1, 2);
+    writeLE(out, 2, 2);
+    writeLE(out, sampleRate, 4);
+    writeLE(out, sampleRate * 4, 4);
+    writeLE(out, 4, 2);
+    writeLE(out, 16, 2);
+    out.write("data", 4);
+    writeLE(out, dataSize, 4);
+    for (size_t i = 0; i < left.size(); ++i) {
+        writeLE(out, uint16_t(int16_t(left[i] * 32767.0f)), 2);
+        writeLE(out, uint16_t(int16_t(right[i] * 32767.0f)), 2);
+    }
+    return bool(out);
+}
+
+// Detect cartridge type and render a preview of every instrument of a single file into the output directory. Layers
+// of chained ICBs are rendered as part of their instrument only.
+static int renderFile(const string& fileName, const string& dir, uint8_t note, ostream& err)
+{
+    unique_ptr<MappedFile> file;
+    vector<uint8_t> buffer;
+    unique_ptr<InstrumentStore> is;
+    string type;
+    string error;
+    int status = openFile(fileName, file, buffer, is, type, error);
+    if (status != Success) {
+        err << fileName << ": " << error << endl;
+        return status;
+    }
+
+    set<uint8_t> layers;
+    for (auto& i : *is) {
+        if (i.second.getNextIcb() != 0) {
+            layers.insert(i.second.getNextIcb());
+        }
+    }
+    string base = getOutputName(dir, fileName, "");
+
+    const uint32_t rate = 44100;
+    vector<float> left(rate * 3 / 2);
+    vector<float> right(left.size());
+    for (auto& i : *is) {
+        if (layers.count(i.first) != 0) {
+            continue;
+        }
+        try {
+            VoiceRenderer renderer(*is, i.first, rate);
+            renderer.render(note, rate, left.data(), right.data(), left.size());
+        }
+        catch (Exception& e) {
+            err << fileName << ": ICB " << uint16_t(i.first) << ": " << e.what() << endl;
+            status = UnknownFormat;
+            continue;
+        }
+        ostringstream name;
+        name << base << "." << setw(3) << setfill('0') << uint16_t(i.first) << ".wav";
+        if (!writeWave(name.str(), left, right, rate)) {
+            err << name.str() << ": Cannot write output file" << endl;
+            status = OpenFailed;
+        }
+    }
+    return status;
+}
+
+// Check if path is a directory
+static bool isDirectory(const string& path)
+{
+#ifdef _WIN32
+    DWORD attr = GetFileAttributesA(path.c_str());
+    return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else // _WIN32
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif // _WIN32
+}
+
+// Collect files from path, directories are searched recursively in name order
+static void collectFiles(const string& path, vector<string>& files)
+{
+    if (!isDirectory(path)) {
+        files.push_back(path);
+        return;
+    }
+
+    vector<string> entries;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (strcmp(data.cFileName, ".") != 0 && strcmp(data.cFileName, "..") != 0) {
+                entries.push_back(path + "\\" + data.cFileName);
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else // _WIN32
+    DIR* dir = opendir(path.c_str());
+    if (dir != nullptr) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                entries.push_back(path + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+#endif // _WIN32
+    sort(entries.begin(), entries.end());
+    for (auto& i : entries) {
+        collectFiles(i, files);
+    }
+}
+
+// Run a job for all files on a pool of worker threads, printing results in input order. In quiet mode, the job
+// output is printed to stderr, as only errors are expected, otherwise it's the dump output.
+static int runBatch(const vector<string>& files, Format format, size_t jobs,
+                    const function<int(const string&, size_t, ostream&)>& job, bool quiet)
+{
+    vector<Result> results(files.size());
+    atomic<size_t> next(0);
+    mutex resultMutex;
+    condition_variable resultCond;
+
+    // Workers fetch the next unprocessed file, so slow files don't hold up the others
+    auto worker = [&]() {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            ostringstream out;
+            int status = job(files[i], i, out);
+            lock_guard<mutex> lock(resultMutex);
+            results[i].m_output = out.str();
+            results[i].m_status = status;
+            results[i].m_done = true;
+            resultCond.notify_one();
+        }
+    };
+    vector<thread> threads;
+    for (size_t i = 0; i < jobs && i < files.size(); ++i) {
+        threads.push_back(thread(worker));
+    }
+
+    // Print results as soon as all previous ones are available
+    size_t failed = 0;
+    if (format == Format::Json && !quiet) {
+        cout << "[" << endl;
+    }
+    for (size_t i = 0; i < files.size(); ++i) {
+        unique_lock<mutex> lock(resultMutex);
+        resultCond.wait(lock, [&]() {
+            return results[i].m_done;
+        });
+        string output;
+        output.swap(results[i].m_output);
+        lock.unlock();
+
+        if (results[i].m_status != Success) {
+            ++failed;
+        }
+        if (quiet) {
+            cerr << output;
+        }
+        else if (format == Format::Json) {
+            cout << output << (i + 1 < files.size() ? "," : "") << endl;
+        }
+        else {
+            cout << "File " << files[i] << endl << output << endl;
+        }
+    }
+    if (format == Format::Json && !quiet) {
+        cout << "]" << endl;
+    }
+    for (auto& i : threads) {
+        i.join();
+    }
+
+    cerr << files.size() << " files, " << failed << " failed" << endl;
+    return failed == 0 ? Success : UnknownFormat;
+}
+
+int main(int argc, char** argv)
+{
+    // Check arguments
+    Format format = Format::Text;
+    size_t jobs = thread::hardware_concurrency();
+    bool batch = false;
+    bool duplicates = false;
+    string similar;
+    string compare;
+    string patchDir;
+    string apply;
+    size_t count = 10;
+    bool sysEx = false;
+    string outputDir;
+    OutputType outputType = OutputType::SysEx;
+    bool verbose = false;
+    string renderDir;
+    uint8_t note = 60;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], nullptr, 10);
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            renderDir = argv[++i];
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            note = uint8_t(strtoul(argv[++i], nullptr, 10) & 0x7f);
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            sysEx = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputDir = argv[++i];
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "syx") == 0) {
+                outputType = OutputType::SysEx;
+            }
+            else if (strcmp(argv[i], "mk1") == 0) {
+                outputType = OutputType::Mk1;
+            }
+            else if (strcmp(argv[i], "dx10") == 0) {
+                outputType = OutputType::Dx10;
+            }
+            else {
+                paths.clear();
+                break;
+            }
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            similar = argv[++i];
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            compare = argv[++i];
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            patchDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            apply = argv[++i];
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            count = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-d") == 0) {
+            duplicates = true;
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "text") == 0) {
+                format = Format::Text;
+            }
+            else if (strcmp(argv[i], "json") == 0) {
+                format = Format::Json;
+            }
+            else {
+                paths.clear();
+                break;
+            }
+            batch = true;
+        }
+        else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        cerr << "Usage: " << argv[0] << " [-v] <filename>" << endl;
+        cerr << "       " << argv[0] << " -s <filename>" << endl;
+        cerr << "       " << argv[0] << " [-j <jobs>] -o <dir> [-t syx|mk1|dx10] <file or directory>..." << endl;
+        cerr << "       " << argv[0] << " [-j <jobs>] [-f text|json] [-d] [-r <dir> [-n <note>]] <file or directory>..."
+             << endl;
+        cerr << "       " << argv[0] << " [-j <jobs>] [-f text|json] -w <file>:<block> [-k <count>]"
+             << " <file or directory>..." << endl;
+        cerr << "       " << argv[0] << " [-j <jobs>] [-f text|json] -c <source> [-p <dir>] <file or directory>..."
+             << endl;
+        cerr << "       " << argv[0] << " [-j <jobs>] [-f text|json] -a <patch> <file or directory>..." << endl;
+        return Usage;
+    }
+    if (jobs == 0) {
+        jobs = 1;
+    }
+    if (verbose) {
+        Logger::setLevel(Logger::Level::Debug);
+    }
+
+    // SysEx export of a single file, with an output directory all files are exported in batch mode
+    if (sysEx && outputDir.empty()) {
+        if (batch || paths.size() != 1 || isDirectory(paths[0])) {
+            cerr << "SysEx export to stdout needs a single input file, use -o <dir> for multiple files" << endl;
+            return Usage;
+        }
+        return exportFile(paths[0], cout, cerr);
+    }
+
+    // Single file mode
+    if (!batch && paths.size() == 1 && !isDirectory(paths[0])) {
+        return dumpFile(paths[0], format, cout, cerr, verbose);
+    }
+
+    // Batch mode
+    vector<string> files;
+    for (auto& i : paths) {
+        collectFiles(i, files);
+    }
+    if (duplicates) {
+        BlockPool pool;
+        int status = runBatch(files, format, jobs, [&](const string& fileName, size_t index, ostream& out) {
+            return poolFile(fileName, index, pool, out);
+        }, true);
+        dumpDuplicates(pool, files, format);
+        return status;
+    }
+    if (!similar.empty()) {
+        SimilarityIndex::Features features;
+        int status = getWaveFeatures(similar, features, cerr);
+        if (status != Success) {
+            return status;
+        }
+        SimilarityIndex index;
+        status = runBatch(files, format, jobs, [&](const string& fileName, size_t, ostream& out) {
+            return indexFile(fileName, index, out);
+        }, true);
+        vector<SimilarityIndex::Match> matches;
+        index.findNearest(SimilarityIndex::Kind::Wave, features, count, matches);
+        dumpSimilar(matches, format);
+        return status;
+    }
+    if (!compare.empty()) {
+        unique_ptr<MappedFile> file;
+        vector<uint8_t> buffer;
+        unique_ptr<InstrumentStore> source;
+        string type;
+        string error;
+        int status = openFile(compare, file, buffer, source, type, error);
+        if (status != Success) {
+            cerr << compare << ": " << error << endl;
+            return status;
+        }
+        return runBatch(files, format, jobs, [&](const string& fileName, size_t, ostream& out) {
+            return diffFile(fileName, *source, patchDir, format, out);
+        }, false);
+    }
+    if (!apply.empty()) {
+        StorePatch patch;
+        try {
+            patch.load(apply);
+        }
+        catch (Exception& e) {
+            cerr << apply << ": " << e.what() << endl;
+            return OpenFailed;
+        }
+        return runBatch(files, format, jobs, [&](const string& fileName, size_t, ostream& out) {
+            return patchFile(fileName, patch, format, out);
+        }, false);
+    }
+    if (!outputDir.empty()) {
+        return runBatch(files, format, jobs, [&](const string& fileName, size_t, ostream& out) {
+            return convertFile(fileName, outputDir, outputType, out);
+        }, true);
+    }
+    if (!renderDir.empty()) {
+        return runBatch(files, format, jobs, [&](const string& fileName, size_t, ostream& out) {
+            return renderFile(fileName, renderDir, note, out);
+        }, true);
+    }
+    return runBatch(files, format, jobs, [&](const string& fileName, size_t, ostream& out) {
+        return dumpFile(fileName, format, out, out);
+    }, false);
 }
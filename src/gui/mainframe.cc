@@ -41,18 +41,26 @@
 #include <gui/wavepanel.hh>
 #include <gui/adddevicedialog.hh>
 #include <exceptions.hh>
+#include <mappedfile.hh>
 #include <wersi/mk1cartridge.hh>
 #include <wersi/dx10cartridge.hh>
+#include <wersi/cartridgeregistry.hh>
 #include <wersi/dx10device.hh>
 #include <wersi/icb.hh>
+#include <wersi/vcf.hh>
+#include <wersi/envelope.hh>
+#include <wersi/wave.hh>
 #include <wersi/sysex.hh>
+#include <wersi/sysexqueue.hh>
+#include <wersi/transferscheduler.hh>
+#include <wersi/transferstats.hh>
 
 #include <wx/filedlg.h>
 #include <wx/file.h>
 #include <wx/filename.h>
-#include <wx/wfstream.h>
 #include <wx/msgdlg.h>
 #include <wx/progdlg.h>
+#include <wx/stdpaths.h>
 
 #ifdef HAVE_RTMIDI
 #include <RtMidi.h>
@@ -63,6 +71,17 @@ using namespace DMSToolbox::Wersi;
 namespace DMSToolbox {
 namespace Gui {
 
+#ifdef HAVE_RTMIDI
+// Device transfer progress and completion, posted from the transfer worker threads
+wxDEFINE_EVENT(EVT_DEVICE_TRANSFER, wxThreadEvent);
+
+// Build device cache key, a device is identified by the MIDI ports it is connected to
+static std::string deviceCacheKey(const wxString& inPortName, const wxString& outPortName)
+{
+    return std::string((inPortName + wxT("\n") + outPortName).utf8_str());
+}
+#endif // HAVE_RTMIDI
+
 // Create main frame
 MainFrame::MainFrame(wxWindow* parent)
     : MainFrameBase(parent)
@@ -74,6 +93,15 @@ MainFrame::MainFrame(wxWindow* parent)
     , m_devices(m_instTree->AppendItem(m_root, _("Devices")))
     , m_cartridges(m_instTree->AppendItem(m_root, _("Cartridges")))
     , m_dragStore(nullptr)
+    , m_index()
+    , m_indexFile(wxStandardPaths::Get().GetUserDataDir() + wxFileName::GetPathSeparator() + wxT("library.idx"))
+    , m_deviceCache()
+    , m_deviceCacheFile(wxStandardPaths::Get().GetUserDataDir() + wxFileName::GetPathSeparator() +
+                        wxT("devices.cache"))
+#ifdef HAVE_RTMIDI
+    , m_transfers()
+    , m_scheduler()
+#endif // HAVE_RTMIDI
 {
     // Add panels
     m_mainTabs->AddPage(m_instPanel, _("Basic"), true);
@@ -83,19 +111,26 @@ MainFrame::MainFrame(wxWindow* parent)
 
     // Do the window layout
     Fit();
+
+#ifdef HAVE_RTMIDI
+    Bind(EVT_DEVICE_TRANSFER, &MainFrame::onTransfer, this);
+#endif // HAVE_RTMIDI
 }
 
 // Destroy main frame
 MainFrame::~MainFrame()
 {
-    for (auto& i : m_instrumentStores) {
-        // Delete store and associated buffer
-        if (i.second.m_store != nullptr) {
-            auto buffer = static_cast<uint8_t*>(i.second.m_store->getBuffer());
-            delete i.second.m_store;
-            delete[] buffer;
-        }
+#ifdef HAVE_RTMIDI
+    // Cancel all transfers before their stores go away
+    m_scheduler.shutdown();
+    for (auto& i : m_transfers) {
+        delete i.second.m_transfer;
+        i.second.m_dialog->Destroy();
+    }
+    m_transfers.clear();
+#endif // HAVE_RTMIDI
 
+    for (auto& i : m_instrumentStores) {
 #ifdef HAVE_RTMIDI
         // Check the following only for MIDI stores
         if (i.second.m_type != 0) {
@@ -105,6 +140,11 @@ MainFrame::~MainFrame()
                 delete i.second.m_midiIn;
             }
 
+            // Delete SysEx queue, no more messages arrive now
+            if (i.second.m_queue != nullptr) {
+                delete i.second.m_queue;
+            }
+
             // Delete MIDI output
             if (i.second.m_midiOut != nullptr) {
                 i.second.m_midiOut->closePort();
@@ -112,6 +152,18 @@ MainFrame::~MainFrame()
             }
         }
 #endif // HAVE_RTMIDI
+
+        // Delete store and associated buffer or mapped file
+        if (i.second.m_store != nullptr) {
+            auto buffer = static_cast<uint8_t*>(i.second.m_store->getBuffer());
+            delete i.second.m_store;
+            if (i.second.m_file != nullptr) {
+                delete i.second.m_file;
+            }
+            else {
+                delete[] buffer;
+            }
+        }
     }
 }
 
@@ -121,6 +173,22 @@ void MainFrame::applyConfiguration()
     // Create configured devices
     createDevices();
 
+    // Read library index and device cache, start over with empty ones if they're broken
+    try {
+        if (wxFile::Exists(m_indexFile)) {
+            m_index.load(std::string(m_indexFile.fn_str()));
+        }
+    }
+    catch (Exception&) {
+    }
+    try {
+        if (wxFile::Exists(m_deviceCacheFile)) {
+            m_deviceCache.load(std::string(m_deviceCacheFile.fn_str()));
+        }
+    }
+    catch (Exception&) {
+    }
+
     // Read cartridges opened last time
     m_config.SetPath(wxT("/Cartridges"));
     wxString name;
@@ -142,6 +210,8 @@ void MainFrame::applyConfiguration()
         cont = m_config.GetNextEntry(name, index);
     }
 
+    saveIndex();
+
     // Expand top level trees
     m_instTree->Expand(m_devices);
     m_instTree->Expand(m_cartridges);
@@ -157,6 +227,10 @@ void MainFrame::onInstDelete(wxTreeEvent& event)
 void MainFrame::onInstRenameBegin(wxTreeEvent& event)
 {
     // Check if a rename is allowed
+    if (!loadCartridge(event.GetItem())) {
+        event.Veto();
+        return;
+    }
     auto ren = m_instTree->GetItemData(event.GetItem());
 
     if (ren != nullptr) {
@@ -232,12 +306,19 @@ void MainFrame::onInstSelect(wxTreeEvent& event)
 
     //auto prevSel = m_instTree->GetItemData(event.GetOldItem());
     auto item = event.GetItem();
+    if (!loadCartridge(item)) {
+        return;
+    }
     auto sel = m_instTree->GetItemData(item);
 
     if (sel != nullptr) {
         auto inst = dynamic_cast<InstrumentHelper*>(sel);
         auto store = inst->getStore();
         auto icbNum = inst->getIcb();
+        if (isBusy(store.m_store)) {
+            // Store contents are being transferred
+            return;
+        }
         if (store.m_store != nullptr && icbNum != 0) {
             Icb* icb = store.m_store->getIcb(icbNum);
             if (icb != nullptr) {
@@ -249,24 +330,37 @@ void MainFrame::onInstSelect(wxTreeEvent& event)
         }
         else if (store.m_store != nullptr && icbNum == 0 && store.m_type != 0) {
             // TODO temporary - read device
-            wxProgressDialog prog(_("Read from device"), _("Reading instruments from device..."), 6180, this,
-                                  wxPD_APP_MODAL | wxPD_AUTO_HIDE | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_REMAINING_TIME);
-            store.m_store->readFromDevice(store.m_midiIn, store.m_midiOut, updateProgress, &prog);
-            m_instTree->DeleteChildren(item);
-            for (auto& i : *(store.m_store)) {
-                wxString instName(wxT("("));
-                instName << uint16_t(i.first) << wxT(") ");
-                instName << wxString::From8BitData(i.second.getName().c_str());
-                m_instTree->AppendItem(item, instName, -1, -1, new InstrumentHelper(store, i.first));
-            }
+            readDevice(store, item);
             //writeDevice();
         }
     }
 }
 
+// Handle instrument expansion
+void MainFrame::onInstExpanding(wxTreeEvent& event)
+{
+    appendInstruments(event.GetItem());
+}
+
+// Handle instrument collapse
+void MainFrame::onInstCollapsed(wxTreeEvent& event)
+{
+    // Drop the instrument items of collapsed stores, they are created again on the next expansion
+    auto item = event.GetItem();
+    auto inst = dynamic_cast<InstrumentHelper*>(m_instTree->GetItemData(item));
+    if (inst != nullptr && inst->getIcb() == 0) {
+        m_instTree->DeleteChildren(item);
+        m_instTree->SetItemHasChildren(item, true);
+    }
+}
+
 // Handle begin drag event
 void MainFrame::onInstBeginDrag(wxTreeEvent& event)
 {
+    if (!loadCartridge(event.GetItem())) {
+        event.Veto();
+        return;
+    }
     auto sel = m_instTree->GetItemData(event.GetItem());
 
     if (sel != nullptr) {
@@ -293,17 +387,11 @@ void MainFrame::onInstEndDrag(wxTreeEvent& event)
         auto inst = dynamic_cast<InstrumentHelper*>(sel);
         auto store = inst->getStore();
         auto icbNum = inst->getIcb();
-        if (store.m_store != nullptr && m_dragStore != nullptr
-                &&store.m_store != m_dragStore && store.m_type != 0 && icbNum == 0) {
+        if (store.m_store != nullptr && m_dragStore != nullptr && !isBusy(store.m_store)
+                && store.m_store != m_dragStore && store.m_type != 0 && icbNum == 0) {
             // Instrument store drag from cartridge to device - allow it
             store.m_store->copyContents(*m_dragStore);
-            m_instTree->DeleteChildren(item);
-            for (auto& i : *(store.m_store)) {
-                wxString instName(wxT("("));
-                instName << uint16_t(i.first) << wxT(") ");
-                instName << wxString::From8BitData(i.second.getName().c_str());
-                m_instTree->AppendItem(item, instName, -1, -1, new InstrumentHelper(store, i.first));
-            }
+            refreshInstruments(item);
             event.Allow();
             return;
         }
@@ -326,6 +414,7 @@ void MainFrame::onFileOpen(wxCommandEvent& /*event*/)
         m_config.SetPath(wxT("/Cartridges"));
         m_config.Write(fn.GetFullName(), dlg.GetPath());
         m_config.Flush();
+        saveIndex();
     }
     catch (Exception& e) {
         wxMessageDialog err(this, wxString::FromUTF8(e.what()), _("Could not load cartridge"),
@@ -339,6 +428,44 @@ void MainFrame::onEditRename(wxCommandEvent& /*event*/)
 {
 }
 
+// Read all devices
+void MainFrame::onDevicesReadAll(wxCommandEvent& /*event*/)
+{
+    wxTreeItemIdValue cookie;
+    for (auto child = m_instTree->GetFirstChild(m_devices, cookie); child.IsOk();
+         child = m_instTree->GetNextChild(m_devices, cookie)) {
+        auto inst = dynamic_cast<InstrumentHelper*>(m_instTree->GetItemData(child));
+        if (inst != nullptr && inst->getStore().m_store != nullptr) {
+            readDevice(inst->getStore(), child);
+        }
+    }
+}
+
+// Write all devices
+void MainFrame::onDevicesWriteAll(wxCommandEvent& /*event*/)
+{
+    writeDevices(false);
+}
+
+// Write changes to all devices
+void MainFrame::onDevicesWriteChanged(wxCommandEvent& /*event*/)
+{
+    writeDevices(true);
+}
+
+// Write all devices in device tree
+void MainFrame::writeDevices(bool dirtyOnly)
+{
+    wxTreeItemIdValue cookie;
+    for (auto child = m_instTree->GetFirstChild(m_devices, cookie); child.IsOk();
+         child = m_instTree->GetNextChild(m_devices, cookie)) {
+        auto inst = dynamic_cast<InstrumentHelper*>(m_instTree->GetItemData(child));
+        if (inst != nullptr && inst->getStore().m_store != nullptr) {
+            writeDevice(inst->getStore(), dirtyOnly);
+        }
+    }
+}
+
 // Create devices from configuration
 void MainFrame::createDevices()
 {
@@ -352,8 +479,10 @@ void MainFrame::createDevices()
         m_config.SetPath(name);
         InstStore is;
         is.m_store = nullptr;
+        is.m_file = nullptr;
         is.m_midiIn = nullptr;
         is.m_midiOut = nullptr;
+        is.m_queue = nullptr;
         try {
             // Build name for MIDI ports
             std::string pname("DMS-Toolbox:");
@@ -363,8 +492,10 @@ void MainFrame::createDevices()
             is.m_midiIn = new RtMidiIn;
             is.m_midiOut = new RtMidiOut;
 
-            is.m_store = new Dx10Device(new uint8_t[6180], 6180);
-            is.m_midiIn->setCallback(SysEx::rtMidiCallback, is.m_store);
+            auto device = new Dx10Device(new uint8_t[Dx10Device::s_bufferSize], Dx10Device::s_bufferSize);
+            is.m_store = device;
+            is.m_queue = new SysExQueue(is.m_store, 1);
+            is.m_midiIn->setCallback(SysEx::rtMidiCallback, is.m_queue);
 
             // Look up and open input port
             wxString inPortName = m_config.Read(wxT("InPort"));
@@ -398,6 +529,8 @@ void MainFrame::createDevices()
             if (!found) {
                 throw ConfigurationException("MIDI output port not found");
             }
+            is.m_cacheKey = deviceCacheKey(inPortName, outPortName);
+            is.m_interface = std::string(outPortName.utf8_str());
 
             // Get channel and device type
             long tmp = 0;
@@ -410,30 +543,34 @@ void MainFrame::createDevices()
             }
             is.m_type = uint8_t(tmp);
 
+            // Get optional number of block requests to keep in flight, depends on MIDI interface
+            if (m_config.Read(wxT("ReadWindow"), &tmp) && tmp > 0) {
+                device->setReadWindow(size_t(tmp));
+            }
+
             // Create instrument store
             auto id = m_instTree->AppendItem(m_devices, name, -1, -1, new InstrumentHelper(is, 0));
-            for (auto& i : *(is.m_store)) {
-                wxString instName(wxT("("));
-                instName << uint16_t(i.first) << wxT(") ");
-                instName << wxString::From8BitData(i.second.getName().c_str());
-                m_instTree->AppendItem(id, instName, -1, -1, new InstrumentHelper(is, i.first));
-            }
+            m_instTree->SetItemHasChildren(id, true);
             m_instrumentStores.insert(std::pair<wxString, InstStore>(name, is));
         }
         catch (Exception& e) {
-            if (is.m_store != nullptr) {
-                auto buffer = static_cast<uint8_t*>(is.m_store->getBuffer());
-                delete is.m_store;
-                is.m_store = nullptr;
-                delete[] buffer;
+            if (is.m_midiIn != nullptr) {
+                delete is.m_midiIn;
+                is.m_midiIn = nullptr;
+            }
+            if (is.m_queue != nullptr) {
+                delete is.m_queue;
+                is.m_queue = nullptr;
             }
             if (is.m_midiOut != nullptr) {
                 delete is.m_midiOut;
                 is.m_midiOut = nullptr;
             }
-            if (is.m_midiIn != nullptr) {
-                delete is.m_midiIn;
-                is.m_midiIn = nullptr;
+            if (is.m_store != nullptr) {
+                auto buffer = static_cast<uint8_t*>(is.m_store->getBuffer());
+                delete is.m_store;
+                is.m_store = nullptr;
+                delete[] buffer;
             }
             wxString msg(_("Device '"));
             msg << name << _("' could not be created, reason: ");
@@ -448,74 +585,209 @@ void MainFrame::createDevices()
 #endif // HAVE_RTMIDI
 }
 
-// Read cartridge file and create instrument store from it.
+// Read cartridge file and create instrument store from it
 void MainFrame::readCartridgeFile(const wxString& filePath, const wxString& cartName)
 {
-    // Open and check file
     if (!wxFile::Exists(filePath)) {
         throw SystemException("File does not exist");
     }
-    wxFile file(filePath, wxFile::read);
-    wxFileOffset size = file.Length();
-    if (size != 8192 && size != 16384) {
-        throw DataFormatException("Invalid file size (must be 8 or 16 KB)");
+
+    InstStore is;
+    is.m_store = nullptr;
+    is.m_file = nullptr;
+    is.m_path = filePath;
+    is.m_midiIn = nullptr;
+    is.m_midiOut = nullptr;
+    is.m_queue = nullptr;
+    is.m_channel = 0;
+    is.m_type = 0;
+
+    // Use the index if the file didn't change, the file is opened on first use then
+    wxFileName fn(filePath);
+    auto entry = m_index.find(std::string(filePath.fn_str()), fn.GetModificationTime().GetTicks(),
+                              fn.GetSize().GetValue());
+    if (entry == nullptr) {
+        openCartridgeFile(is);
     }
-    wxFileInputStream fileStream(file);
-    if (fileStream.IsOk()) {
-        InstrumentStore* store(nullptr);
-        char* buffer(new char[size]);
-        try {
-            fileStream.Read(buffer, size);
-            if (fileStream.LastRead() != size_t(size)) {
-                throw DataFormatException("Could not read whole cartridge data");
-            }
-            if (store == nullptr) {
-                try {
-                    store = new Mk1Cartridge(buffer);
-                }
-                catch (DataFormatException&) {
-                    // Ignore data format errors, try next type
-                }
-            }
-            if (store == nullptr) {
-                try {
-                    store = new Dx10Cartridge(buffer, size);
-                }
-                catch (DataFormatException&) {
-                    // Ignore data format errors, try next type
-                }
-            }
-            if (store == nullptr) {
-                throw DataFormatException("Unknown cartridge format");
-            }
 
-            InstStore is;
-            is.m_store = store;
-            is.m_midiIn = nullptr;
-            is.m_midiOut = nullptr;
-            is.m_channel = 0;
-            is.m_type = 0;
-            auto id = m_instTree->AppendItem(m_cartridges, cartName, -1, -1, new InstrumentHelper(is, 0));
-            for (auto& i : *store) {
-                wxString instName(wxT("("));
-                instName << uint16_t(i.first) << wxT(") ");
-                instName << wxString::From8BitData(i.second.getName().c_str());
-                m_instTree->AppendItem(id, instName, -1, -1, new InstrumentHelper(is, i.first));
-            }
-            m_instrumentStores.insert(std::pair<wxString, InstStore>(cartName, is));
+    auto id = m_instTree->AppendItem(m_cartridges, cartName, -1, -1, new InstrumentHelper(is, 0));
+    m_instTree->SetItemHasChildren(id, true);
+    m_instrumentStores.insert(std::pair<wxString, InstStore>(cartName, is));
+}
+
+// Open cartridge file
+void MainFrame::openCartridgeFile(InstStore& store)
+{
+    // Map and check file
+    std::string path(store.m_path.fn_str());
+    MappedFile* file(new MappedFile(path));
+    size_t size = file->getSize();
+    InstrumentStore* is(nullptr);
+    try {
+        if (size != 8192 && size != 16384) {
+            throw DataFormatException("Invalid file size (must be 8 or 16 KB)");
         }
-        catch (...) {
-            if (store != nullptr) {
-                delete store;
-            }
-            if (buffer != nullptr) {
-                delete[] buffer;
-            }
-            throw;
+        std::string format;
+        is = CartridgeRegistry::open(file->getData(), size, false, format);
+
+        // Update library index
+        wxFileName fn(store.m_path);
+        LibraryIndex::Entry entry;
+        entry.m_path = path;
+        entry.m_mtime = fn.GetModificationTime().GetTicks();
+        entry.m_size = size;
+        LibraryIndex::describe(entry, *is, format);
+        m_index.insert(entry);
+    }
+    catch (...) {
+        if (is != nullptr) {
+            delete is;
         }
+        delete file;
+        throw;
     }
-    else {
-        throw SystemException("Unable to open file");
+    store.m_store = is;
+    store.m_file = file;
+}
+
+// Load cartridge of tree item
+bool MainFrame::loadCartridge(const wxTreeItemId& item)
+{
+    auto data = m_instTree->GetItemData(item);
+    if (data == nullptr) {
+        return true;
+    }
+    auto inst = dynamic_cast<InstrumentHelper*>(data);
+    if (inst == nullptr || inst->getStore().m_store != nullptr || inst->getStore().m_path.IsEmpty()) {
+        return true;
+    }
+
+    InstStore is(inst->getStore());
+    try {
+        openCartridgeFile(is);
+    }
+    catch (Exception& e) {
+        m_index.remove(std::string(is.m_path.fn_str()));
+        wxString msg(_("Cartridge file '"));
+        msg << is.m_path << _("' could not be read, reason: ");
+        msg << wxString::FromUTF8(e.what());
+        wxMessageDialog err(this, msg, _("Could not load cartridge"), wxOK | wxCENTRE | wxICON_ERROR);
+        err.ShowModal();
+        return false;
+    }
+
+    // Attach the store to the cartridge and all instrument items, the items keep copies of the wrapper
+    auto cart = inst->getIcb() != 0 ? m_instTree->GetItemParent(item) : item;
+    auto ent = m_instrumentStores.find(m_instTree->GetItemText(cart));
+    if (ent != m_instrumentStores.end()) {
+        ent->second = is;
+    }
+    auto old = m_instTree->GetItemData(cart);
+    m_instTree->SetItemData(cart, new InstrumentHelper(is, 0));
+    delete old;
+    wxTreeItemIdValue cookie;
+    for (auto child = m_instTree->GetFirstChild(cart, cookie); child.IsOk();
+            child = m_instTree->GetNextChild(cart, cookie)) {
+        auto helper = dynamic_cast<InstrumentHelper*>(m_instTree->GetItemData(child));
+        if (helper != nullptr) {
+            m_instTree->SetItemData(child, new InstrumentHelper(is, helper->getIcb()));
+            delete helper;
+        }
+    }
+    return true;
+}
+
+// Get instrument tree label
+wxString MainFrame::getInstrumentLabel(uint8_t icb, const std::string& name)
+{
+    wxString label(wxT("("));
+    label << uint16_t(icb) << wxT(") ");
+    label << wxString::From8BitData(name.c_str());
+    return label;
+}
+
+// Append instrument items of store
+void MainFrame::appendInstruments(const wxTreeItemId& item)
+{
+    auto inst = dynamic_cast<InstrumentHelper*>(m_instTree->GetItemData(item));
+    if (inst == nullptr || inst->getIcb() != 0 || m_instTree->GetChildrenCount(item, false) != 0) {
+        return;
+    }
+
+    // Copy the wrapper, loading the cartridge replaces the item data
+    InstStore store(inst->getStore());
+    if (store.m_store != nullptr) {
+        for (auto& i : *(store.m_store)) {
+            m_instTree->AppendItem(item, getInstrumentLabel(i.first, i.second.getName()), -1, -1,
+                                   new InstrumentHelper(store, i.first));
+        }
+        return;
+    }
+
+    // Cartridge not opened yet, use the index if the file didn't change
+    wxFileName fn(store.m_path);
+    auto entry = m_index.find(std::string(store.m_path.fn_str()), fn.GetModificationTime().GetTicks(),
+                              fn.GetSize().GetValue());
+    if (entry != nullptr) {
+        for (auto& i : entry->m_instruments) {
+            m_instTree->AppendItem(item, getInstrumentLabel(i.m_icb, i.m_name), -1, -1,
+                                   new InstrumentHelper(store, i.m_icb));
+        }
+    }
+    else if (loadCartridge(item)) {
+        appendInstruments(item);
+    }
+}
+
+// Refresh instrument items of store
+void MainFrame::refreshInstruments(const wxTreeItemId& item)
+{
+    // Items of collapsed stores are created with the current names on the next expansion
+    if (m_instTree->GetChildrenCount(item, false) == 0) {
+        return;
+    }
+    auto inst = dynamic_cast<InstrumentHelper*>(m_instTree->GetItemData(item));
+    if (inst == nullptr || inst->getStore().m_store == nullptr) {
+        return;
+    }
+
+    // Update changed labels only, the ICB list of a store only changes with its contents being reloaded
+    auto store = inst->getStore().m_store;
+    wxTreeItemIdValue cookie;
+    auto child = m_instTree->GetFirstChild(item, cookie);
+    for (auto& i : *store) {
+        if (!child.IsOk()) {
+            break;
+        }
+        auto label = getInstrumentLabel(i.first, i.second.getName());
+        if (m_instTree->GetItemText(child) != label) {
+            m_instTree->SetItemText(child, label);
+        }
+        child = m_instTree->GetNextChild(item, cookie);
+    }
+}
+
+// Save library index
+void MainFrame::saveIndex()
+{
+    try {
+        wxFileName::Mkdir(wxStandardPaths::Get().GetUserDataDir(), wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+        m_index.save(std::string(m_indexFile.fn_str()));
+    }
+    catch (Exception&) {
+        // The index is a cache only, a missing index just costs time on the next start
+    }
+}
+
+// Save device cache
+void MainFrame::saveDeviceCache()
+{
+    try {
+        wxFileName::Mkdir(wxStandardPaths::Get().GetUserDataDir(), wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+        m_deviceCache.save(std::string(m_deviceCacheFile.fn_str()));
+    }
+    catch (Exception&) {
+        // Like the index, the cache only saves time when reading a known device
     }
 }
 
@@ -587,8 +859,10 @@ void MainFrame::addDevice()
         // Get data from device dialog
         InstStore is;
         is.m_store = nullptr;
+        is.m_file = nullptr;
         is.m_midiIn = nullptr;
         is.m_midiOut = nullptr;
+        is.m_queue = nullptr;
         try {
             const wxString& name = dlg.getName();
             std::string pname("DMS-Toolbox:");
@@ -612,17 +886,16 @@ void MainFrame::addDevice()
 
             is.m_channel = dlg.getChannel();
             is.m_type = dlg.getType();
+            is.m_cacheKey = deviceCacheKey(wxString::FromUTF8(is.m_midiIn->getPortName(inPort).c_str()),
+                                           wxString::FromUTF8(is.m_midiOut->getPortName(outPort).c_str()));
+            is.m_interface = is.m_midiOut->getPortName(outPort);
 
             // Create instrument store
-            is.m_store = new Dx10Device(new uint8_t[6180], 6180);
+            is.m_store = new Dx10Device(new uint8_t[Dx10Device::s_bufferSize], Dx10Device::s_bufferSize);
+            is.m_queue = new SysExQueue(is.m_store, 1);
 
             auto id = m_instTree->AppendItem(m_devices, name, -1, -1, new InstrumentHelper(is, 0));
-            for (auto& i : *(is.m_store)) {
-                wxString instName(wxT("("));
-                instName << uint16_t(i.first) << wxT(") ");
-                instName << wxString::From8BitData(i.second.getName().c_str());
-                m_instTree->AppendItem(id, instName, -1, -1, new InstrumentHelper(is, i.first));
-            }
+            m_instTree->SetItemHasChildren(id, true);
             m_instrumentStores.insert(std::pair<wxString, InstStore>(name, is));
             m_config.SetPath(wxT("/Devices"));
             m_config.SetPath(name);
@@ -631,21 +904,24 @@ void MainFrame::addDevice()
             m_config.Write(wxT("Channel"), long(is.m_channel));
             m_config.Write(wxT("Type"), long(is.m_type));
             m_config.Flush();
-            is.m_midiIn->setCallback(SysEx::rtMidiCallback, is.m_store);
+            is.m_midiIn->setCallback(SysEx::rtMidiCallback, is.m_queue);
         }
         catch (ConfigurationException& e) {
-            if (is.m_store != nullptr) {
-                auto buffer = static_cast<uint8_t*>(is.m_store->getBuffer());
-                delete is.m_store;
-                is.m_store = nullptr;
-                delete[] buffer;
-            }
             if (is.m_midiIn != nullptr) {
                 delete is.m_midiIn;
             }
+            if (is.m_queue != nullptr) {
+                delete is.m_queue;
+            }
             if (is.m_midiOut != nullptr) {
                 delete is.m_midiOut;
             }
+            if (is.m_store != nullptr) {
+                auto buffer = static_cast<uint8_t*>(is.m_store->getBuffer());
+                delete is.m_store;
+                is.m_store = nullptr;
+                delete[] buffer;
+            }
             wxString msg(_("Could not add device: "));
             msg << wxString::FromUTF8(e.what());
             wxMessageDialog err(this, msg, _("Could not add device"), wxOK | wxCENTRE | wxICON_ERROR);
@@ -665,85 +941,172 @@ void MainFrame::addDevice()
 #endif // HAVE_RTMIDI
 }
 
-// Read MIDI device
 #ifdef HAVE_RTMIDI
-// Write MIDI device
-void MainFrame::writeDevice(const InstStore& store)
+// Read device contents
+void MainFrame::readDevice(const InstStore& store, const wxTreeItemId& item)
 {
-    uint8_t offset = 0;
+    if (isBusy(store.m_store)) {
+        return;
+    }
+    startTransfer(new DeviceTransfer(*(store.m_store), store.m_midiIn, store.m_midiOut,
+                                     m_deviceCache.find(store.m_cacheKey)),
+                  store.m_interface, TransferScheduler::Priority::Bulk, item, _("Read from device"),
+                  _("Reading instruments from device..."));
+}
 
-    // Send ICBs
-    for (auto& i : *(store.m_store)) {
-        SysEx::sendIcb(store.m_midiOut, store.m_type, i.first, i.second);
-        if (offset == 0) {
-            offset = i.first - 1;
-        }
+// Write device contents
+void MainFrame::writeDevice(const InstStore& store, bool dirtyOnly)
+{
+    if (isBusy(store.m_store)) {
+        return;
     }
+    // Writing only the changed blocks is what the user waits for after editing, it goes ahead of backups
+    startTransfer(new DeviceTransfer(*(store.m_store), store.m_midiOut, store.m_type, dirtyOnly), store.m_interface,
+                  dirtyOnly ? TransferScheduler::Priority::Interactive : TransferScheduler::Priority::Bulk,
+                  wxTreeItemId(), _("Write to device"), _("Writing instruments to device..."));
+}
 
-    // Send VCFs
-    for (size_t i = 0; i < 10; ++i) {
-        uint8_t addr = i + offset;
-        auto vcf = store.m_store->getVcf(addr);
-        if (vcf != nullptr) {
-            SysEx::sendVcf(store.m_midiOut, store.m_type, addr, *vcf);
-        }
+// Start device transfer
+void MainFrame::startTransfer(DeviceTransfer* transfer, const std::string& interface,
+                              TransferScheduler::Priority priority, const wxTreeItemId& item, const wxString& title,
+                              const wxString& message)
+{
+    // Without parent, the progress dialog doesn't disable the main frame
+    Transfer entry;
+    entry.m_transfer = transfer;
+    entry.m_dialog = new wxProgressDialog(title, message, 1000, nullptr,
+                                          wxPD_AUTO_HIDE | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_REMAINING_TIME);
+    entry.m_item = item;
+    m_transfers.insert(std::make_pair(&(transfer->getStore()), entry));
+    m_scheduler.submit(transfer, interface, priority, notifyTransfer, this);
+}
+
+// Handle device transfer event
+void MainFrame::onTransfer(wxThreadEvent& event)
+{
+    // Events of finished transfers may still be queued, the payload must not be dereferenced before it is found
+    auto transfer = event.GetPayload<DeviceTransfer*>();
+    auto i = m_transfers.begin();
+    while (i != m_transfers.end() && i->second.m_transfer != transfer) {
+        ++i;
+    }
+    if (i == m_transfers.end()) {
+        return;
     }
 
-    // Send AMPLs
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + offset;
-        if (i >= 10) {
-            ++addr;
-        }
-        auto ampl = store.m_store->getAmpl(addr);
-        if (ampl != nullptr) {
-            SysEx::sendAmpl(store.m_midiOut, store.m_type, addr, *ampl);
+    // Progress, the dialog would hide itself at the end of its range
+    if (event.GetInt() == 0) {
+        uint32_t max = transfer->getMax();
+        int value = max > 0 ? int(uint64_t(transfer->getCurrent()) * 999 / max) : 0;
+        if (!i->second.m_dialog->Update(value)) {
+            m_scheduler.cancel(transfer);
         }
+        return;
     }
 
-    // Send FREQs
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + offset;
-        if (i >= 10) {
-            ++addr;
+    // Completion
+    Transfer entry = i->second;
+    m_transfers.erase(i);
+    entry.m_dialog->Destroy();
+    wxString name;
+    std::string cacheKey;
+    for (auto& j : m_instrumentStores) {
+        if (j.second.m_store == &(transfer->getStore())) {
+            name = j.first;
+            cacheKey = j.second.m_cacheKey;
         }
-        auto freq = store.m_store->getFreq(addr);
-        if (freq != nullptr) {
-            SysEx::sendFreq(store.m_midiOut, store.m_type, addr, *freq);
+    }
+    try {
+        entry.m_transfer->wait();
+        if (entry.m_transfer->getType() == DeviceTransfer::Type::Read) {
+            m_deviceCache.insert(cacheKey, entry.m_transfer->getCacheEntry());
+            refreshInstruments(entry.m_item);
+            m_wavePanel->refreshWave();
         }
+        else {
+            // The store may have changed while writing, the next read must check the device again
+            m_deviceCache.remove(cacheKey);
+        }
+        saveDeviceCache();
+    }
+    catch (Exception&) {
+        // The scheduler collected the failure
     }
+    showTransferStats(name, transfer->getStore());
+    delete entry.m_transfer;
 
-    // Send WAVEs
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + offset;
-        if (i >= 10) {
-            ++addr;
-        }
-        auto wave = store.m_store->getWave(addr);
-        if (wave != nullptr) {
-            SysEx::sendWave(store.m_midiOut, store.m_type, addr, *wave);
+    // Report all failures of a backup or restore together
+    if (m_transfers.empty()) {
+        showTransferFailures();
+    }
+}
+
+// Show device transfer statistics
+void MainFrame::showTransferStats(const wxString& name, InstrumentStore& store)
+{
+    auto stats = store.getStats();
+    if (stats == nullptr) {
+        return;
+    }
+    TransferStats::Snapshot snapshot;
+    stats->getSnapshot(snapshot);
+    m_statusBar->SetStatusText(name + wxT(": ") + wxString::FromUTF8(TransferStats::summarize(snapshot).c_str()));
+}
+
+// Show device transfer failures
+void MainFrame::showTransferFailures()
+{
+    std::vector<TransferScheduler::Failure> failures;
+    m_scheduler.getFailures(failures);
+    if (failures.empty()) {
+        return;
+    }
+
+    wxString message;
+    for (auto& i : failures) {
+        wxString name;
+        for (auto& j : m_instrumentStores) {
+            if (j.second.m_store == i.m_store) {
+                name = j.first;
+            }
         }
+        bool read = i.m_type == DeviceTransfer::Type::Read;
+        message += wxString::Format(read ? _("%s: Could not read from device: %s\n")
+                                         : _("%s: Could not write to device: %s\n"),
+                                    name, wxString::FromUTF8(i.m_message.c_str()));
     }
+    wxMessageDialog err(this, message.Trim(), failures.size() == 1 ? _("Device transfer failed")
+                                                                   : _("Device transfers failed"),
+                        wxOK | wxCENTRE | wxICON_ERROR);
+    err.ShowModal();
+}
+
+// Check for running device transfer
+bool MainFrame::isBusy(const InstrumentStore* store) const
+{
+    return store != nullptr && m_transfers.find(const_cast<InstrumentStore*>(store)) != m_transfers.end();
+}
+
+// Notify main frame about device transfer progress
+void MainFrame::notifyTransfer(void* object, DeviceTransfer* transfer, bool done)
+{
+    auto event = new wxThreadEvent(EVT_DEVICE_TRANSFER);
+    event->SetPayload(transfer);
+    event->SetInt(done ? 1 : 0);
+    wxQueueEvent(static_cast<MainFrame*>(object), event);
 }
 #else // HAVE_RTMIDI
-void MainFrame::readDevice(const InstStore& /*store*/)
+void MainFrame::readDevice(const InstStore& /*store*/, const wxTreeItemId& /*item*/)
 {
 }
-void MainFrame::writeDevice(const InstStore& /*store*/)
+void MainFrame::writeDevice(const InstStore& /*store*/, bool /*dirtyOnly*/)
 {
 }
-#endif // HAVE_RTMIDI
-
-// Update progress dialog
-bool MainFrame::updateProgress(void* object, uint32_t current, uint32_t /*max*/)
+bool MainFrame::isBusy(const InstrumentStore* /*store*/) const
 {
-    auto progDlg = reinterpret_cast<wxProgressDialog*>(object);
-    if (progDlg != nullptr) {
-        //progDlg->SetRange(max);
-        return progDlg->Update(current);
-    }
     return false;
 }
+#endif // HAVE_RTMIDI
 
 } // namespace Gui
 } // namespace DMSToolbox
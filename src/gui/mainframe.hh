@@ -38,7 +38,11 @@
 #pragma once
 
 #include <gui/gui.hh>
+#include <wersi/libraryindex.hh>
+#include <wersi/devicecache.hh>
+#include <wersi/transferscheduler.hh>
 #include <wx/config.h>
+#include <wx/progdlg.h>
 #include <map>
 #include <string>
 
@@ -50,9 +54,13 @@ class RtMidiOut;
 
 namespace DMSToolbox {
 
+// Forward declarations
+class MappedFile;
+
 namespace Wersi {
 // Forward declarations
 class InstrumentStore;
+class SysExQueue;
 } // namespace Wersi
 
 namespace Gui {
@@ -132,6 +140,26 @@ class MainFrame : public MainFrameBase {
          */
         virtual void onInstSelect(wxTreeEvent& event);
 
+        /**
+          Instrument expansion event handler.
+
+          This handler is called when an instrument store is about to be expanded in the instrument tree. The
+          instrument items are created here.
+
+          @param[in]    event       Event for item expansion
+         */
+        virtual void onInstExpanding(wxTreeEvent& event);
+
+        /**
+          Instrument collapse event handler.
+
+          This handler is called when an instrument store has been collapsed in the instrument tree. The instrument
+          items are deleted here.
+
+          @param[in]    event       Event for item collapse
+         */
+        virtual void onInstCollapsed(wxTreeEvent& event);
+
         /**
           Begin drag event handler.
 
@@ -168,13 +196,47 @@ class MainFrame : public MainFrameBase {
          */
         virtual void onEditRename(wxCommandEvent& event);
 
+        /**
+          Devices/read all menu event handler.
+
+          Backs up all devices by reading their contents. Devices on different MIDI interfaces are read in parallel.
+
+          @param[in]    event       Menu item command event
+         */
+        virtual void onDevicesReadAll(wxCommandEvent& event);
+
+        /**
+          Devices/write all menu event handler.
+
+          Restores all devices by writing their complete contents. Devices on different MIDI interfaces are written in
+          parallel.
+
+          @param[in]    event       Menu item command event
+         */
+        virtual void onDevicesWriteAll(wxCommandEvent& event);
+
+        /**
+          Devices/write changes menu event handler.
+
+          Writes only the blocks changed since the last read or write to all devices, e.g. after dropping cartridge
+          contents onto them.
+
+          @param[in]    event       Menu item command event
+         */
+        virtual void onDevicesWriteChanged(wxCommandEvent& event);
+
     private:
         /// Instrument store wrapper struct to hold MIDI information for physical devices
         struct InstStore {
             Wersi::InstrumentStore* m_store;    ///< Instrument store
+            MappedFile*             m_file;     ///< Mapped cartridge file backing the store, nullptr if allocated
+            wxString                m_path;     ///< Cartridge file path, empty for devices
 #ifdef HAVE_RTMIDI
             RtMidiIn*               m_midiIn;   ///< MIDI input object
             RtMidiOut*              m_midiOut;  ///< MIDI output object
+            Wersi::SysExQueue*      m_queue;    ///< SysEx ingress queue between MIDI input and store
+            std::string             m_cacheKey; ///< Device cache key built from the MIDI port names
+            std::string             m_interface;    ///< MIDI output port name, identifies the MIDI interface
 #endif // HAVE_RTMIDI
             uint8_t                 m_channel;  ///< MIDI channel
             uint8_t                 m_type;     ///< Device type, 0 for cartridge
@@ -220,6 +282,25 @@ class MainFrame : public MainFrameBase {
         /// Source storage on drag&drop copy action
         Wersi::InstrumentStore* m_dragStore;
 
+        Wersi::LibraryIndex     m_index;        ///< Cartridge library index
+        wxString                m_indexFile;    ///< Cartridge library index file name
+        Wersi::DeviceCache      m_deviceCache;  ///< Contents last read from devices
+        wxString                m_deviceCacheFile;  ///< Device cache file name
+
+#ifdef HAVE_RTMIDI
+        /// Running device transfer
+        struct Transfer {
+            Wersi::DeviceTransfer*  m_transfer; ///< Device transfer
+            wxProgressDialog*       m_dialog;   ///< Progress dialog
+            wxTreeItemId            m_item;     ///< Tree item of the store, valid for reads
+        };
+
+        /// Running device transfers by instrument store
+        std::map<Wersi::InstrumentStore*, Transfer> m_transfers;
+
+        Wersi::TransferScheduler    m_scheduler;    ///< Scheduler running transfers per MIDI interface
+#endif // HAVE_RTMIDI
+
         /**
           Create devices from configuration.
 
@@ -231,13 +312,83 @@ class MainFrame : public MainFrameBase {
           Read cartridge file and create instrument store from it.
 
           Reads a cartridge file and creates an instrument store from it. The instrument store is automatically
-          appended to the cartridges tree.
+          appended to the cartridges tree. If the library index has an entry for the unchanged file, the tree is
+          populated from the index and the file is opened when the cartridge is first used.
 
           @param[in]    filePath    Full path to the cartridge image file
           @param[in]    cartName    Name of cartridge as displayed in the cartridge tree
          */
         void readCartridgeFile(const wxString& filePath, const wxString& cartName);
 
+        /**
+          Open cartridge file.
+
+          Opens the cartridge file given by the path of the instrument store wrapper and sets the store and file
+          members. The library index entry of the file is updated.
+
+          @param[in,out] store      Instrument store wrapper of the cartridge
+         */
+        void openCartridgeFile(InstStore& store);
+
+        /**
+          Load cartridge of tree item.
+
+          If the tree item belongs to a cartridge that has been populated from the library index only, the cartridge
+          file is opened and all tree items of the cartridge are updated. Shows an error message if the file can't be
+          opened.
+
+          @param[in]    item        Tree item of the cartridge or one of its instruments
+
+          @return                   False if the cartridge could not be opened
+         */
+        bool loadCartridge(const wxTreeItemId& item);
+
+        /**
+          Get instrument tree label.
+
+          Returns the label of an instrument item in the instrument tree.
+
+          @param[in]    icb         ICB number
+          @param[in]    name        Instrument name
+
+          @return                   Instrument item label
+         */
+        static wxString getInstrumentLabel(uint8_t icb, const std::string& name);
+
+        /**
+          Append instrument items.
+
+          Appends the instrument items to the tree item of an instrument store if it has none yet. Cartridges that
+          have not been opened yet are populated from the library index if possible.
+
+          @param[in]    item        Tree item of the instrument store
+         */
+        void appendInstruments(const wxTreeItemId& item);
+
+        /**
+          Refresh instrument items.
+
+          Updates the labels of the instrument items of an instrument store after its contents changed. Nothing is
+          done if the items have not been created.
+
+          @param[in]    item        Tree item of the instrument store
+         */
+        void refreshInstruments(const wxTreeItemId& item);
+
+        /**
+          Save library index.
+
+          Writes the library index file. Errors are ignored, as the index only speeds up loading cartridges.
+         */
+        void saveIndex();
+
+        /**
+          Save device cache.
+
+          Writes the device cache file. Errors are ignored, as the cache only speeds up reading devices.
+         */
+        void saveDeviceCache();
+
         /**
           Add device.
 
@@ -245,27 +396,106 @@ class MainFrame : public MainFrameBase {
          */
         void addDevice();
 
+        /**
+          Read device contents.
+
+          Starts reading the instrument data from a device in the background. The instrument items of the store are
+          refreshed when the read finished.
+
+          @param[in]    store       Instrument store with all necessary device data
+          @param[in]    item        Tree item of the store
+         */
+        void readDevice(const InstStore& store, const wxTreeItemId& item);
+
         /**
           Write device contents.
 
-          Writes all instrument data to a device using the given instrument store wrapper.
+          Starts writing instrument data to a device in the background using the given instrument store wrapper. In
+          incremental mode, only the blocks changed since the last read or write are sent.
 
           @param[in]    store       Instrument store with all necessary device data
+          @param[in]    dirtyOnly   Only write blocks changed since last synchronization
+         */
+        void writeDevice(const InstStore& store, bool dirtyOnly);
+
+        /**
+          Write all devices.
+
+          Starts writing all devices of the device tree in the background.
+
+          @param[in]    dirtyOnly   Only write blocks changed since last synchronization
+         */
+        void writeDevices(bool dirtyOnly);
+
+        /**
+          Check for running device transfer.
+
+          Returns true if the contents of the given instrument store are currently read from or written to a device.
+          The store must not be touched then.
+
+          @param[in]    store       Instrument store to check
+
+          @return                   True if a transfer is running for the store
          */
-        void writeDevice(const InstStore& store);
+        bool isBusy(const Wersi::InstrumentStore* store) const;
 
+#ifdef HAVE_RTMIDI
         /**
-          Update a progress dialog.
+          Start device transfer.
+
+          Shows a progress dialog for the transfer and queues it with the transfer scheduler. The main frame takes
+          ownership of the transfer.
 
-          Used as callback to update a progress dialog.
+          @param[in]    transfer    Device transfer to start
+          @param[in]    interface   MIDI interface of the device, see InstStore::m_interface
+          @param[in]    priority    Transfer priority
+          @param[in]    item        Tree item of the store, refreshed after a read
+          @param[in]    title       Progress dialog title
+          @param[in]    message     Progress dialog message
+         */
+        void startTransfer(Wersi::DeviceTransfer* transfer, const std::string& interface,
+                           Wersi::TransferScheduler::Priority priority, const wxTreeItemId& item, const wxString& title,
+                           const wxString& message);
 
-          @param[in]    object      Object to update, wxProgressDialog instance usually
-          @param[in]    current     Current progress value
-          @param[in]    max         Maximum value of progress
+        /**
+          Device transfer event handler.
 
-          @return                   If true, caller should abort activity
+          Updates the progress dialog of a transfer, or finishes the transfer if it completed. Errors are shown when
+          all transfers have completed.
+
+          @param[in]    event       Event posted by notifyTransfer()
          */
-        static bool updateProgress(void* object, uint32_t current, uint32_t max);
+        void onTransfer(wxThreadEvent& event);
+
+        /**
+          Show device transfer statistics.
+
+          Shows the summary of the transfer statistics of the device in the status bar.
+
+          @param[in]    name        Device name
+          @param[in]    store       Instrument store of the device
+         */
+        void showTransferStats(const wxString& name, Wersi::InstrumentStore& store);
+
+        /**
+          Show device transfer failures.
+
+          Shows the failures collected by the transfer scheduler in a single message dialog.
+         */
+        void showTransferFailures();
+
+        /**
+          Notify about device transfer.
+
+          Used as callback of device transfers, posts a transfer event to the main frame. Called from the transfer
+          worker thread.
+
+          @param[in]    object      Main frame
+          @param[in]    transfer    Device transfer
+          @param[in]    done        True if the transfer completed
+         */
+        static void notifyTransfer(void* object, Wersi::DeviceTransfer* transfer, bool done);
+#endif // HAVE_RTMIDI
 };
 
 } // namespace Gui
@@ -36,10 +36,8 @@
  */
 
 #include <gui/wavepanel.hh>
+#include <gui/waveview.hh>
 #include <wersi/wave.hh>
-#include <wx/dcmemory.h>
-#include <wx/dcclient.h>
-#include <memory>
 
 using namespace DMSToolbox::Wersi;
 
@@ -49,20 +47,16 @@ namespace Gui {
 // Create wave panel
 WavePanel::WavePanel(wxWindow* parent)
     : WavePanelBase(parent)
-    , m_bassPanel(new wxPanel(this, wxID_ANY, wxDefaultPosition, wxSize(512, 256)))
-    , m_tenorPanel(new wxPanel(this, wxID_ANY, wxDefaultPosition, wxSize(512, 256)))
-    , m_altoPanel(new wxPanel(this, wxID_ANY, wxDefaultPosition, wxSize(512, 256)))
-    , m_sopranoPanel(new wxPanel(this, wxID_ANY, wxDefaultPosition, wxSize(512, 256)))
+    , m_bassPanel(new WaveView(this, wxSize(512, 256)))
+    , m_tenorPanel(new WaveView(this, wxSize(512, 256)))
+    , m_altoPanel(new WaveView(this, wxSize(512, 256)))
+    , m_sopranoPanel(new WaveView(this, wxSize(512, 256)))
     , m_wave(nullptr)
 {
     m_bassPanelSizer->Add(m_bassPanel, 1, wxALIGN_CENTER | wxALL, 10);
-    m_bassPanel->Connect(wxEVT_PAINT, wxPaintEventHandler(WavePanel::onPaint), NULL, this);
     m_tenorPanelSizer->Add(m_tenorPanel, 1, wxALIGN_CENTER | wxALL, 10);
-    m_tenorPanel->Connect(wxEVT_PAINT, wxPaintEventHandler(WavePanel::onPaint), NULL, this);
     m_altoPanelSizer->Add(m_altoPanel, 1, wxALIGN_CENTER | wxALL, 10);
-    m_altoPanel->Connect(wxEVT_PAINT, wxPaintEventHandler(WavePanel::onPaint), NULL, this);
     m_sopranoPanelSizer->Add(m_sopranoPanel, 1, wxALIGN_CENTER | wxALL, 10);
-    m_sopranoPanel->Connect(wxEVT_PAINT, wxPaintEventHandler(WavePanel::onPaint), NULL, this);
 }
 
 // Set wave to edit
@@ -70,63 +64,30 @@ void WavePanel::setWave(Wave* wave)
 {
     m_wave = wave;
     if (m_wave != nullptr) {
-        m_waveLevelSlider->SetValue(m_wave->getLevel());
-        m_fixedWaveCheckBox->SetValue(m_wave->getFixedFormants());
+        // Only display the wave here, the non-const accessors would mark it modified
+        const Wave& view = *m_wave;
+        m_waveLevelSlider->SetValue(view.getLevel());
+        m_fixedWaveCheckBox->SetValue(view.getFixedFormants());
+        m_bassPanel->setSamples(view.getBass(), WaveLayout::s_bassSize);
+        m_tenorPanel->setSamples(view.getTenor(), WaveLayout::s_tenorSize);
+        m_altoPanel->setSamples(view.getAlto(), WaveLayout::s_altoSize);
+        m_sopranoPanel->setSamples(view.getSoprano(), WaveLayout::s_sopranoSize);
+    }
+    else {
+        m_bassPanel->setSamples(nullptr, 0);
+        m_tenorPanel->setSamples(nullptr, 0);
+        m_altoPanel->setSamples(nullptr, 0);
+        m_sopranoPanel->setSamples(nullptr, 0);
     }
-
-    Refresh();
-    Update();
 }
 
-// Handle paint event
-void WavePanel::onPaint(wxPaintEvent& event)
+// Refresh wave drawings
+void WavePanel::refreshWave()
 {
-    wxObject* obj = event.GetEventObject();
-    uint8_t* source = nullptr;
-    size_t size = 0;
-    wxPanel* target = nullptr;
-    if (obj == m_bassPanel) {
-        if (m_wave != nullptr) {
-            source = m_wave->getBass();
-            size = 64;
-        }
-        target = m_bassPanel;
-    }
-    else if (obj == m_tenorPanel) {
-        if (m_wave != nullptr) {
-            source = m_wave->getTenor();
-            size = 64;
-        }
-        target = m_tenorPanel;
-    }
-    else if (obj == m_altoPanel) {
-        if (m_wave != nullptr) {
-            source = m_wave->getAlto();
-            size = 32;
-        }
-        target = m_altoPanel;
-    }
-    else if (obj == m_sopranoPanel) {
-        if (m_wave != nullptr) {
-            source = m_wave->getSoprano();
-            size = 16;
-        }
-        target = m_sopranoPanel;
-    }
-
-    if (target != nullptr) {
-        wxPaintDC dc(target);
-        dc.Clear();
-        if (source != nullptr) {
-            std::unique_ptr<wxPoint[]> points(new wxPoint[size + 1]);
-            size_t factor = 512 / size;
-            for (size_t i = 0; i < size; ++i) {
-                points[i] = wxPoint(i * factor, 255 - source[i]);
-            }
-            points[size] = wxPoint(size * factor, 255 - source[0]);
-            dc.DrawSpline(size + 1, points.get());
-        }
-    }
+    m_bassPanel->refreshSamples();
+    m_tenorPanel->refreshSamples();
+    m_altoPanel->refreshSamples();
+    m_sopranoPanel->refreshSamples();
 }
 
 } // namespace Gui
@@ -48,6 +48,9 @@ class Wave;
 
 namespace Gui {
 
+// Forward declarations
+class WaveView;
+
 /**
   @ingroup gui_group
 
@@ -76,22 +79,20 @@ class WavePanel : public WavePanelBase {
          */
         void setWave(Wersi::Wave* wave);
 
-    private:
-        wxPanel*        m_bassPanel;    ///< Bass wave drawing panel
-        wxPanel*        m_tenorPanel;   ///< Bass wave drawing panel
-        wxPanel*        m_altoPanel;    ///< Bass wave drawing panel
-        wxPanel*        m_sopranoPanel; ///< Bass wave drawing panel
-
-        Wersi::Wave*    m_wave;         ///< Wave data being edited
-
         /**
-          Handle paint event.
+          Refresh wave drawings.
 
-          Handles a paint event and redraws a wave.
-
-          @param[in]    event       wxWidgets paint event
+          Repaints the wave drawings whose data has been changed outside the panel, e.g. by reading from a device.
          */
-        void onPaint(wxPaintEvent& event);
+        void refreshWave();
+
+    private:
+        WaveView*       m_bassPanel;    ///< Bass wave drawing panel
+        WaveView*       m_tenorPanel;   ///< Tenor wave drawing panel
+        WaveView*       m_altoPanel;    ///< Alto wave drawing panel
+        WaveView*       m_sopranoPanel; ///< Soprano wave drawing panel
+
+        Wersi::Wave*    m_wave;         ///< Wave data being edited
 };
 
 } // namespage Gui
@@ -0,0 +1,145 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <gui/waveview.hh>
+#include <wx/dcmemory.h>
+#include <wx/dcclient.h>
+#include <wx/region.h>
+#include <cstring>
+
+namespace DMSToolbox {
+namespace Gui {
+
+// Create wave section view
+WaveView::WaveView(wxWindow* parent, const wxSize& size)
+    : wxPanel(parent, wxID_ANY, wxDefaultPosition, size)
+    , m_samples(nullptr)
+    , m_size(0)
+    , m_drawn()
+    , m_points()
+    , m_bitmap()
+    , m_valid(false)
+{
+    // The whole window is covered by the backing bitmap, erasing the background first only causes flicker
+    SetBackgroundStyle(wxBG_STYLE_PAINT);
+    Bind(wxEVT_PAINT, &WaveView::onPaint, this);
+    Bind(wxEVT_SIZE, &WaveView::onSize, this);
+}
+
+// Set wave samples to draw
+void WaveView::setSamples(const uint8_t* samples, size_t size)
+{
+    m_samples = samples;
+    m_size = (samples != nullptr) ? size : 0;
+    refreshSamples();
+}
+
+// Check drawn wave samples
+void WaveView::refreshSamples()
+{
+    if (samplesChanged()) {
+        m_valid = false;
+        Refresh(false);
+    }
+}
+
+// Check for changed wave samples
+bool WaveView::samplesChanged() const
+{
+    if (m_drawn.size() != m_size) {
+        return true;
+    }
+    return (m_size != 0) && (memcmp(m_drawn.data(), m_samples, m_size) != 0);
+}
+
+// Render backing bitmap
+void WaveView::render()
+{
+    wxSize size = GetClientSize();
+    if ((size.GetWidth() <= 0) || (size.GetHeight() <= 0)) {
+        return;
+    }
+    if (!m_bitmap.IsOk() || (m_bitmap.GetWidth() != size.GetWidth()) || (m_bitmap.GetHeight() != size.GetHeight())) {
+        m_bitmap.Create(size.GetWidth(), size.GetHeight());
+    }
+
+    wxMemoryDC dc(m_bitmap);
+    dc.SetBackground(wxBrush(GetBackgroundColour()));
+    dc.Clear();
+    m_drawn.assign(m_samples, m_samples + m_size);
+    if (m_size != 0) {
+        // Samples are unsigned 0..255 from bottom to top, the curve wraps around to the first sample
+        int width = size.GetWidth() - 1;
+        int height = size.GetHeight() - 1;
+        m_points.resize(m_size + 1);
+        for (size_t i = 0; i <= m_size; ++i) {
+            m_points[i] = wxPoint(i * width / m_size, height - m_drawn[i % m_size] * height / 255);
+        }
+        dc.DrawSpline(m_points.size(), m_points.data());
+    }
+    dc.SelectObject(wxNullBitmap);
+    m_valid = true;
+}
+
+// Handle paint event
+void WaveView::onPaint(wxPaintEvent&)
+{
+    if (!m_valid || samplesChanged()) {
+        render();
+    }
+
+    wxPaintDC dc(this);
+    if (!m_bitmap.IsOk()) {
+        return;
+    }
+    wxMemoryDC source(m_bitmap);
+    for (wxRegionIterator it(GetUpdateRegion()); it; ++it) {
+        wxRect rect = it.GetRect();
+        dc.Blit(rect.GetPosition(), rect.GetSize(), &source, rect.GetPosition());
+    }
+}
+
+// Handle size event
+void WaveView::onSize(wxSizeEvent& event)
+{
+    m_valid = false;
+    Refresh(false);
+    event.Skip();
+}
+
+} // namespace Gui
+} // namespace DMSToolbox
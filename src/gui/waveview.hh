@@ -0,0 +1,130 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gui/gui.hh>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Gui {
+
+/**
+  @ingroup gui_group
+
+  Wave section view.
+
+  This class draws a single wave section (bass, tenor, alto or soprano) of a WAVE block. The wave curve is rendered
+  into a backing bitmap once and paint events only blit that bitmap to the window, so repainting while scrolling or
+  overlapping other windows does not recompute the spline. The bitmap is rendered again only if the panel is resized
+  or the wave samples differ from the ones rendered last time.
+ */
+class WaveView : public wxPanel {
+    public:
+        /**
+          Create wave section view.
+
+          Creates an empty wave section view.
+
+          @param[in]    parent      Parent window this view belongs to
+          @param[in]    size        Initial view size
+         */
+        WaveView(wxWindow* parent, const wxSize& size);
+
+        /**
+          Set wave samples to draw.
+
+          Sets the wave samples to draw and schedules a repaint if they differ from the currently drawn ones. The
+          samples are referenced, not copied, so they must stay valid until they are replaced or cleared.
+
+          @param[in]    samples     Wave samples, nullptr to clear the view
+          @param[in]    size        Number of wave samples
+         */
+        void setSamples(const uint8_t* samples, size_t size);
+
+        /**
+          Check drawn wave samples.
+
+          Schedules a repaint if the referenced wave samples have been changed since they were drawn last.
+         */
+        void refreshSamples();
+
+    private:
+        const uint8_t*          m_samples;      ///< Referenced wave samples
+        size_t                  m_size;         ///< Number of referenced wave samples
+        std::vector<uint8_t>    m_drawn;        ///< Copy of the wave samples in the backing bitmap
+        std::vector<wxPoint>    m_points;       ///< Spline points, kept to avoid reallocating
+        wxBitmap                m_bitmap;       ///< Backing bitmap
+        bool                    m_valid;        ///< Backing bitmap matches samples and view size
+
+        /**
+          Check for changed wave samples.
+
+          Compares the referenced wave samples with the ones in the backing bitmap.
+
+          @return                   True if the samples changed since the last rendering
+         */
+        bool samplesChanged() const;
+
+        /**
+          Render backing bitmap.
+
+          Renders the wave curve into the backing bitmap using the current view size.
+         */
+        void render();
+
+        /**
+          Handle paint event.
+
+          Renders the backing bitmap if it is invalid and copies the damaged regions to the window.
+
+          @param[in]    event       wxWidgets paint event
+         */
+        void onPaint(wxPaintEvent& event);
+
+        /**
+          Handle size event.
+
+          Invalidates the backing bitmap, it has to be rendered with the new size.
+
+          @param[in]    event       wxWidgets size event
+         */
+        void onSize(wxSizeEvent& event);
+};
+
+} // namespace Gui
+} // namespace DMSToolbox
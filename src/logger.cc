@@ -0,0 +1,111 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <logger.hh>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+
+namespace DMSToolbox {
+
+// Lowest level to log
+std::atomic<int> Logger::s_level(int(Logger::Level::Warning));
+
+// Sink and mutex serializing it, only used for messages actually logged
+static std::mutex s_sinkMutex;
+static void (*s_sink)(void* object, Logger::Level level, const char* message) = nullptr;
+static void* s_sinkObject = nullptr;
+
+// Set log level
+void Logger::setLevel(Level level)
+{
+    s_level.store(int(level), std::memory_order_relaxed);
+}
+
+// Set log sink
+void Logger::setSink(void(*sink)(void* object, Level level, const char* message), void* object)
+{
+    std::lock_guard<std::mutex> lock(s_sinkMutex);
+    s_sink = sink;
+    s_sinkObject = object;
+}
+
+// Log message
+void Logger::log(Level level, const char* format, ...)
+{
+    if (!isEnabled(level)) {
+        return;
+    }
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    std::lock_guard<std::mutex> lock(s_sinkMutex);
+    if (s_sink != nullptr) {
+        s_sink(s_sinkObject, level, message);
+    }
+    else {
+        fprintf(stderr, "%s: %s\n", getLevelName(level), message);
+    }
+}
+
+// Get level name
+const char* Logger::getLevelName(Level level)
+{
+    switch (level) {
+        case Level::Debug:
+            return "DEBUG";
+            break;
+        case Level::Info:
+            return "INFO";
+            break;
+        case Level::Warning:
+            return "WARNING";
+            break;
+        case Level::Error:
+            return "ERROR";
+            break;
+        default:
+            return "";
+            break;
+    }
+}
+
+} // namespace DMSToolbox
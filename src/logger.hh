@@ -0,0 +1,145 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <atomic>
+
+namespace DMSToolbox {
+
+/**
+  @ingroup common_group
+
+  Leveled diagnostic logger.
+
+  Messages below the current level are dropped before they are formatted, so disabled log statements in the MIDI
+  path only cost an atomic load. Messages are handed to a sink, which writes them to stderr by default. Log
+  statements should use the DMS_LOG() macro, which removes them completely if DMS_NO_LOGGING is defined.
+ */
+class Logger {
+    public:
+        /// Log level
+        enum class Level {
+            Debug,                                  ///< Detailed diagnostics, e.g. single resent requests
+            Info,                                   ///< Noteworthy events
+            Warning,                                ///< Problems that have been recovered from
+            Error,                                  ///< Problems that made an operation fail
+            Off                                     ///< No messages at all
+        };
+
+        /**
+          Set log level.
+
+          Sets the lowest level of messages to be passed to the sink, Warning by default.
+
+          @param[in]    level       Lowest level to log
+         */
+        static void setLevel(Level level);
+
+        /**
+          Check log level.
+
+          Returns true if messages of the given level are passed to the sink.
+
+          @param[in]    level       Message level
+
+          @return                   True if messages of this level are logged
+         */
+        static bool isEnabled(Level level) {
+            return int(level) >= s_level.load(std::memory_order_relaxed);
+        }
+
+        /**
+          Set log sink.
+
+          Sets the function receiving formatted messages, nullptr restores the default sink writing to stderr. The
+          sink may be called from any thread, but never from more than one thread at a time.
+
+          @param[in]    sink        Sink function
+          @param[in]    object      Object to pass to sink function
+         */
+        static void setSink(void(*sink)(void* object, Level level, const char* message), void* object);
+
+        /**
+          Log message.
+
+          Formats the message with printf style arguments and passes it to the sink if the level is enabled. Messages
+          are truncated to 255 characters.
+
+          @param[in]    level       Message level
+          @param[in]    format      printf style format string
+         */
+        static void log(Level level, const char* format, ...);
+
+        /**
+          Get level name.
+
+          Returns the upper case name of the given level as used by the default sink.
+
+          @param[in]    level       Log level
+
+          @return                   Level name
+         */
+        static const char* getLevelName(Level level);
+
+    private:
+        static std::atomic<int>     s_level;        ///< Lowest level to log
+
+        Logger();                                   ///< Static members only
+};
+
+} // namespace DMSToolbox
+
+/**
+  @ingroup common_group
+
+  Log message.
+
+  Logs a printf style message with the given Logger::Level, e.g. DMS_LOG(Warning, "Lost %u bytes", count). Arguments
+  are only evaluated if the level is enabled, and not at all if DMS_NO_LOGGING is defined.
+ */
+#ifdef DMS_NO_LOGGING
+#define DMS_LOG(level, ...) do { } while (false)
+#else // DMS_NO_LOGGING
+#define DMS_LOG(level, ...) \
+    do { \
+        if (DMSToolbox::Logger::isEnabled(DMSToolbox::Logger::Level::level)) { \
+            DMSToolbox::Logger::log(DMSToolbox::Logger::Level::level, __VA_ARGS__); \
+        } \
+    } while (false)
+#endif // DMS_NO_LOGGING
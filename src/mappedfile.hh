@@ -0,0 +1,107 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <string>
+
+namespace DMSToolbox {
+
+/**
+  @ingroup common_group
+
+  Memory mapped file.
+
+  Maps a whole file into memory, so instrument stores can work directly on the file contents without reading them
+  into a separate buffer first. The mapping is private and copy-on-write: the mapped data may be modified, but
+  changes are never written back to the file, and memory is only allocated for the pages actually written to.
+ */
+class MappedFile {
+    public:
+        /**
+          Map file.
+
+          Maps the file with the given name into memory. A SystemException is thrown if the file cannot be opened
+          or mapped.
+
+          @param[in]    fileName    Name of file to map
+         */
+        MappedFile(const std::string& fileName);
+
+        /**
+          Unmap file.
+
+          Unmaps the file, all pointers into the mapped data get invalid.
+         */
+        ~MappedFile();
+
+        /**
+          Get mapped data.
+
+          Returns a pointer to the mapped file data, usable as instrument store raw data buffer.
+
+          @return                   Mapped file data
+         */
+        void* getData() {
+            return m_data;
+        }
+
+        /**
+          Get mapped size.
+
+          Returns the size of the mapped file data.
+
+          @return                   Mapped file size
+         */
+        size_t getSize() const {
+            return m_size;
+        }
+
+    private:
+        void*       m_data;         ///< Mapped file data
+        size_t      m_size;         ///< Mapped file size
+#ifdef _WIN32
+        void*       m_file;         ///< File handle
+        void*       m_mapping;      ///< File mapping handle
+#endif // _WIN32
+
+        MappedFile(const MappedFile&);              ///< Inhibit copying objects
+        MappedFile& operator=(const MappedFile&);   ///< Inhibit copying objects
+};
+
+} // namespace DMSToolbox
@@ -0,0 +1,95 @@
+// vim:set ts=4 sw=4 et cin:
+
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <status.hh>
+#include <exceptions.hh>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace DMSToolbox {
+
+// Report error
+bool Status::fail(Code code, const char* format, ...)
+{
+    m_code = code;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(m_message, sizeof(m_message), format, args);
+    va_end(args);
+    return false;
+}
+
+// Append to error message
+void Status::append(const char* format, ...)
+{
+    size_t length = strlen(m_message);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(m_message + length, sizeof(m_message) - length, format, args);
+    va_end(args);
+}
+
+// Prepend to error message
+void Status::prepend(const char* text)
+{
+    size_t length = std::min(strlen(text), sizeof(m_message) - 1);
+    size_t keep = std::min(strlen(m_message), sizeof(m_message) - 1 - length);
+    memmove(m_message + length, m_message, keep);
+    memcpy(m_message, text, length);
+    m_message[length + keep] = '\0';
+}
+
+// Throw exception
+void Status::raise() const
+{
+    switch (m_code) {
+        case Code::DataFormat:
+            throw DataFormatException(m_message);
+            break;
+        case Code::Midi:
+            throw MidiException(m_message);
+            break;
+        default:
+            break;
+    }
+}
+
+} // namespace DMSToolbox
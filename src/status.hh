@@ -0,0 +1,148 @@
+// vim:set ts=4 sw=4 et cin:
+
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+
+namespace DMSToolbox {
+
+/**
+  @ingroup common_group
+
+  Non-throwing error status.
+
+  Alternative to the exceptions for paths where errors are routine, like probing files of unknown format in a batch
+  scan or decoding frames on a busy MIDI bus. The error message is formatted into a fixed buffer inside the status
+  object, so reporting an error never allocates memory. Messages are truncated to 255 characters. The throwing APIs
+  are wrappers around the status based ones, raise() turns a failed status into the matching exception.
+ */
+class Status {
+    public:
+        /// Error code, each one corresponds to an exception class
+        enum class Code {
+            Ok,                                     ///< No error
+            DataFormat,                             ///< DataFormatException
+            Midi                                    ///< MidiException
+        };
+
+        /// Create successful status
+        Status()
+            : m_code(Code::Ok) {
+            m_message[0] = '\0';
+        }
+
+        /**
+          Check for success.
+
+          @return                   True if no error has been reported
+         */
+        bool isOk() const {
+            return m_code == Code::Ok;
+        }
+
+        /**
+          Get error code.
+
+          @return                   Error code, Code::Ok if no error has been reported
+         */
+        Code getCode() const {
+            return m_code;
+        }
+
+        /**
+          Get error message.
+
+          @return                   Error message, empty if no error has been reported
+         */
+        const char* getMessage() const {
+            return m_message;
+        }
+
+        /// Reset to success
+        void clear() {
+            m_code = Code::Ok;
+            m_message[0] = '\0';
+        }
+
+        /**
+          Report error.
+
+          Sets the error code and formats the message with printf style arguments, replacing any previous error.
+          Always returns false, so functions returning their success can report and return in one statement.
+
+          @param[in]    code        Error code
+          @param[in]    format      printf style format string
+
+          @return                   False
+         */
+        bool fail(Code code, const char* format, ...);
+
+        /**
+          Append to error message.
+
+          Formats more text with printf style arguments behind the current message.
+
+          @param[in]    format      printf style format string
+         */
+        void append(const char* format, ...);
+
+        /**
+          Prepend to error message.
+
+          Inserts the given text in front of the current message, e.g. to name the object that failed.
+
+          @param[in]    text        Text to insert
+         */
+        void prepend(const char* text);
+
+        /**
+          Throw exception.
+
+          Throws the exception matching the error code with the error message. Does nothing if no error has been
+          reported.
+         */
+        void raise() const;
+
+    private:
+        Code        m_code;                         ///< Error code
+        char        m_message[256];                 ///< Error message
+};
+
+} // namespace DMSToolbox
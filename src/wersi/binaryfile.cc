@@ -0,0 +1,180 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/binaryfile.hh>
+#include <exceptions.hh>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create new binary writer
+BinaryWriter::BinaryWriter(const BinaryFormat& format)
+    : m_buffer(format.m_magic, format.m_magic + 4)
+    , m_what(format.m_what)
+{
+    m_buffer.push_back(format.m_version);
+}
+
+// Append little endian value
+void BinaryWriter::put(uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        m_buffer.push_back(uint8_t(value >> (i * 8)));
+    }
+}
+
+// Append string with 16 bit length
+void BinaryWriter::putString(const string& str)
+{
+    size_t size = str.size() < 0xffff ? str.size() : 0xffff;
+    put(size, 2);
+    m_buffer.insert(m_buffer.end(), str.begin(), str.begin() + size);
+}
+
+// Append raw data
+void BinaryWriter::putData(const void* data, size_t size)
+{
+    auto ptr = static_cast<const uint8_t*>(data);
+    m_buffer.insert(m_buffer.end(), ptr, ptr + size);
+}
+
+// Save file
+void BinaryWriter::save(const string& fileName) const
+{
+    // Write temporary file and replace file with it
+    string tmpName(fileName + ".tmp");
+    {
+        ofstream file(tmpName.c_str(), ios::out | ios::binary | ios::trunc);
+        file.write(reinterpret_cast<const char*>(&(m_buffer[0])), m_buffer.size());
+        file.close();
+        if (!file) {
+            SystemException exc("Cannot write " + m_what + ": ");
+            exc << strerror(errno);
+            std::remove(tmpName.c_str());
+            throw exc;
+        }
+    }
+#ifdef _WIN32
+    // Renaming doesn't replace existing files on Windows
+    std::remove(fileName.c_str());
+#endif // _WIN32
+    if (std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+        SystemException exc("Cannot replace " + m_what + ": ");
+        exc << strerror(errno);
+        std::remove(tmpName.c_str());
+        throw exc;
+    }
+}
+
+// Create new binary reader
+BinaryReader::BinaryReader(const string& fileName, const BinaryFormat& format)
+    : m_buffer()
+    , m_pos(0)
+    , m_what(format.m_what)
+{
+    ifstream file(fileName.c_str(), ios::in | ios::binary);
+    if (!file.is_open()) {
+        SystemException exc("Cannot open " + m_what + ": ");
+        exc << strerror(errno);
+        throw exc;
+    }
+    m_buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+    // Check header
+    if (m_buffer.size() < 5 || memcmp(&(m_buffer[0]), format.m_magic, 4) != 0) {
+        throw DataFormatException("Invalid " + m_what + ", bad magic");
+    }
+    if (m_buffer[4] != format.m_version) {
+        throw DataFormatException("Invalid " + m_what + ", unsupported version");
+    }
+    m_pos = 5;
+}
+
+// Read little endian value
+uint64_t BinaryReader::get(size_t size)
+{
+    check(size);
+    uint64_t ret = 0;
+    for (size_t i = 0; i < size; ++i) {
+        ret |= uint64_t(m_buffer[m_pos++]) << (i * 8);
+    }
+    return ret;
+}
+
+// Read string with 16 bit length
+string BinaryReader::getString()
+{
+    size_t size = get(2);
+    check(size);
+    string ret(m_buffer.begin() + m_pos, m_buffer.begin() + m_pos + size);
+    m_pos += size;
+    return ret;
+}
+
+// Read raw data
+void BinaryReader::getData(void* data, size_t size)
+{
+    check(size);
+    memcpy(data, &(m_buffer[m_pos]), size);
+    m_pos += size;
+}
+
+// Check for end of file
+void BinaryReader::checkEnd() const
+{
+    if (m_pos != m_buffer.size()) {
+        throw DataFormatException("Invalid " + m_what + ", trailing data");
+    }
+}
+
+// Check if enough data is left
+void BinaryReader::check(size_t size) const
+{
+    if (m_buffer.size() - m_pos < size) {
+        throw DataFormatException("Invalid " + m_what + ", unexpected end of file");
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,223 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <string>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Binary cache file format.
+
+  Cache files start with a four byte magic and a version byte. The version must be increased on any change of the
+  file contents, files of other versions are rejected.
+ */
+struct BinaryFormat {
+    char                m_magic[4];     ///< File magic
+    uint8_t             m_version;      ///< File format version
+    const char*         m_what;         ///< File description for error messages, e.g. "index file"
+};
+
+/**
+  @ingroup wersi_group
+
+  Binary cache file writer.
+
+  Collects little endian values and strings for cache files like the library index. Files are written to a
+  temporary file first and renamed, so an interrupted write never leaves a broken file.
+ */
+class BinaryWriter {
+    public:
+        /**
+          Create new binary writer.
+
+          Creates a writer with the file header already added.
+
+          @param[in]    format      File format
+         */
+        explicit BinaryWriter(const BinaryFormat& format);
+
+        /**
+          Add value.
+
+          Appends the lower bytes of the value in little endian order.
+
+          @param[in]    value       Value to append
+          @param[in]    size        Number of bytes
+         */
+        void put(uint64_t value, size_t size);
+
+        /**
+          Add string.
+
+          Appends the string with a 16 bit length, longer strings are truncated.
+
+          @param[in]    str         String to append
+         */
+        void putString(const std::string& str);
+
+        /**
+          Add raw data.
+
+          Appends raw data without length.
+
+          @param[in]    data        Data to append
+          @param[in]    size        Data size
+         */
+        void putData(const void* data, size_t size);
+
+        /**
+          Save file.
+
+          Writes the collected data to the given file. A SystemException is thrown on errors.
+
+          @param[in]    fileName    File name
+         */
+        void save(const std::string& fileName) const;
+
+    private:
+        std::vector<uint8_t>    m_buffer;       ///< File contents
+        std::string             m_what;         ///< File description for error messages
+};
+
+/**
+  @ingroup wersi_group
+
+  Binary cache file reader.
+
+  Reads files written by BinaryWriter with bounds checking, a DataFormatException is thrown on any attempt to read
+  past the end of the file.
+ */
+class BinaryReader {
+    public:
+        /**
+          Create new binary reader.
+
+          Reads the whole file and checks its header. A SystemException is thrown if the file can't be read, a
+          DataFormatException if magic or version don't match.
+
+          @param[in]    fileName    File name
+          @param[in]    format      File format
+         */
+        BinaryReader(const std::string& fileName, const BinaryFormat& format);
+
+        /**
+          Load file.
+
+          Clears the target and reads the whole file into it with the given function. If reading fails or there is
+          data left in the file, the target is cleared again before the exception is passed on, so nothing is kept
+          from a broken file.
+
+          @param[in]    fileName    File name
+          @param[in]    format      File format
+          @param[in,out] target     Object to load into, anything with a clear() method
+          @param[in]    read        Function reading the file contents from the reader into the target
+         */
+        template<typename T, typename F> static void load(const std::string& fileName, const BinaryFormat& format,
+                                                          T& target, F read) {
+            target.clear();
+            try {
+                BinaryReader reader(fileName, format);
+                read(reader);
+                reader.checkEnd();
+            }
+            catch (...) {
+                target.clear();
+                throw;
+            }
+        }
+
+        /**
+          Read value.
+
+          Reads a little endian value.
+
+          @param[in]    size        Number of bytes
+
+          @return                   Value read
+         */
+        uint64_t get(size_t size);
+
+        /**
+          Read string.
+
+          Reads a string with 16 bit length.
+
+          @return                   String read
+         */
+        std::string getString();
+
+        /**
+          Read raw data.
+
+          Reads raw data of known size.
+
+          @param[out]   data        Buffer receiving the data
+          @param[in]    size        Data size
+         */
+        void getData(void* data, size_t size);
+
+        /**
+          Check for end of file.
+
+          Throws a DataFormatException if there is data left in the file.
+         */
+        void checkEnd() const;
+
+    private:
+        std::vector<uint8_t>    m_buffer;       ///< File contents
+        size_t                  m_pos;          ///< Read position
+        std::string             m_what;         ///< File description for error messages
+
+        /**
+          Check remaining data.
+
+          Throws a DataFormatException if less than the given number of bytes is left.
+
+          @param[in]    size        Number of bytes to be read
+         */
+        void check(size_t size) const;
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,137 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wersi/sysex.hh>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Block layout traits.
+
+  Compile-time size of the raw data of a Wersi block type, as transferred by SysEx and stored in all instrument store
+  formats. RELWAVE blocks are FIXWAVE blocks without the fixed formant data at the end. Message types without block
+  data have a size of 0.
+ */
+template<SysEx::BlockType type> struct BlockLayout {
+    /// Raw block size in bytes
+    static constexpr size_t s_size =
+        type == SysEx::BlockType::IcBlock       ? 16 :
+        type == SysEx::BlockType::VcfBlock      ? 10 :
+        type == SysEx::BlockType::AmplBlock     ? 44 :
+        type == SysEx::BlockType::FreqBlock     ? 32 :
+        type == SysEx::BlockType::FixWaveBlock  ? 212 :
+        type == SysEx::BlockType::RelWaveBlock  ? 177 : 0;
+};
+
+template<SysEx::BlockType type> constexpr size_t BlockLayout<type>::s_size;
+
+/**
+  @ingroup wersi_group
+
+  Block group layout traits.
+
+  Compile-time layout of a group of blocks of the same type stored back to back in the raw data buffer of an
+  instrument store format.
+ */
+template<SysEx::BlockType type, size_t offset, size_t count> struct GroupLayout {
+    static constexpr size_t s_offset = offset;                                  ///< Offset of first block
+    static constexpr size_t s_count = count;                                    ///< Number of blocks
+    static constexpr size_t s_size = BlockLayout<type>::s_size;                 ///< Size of one block
+    static constexpr size_t s_end = offset + count * BlockLayout<type>::s_size; ///< Offset behind last block
+};
+
+template<SysEx::BlockType type, size_t offset, size_t count>
+constexpr size_t GroupLayout<type, offset, count>::s_offset;
+template<SysEx::BlockType type, size_t offset, size_t count>
+constexpr size_t GroupLayout<type, offset, count>::s_count;
+template<SysEx::BlockType type, size_t offset, size_t count>
+constexpr size_t GroupLayout<type, offset, count>::s_size;
+template<SysEx::BlockType type, size_t offset, size_t count>
+constexpr size_t GroupLayout<type, offset, count>::s_end;
+
+/**
+  @ingroup wersi_group
+
+  Wave block layout.
+
+  Compile-time layout of the parts of a wave block. A RELWAVE block ends where the fixed formant data of a FIXWAVE
+  block starts.
+ */
+struct WaveLayout {
+    static constexpr size_t s_levelOffset = 0;                                  ///< Level and fixed formant flag
+    static constexpr size_t s_bassOffset = 1;                                   ///< Bass wave offset
+    static constexpr size_t s_bassSize = 64;                                    ///< Bass wave size
+    static constexpr size_t s_tenorOffset = s_bassOffset + s_bassSize;          ///< Tenor wave offset
+    static constexpr size_t s_tenorSize = 64;                                   ///< Tenor wave size
+    static constexpr size_t s_altoOffset = s_tenorOffset + s_tenorSize;         ///< Alto wave offset
+    static constexpr size_t s_altoSize = 32;                                    ///< Alto wave size
+    static constexpr size_t s_sopranoOffset = s_altoOffset + s_altoSize;        ///< Soprano wave offset
+    static constexpr size_t s_sopranoSize = 16;                                 ///< Soprano wave size
+    static constexpr size_t s_fixFormOffset = s_sopranoOffset + s_sopranoSize;  ///< Fixed formant data offset
+    static constexpr size_t s_fixFormSize = 35;                                 ///< Fixed formant data size
+
+    /**
+      Get wave block size.
+
+      Returns the size of a wave block with the given first byte, only fixed formant waves have bit 7 set and need
+      the fixed formant data.
+
+      @param[in]    header      First byte of the wave block
+
+      @return                   Wave block size
+     */
+    static constexpr size_t getBlockSize(uint8_t header) {
+        return (header & 0x80) != 0 ? BlockLayout<SysEx::BlockType::FixWaveBlock>::s_size
+                                    : BlockLayout<SysEx::BlockType::RelWaveBlock>::s_size;
+    }
+};
+
+static_assert(WaveLayout::s_fixFormOffset == BlockLayout<SysEx::BlockType::RelWaveBlock>::s_size,
+              "RELWAVE must end where the fixed formant data starts");
+static_assert(WaveLayout::s_fixFormOffset + WaveLayout::s_fixFormSize
+              == BlockLayout<SysEx::BlockType::FixWaveBlock>::s_size, "Fixed formant data must end FIXWAVE");
+static_assert(SysEx::s_maxMessageSize
+              == sizeof(SysEx::SysExMessage) + 2 * BlockLayout<SysEx::BlockType::FixWaveBlock>::s_size,
+              "Largest SysEx message must hold a FIXWAVE");
+
+} // namespace Wersi
+} // namespace DMSToolbox
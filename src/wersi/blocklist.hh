@@ -0,0 +1,211 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <utility>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Block list indexed by block number.
+
+  Stores the data blocks of one type of an instrument store contiguously in insertion order, with a dense index over
+  all 256 possible block numbers for constant time lookup. The interface follows std::map where it is used by the
+  instrument stores, elements are pairs of block number and block object.
+
+  Pointers to elements stay valid as long as the number of elements doesn't exceed the capacity set with reserve(),
+  so a store that hands out pointers and inserts blocks later on must reserve the maximum number of blocks first.
+ */
+template<typename T> class BlockList {
+    public:
+        typedef std::pair<uint8_t, T>                               value_type;     ///< Element type
+        typedef typename std::vector<value_type>::iterator          iterator;       ///< Iterator
+        typedef typename std::vector<value_type>::const_iterator    const_iterator; ///< Const iterator
+
+        /**
+          Create new block list.
+
+          Creates an empty block list.
+         */
+        BlockList()
+            : m_elements()
+            , m_index() {
+            clearIndex();
+        }
+
+        /**
+          Get iterator to beginning.
+
+          Returns an iterator to the first element in insertion order.
+
+          @return                   Iterator to first element
+         */
+        iterator begin() {
+            return m_elements.begin();
+        }
+
+        /**
+          Get const iterator to beginning.
+
+          Returns an iterator to the first element in insertion order.
+
+          @return                   Iterator to first element
+         */
+        const_iterator begin() const {
+            return m_elements.begin();
+        }
+
+        /**
+          Get iterator to end.
+
+          Returns an iterator behind the last element.
+
+          @return                   Iterator behind last element
+         */
+        iterator end() {
+            return m_elements.end();
+        }
+
+        /**
+          Get const iterator to end.
+
+          Returns an iterator behind the last element.
+
+          @return                   Iterator behind last element
+         */
+        const_iterator end() const {
+            return m_elements.end();
+        }
+
+        /**
+          Get number of elements.
+
+          Returns the number of blocks in the list.
+
+          @return                   Number of blocks
+         */
+        size_t size() const {
+            return m_elements.size();
+        }
+
+        /**
+          Reserve storage.
+
+          Reserves storage for the given number of blocks, so inserting up to this number doesn't move any element.
+
+          @param[in]    count       Number of blocks to reserve storage for
+         */
+        void reserve(size_t count) {
+            m_elements.reserve(count);
+        }
+
+        /**
+          Clear list.
+
+          Removes all blocks, the reserved storage is kept.
+         */
+        void clear() {
+            m_elements.clear();
+            clearIndex();
+        }
+
+        /**
+          Find block.
+
+          Returns an iterator to the block with the given block number or end() if not found.
+
+          @param[in]    block       Block number
+
+          @return                   Iterator to block or end()
+         */
+        iterator find(uint8_t block) {
+            return m_index[block] == s_none ? m_elements.end() : m_elements.begin() + m_index[block];
+        }
+
+        /**
+          Find block.
+
+          Returns an iterator to the block with the given block number or end() if not found.
+
+          @param[in]    block       Block number
+
+          @return                   Iterator to block or end()
+         */
+        const_iterator find(uint8_t block) const {
+            return m_index[block] == s_none ? m_elements.end() : m_elements.begin() + m_index[block];
+        }
+
+        /**
+          Insert block.
+
+          Appends the block if there is no block with the same block number yet.
+
+          @param[in]    value       Pair of block number and block object
+
+          @return                   Pair of iterator to the block with this number and true if it was inserted
+         */
+        std::pair<iterator, bool> insert(const value_type& value) {
+            if (m_index[value.first] != s_none) {
+                return std::make_pair(m_elements.begin() + m_index[value.first], false);
+            }
+            m_index[value.first] = uint16_t(m_elements.size());
+            m_elements.push_back(value);
+            return std::make_pair(m_elements.end() - 1, true);
+        }
+
+    private:
+        static const uint16_t       s_none = 0xffff;    ///< Index value for missing block
+
+        std::vector<value_type>     m_elements;         ///< Blocks in insertion order
+        uint16_t                    m_index[256];       ///< Element index by block number
+
+        /// Mark all block numbers as missing
+        void clearIndex() {
+            for (auto& i : m_index) {
+                i = s_none;
+            }
+        }
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
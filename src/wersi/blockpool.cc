@@ -0,0 +1,205 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/blockpool.hh>
+#include <wersi/blocklayout.hh>
+#include <wersi/instrumentstore.hh>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create new block pool
+BlockPool::BlockPool()
+    : m_entries()
+    , m_numReferences(0)
+    , m_referencedSize(0)
+    , m_distinctSize(0)
+    , m_mutex()
+{
+}
+
+// Destroy block pool
+BlockPool::~BlockPool()
+{
+}
+
+// Add block
+bool BlockPool::add(size_t owner, SysEx::BlockType type, uint8_t block, const void* data, size_t size)
+{
+    auto bytes = static_cast<const uint8_t*>(data);
+    uint64_t key = hash(data, size);
+    Reference ref = { owner, block };
+
+    lock_guard<mutex> lock(m_mutex);
+    ++m_numReferences;
+    m_referencedSize += size;
+
+    // Look for identical block, hash collisions are resolved by comparing the contents
+    auto range = m_entries.equal_range(key);
+    for (auto i = range.first; i != range.second; ++i) {
+        Entry& entry = i->second;
+        if (entry.m_type == type && entry.m_data.size() == size && memcmp(&(entry.m_data[0]), bytes, size) == 0) {
+            entry.m_references.push_back(ref);
+            return false;
+        }
+    }
+
+    auto i = m_entries.insert(make_pair(key, Entry(type, bytes, size)));
+    i->second.m_references.push_back(ref);
+    m_distinctSize += size;
+    return true;
+}
+
+// Add instrument store
+void BlockPool::add(size_t owner, InstrumentStore& store)
+{
+    vector<InstrumentStore::DeviceBlock> blocks;
+    store.getDeviceBlocks(blocks);
+    for (auto& i : blocks) {
+        if (i.m_type == SysEx::BlockType::IcBlock || i.m_length == 0) {
+            continue;
+        }
+
+        // Some stores keep relative formant waves in FIXWAVE sized blocks, only the RELWAVE part is used then
+        const uint8_t relWaveSize = BlockLayout<SysEx::BlockType::RelWaveBlock>::s_size;
+        if (i.m_type == SysEx::BlockType::FixWaveBlock && (i.m_data[0] & 0x80) == 0 && i.m_length > relWaveSize) {
+            add(owner, SysEx::BlockType::RelWaveBlock, i.m_address, i.m_data, relWaveSize);
+        }
+        else {
+            add(owner, i.m_type, i.m_address, i.m_data, i.m_length);
+        }
+    }
+}
+
+// Remove instrument store
+void BlockPool::remove(size_t owner)
+{
+    lock_guard<mutex> lock(m_mutex);
+    for (auto i = m_entries.begin(); i != m_entries.end();) {
+        auto& refs = i->second.m_references;
+        size_t size = i->second.m_data.size();
+        auto last = remove_if(refs.begin(), refs.end(), [owner](const Reference& ref) {
+            return ref.m_owner == owner;
+        });
+        m_numReferences -= refs.end() - last;
+        m_referencedSize -= (refs.end() - last) * size;
+        refs.erase(last, refs.end());
+        if (refs.empty()) {
+            m_distinctSize -= size;
+            m_entries.erase(i++);
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+// Get number of references
+size_t BlockPool::getNumReferences() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_numReferences;
+}
+
+// Get number of blocks
+size_t BlockPool::getNumBlocks() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+// Get referenced data size
+size_t BlockPool::getReferencedSize() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_referencedSize;
+}
+
+// Get distinct data size
+size_t BlockPool::getDistinctSize() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_distinctSize;
+}
+
+// Get duplicates
+void BlockPool::getDuplicates(vector<Duplicate>& duplicates) const
+{
+    duplicates.clear();
+    {
+        lock_guard<mutex> lock(m_mutex);
+        for (auto& i : m_entries) {
+            if (i.second.m_references.size() > 1) {
+                Duplicate dup;
+                dup.m_type = i.second.m_type;
+                dup.m_size = i.second.m_data.size();
+                dup.m_references = i.second.m_references;
+                duplicates.push_back(dup);
+            }
+        }
+    }
+
+    // Most common first, ties are ordered by first reference for stable output
+    sort(duplicates.begin(), duplicates.end(), [](const Duplicate& a, const Duplicate& b) {
+        if (a.m_references.size() != b.m_references.size()) {
+            return a.m_references.size() > b.m_references.size();
+        }
+        if (a.m_references[0].m_owner != b.m_references[0].m_owner) {
+            return a.m_references[0].m_owner < b.m_references[0].m_owner;
+        }
+        return a.m_references[0].m_block < b.m_references[0].m_block;
+    });
+}
+
+// Calculate block hash
+uint64_t BlockPool::hash(const void* data, size_t size)
+{
+    auto bytes = static_cast<const uint8_t*>(data);
+    uint64_t ret = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        ret ^= bytes[i];
+        ret *= 0x100000001b3ULL;
+    }
+    return ret;
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
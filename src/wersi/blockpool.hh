@@ -0,0 +1,221 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <wersi/sysex.hh>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class InstrumentStore;
+
+/**
+  @ingroup wersi_group
+
+  Content addressed duplicate block index.
+
+  Groups the VCF, AMPL, FREQ and WAVE blocks of any number of instrument stores by their contents, keeping references
+  to all store blocks having the same contents. Blocks are looked up by a hash of their contents. ICBs are not
+  indexed, their contents consist of store specific block numbers mostly.
+
+  This is an index for finding duplicates only, memory is not deduplicated: the instrument stores keep their own
+  buffers and block objects, identical blocks are not shared between them. The index holds one copy of each distinct
+  contents for comparing, so stores may be closed after being added. Stores are identified by a caller defined owner
+  number. All methods may be called from multiple threads.
+ */
+class BlockPool {
+    public:
+        /// Reference to a block of an instrument store
+        struct Reference {
+            size_t              m_owner;            ///< Owner number of the instrument store
+            uint8_t             m_block;            ///< Block number in the instrument store
+        };
+
+        /// Group of identical blocks
+        struct Duplicate {
+            /// Create empty group
+            Duplicate()
+                : m_type(SysEx::BlockType::VcfBlock)
+                , m_size(0)
+                , m_references() {
+            }
+
+            SysEx::BlockType        m_type;         ///< Block type
+            size_t                  m_size;         ///< Block size
+            std::vector<Reference>  m_references;   ///< All blocks with this contents
+        };
+
+        /**
+          Create new block pool.
+
+          Creates an empty duplicate block index.
+         */
+        BlockPool();
+
+        /**
+          Destroy block pool.
+
+          Destroys the index including all copies of block data.
+         */
+        ~BlockPool();
+
+        /**
+          Add block.
+
+          Adds a reference to the block to the group of blocks with the same type and contents, creating a new group
+          with a copy of the contents if there is none yet.
+
+          @param[in]    owner       Owner number of the instrument store
+          @param[in]    type        Block type
+          @param[in]    block       Block number in the instrument store
+          @param[in]    data        Block data
+          @param[in]    size        Block size
+
+          @return                   True if the contents is new, false if an identical block has been added before
+         */
+        bool add(size_t owner, SysEx::BlockType type, uint8_t block, const void* data, size_t size);
+
+        /**
+          Add instrument store.
+
+          Adds all VCF, AMPL, FREQ and WAVE blocks of the instrument store. In lazy mode, all blocks are parsed.
+
+          @param[in]    owner       Owner number of the instrument store
+          @param[in]    store       Instrument store
+         */
+        void add(size_t owner, InstrumentStore& store);
+
+        /**
+          Remove instrument store.
+
+          Removes all references of the given owner, blocks not referenced anymore are deleted.
+
+          @param[in]    owner       Owner number of the instrument store
+         */
+        void remove(size_t owner);
+
+        /**
+          Get number of references.
+
+          Returns the number of blocks added to the index and not removed yet.
+
+          @return                   Number of references
+         */
+        size_t getNumReferences() const;
+
+        /**
+          Get number of blocks.
+
+          Returns the number of distinct block contents in the index.
+
+          @return                   Number of distinct blocks
+         */
+        size_t getNumBlocks() const;
+
+        /**
+          Get referenced data size.
+
+          Returns the size of all referenced blocks, as kept by the instrument stores.
+
+          @return                   Referenced data size in bytes
+         */
+        size_t getReferencedSize() const;
+
+        /**
+          Get distinct data size.
+
+          Returns the size of all distinct block contents, the memory deduplicating the stores would need.
+
+          @return                   Distinct data size in bytes
+         */
+        size_t getDistinctSize() const;
+
+        /**
+          Get duplicates.
+
+          Fills the list with all groups of identical blocks that are referenced more than once, ordered by the
+          number of references, most common blocks first.
+
+          @param[out]   duplicates  List of groups of identical blocks
+         */
+        void getDuplicates(std::vector<Duplicate>& duplicates) const;
+
+        /**
+          Calculate block hash.
+
+          Calculates the 64 bit FNV-1a hash of the given data as used for looking up blocks.
+
+          @param[in]    data        Block data
+          @param[in]    size        Block size
+
+          @return                   Hash value
+         */
+        static uint64_t hash(const void* data, size_t size);
+
+    private:
+        /// Distinct block contents
+        struct Entry {
+            /// Create entry from data
+            Entry(SysEx::BlockType type, const uint8_t* data, size_t size)
+                : m_type(type)
+                , m_data(data, data + size)
+                , m_references() {
+            }
+
+            SysEx::BlockType        m_type;         ///< Block type
+            std::vector<uint8_t>    m_data;         ///< Copy of block data for comparing
+            std::vector<Reference>  m_references;   ///< All blocks with this contents
+        };
+
+        std::multimap<uint64_t, Entry>  m_entries;          ///< Distinct blocks by hash
+        size_t                          m_numReferences;    ///< Number of references
+        size_t                          m_referencedSize;   ///< Size of all referenced blocks
+        size_t                          m_distinctSize;     ///< Size of all distinct blocks
+        mutable std::mutex              m_mutex;            ///< Mutex protecting all members
+
+        BlockPool(const BlockPool&);                ///< Inhibit copying objects
+        BlockPool& operator=(const BlockPool&);     ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
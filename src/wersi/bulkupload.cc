@@ -0,0 +1,246 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/bulkupload.hh>
+#include <exceptions.hh>
+#include <chrono>
+#include <cstring>
+
+#ifdef HAVE_RTMIDI
+#include <RtMidi.h>
+#endif // HAVE_RTMIDI
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create new bulk upload
+BulkUpload::BulkUpload(InstrumentStore& store, uint8_t device, bool dirtyOnly)
+    : m_store(store)
+    , m_frames()
+    , m_data()
+    , m_raw()
+    , m_readBack()
+    , m_sendBuffer()
+    , m_byteRate(s_midiByteRate)
+    , m_verify(false)
+    , m_thread()
+    , m_running(false)
+    , m_cancel(false)
+    , m_error()
+{
+    // Take snapshot of block data
+    std::vector<InstrumentStore::DeviceBlock> blocks;
+    if (dirtyOnly) {
+        m_store.getDirtyBlocks(blocks);
+    }
+    else {
+        m_store.getDeviceBlocks(blocks);
+    }
+    size_t rawSize = 0;
+    size_t dataSize = 0;
+    for (auto& i : blocks) {
+        rawSize += i.m_length;
+        dataSize += sizeof(SysEx::SysExMessage) + 2 * i.m_length;
+    }
+    m_raw.resize(rawSize);
+    m_readBack.resize(rawSize);
+    m_data.resize(dataSize);
+    m_sendBuffer.reserve(SysEx::s_maxMessageSize);
+
+    // Encode all frames into one contiguous buffer
+    size_t rawOffset = 0;
+    size_t offset = 0;
+    for (auto& i : blocks) {
+        Frame frame;
+        frame.m_block = i;
+        frame.m_rawOffset = rawOffset;
+        memcpy(&m_raw[rawOffset], i.m_data, i.m_length);
+        frame.m_offset = offset;
+        SysEx::encode(device, i.m_type, i.m_address, i.m_data, i.m_length, m_sendBuffer);
+        frame.m_size = m_sendBuffer.size();
+        memcpy(&m_data[offset], &m_sendBuffer[0], frame.m_size);
+        m_frames.push_back(frame);
+        rawOffset += i.m_length;
+        offset += frame.m_size;
+    }
+}
+
+// Destroy bulk upload
+BulkUpload::~BulkUpload()
+{
+    if (m_thread.joinable()) {
+        m_cancel = true;
+        m_thread.join();
+    }
+}
+
+// Return SysEx frame
+const unsigned char* BulkUpload::getFrame(size_t index, size_t& size) const
+{
+    const Frame& frame = m_frames.at(index);
+    size = frame.m_size;
+    return &m_data[frame.m_offset];
+}
+
+#ifdef HAVE_RTMIDI
+// Run upload
+void BulkUpload::run(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max), void* object)
+{
+    m_cancel = false;
+    execute(outPort, callback, object);
+}
+
+// Start upload in background
+void BulkUpload::start(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max),
+                       void* object)
+{
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    m_error = std::exception_ptr();
+    m_cancel = false;
+    m_running = true;
+    m_thread = std::thread([this, outPort, callback, object]() {
+        try {
+            execute(outPort, callback, object);
+        }
+        catch (...) {
+            m_error = std::current_exception();
+        }
+        m_running = false;
+    });
+}
+
+// Wait for background upload
+void BulkUpload::wait()
+{
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+}
+
+// Execute upload
+void BulkUpload::execute(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max),
+                         void* object)
+{
+    std::vector<size_t> frames;
+    for (size_t i = 0; i < m_frames.size(); ++i) {
+        frames.push_back(i);
+    }
+    sendFrames(outPort, frames, callback, object);
+
+    if (m_verify) {
+        // Verify all blocks, send mismatching blocks once more and check again
+        verifyFrames(outPort, frames, callback, object);
+        if (!frames.empty()) {
+            sendFrames(outPort, frames, callback, object);
+            verifyFrames(outPort, frames, callback, object);
+        }
+        if (!frames.empty()) {
+            MidiException exc("Verification failed for ");
+            exc << frames.size() << " blocks";
+            throw exc;
+        }
+    }
+
+    // Device now holds the snapshot data
+    for (auto& i : m_frames) {
+        m_store.markSynced(i.m_block, &m_raw[i.m_rawOffset]);
+    }
+}
+
+// Send frames
+void BulkUpload::sendFrames(RtMidiOut* outPort, const std::vector<size_t>& frames,
+                            bool(*callback)(void* object, uint32_t current, uint32_t max), void* object)
+{
+    uint32_t total = 0;
+    for (auto i : frames) {
+        total += m_frames[i].m_size;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    uint32_t sent = 0;
+    for (auto i : frames) {
+        if (m_cancel || (callback != nullptr && !callback(object, sent, total))) {
+            throw MidiException("Writing to device aborted");
+        }
+
+        // Send frame, then wait until it has passed the wire at the configured rate
+        const Frame& frame = m_frames[i];
+        m_sendBuffer.assign(m_data.begin() + frame.m_offset, m_data.begin() + frame.m_offset + frame.m_size);
+        SysEx::send(outPort, m_sendBuffer);
+        sent += frame.m_size;
+        if (m_byteRate != 0) {
+            std::this_thread::sleep_until(begin + std::chrono::microseconds(uint64_t(sent) * 1000000 / m_byteRate));
+        }
+    }
+    if (callback != nullptr) {
+        callback(object, total, total);
+    }
+}
+
+// Verify frames
+void BulkUpload::verifyFrames(RtMidiOut* outPort, std::vector<size_t>& frames,
+                              bool(*callback)(void* object, uint32_t current, uint32_t max), void* object)
+{
+    // Read back into separate buffer at the same offsets as the snapshot
+    std::vector<InstrumentStore::DeviceBlock> blocks;
+    for (auto i : frames) {
+        InstrumentStore::DeviceBlock block = m_frames[i].m_block;
+        block.m_data = &m_readBack[m_frames[i].m_rawOffset];
+        blocks.push_back(block);
+    }
+    m_store.readBlocks(outPort, blocks, callback, object);
+
+    // Keep mismatching frames only
+    std::vector<size_t> mismatch;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (memcmp(blocks[i].m_data, &m_raw[m_frames[frames[i]].m_rawOffset], blocks[i].m_length) != 0) {
+            mismatch.push_back(frames[i]);
+        }
+    }
+    frames.swap(mismatch);
+}
+#endif // HAVE_RTMIDI
+
+} // namespace Wersi
+} // namespace DMSToolbox
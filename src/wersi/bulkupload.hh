@@ -0,0 +1,287 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wersi/instrumentstore.hh>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Wersi SysEx bulk upload engine.
+
+  This class uploads all blocks, or only the blocks changed since the last synchronization, of an instrument store
+  to a device. On creation, the complete sequence of SysEx
+  frames is encoded into one contiguous buffer, taking a snapshot of the store contents. The frames are then sent
+  paced at a configurable byte rate, which defaults to the MIDI wire rate of 31.25 kbaud, so the device receive
+  buffer is never overrun even if the MIDI interface itself doesn't throttle. Optionally all blocks are read back
+  from the device after the upload and compared against the snapshot, mismatching blocks are sent once more.
+
+  The upload can be run synchronously or on a background thread.
+ */
+class BulkUpload {
+    public:
+        /// Default byte rate, MIDI runs at 31250 baud with 10 bits per byte
+        static const uint32_t s_midiByteRate = 3125;
+
+        /**
+          Create new bulk upload.
+
+          Creates a new bulk upload for the device blocks of the given instrument store and encodes the SysEx frames
+          for the given device type. After a successful upload, the uploaded blocks are marked as synchronized in
+          the store.
+
+          @param[in]    store       Instrument store to upload
+          @param[in]    device      Device type to create messages for
+          @param[in]    dirtyOnly   Only upload blocks changed since the last synchronization
+         */
+        BulkUpload(InstrumentStore& store, uint8_t device, bool dirtyOnly = false);
+
+        /**
+          Destroy bulk upload.
+
+          Destroys the bulk upload. If a background upload is still running, it is cancelled and waited for.
+         */
+        ~BulkUpload();
+
+        /**
+          Get number of frames.
+
+          Returns the number of SysEx frames to upload.
+
+          @return                   Number of SysEx frames
+         */
+        size_t getNumFrames() const {
+            return m_frames.size();
+        }
+
+        /**
+          Get total size.
+
+          Returns the total size of all SysEx frames to upload in bytes.
+
+          @return                   Total size in bytes
+         */
+        size_t getTotalSize() const {
+            return m_data.size();
+        }
+
+        /**
+          Get frame.
+
+          Returns a pointer to the SysEx frame with the given index and its size.
+
+          @param[in]    index       Frame index
+          @param[out]   size        Frame size
+
+          @return                   Pointer to frame data
+         */
+        const unsigned char* getFrame(size_t index, size_t& size) const;
+
+        /**
+          Get byte rate.
+
+          Returns the byte rate the upload is paced at, 0 if not paced at all.
+
+          @return                   Byte rate in bytes per second
+         */
+        uint32_t getByteRate() const {
+            return m_byteRate;
+        }
+
+        /**
+          Set byte rate.
+
+          Sets the byte rate the upload is paced at. A rate of 0 disables pacing.
+
+          @param[in]    rate        Byte rate in bytes per second
+         */
+        void setByteRate(uint32_t rate) {
+            m_byteRate = rate;
+        }
+
+        /**
+          Get verify mode.
+
+          Returns true if the upload is verified by reading back all blocks.
+
+          @return                   True if upload is verified
+         */
+        bool getVerify() const {
+            return m_verify;
+        }
+
+        /**
+          Set verify mode.
+
+          Enables or disables verification of the upload by reading back all blocks from the device.
+
+          @param[in]    verify      True to verify upload
+         */
+        void setVerify(bool verify) {
+            m_verify = verify;
+        }
+
+#ifdef HAVE_RTMIDI
+        /**
+          Run upload.
+
+          Runs the upload on the calling thread. The progress display callback is called after each frame and may
+          return false to abort the upload. If the upload is aborted or verification fails, a MidiException is
+          thrown.
+
+          @param[in]    outPort     MIDI output port
+          @param[in]    callback    Callback for progress display
+          @param[in]    object      Object to pass to progress display callback
+         */
+        void run(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+
+        /**
+          Start upload in background.
+
+          Starts the upload on a background thread. The progress display callback is called from this thread.
+
+          @param[in]    outPort     MIDI output port
+          @param[in]    callback    Callback for progress display
+          @param[in]    object      Object to pass to progress display callback
+         */
+        void start(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+
+        /**
+          Wait for background upload.
+
+          Waits until the background upload is finished. If it failed, the exception is rethrown.
+         */
+        void wait();
+#endif // HAVE_RTMIDI
+
+        /**
+          Check for running background upload.
+
+          Returns true if a background upload is still running.
+
+          @return                   True if upload is running
+         */
+        bool isRunning() const {
+            return m_running;
+        }
+
+        /**
+          Cancel upload.
+
+          Requests the running upload to stop after the current frame.
+         */
+        void cancel() {
+            m_cancel = true;
+        }
+
+    private:
+        /// SysEx frame
+        struct Frame {
+            InstrumentStore::DeviceBlock    m_block;        ///< Device block of the store
+            size_t                          m_rawOffset;    ///< Block data offset in m_raw
+            size_t                          m_offset;       ///< Frame offset in m_data
+            size_t                          m_size;         ///< Frame size
+        };
+
+        InstrumentStore&            m_store;        ///< Instrument store to upload
+        std::vector<Frame>          m_frames;       ///< SysEx frames
+        std::vector<unsigned char>  m_data;         ///< Encoded SysEx frames
+        std::vector<uint8_t>        m_raw;          ///< Snapshot of raw block data
+        std::vector<uint8_t>        m_readBack;     ///< Read back raw block data for verification
+        std::vector<unsigned char>  m_sendBuffer;   ///< Reusable MIDI send buffer
+        uint32_t                    m_byteRate;     ///< Byte rate for pacing, 0 for none
+        bool                        m_verify;       ///< Verify upload by reading back
+
+        std::thread                 m_thread;       ///< Background upload thread
+        std::atomic<bool>           m_running;      ///< True while background upload is running
+        std::atomic<bool>           m_cancel;       ///< Set to cancel the running upload
+        std::exception_ptr          m_error;        ///< Error of background upload
+
+#ifdef HAVE_RTMIDI
+        /**
+          Execute upload.
+
+          Sends all frames, verifies them if requested and marks the uploaded blocks as synchronized.
+
+          @param[in]    outPort     MIDI output port
+          @param[in]    callback    Callback for progress display
+          @param[in]    object      Object to pass to progress display callback
+         */
+        void execute(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+
+        /**
+          Send frames.
+
+          Sends the frames with the given indices paced at the configured byte rate.
+
+          @param[in]    outPort     MIDI output port
+          @param[in]    frames      Indices of frames to send
+          @param[in]    callback    Callback for progress display
+          @param[in]    object      Object to pass to progress display callback
+         */
+        void sendFrames(RtMidiOut* outPort, const std::vector<size_t>& frames,
+                        bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+
+        /**
+          Verify frames.
+
+          Reads back the blocks of the frames with the given indices and keeps only the indices of frames whose data
+          differs from the snapshot.
+
+          @param[in]        outPort     MIDI output port
+          @param[in,out]    frames      Indices of frames to verify, receives indices of mismatching frames
+          @param[in]        callback    Callback for progress display
+          @param[in]        object      Object to pass to progress display callback
+         */
+        void verifyFrames(RtMidiOut* outPort, std::vector<size_t>& frames,
+                          bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+#endif // HAVE_RTMIDI
+
+        BulkUpload(const BulkUpload&);              ///< Inhibit copying objects
+        BulkUpload& operator=(const BulkUpload&);   ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
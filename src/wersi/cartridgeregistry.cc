@@ -0,0 +1,129 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/cartridgeregistry.hh>
+#include <wersi/mk1cartridge.hh>
+#include <wersi/dx10cartridge.hh>
+#include <algorithm>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create MK1 cartridge
+static InstrumentStore* createMk1(void* buffer, size_t /*size*/, bool lazy, Status& status)
+{
+    return Mk1Cartridge::create(buffer, lazy, status);
+}
+
+// Create DX10/DX5 cartridge
+static InstrumentStore* createDx10(void* buffer, size_t size, bool lazy, Status& status)
+{
+    return Dx10Cartridge::create(buffer, size, lazy, status);
+}
+
+// Return all formats
+const std::vector<CartridgeRegistry::Format>& CartridgeRegistry::getFormats()
+{
+    static const Format formats[] = {
+        { "MK1", Mk1Cartridge::probe, createMk1 },
+        { "DX10/DX5", Dx10Cartridge::probe, createDx10 }
+    };
+    static_assert(sizeof(formats) / sizeof(formats[0]) <= s_maxFormats, "Too many cartridge formats");
+    static const std::vector<Format> list(formats, formats + sizeof(formats) / sizeof(formats[0]));
+    return list;
+}
+
+// Probe for most likely format
+const CartridgeRegistry::Format* CartridgeRegistry::probe(const void* buffer, size_t size, unsigned& confidence)
+{
+    const Format* ret = nullptr;
+    confidence = 0;
+    for (auto& i : getFormats()) {
+        unsigned tmp = i.m_probe(buffer, size);
+        if (tmp > confidence) {
+            confidence = tmp;
+            ret = &i;
+        }
+    }
+    return ret;
+}
+
+// Open cartridge image
+InstrumentStore* CartridgeRegistry::open(void* buffer, size_t size, bool lazy, std::string& name)
+{
+    Status status;
+    InstrumentStore* store = open(buffer, size, lazy, name, status);
+    if (store == nullptr) {
+        status.raise();
+    }
+    return store;
+}
+
+// Open cartridge image without throwing
+InstrumentStore* CartridgeRegistry::open(void* buffer, size_t size, bool lazy, std::string& name, Status& status)
+{
+    // Order candidates by confidence, there are only a few formats
+    std::pair<unsigned, const Format*> candidates[s_maxFormats];
+    size_t numCandidates = 0;
+    for (auto& i : getFormats()) {
+        unsigned confidence = i.m_probe(buffer, size);
+        if (confidence > 0) {
+            candidates[numCandidates++] = std::make_pair(confidence, &i);
+        }
+    }
+    std::stable_sort(candidates, candidates + numCandidates,
+    [](const std::pair<unsigned, const Format*>& a, const std::pair<unsigned, const Format*>& b) {
+        return a.first > b.first;
+    });
+
+    // Errors of all tried formats are collected in the status
+    Status error;
+    status.fail(Status::Code::DataFormat, "Unknown cartridge format");
+    for (size_t i = 0; i < numCandidates; ++i) {
+        InstrumentStore* store = candidates[i].second->m_create(buffer, size, lazy, error);
+        if (store != nullptr) {
+            name = candidates[i].second->m_name;
+            status.clear();
+            return store;
+        }
+        status.append(", %s: %s", candidates[i].second->m_name, error.getMessage());
+    }
+    return nullptr;
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
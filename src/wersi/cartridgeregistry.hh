@@ -0,0 +1,128 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <status.hh>
+#include <string>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class InstrumentStore;
+
+/**
+  @ingroup wersi_group
+
+  Wersi cartridge format registry.
+
+  Knows all supported cartridge image formats. The formats are probed cheaply on raw data, only the most likely
+  formats are then used to create an instrument store.
+ */
+class CartridgeRegistry {
+    public:
+        /// Cartridge image format
+        struct Format {
+            const char*         m_name;                                         ///< Format name
+            unsigned            (*m_probe)(const void* buffer, size_t size);    ///< Probe function
+            /// Store creation function, returns nullptr and reports the error in the status on invalid data
+            InstrumentStore*    (*m_create)(void* buffer, size_t size, bool lazy, Status& status);
+        };
+
+        /// Maximum number of formats
+        static const size_t s_maxFormats = 8;
+
+        /**
+          Get formats.
+
+          Returns the list of all supported cartridge image formats.
+
+          @return                   List of formats
+         */
+        static const std::vector<Format>& getFormats();
+
+        /**
+          Probe raw data.
+
+          Probes the raw data for all formats and returns the most likely one.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    size        Size of raw data buffer
+          @param[out]   confidence  Confidence of returned format from 0 to 100
+
+          @return                   Most likely format or nullptr if no format matches at all
+         */
+        static const Format* probe(const void* buffer, size_t size, unsigned& confidence);
+
+        /**
+          Open cartridge image.
+
+          Creates an instrument store for the raw data. The formats are tried in the order of their probe confidence,
+          formats not matching at all are skipped without trying. If no format can be created, a DataFormatException
+          with the errors of all tried formats is thrown.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    size        Size of raw data buffer
+          @param[in]    lazy        If true, blocks are parsed on first access
+          @param[out]   name        Receives the name of the detected format
+
+          @return                   Newly created instrument store, to be deleted by the caller
+         */
+        static InstrumentStore* open(void* buffer, size_t size, bool lazy, std::string& name);
+
+        /**
+          Open cartridge image without throwing.
+
+          Same as open() above, but the errors of all tried formats are reported in the given status instead of
+          throwing a DataFormatException, so scanning many files of unknown format stays cheap.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    size        Size of raw data buffer
+          @param[in]    lazy        If true, blocks are parsed on first access
+          @param[out]   name        Receives the name of the detected format
+          @param[out]   status      Receives the error, if any
+
+          @return                   Newly created instrument store, to be deleted by the caller, nullptr on error
+         */
+        static InstrumentStore* open(void* buffer, size_t size, bool lazy, std::string& name, Status& status);
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,108 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/checksum.hh>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHECKSUM_NEON
+#endif
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Calculate byte sum
+uint16_t Checksum::sum(const void* data, size_t size, uint16_t initial)
+{
+    auto bytes = static_cast<const uint8_t*>(data);
+    uint16_t ret = initial;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // Sum of absolute differences against zero adds up 8 bytes into each 64 bit lane
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    ret += uint16_t(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc)));
+#elif defined(CHECKSUM_NEON)
+    // Pairwise add into 16 bit lanes, wrapping around is fine for a modulo 65536 sum
+    uint16x8_t acc = vdupq_n_u16(0);
+    for (; i + 16 <= size; i += 16) {
+        acc = vpadalq_u8(acc, vld1q_u8(bytes + i));
+    }
+    uint16_t lanes[8];
+    vst1q_u16(lanes, acc);
+    for (auto lane : lanes) {
+        ret += lane;
+    }
+#endif
+    for (; i < size; ++i) {
+        ret += bytes[i];
+    }
+    return ret;
+}
+
+// Verify stored checksum
+bool Checksum::verify(const void* data, size_t size, const uint8_t* stored, uint16_t initial)
+{
+    uint16_t check = sum(data, size, initial);
+    check += (stored[0] << 8) | stored[1];
+    return check == 0;
+}
+
+// Store checksum
+void Checksum::store(const void* data, size_t size, uint8_t* stored, uint16_t initial)
+{
+    uint16_t check = -sum(data, size, initial);
+    stored[0] = check >> 8;
+    stored[1] = check & 0xff;
+}
+
+// Adjust stored checksum
+void Checksum::adjust(uint8_t* stored, uint16_t delta)
+{
+    uint16_t check = ((stored[0] << 8) | stored[1]) - delta;
+    stored[0] = check >> 8;
+    stored[1] = check & 0xff;
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
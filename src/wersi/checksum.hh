@@ -0,0 +1,109 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Wersi cartridge checksum helpers.
+
+  Cartridge images protect their data with 16 bit checksums, the stored checksum word is chosen so that the sum of
+  all protected bytes, an optional start value and the checksum word itself is zero. These helpers calculate the
+  byte sums and keep stored checksums up to date when only parts of the protected data change.
+ */
+class Checksum {
+    public:
+        /**
+          Calculate byte sum.
+
+          Returns the sum of all bytes in the given data, modulo 65536.
+
+          @param[in]    data        Data to sum up
+          @param[in]    size        Size of data
+          @param[in]    initial     Start value of the sum
+
+          @return                   Byte sum
+         */
+        static uint16_t sum(const void* data, size_t size, uint16_t initial = 0);
+
+        /**
+          Verify stored checksum.
+
+          Returns true if the protected data sums up with the start value and the stored big endian checksum word
+          to zero.
+
+          @param[in]    data        Protected data
+          @param[in]    size        Size of protected data
+          @param[in]    stored      Location of stored checksum word
+          @param[in]    initial     Start value of the sum
+
+          @return                   True if checksum is correct
+         */
+        static bool verify(const void* data, size_t size, const uint8_t* stored, uint16_t initial = 0);
+
+        /**
+          Store checksum.
+
+          Calculates the checksum word for the protected data and stores it big endian at the given location.
+
+          @param[in]    data        Protected data
+          @param[in]    size        Size of protected data
+          @param[out]   stored      Location of stored checksum word
+          @param[in]    initial     Start value of the sum
+         */
+        static void store(const void* data, size_t size, uint8_t* stored, uint16_t initial = 0);
+
+        /**
+          Adjust stored checksum.
+
+          Adjusts the stored big endian checksum word after the protected data changed by the given byte sum delta,
+          so the checksum stays correct without summing up all data again.
+
+          @param[in,out]    stored      Location of stored checksum word
+          @param[in]        delta       Byte sum of new data minus byte sum of old data
+         */
+        static void adjust(uint8_t* stored, uint16_t delta);
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
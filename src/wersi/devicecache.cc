@@ -0,0 +1,214 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/devicecache.hh>
+#include <wersi/instrumentstore.hh>
+#include <wersi/binaryfile.hh>
+#include <exceptions.hh>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Cache file format
+static const BinaryFormat s_format = { { 'D', 'M', 'S', 'C' }, 1, "cache file" };
+
+// Create new device cache
+DeviceCache::DeviceCache()
+    : m_entries()
+{
+}
+
+// Destroy device cache
+DeviceCache::~DeviceCache()
+{
+}
+
+// Load cache file
+void DeviceCache::load(const string& fileName)
+{
+    BinaryReader::load(fileName, s_format, m_entries, [this](BinaryReader& reader) {
+        size_t count = reader.get(4);
+        for (size_t i = 0; i < count; ++i) {
+            string key = reader.getString();
+            Entry entry;
+            entry.m_data.resize(reader.get(4));
+            if (!entry.m_data.empty()) {
+                reader.getData(&(entry.m_data[0]), entry.m_data.size());
+            }
+            size_t num = reader.get(2);
+            entry.m_blocks.reserve(num);
+            for (size_t j = 0; j < num; ++j) {
+                Block block;
+                block.m_type = SysEx::BlockType(reader.get(1));
+                block.m_address = uint8_t(reader.get(1));
+                block.m_time = int64_t(reader.get(8));
+                entry.m_blocks.push_back(block);
+            }
+            m_entries[key] = entry;
+        }
+    });
+}
+
+// Save cache file
+void DeviceCache::save(const string& fileName) const
+{
+    BinaryWriter writer(s_format);
+    writer.put(m_entries.size(), 4);
+    for (auto& i : m_entries) {
+        const Entry& entry = i.second;
+        writer.putString(i.first);
+        writer.put(entry.m_data.size(), 4);
+        if (!entry.m_data.empty()) {
+            writer.putData(&(entry.m_data[0]), entry.m_data.size());
+        }
+        writer.put(entry.m_blocks.size(), 2);
+        for (auto& j : entry.m_blocks) {
+            writer.put(uint8_t(j.m_type), 1);
+            writer.put(j.m_address, 1);
+            writer.put(uint64_t(j.m_time), 8);
+        }
+    }
+
+    writer.save(fileName);
+}
+
+// Find entry
+const DeviceCache::Entry* DeviceCache::find(const string& key) const
+{
+    auto i = m_entries.find(key);
+    if (i == m_entries.end()) {
+        return nullptr;
+    }
+    return &(i->second);
+}
+
+// Insert entry
+void DeviceCache::insert(const string& key, const Entry& entry)
+{
+    m_entries[key] = entry;
+}
+
+// Remove entry
+void DeviceCache::remove(const string& key)
+{
+    m_entries.erase(key);
+}
+
+// Describe instrument store
+void DeviceCache::describe(Entry& entry, InstrumentStore& store, int64_t time)
+{
+    auto buffer = static_cast<const uint8_t*>(store.getBuffer());
+    entry.m_data.assign(buffer, buffer + store.getBufferSize());
+
+    vector<InstrumentStore::DeviceBlock> blocks;
+    store.getDeviceBlocks(blocks);
+    entry.m_blocks.clear();
+    entry.m_blocks.reserve(blocks.size());
+    for (auto& i : blocks) {
+        Block block = { i.m_type, i.m_address, time };
+        entry.m_blocks.push_back(block);
+    }
+}
+
+#ifdef HAVE_RTMIDI
+// Restore instrument store after spot check
+bool DeviceCache::spotCheck(Entry& entry, InstrumentStore& store, RtMidiOut* outPort, size_t count, int64_t time,
+                            bool(*callback)(void* object, uint32_t current, uint32_t max), void* object)
+{
+    if (entry.m_data.size() != store.getBufferSize()) {
+        return false;
+    }
+
+    // Restore cached contents, the block layout must still be the cached one
+    auto buffer = static_cast<uint8_t*>(store.getBuffer());
+    memcpy(buffer, &(entry.m_data[0]), entry.m_data.size());
+    store.clearSynced();
+    store.getJournal().clear();
+    store.dissect();
+    vector<InstrumentStore::DeviceBlock> blocks;
+    store.getDeviceBlocks(blocks);
+    if (blocks.size() != entry.m_blocks.size()) {
+        return false;
+    }
+
+    // Pick the ICBs verified least recently, ties in device block order
+    vector<size_t> picked;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].m_type != entry.m_blocks[i].m_type || blocks[i].m_address != entry.m_blocks[i].m_address) {
+            return false;
+        }
+        if (blocks[i].m_type == SysEx::BlockType::IcBlock) {
+            picked.push_back(i);
+        }
+    }
+    stable_sort(picked.begin(), picked.end(), [&entry](size_t a, size_t b) {
+        return entry.m_blocks[a].m_time < entry.m_blocks[b].m_time;
+    });
+    if (picked.size() > count) {
+        picked.resize(count);
+    }
+
+    // Read them into a scratch buffer and compare
+    vector<uint8_t> scratch(entry.m_data.size());
+    vector<InstrumentStore::DeviceBlock> requests;
+    for (auto i : picked) {
+        InstrumentStore::DeviceBlock block = blocks[i];
+        block.m_data = &(scratch[block.m_data - buffer]);
+        requests.push_back(block);
+    }
+    store.readBlocks(outPort, requests, callback, object);
+    for (auto i : picked) {
+        size_t offset = blocks[i].m_data - buffer;
+        if (memcmp(&(scratch[offset]), buffer + offset, blocks[i].m_length) != 0) {
+            return false;
+        }
+    }
+
+    for (auto i : picked) {
+        entry.m_blocks[i].m_time = time;
+    }
+    store.markSynced();
+    return true;
+}
+#endif // HAVE_RTMIDI
+
+} // namespace Wersi
+} // namespace DMSToolbox
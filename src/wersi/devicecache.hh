@@ -0,0 +1,203 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <wersi/sysex.hh>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class InstrumentStore;
+
+/**
+  @ingroup wersi_group
+
+  Persistent device contents cache.
+
+  Keeps the raw data last read from each device in a compact binary cache file, so reconnecting to a known device
+  doesn't need a full read. Entries are keyed by a string identifying the device, usually built from its MIDI port
+  names. Each block carries the time it was last read from the device, a spot check re-reads the least recently
+  verified ICBs and accepts the cached contents if they still match.
+ */
+class DeviceCache {
+    public:
+        /// Block of a cached device
+        struct Block {
+            SysEx::BlockType        m_type;         ///< SysEx block type
+            uint8_t                 m_address;      ///< Block address
+            int64_t                 m_time;         ///< Time the block was last read from the device
+        };
+
+        /// Cached device contents
+        struct Entry {
+            /// Create empty entry
+            Entry()
+                : m_data()
+                , m_blocks() {
+            }
+
+            std::vector<uint8_t>    m_data;         ///< Raw data buffer contents
+            std::vector<Block>      m_blocks;       ///< All blocks in device block order
+        };
+
+        /**
+          Create new device cache.
+
+          Creates an empty device cache.
+         */
+        DeviceCache();
+
+        /**
+          Destroy device cache.
+
+          Destroys the device cache.
+         */
+        ~DeviceCache();
+
+        /**
+          Load cache file.
+
+          Replaces all entries with the contents of the given cache file. A SystemException is thrown if the file
+          can't be read, a DataFormatException if it is broken or has been written by an incompatible version. The
+          cache is empty then.
+
+          @param[in]    fileName    Cache file name
+         */
+        void load(const std::string& fileName);
+
+        /**
+          Save cache file.
+
+          Writes all entries to the given cache file through a temporary file. A SystemException is thrown on errors.
+
+          @param[in]    fileName    Cache file name
+         */
+        void save(const std::string& fileName) const;
+
+        /**
+          Find entry.
+
+          Returns the entry for the given device, nullptr if there is none.
+
+          @param[in]    key         Device key
+
+          @return                   Pointer to entry or nullptr
+         */
+        const Entry* find(const std::string& key) const;
+
+        /**
+          Insert entry.
+
+          Inserts the entry, replacing any entry for the same device.
+
+          @param[in]    key         Device key
+          @param[in]    entry       Entry to insert
+         */
+        void insert(const std::string& key, const Entry& entry);
+
+        /**
+          Remove entry.
+
+          Removes the entry for the given device, if any.
+
+          @param[in]    key         Device key
+         */
+        void remove(const std::string& key);
+
+        /**
+          Get number of entries.
+
+          Returns the number of cached devices.
+
+          @return                   Number of entries
+         */
+        size_t size() const {
+            return m_entries.size();
+        }
+
+        /**
+          Describe instrument store.
+
+          Fills the entry from the raw data and device blocks of the given instrument store, all blocks get the given
+          time.
+
+          @param[out]   entry       Entry to fill
+          @param[in]    store       Instrument store just read from the device
+          @param[in]    time        Time the store has been read
+         */
+        static void describe(Entry& entry, InstrumentStore& store, int64_t time);
+
+#ifdef HAVE_RTMIDI
+        /**
+          Restore instrument store after spot check.
+
+          Copies the cached data into the instrument store and re-reads the given number of ICBs that have been
+          verified least recently from the device. If they match the cached data, the store is dissected, marked as
+          synchronized, the timestamps of the blocks read are updated and true is returned. Otherwise, the store
+          contains stale data and must be read completely. Only the ICBs are compared, so changes to other blocks
+          which didn't touch an ICB aren't detected. Errors reading the blocks are thrown as for
+          InstrumentStore::readBlocks().
+
+          @param[in,out] entry      Cached device contents
+          @param[in]    store       Instrument store to restore
+          @param[in]    outPort     MIDI output port
+          @param[in]    count       Number of ICBs to compare
+          @param[in]    time        Current time
+          @param[in]    callback    Callback for progress display
+          @param[in]    object      Object to pass to progress display callback
+
+          @return                   True if the cached data has been accepted
+         */
+        static bool spotCheck(Entry& entry, InstrumentStore& store, RtMidiOut* outPort, size_t count, int64_t time,
+                              bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+#endif // HAVE_RTMIDI
+
+    private:
+        std::map<std::string, Entry>    m_entries;      ///< Entries by device key
+
+        DeviceCache(const DeviceCache&);                ///< Inhibit copying objects
+        DeviceCache& operator=(const DeviceCache&);     ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
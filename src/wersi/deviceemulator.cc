@@ -0,0 +1,279 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/deviceemulator.hh>
+#include <wersi/bulkupload.hh>
+#include <algorithm>
+#include <cstring>
+
+#ifdef HAVE_RTMIDI
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create configuration of an ideal device
+DeviceEmulator::Config::Config()
+    : m_latency(0)
+    , m_jitter(0)
+    , m_byteRate(BulkUpload::s_midiByteRate)
+    , m_loss(0.0)
+    , m_seed(1)
+{
+}
+
+// Create zero counters
+DeviceEmulator::Counters::Counters()
+    : m_requests(0)
+    , m_writes(0)
+    , m_responses(0)
+    , m_lost(0)
+    , m_invalid(0)
+    , m_unknown(0)
+{
+}
+
+// Create new device emulator
+DeviceEmulator::DeviceEmulator(InstrumentStore& store, uint8_t device, RtMidiOut* outPort)
+    : m_store(store)
+    , m_device(device)
+    , m_outPort(outPort != nullptr ? outPort : reinterpret_cast<RtMidiOut*>(this))
+    , m_blocks()
+    , m_config()
+    , m_random(m_config.m_seed)
+    , m_counters()
+    , m_inbound()
+    , m_outbound()
+    , m_inWireFree()
+    , m_outWireFree()
+    , m_lastDelivery()
+    , m_mutex()
+    , m_cond()
+    , m_stopping(false)
+    , m_callback(nullptr)
+    , m_userData(nullptr)
+    , m_callbackMutex()
+    , m_thread()
+{
+    m_store.getDeviceBlocks(m_blocks);
+    m_thread = std::thread([this]() {
+        work();
+    });
+    SysEx::setLoopback(m_outPort, receive, this);
+}
+
+// Destroy device emulator
+DeviceEmulator::~DeviceEmulator()
+{
+    // No more frames can arrive once the loopback is gone
+    SysEx::setLoopback(m_outPort, nullptr, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_cond.notify_all();
+    }
+    m_thread.join();
+}
+
+// Set configuration
+void DeviceEmulator::setConfig(const Config& config)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_config = config;
+    m_random.seed(m_config.m_seed);
+}
+
+// Set response callback
+void DeviceEmulator::setCallback(void(*callback)(double timestamp, std::vector<unsigned char>* message,
+                                                 void* userData), void* userData)
+{
+    std::lock_guard<std::mutex> lock(m_callbackMutex);
+    m_callback = callback;
+    m_userData = userData;
+}
+
+// Cancel response callback
+void DeviceEmulator::cancelCallback()
+{
+    setCallback(nullptr, nullptr);
+}
+
+// Get counters
+DeviceEmulator::Counters DeviceEmulator::getCounters() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_counters;
+}
+
+// Queue received frame
+void DeviceEmulator::receive(void* object, const std::vector<unsigned char>& message)
+{
+    auto emulator = static_cast<DeviceEmulator*>(object);
+    Frame frame;
+    frame.m_time = Clock::now();
+    frame.m_data = message;
+
+    std::lock_guard<std::mutex> lock(emulator->m_mutex);
+    emulator->m_inbound.push_back(std::move(frame));
+    emulator->m_cond.notify_all();
+}
+
+// Get wire time
+DeviceEmulator::Clock::duration DeviceEmulator::getWireTime(size_t size) const
+{
+    if (m_config.m_byteRate == 0) {
+        return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(
+               std::chrono::microseconds(uint64_t(size) * 1000000 / m_config.m_byteRate));
+}
+
+// Check for frame loss
+bool DeviceEmulator::isLost()
+{
+    if (m_config.m_loss <= 0.0 || std::uniform_real_distribution<double>(0.0, 1.0)(m_random) >= m_config.m_loss) {
+        return false;
+    }
+    ++m_counters.m_lost;
+    return true;
+}
+
+// Process received frame
+void DeviceEmulator::process(const Frame& frame)
+{
+    // The frame is complete once it has passed the wire towards the device
+    Clock::time_point arrival = std::max(frame.m_time, m_inWireFree) + getWireTime(frame.m_data.size());
+    m_inWireFree = arrival;
+    if (isLost()) {
+        return;
+    }
+
+    uint8_t decoded[sizeof(SysEx::Message) + 255];
+    auto message = reinterpret_cast<SysEx::Message*>(decoded);
+    Status status;
+    auto sysEx = reinterpret_cast<const SysEx::SysExMessage*>(frame.m_data.data());
+    if (frame.m_data.size() < sizeof(SysEx::SysExMessage)
+            || !SysEx::fromSysEx(sysEx->m_device, *sysEx, *message, frame.m_data.size(), status)
+            || (message->m_type == SysEx::BlockType::RequestBlock && message->m_length < 1)) {
+        ++m_counters.m_invalid;
+        return;
+    }
+
+    if (message->m_type != SysEx::BlockType::RequestBlock) {
+        // Write block into device memory
+        auto block = m_blocks.find(InstrumentStore::getDeviceBlockKey(message->m_type, message->m_address));
+        if (block == m_blocks.end()) {
+            ++m_counters.m_unknown;
+            return;
+        }
+        memcpy(block->second.m_data, message->m_data, std::min(message->m_length, block->second.m_length));
+        ++m_counters.m_writes;
+        return;
+    }
+
+    ++m_counters.m_requests;
+    auto type = static_cast<SysEx::BlockType>(message->m_data[0]);
+    auto block = m_blocks.find(InstrumentStore::getDeviceBlockKey(type, message->m_address));
+    if (block == m_blocks.end()) {
+        ++m_counters.m_unknown;
+        return;
+    }
+
+    // Responses leave the device in order, each one after the latency and the previous response
+    Frame response;
+    SysEx::encode(m_device, block->second.m_type, block->second.m_address, block->second.m_data,
+                  block->second.m_length, response.m_data);
+    Clock::time_point ready = arrival + m_config.m_latency;
+    if (m_config.m_jitter.count() > 0) {
+        ready += std::chrono::microseconds(
+                     std::uniform_int_distribution<int64_t>(0, m_config.m_jitter.count())(m_random));
+    }
+    response.m_time = std::max(ready, m_outWireFree) + getWireTime(response.m_data.size());
+    m_outWireFree = response.m_time;
+    if (!isLost()) {
+        m_outbound.push_back(std::move(response));
+    }
+}
+
+// Worker thread main loop
+void DeviceEmulator::work()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        if (!m_inbound.empty()) {
+            process(m_inbound.front());
+            m_inbound.pop_front();
+            continue;
+        }
+        if (m_outbound.empty()) {
+            m_cond.wait(lock);
+            continue;
+        }
+        if (Clock::now() < m_outbound.front().m_time) {
+            m_cond.wait_until(lock, m_outbound.front().m_time);
+            continue;
+        }
+
+        // Deliver due response with the time since the previous one, like RtMidi does
+        Frame frame = std::move(m_outbound.front());
+        m_outbound.pop_front();
+        double timestamp = 0.0;
+        if (m_lastDelivery != Clock::time_point()) {
+            timestamp = std::chrono::duration<double>(frame.m_time - m_lastDelivery).count();
+        }
+        m_lastDelivery = frame.m_time;
+        lock.unlock();
+
+        bool delivered = false;
+        {
+            std::lock_guard<std::mutex> callbackLock(m_callbackMutex);
+            if (m_callback != nullptr) {
+                m_callback(timestamp, &frame.m_data, m_userData);
+                delivered = true;
+            }
+        }
+
+        lock.lock();
+        if (delivered) {
+            ++m_counters.m_responses;
+        }
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
+
+#endif // HAVE_RTMIDI
@@ -0,0 +1,256 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wersi/instrumentstore.hh>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_RTMIDI
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  In-process Wersi device emulator.
+
+  This class emulates a Wersi device like the DX10 or EX10R on the far side of a MIDI interface. Messages sent to its
+  output port through SysEx::send() are intercepted, block requests are answered from the blocks of an instrument
+  store acting as the device memory and received blocks are written into it. Responses are delivered on a worker
+  thread to a callback with the RtMidiIn callback signature, usually SysEx::rtMidiCallback() with a SysExQueue, so
+  device reads, uploads and transfers run unchanged against the emulator. Latency, jitter, wire byte rate and frame
+  loss are configurable, which makes the emulator usable for benchmarks and for testing without any MIDI hardware.
+
+  The block layout of the emulated device is taken from the store once on creation, the store must not be accessed
+  by other threads while the emulator exists.
+ */
+class DeviceEmulator {
+    public:
+        /// Emulated wire and device behaviour
+        struct Config {
+            /// Create configuration of an ideal device on a plain MIDI wire
+            Config();
+
+            std::chrono::microseconds   m_latency;  ///< Time from receiving a request to starting the response
+            std::chrono::microseconds   m_jitter;   ///< Maximum random delay added to the latency
+            uint32_t                    m_byteRate; ///< Wire byte rate in both directions, 0 for unlimited
+            double                      m_loss;     ///< Probability of losing a frame in either direction
+            uint32_t                    m_seed;     ///< Seed for jitter and loss, runs are reproducible
+        };
+
+        /// Emulator counters
+        struct Counters {
+            /// Create zero counters
+            Counters();
+
+            uint32_t    m_requests;                 ///< Block requests received
+            uint32_t    m_writes;                   ///< Blocks written to the device memory
+            uint32_t    m_responses;                ///< Responses delivered
+            uint32_t    m_lost;                     ///< Frames lost in either direction
+            uint32_t    m_invalid;                  ///< Frames that could not be decoded
+            uint32_t    m_unknown;                  ///< Requests and writes for blocks the device doesn't have
+        };
+
+        /**
+          Create new device emulator.
+
+          Creates an emulator of a device holding the blocks of the given store and starts its worker thread. If no
+          output port is given, the emulator intercepts its own port handle, see getOutPort().
+
+          @param[in]    store       Instrument store holding the emulated device memory
+          @param[in]    device      Device type used in responses
+          @param[in]    outPort     Output port to intercept, nullptr for the emulator's own port handle
+         */
+        DeviceEmulator(InstrumentStore& store, uint8_t device, RtMidiOut* outPort = nullptr);
+
+        /**
+          Destroy device emulator.
+
+          Stops intercepting the output port and stops the worker thread, undelivered responses are dropped.
+         */
+        ~DeviceEmulator();
+
+        /**
+          Get output port.
+
+          Returns the output port intercepted by the emulator. If no port has been given on creation, this is a
+          handle that may be passed to all functions of this library taking an output port, but must never be used
+          with RtMidi directly.
+
+          @return                   Output port
+         */
+        RtMidiOut* getOutPort() const {
+            return m_outPort;
+        }
+
+        /**
+          Set configuration.
+
+          Sets the emulated wire and device behaviour for all following frames and restarts the random sequence.
+
+          @param[in]    config      New configuration
+         */
+        void setConfig(const Config& config);
+
+        /**
+          Set response callback.
+
+          Sets the callback responses are delivered to from the worker thread, like RtMidiIn::setCallback().
+
+          @param[in]    callback    Response callback
+          @param[in]    userData    User data to pass to the callback
+         */
+        void setCallback(void(*callback)(double timestamp, std::vector<unsigned char>* message, void* userData),
+                         void* userData);
+
+        /**
+          Cancel response callback.
+
+          Removes the response callback, once this returns it is guaranteed not to be called any more. Responses
+          without a callback are dropped.
+         */
+        void cancelCallback();
+
+        /**
+          Get counters.
+
+          Returns a copy of the counters since creation.
+
+          @return                   Counters
+         */
+        Counters getCounters() const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;    ///< Clock used for all emulated timing
+
+        /// Frame in flight
+        struct Frame {
+            /// Create empty frame
+            Frame()
+                : m_time()
+                , m_data() {
+            }
+
+            Clock::time_point           m_time;     ///< Time the frame was sent or is due for delivery
+            std::vector<unsigned char>  m_data;     ///< Complete SysEx frame
+        };
+
+        InstrumentStore&            m_store;        ///< Emulated device memory
+        uint8_t                     m_device;       ///< Device type used in responses
+        RtMidiOut*                  m_outPort;      ///< Intercepted output port
+        InstrumentStore::DeviceBlockMap m_blocks;   ///< Device blocks by type and address
+        Config                      m_config;       ///< Emulated behaviour
+        std::mt19937                m_random;       ///< Random source for jitter and loss
+        Counters                    m_counters;     ///< Counters
+        std::deque<Frame>           m_inbound;      ///< Frames received, in sending order
+        std::deque<Frame>           m_outbound;     ///< Responses, in delivery order
+        Clock::time_point           m_inWireFree;   ///< Time the wire towards the device becomes free
+        Clock::time_point           m_outWireFree;  ///< Time the wire from the device becomes free
+        Clock::time_point           m_lastDelivery; ///< Time of the previous delivery, for RtMidi style timestamps
+        mutable std::mutex          m_mutex;        ///< Mutex protecting the members above
+        std::condition_variable     m_cond;         ///< Signalled when frames are received or on shutdown
+        bool                        m_stopping;     ///< Set when shutting down
+        /// Response callback
+        void (*m_callback)(double timestamp, std::vector<unsigned char>* message, void* userData);
+        void*                       m_userData;     ///< User data to pass to the response callback
+        std::mutex                  m_callbackMutex;    ///< Mutex held while calling and changing the callback
+        std::thread                 m_thread;       ///< Worker thread
+
+        /**
+          Loopback receiver.
+
+          Queues a frame sent to the intercepted port, called on the sending thread.
+
+          @param[in]    object      Emulator
+          @param[in]    message     Frame sent
+         */
+        static void receive(void* object, const std::vector<unsigned char>& message);
+
+        /**
+          Get wire time.
+
+          Returns the time the given number of bytes occupies the wire. Must be called with the mutex held.
+
+          @param[in]    size        Number of bytes
+
+          @return                   Wire time
+         */
+        Clock::duration getWireTime(size_t size) const;
+
+        /**
+          Check for frame loss.
+
+          Decides randomly if a frame is lost according to the configured probability and counts lost frames. Must
+          be called with the mutex held.
+
+          @return                   True if the frame is lost
+         */
+        bool isLost();
+
+        /**
+          Process received frame.
+
+          Answers a block request or writes a block into the device memory. Must be called with the mutex held.
+
+          @param[in]    frame       Frame received
+         */
+        void process(const Frame& frame);
+
+        /**
+          Worker thread main loop.
+
+          Processes received frames and delivers responses when due until the emulator is destroyed.
+         */
+        void work();
+
+        // Inhibit copying
+        DeviceEmulator(const DeviceEmulator&);
+        DeviceEmulator& operator=(const DeviceEmulator&);
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
+
+#endif // HAVE_RTMIDI
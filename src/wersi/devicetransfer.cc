@@ -0,0 +1,196 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/devicetransfer.hh>
+#include <wersi/bulkupload.hh>
+#include <exceptions.hh>
+#include <ctime>
+
+#ifdef HAVE_RTMIDI
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Number of ICBs re-read to validate cached device contents
+static const size_t s_spotCheckCount = 4;
+
+// Create new device read
+DeviceTransfer::DeviceTransfer(InstrumentStore& store, RtMidiIn* inPort, RtMidiOut* outPort,
+                               const DeviceCache::Entry* cached)
+    : m_store(store)
+    , m_inPort(inPort)
+    , m_outPort(outPort)
+    , m_type(Type::Read)
+    , m_upload()
+    , m_cacheEntry(cached != nullptr ? *cached : DeviceCache::Entry())
+    , m_useCache(cached != nullptr)
+    , m_fromCache(false)
+    , m_callback(nullptr)
+    , m_object(nullptr)
+    , m_reported(0)
+    , m_thread()
+    , m_running(false)
+    , m_cancel(false)
+    , m_current(0)
+    , m_max(0)
+    , m_error()
+{
+}
+
+// Create new device write
+DeviceTransfer::DeviceTransfer(InstrumentStore& store, RtMidiOut* outPort, uint8_t device, bool dirtyOnly)
+    : m_store(store)
+    , m_inPort(nullptr)
+    , m_outPort(outPort)
+    , m_type(Type::Write)
+    , m_upload(new BulkUpload(store, device, dirtyOnly))
+    , m_cacheEntry()
+    , m_useCache(false)
+    , m_fromCache(false)
+    , m_callback(nullptr)
+    , m_object(nullptr)
+    , m_reported(0)
+    , m_thread()
+    , m_running(false)
+    , m_cancel(false)
+    , m_current(0)
+    , m_max(0)
+    , m_error()
+{
+    m_upload->setVerify(true);
+}
+
+// Destroy device transfer
+DeviceTransfer::~DeviceTransfer()
+{
+    if (m_thread.joinable()) {
+        cancel();
+        m_thread.join();
+    }
+}
+
+// Start transfer
+void DeviceTransfer::start(void(*callback)(void* object, DeviceTransfer* transfer, bool done), void* object)
+{
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    m_cancel = false;
+    m_running = true;
+    m_thread = std::thread([this, callback, object]() {
+        run(callback, object);
+    });
+}
+
+// Run transfer
+void DeviceTransfer::run(void(*callback)(void* object, DeviceTransfer* transfer, bool done), void* object)
+{
+    m_callback = callback;
+    m_object = object;
+    m_reported = 0;
+    m_error = std::exception_ptr();
+    m_current = 0;
+    m_max = 0;
+    m_running = true;
+    try {
+        if (m_cancel) {
+            throw MidiException("Transfer cancelled");
+        }
+        if (m_type == Type::Read) {
+            m_fromCache = m_useCache && DeviceCache::spotCheck(m_cacheEntry, m_store, m_outPort, s_spotCheckCount,
+                                                               int64_t(time(nullptr)), progress, this);
+            if (!m_fromCache) {
+                m_store.readFromDevice(m_inPort, m_outPort, progress, this);
+                DeviceCache::describe(m_cacheEntry, m_store, int64_t(time(nullptr)));
+            }
+        }
+        else {
+            m_upload->run(m_outPort, progress, this);
+        }
+    }
+    catch (...) {
+        m_error = std::current_exception();
+    }
+    m_running = false;
+    if (m_callback != nullptr) {
+        m_callback(m_object, this, true);
+    }
+}
+
+// Cancel transfer
+void DeviceTransfer::cancel()
+{
+    m_cancel = true;
+
+    // Wake up a read waiting for responses, writes read back the blocks for verification, too
+    m_store.cancelRead();
+    if (m_upload) {
+        m_upload->cancel();
+    }
+}
+
+// Wait for transfer
+void DeviceTransfer::wait()
+{
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+}
+
+// Progress callback
+bool DeviceTransfer::progress(void* object, uint32_t current, uint32_t max)
+{
+    auto transfer = static_cast<DeviceTransfer*>(object);
+    transfer->m_current = current;
+    transfer->m_max = max;
+    uint32_t perMille = max > 0 ? uint32_t(uint64_t(current) * 1000 / max) : 0;
+    if (perMille != transfer->m_reported && transfer->m_callback != nullptr) {
+        transfer->m_reported = perMille;
+        transfer->m_callback(transfer->m_object, transfer, false);
+    }
+    return !transfer->m_cancel;
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
+
+#endif // HAVE_RTMIDI
@@ -0,0 +1,290 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wersi/instrumentstore.hh>
+#include <wersi/devicecache.hh>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+
+#ifdef HAVE_RTMIDI
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class BulkUpload;
+
+/**
+  @ingroup wersi_group
+
+  Background device transfer.
+
+  Reads the contents of an instrument store from a device or writes them to it on a worker thread, so the caller
+  stays responsive. Progress and completion are reported through a callback called from the worker thread, which is
+  expected to hand the notification over to the caller's own thread. Transfers of different instrument stores may
+  run at the same time, the store of a running transfer must not be accessed by other threads.
+ */
+class DeviceTransfer {
+    public:
+        /// Transfer direction
+        enum class Type {
+            Read,                                   ///< Read store contents from device
+            Write                                   ///< Write store contents to device
+        };
+
+        /**
+          Create new device read.
+
+          Creates a transfer reading all blocks of the instrument store from the device. If cached contents of the
+          device are given, they are copied and a spot check decides if they can be used instead of a full read.
+
+          @param[in]    store       Instrument store to read
+          @param[in]    inPort      MIDI input port
+          @param[in]    outPort     MIDI output port
+          @param[in]    cached      Cached device contents or nullptr
+         */
+        DeviceTransfer(InstrumentStore& store, RtMidiIn* inPort, RtMidiOut* outPort,
+                       const DeviceCache::Entry* cached = nullptr);
+
+        /**
+          Create new device write.
+
+          Creates a verified bulk upload of the instrument store to the device. The store contents are taken as a
+          snapshot here, so the write isn't affected by changes made while it is running.
+
+          @param[in]    store       Instrument store to write
+          @param[in]    outPort     MIDI output port
+          @param[in]    device      Device type to create messages for
+          @param[in]    dirtyOnly   Only write blocks changed since the last synchronization
+         */
+        DeviceTransfer(InstrumentStore& store, RtMidiOut* outPort, uint8_t device, bool dirtyOnly);
+
+        /**
+          Destroy device transfer.
+
+          Destroys the device transfer. A running transfer is cancelled and waited for.
+         */
+        ~DeviceTransfer();
+
+        /**
+          Get transfer direction.
+
+          Returns if this transfer reads or writes.
+
+          @return                   Transfer direction
+         */
+        Type getType() const {
+            return m_type;
+        }
+
+        /**
+          Get instrument store.
+
+          Returns the instrument store being transferred.
+
+          @return                   Instrument store
+         */
+        InstrumentStore& getStore() const {
+            return m_store;
+        }
+
+        /**
+          Start transfer.
+
+          Starts the transfer on a worker thread. The callback is called from the worker thread whenever the progress
+          advanced noticeably and once with done set when the transfer finished, successfully or not. The callback
+          must not call wait() or destroy the transfer.
+
+          @param[in]    callback    Notification callback
+          @param[in]    object      Object to pass to notification callback
+         */
+        void start(void(*callback)(void* object, DeviceTransfer* transfer, bool done), void* object);
+
+        /**
+          Run transfer.
+
+          Runs the transfer on the calling thread, which is what start() does on its worker thread. The callback is
+          called like for start() and may get notified about completion before run() returns. A transfer cancelled
+          before it is run fails right away.
+
+          @param[in]    callback    Notification callback
+          @param[in]    object      Object to pass to notification callback
+         */
+        void run(void(*callback)(void* object, DeviceTransfer* transfer, bool done), void* object);
+
+        /**
+          Cancel transfer.
+
+          Requests the running transfer to stop before the next block. It finishes with a MidiException then.
+         */
+        void cancel();
+
+        /**
+          Wait for transfer.
+
+          Waits until the transfer is finished. If it failed or has been cancelled, the exception is rethrown.
+         */
+        void wait();
+
+        /**
+          Get error.
+
+          Returns the error of the finished transfer, a null pointer if it succeeded. Unlike wait(), the error is
+          kept.
+
+          @return                   Transfer error
+         */
+        std::exception_ptr getError() const {
+            return m_error;
+        }
+
+        /**
+          Get MIDI output port.
+
+          Returns the MIDI output port used, which identifies the MIDI interface of the device.
+
+          @return                   MIDI output port
+         */
+        RtMidiOut* getOutPort() const {
+            return m_outPort;
+        }
+
+        /**
+          Get cache entry.
+
+          Returns the device contents as read by a successful read, to be stored in the device cache. Block timestamps
+          are updated for the blocks actually read.
+
+          @return                   Device cache entry
+         */
+        const DeviceCache::Entry& getCacheEntry() const {
+            return m_cacheEntry;
+        }
+
+        /**
+          Check for cached read.
+
+          Returns true if a successful read restored the cached contents after a spot check instead of reading all
+          blocks.
+
+          @return                   True if the cache has been used
+         */
+        bool isFromCache() const {
+            return m_fromCache;
+        }
+
+        /**
+          Check for running transfer.
+
+          Returns true while the worker thread is transferring data.
+
+          @return                   True if transfer is running
+         */
+        bool isRunning() const {
+            return m_running;
+        }
+
+        /**
+          Get progress.
+
+          Returns the current progress value, to be related to getMax().
+
+          @return                   Current progress value
+         */
+        uint32_t getCurrent() const {
+            return m_current;
+        }
+
+        /**
+          Get progress maximum.
+
+          Returns the maximum progress value, 0 if not known yet.
+
+          @return                   Maximum progress value
+         */
+        uint32_t getMax() const {
+            return m_max;
+        }
+
+    private:
+        InstrumentStore&            m_store;        ///< Instrument store to transfer
+        RtMidiIn*                   m_inPort;       ///< MIDI input port
+        RtMidiOut*                  m_outPort;      ///< MIDI output port
+        Type                        m_type;         ///< Transfer direction
+        std::unique_ptr<BulkUpload> m_upload;       ///< Bulk upload for writes
+        DeviceCache::Entry          m_cacheEntry;   ///< Cached device contents for reads
+        bool                        m_useCache;     ///< True if the cached contents should be spot checked
+        bool                        m_fromCache;    ///< True if the cached contents have been used
+
+        /// Notification callback
+        void                        (*m_callback)(void* object, DeviceTransfer* transfer, bool done);
+        void*                       m_object;       ///< Object to pass to notification callback
+        uint32_t                    m_reported;     ///< Progress in per mille last reported
+
+        std::thread                 m_thread;       ///< Worker thread
+        std::atomic<bool>           m_running;      ///< True while the worker is running
+        std::atomic<bool>           m_cancel;       ///< Set to cancel the transfer
+        std::atomic<uint32_t>       m_current;      ///< Current progress value
+        std::atomic<uint32_t>       m_max;          ///< Maximum progress value
+        std::exception_ptr          m_error;        ///< Error of the transfer
+
+        /**
+          Progress callback.
+
+          Records the progress reported by the store or bulk upload and notifies the caller if it advanced by at
+          least one per mille.
+
+          @param[in]    object      Device transfer
+          @param[in]    current     Current progress value
+          @param[in]    max         Maximum progress value
+
+          @return                   False if the transfer has been cancelled
+         */
+        static bool progress(void* object, uint32_t current, uint32_t max);
+
+        DeviceTransfer(const DeviceTransfer&);              ///< Inhibit copying objects
+        DeviceTransfer& operator=(const DeviceTransfer&);   ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
+
+#endif // HAVE_RTMIDI
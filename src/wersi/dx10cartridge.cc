@@ -36,141 +36,206 @@
  */
 
 #include <wersi/dx10cartridge.hh>
+#include <wersi/checksum.hh>
+#include <wersi/storeconverter.hh>
 #include <wersi/icb.hh>
 #include <wersi/vcf.hh>
 #include <wersi/envelope.hh>
 #include <wersi/wave.hh>
-#include <exceptions.hh>
 
 namespace DMSToolbox {
 namespace Wersi {
 
 // Create new DX10/DX5 cartridge object
-Dx10Cartridge::Dx10Cartridge(void* buffer, size_t size, bool /*initialize*/)
-    : InstrumentStore(buffer, size)
+Dx10Cartridge::Dx10Cartridge(void* buffer, size_t size, bool /*initialize*/, bool lazy)
+    : InstrumentStore(buffer, size, lazy)
 {
     dissect();
 }
 
+// Create new DX10/DX5 cartridge object without throwing on invalid data
+Dx10Cartridge::Dx10Cartridge(void* buffer, size_t size, bool lazy, Status& status)
+    : InstrumentStore(buffer, size, lazy)
+{
+    dissect(status);
+}
+
+// Create DX10/DX5 cartridge object, nullptr on invalid data
+Dx10Cartridge* Dx10Cartridge::create(void* buffer, size_t size, bool lazy, Status& status)
+{
+    status.clear();
+    Dx10Cartridge* cartridge = new Dx10Cartridge(buffer, size, lazy, status);
+    if (!status.isOk()) {
+        delete cartridge;
+        return nullptr;
+    }
+    return cartridge;
+}
+
 // Destroy DX10/DX5 cartridge object
 Dx10Cartridge::~Dx10Cartridge()
 {
 }
 
+// Probe raw data for DX10/DX5 cartridge image
+unsigned Dx10Cartridge::probe(const void* buffer, size_t size)
+{
+    auto data = static_cast<const uint8_t*>(buffer);
+    if (size != 8192 && size != 16384) {
+        return 0;
+    }
+
+    // Without any header, the presets/instruments checksum is the only hint
+    return Checksum::verify(data, 0x0f64, &(data[0x0f64]), 0x3131) ? 80 : 0;
+}
+
 // Dissect raw DX10/DX5 cartridge data
 void Dx10Cartridge::dissect()
+{
+    Status status;
+    if (!dissect(status)) {
+        status.raise();
+    }
+}
+
+// Dissect raw DX10/DX5 cartridge data without throwing
+bool Dx10Cartridge::dissect(Status& status)
 {
     clearLists();
 
-    try {
-        // Check size
-        if (m_size != 8192 && m_size != 16384) {
-            throw DataFormatException("invalid raw data size");
-        }
+    // Check size
+    if (m_size != 8192 && m_size != 16384) {
+        return status.fail(Status::Code::DataFormat, "Invalid DX10/DX5 cartridge, invalid raw data size");
+    }
 
-        // Verify presets/instruments checksum
-        uint16_t check = 0x3131;
-        for (size_t i = 0; i < 0x0f64; ++i) {
-            check += m_buffer[i];
-        }
-        uint16_t dummy = (m_buffer[0x0f64] << 8) | m_buffer[0x0f65];
-        dummy += check;
-        if (dummy != 0) {
-            throw DataFormatException("checksum verification for presets/instruments failed");
-        }
+    // Verify presets/instruments checksum
+    if (!Checksum::verify(m_buffer, 0x0f64, &(m_buffer[0x0f64]), 0x3131)) {
+        return status.fail(Status::Code::DataFormat,
+                           "Invalid DX10/DX5 cartridge, checksum verification for presets/instruments failed");
+    }
 
-        // Verify rhythms/sequences checksum
-        if (m_size > 8192) {
-            check = 0;
-            for (size_t i = 0x2000; i < 0x3ffe; ++i) {
-                check += m_buffer[i];
-            }
-            dummy = (m_buffer[0x3ffe] << 8) | m_buffer[0x3fff];
-            dummy += check;
-            if (dummy != 0) {
-                throw DataFormatException("checksum verification for rhythms/sequences failed");
-            }
-        }
+    // Verify rhythms/sequences checksum
+    if (m_size > 8192 && !Checksum::verify(&(m_buffer[0x2000]), 0x1ffe, &(m_buffer[0x3ffe]))) {
+        return status.fail(Status::Code::DataFormat,
+                           "Invalid DX10/DX5 cartridge, checksum verification for rhythms/sequences failed");
+    }
 
-        // Skip presets
-        size_t idx = 0;
-        for (size_t i = 0; i < 8; ++i) {
-            idx += 250;
+    // Reserve all blocks, so lazy loading never moves blocks already handed out
+    m_icb.reserve(IcbGroup::s_count);
+    m_vcf.reserve(VcfGroup::s_count);
+    m_ampl.reserve(AmplGroup::s_count);
+    m_freq.reserve(FreqGroup::s_count);
+    m_wave.reserve(WaveGroup::s_count);
+
+    // Extract ICBs after the presets
+    size_t idx = IcbGroup::s_offset;
+    for (size_t i = 0; i < 20; ++i) {
+        uint8_t addr = i + 194;
+        if (i >= 10) {
+            ++addr;
         }
+        Icb icb(addr, &(m_buffer[idx]));
+        m_icb.insert(std::pair<uint8_t, Icb>(addr, icb));
+        idx += IcbGroup::s_size;
+    }
 
-        // Extract ICBs
-        for (size_t i = 0; i < 20; ++i) {
-            uint8_t addr = i + 194;
-            if (i >= 10) {
-                ++addr;
-            }
-            Icb icb(addr, &(m_buffer[idx]));
-            m_icb.insert(std::pair<uint8_t, Icb>(addr, icb));
-            idx += 16;
-        }
+    // Extract all other blocks now, unless they are parsed on first access
+    if (!m_lazy) {
+        loadAll();
+    }
+    republishSnapshot();
+    return true;
+}
 
-        // Extract VCFs
-        for (size_t i = 0; i < 10; ++i) {
-            uint8_t addr = i + 193;
-            Vcf vcf(addr, &(m_buffer[idx]));
-            m_vcf.insert(std::pair<uint8_t, Vcf>(addr, vcf));
-            idx += 10;
-        }
+// Get index of block in a group of 20 blocks
+int Dx10Cartridge::getBlockIndex(uint8_t block, uint8_t first, size_t count)
+{
+    // Block numbers of second half skip one number
+    if (block >= first && block < first + 10) {
+        return block - first;
+    }
+    if (count > 10 && block > first + 10 && block <= first + count) {
+        return block - first - 1;
+    }
+    return -1;
+}
 
-        // Extract AMPLs
-        for (size_t i = 0; i < 20; ++i) {
-            uint8_t addr = i + 193;
-            if (i >= 10) {
-                ++addr;
-            }
-            Envelope ampl(addr, &(m_buffer[idx]), 44);
-            m_ampl.insert(std::pair<uint8_t, Envelope>(addr, ampl));
-            idx += 44;
+// Load all blocks
+void Dx10Cartridge::loadAll()
+{
+    for (size_t i = 0; i < 10; ++i) {
+        loadVcf(i + 193);
+    }
+    for (size_t i = 0; i < 20; ++i) {
+        uint8_t addr = i + 193;
+        if (i >= 10) {
+            ++addr;
         }
+        loadAmpl(addr);
+        loadFreq(addr);
+        loadWave(addr);
+    }
+}
 
-        // Extract FREQs
-        for (size_t i = 0; i < 20; ++i) {
-            uint8_t addr = i + 193;
-            if (i >= 10) {
-                ++addr;
-            }
-            Envelope freq(addr, &(m_buffer[idx]), 32);
-            m_freq.insert(std::pair<uint8_t, Envelope>(addr, freq));
-            idx += 32;
-        }
+// Load VCF
+void Dx10Cartridge::loadVcf(uint8_t block)
+{
+    int index = getBlockIndex(block, 193, 10);
+    if (index >= 0 && m_vcf.find(block) == m_vcf.end()) {
+        Vcf vcf(block, &(m_buffer[VcfGroup::s_offset + index * VcfGroup::s_size]));
+        m_vcf.insert(std::pair<uint8_t, Vcf>(block, vcf));
+    }
+}
 
-        // Check pointer correctness and skip checksum
-        if (idx != 0x0f64) {
-            throw DataFormatException("something went wrong extracting ICB, VCF, AMPL and FREQ");
-        }
-        idx += 2;
-
-        // Extract WAVEs
-        for (size_t i = 0; i < 20; ++i) {
-            uint8_t addr = i + 193;
-            if (i >= 10) {
-                ++addr;
-            }
-            Wave wave(addr, &(m_buffer[idx]), 212);
-            m_wave.insert(std::pair<uint8_t, Wave>(addr, wave));
-            idx += 212;
-        }
+// Load AMPL
+void Dx10Cartridge::loadAmpl(uint8_t block)
+{
+    int index = getBlockIndex(block, 193, 20);
+    if (index >= 0 && m_ampl.find(block) == m_ampl.end()) {
+        Envelope ampl(block, &(m_buffer[AmplGroup::s_offset + index * AmplGroup::s_size]), AmplGroup::s_size);
+        m_ampl.insert(std::pair<uint8_t, Envelope>(block, ampl));
+    }
+}
 
-        // Check pointer correctness
-        if (idx != 0x1ff6) {
-            throw DataFormatException("something went wrong extracting WAVE");
-        }
+// Load FREQ
+void Dx10Cartridge::loadFreq(uint8_t block)
+{
+    int index = getBlockIndex(block, 193, 20);
+    if (index >= 0 && m_freq.find(block) == m_freq.end()) {
+        Envelope freq(block, &(m_buffer[FreqGroup::s_offset + index * FreqGroup::s_size]), FreqGroup::s_size);
+        m_freq.insert(std::pair<uint8_t, Envelope>(block, freq));
     }
-    catch (DataFormatException& e) {
-        DataFormatException exc("Invalid DX10/DX5 cartridge, ");
-        exc << e.what();
-        throw e;
+}
+
+// Load WAVE
+void Dx10Cartridge::loadWave(uint8_t block)
+{
+    int index = getBlockIndex(block, 193, 20);
+    if (index >= 0 && m_wave.find(block) == m_wave.end()) {
+        Wave wave(block, &(m_buffer[WaveGroup::s_offset + index * WaveGroup::s_size]), WaveGroup::s_size);
+        m_wave.insert(std::pair<uint8_t, Wave>(block, wave));
     }
 }
 
+// Get block layout
+void Dx10Cartridge::getLayout(StoreLayout& layout) const
+{
+    StoreLayout::addSlots(layout.m_icb, 194, IcbGroup::s_count, IcbGroup::s_offset, IcbGroup::s_size);
+    StoreLayout::addSlots(layout.m_vcf, 193, VcfGroup::s_count, VcfGroup::s_offset, VcfGroup::s_size);
+    StoreLayout::addSlots(layout.m_ampl, 193, AmplGroup::s_count, AmplGroup::s_offset, AmplGroup::s_size);
+    StoreLayout::addSlots(layout.m_freq, 193, FreqGroup::s_count, FreqGroup::s_offset, FreqGroup::s_size);
+    StoreLayout::addSlots(layout.m_wave, 193, WaveGroup::s_count, WaveGroup::s_offset, WaveGroup::s_size);
+
+    // The waves are not covered by the presets/instruments checksum
+    StoreLayout::ChecksumRange checksum = { 0, 0x0f64, 0x0f64 };
+    layout.m_checksums.push_back(checksum);
+}
+
 // Put together and update DX10/DX5 cartridge raw data
 void Dx10Cartridge::update()
 {
+    // Only presets and instruments are covered by a checksum, waves are not
+    Checksum::adjust(&(m_buffer[0x0f64]), updateBlocks(0, 0x0f64));
 }
 
 } // namespace Wersi
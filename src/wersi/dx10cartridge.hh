@@ -38,6 +38,7 @@
 #pragma once
 
 #include <wersi/instrumentstore.hh>
+#include <wersi/blocklayout.hh>
 
 namespace DMSToolbox {
 namespace Wersi {
@@ -60,13 +61,17 @@ class Dx10Cartridge : public InstrumentStore {
           update() is called, the update() method of all contained objects is called to update their part of the
           buffer, then the cartridge raw buffer is updated with this new information.
 
+          In lazy mode, only the size, checksums and ICBs are checked and parsed during creation, all other blocks
+          are parsed on first access.
+
           @todo implement double buffering for this
 
           @param[in]    buffer      Raw data buffer
           @param[in]    size        Size of data buffer
           @param[in]    initialize  If true, a blank DX10/DX5 cartridge is created
+          @param[in]    lazy        If true, blocks are parsed on first access
          */
-        Dx10Cartridge(void* buffer, size_t size, bool initialize = false);
+        Dx10Cartridge(void* buffer, size_t size, bool initialize = false, bool lazy = false);
 
         /**
           Destroy DX10/DX5 cartridge object.
@@ -75,9 +80,36 @@ class Dx10Cartridge : public InstrumentStore {
          */
         virtual ~Dx10Cartridge();
 
+        /**
+          Create DX10/DX5 cartridge object without throwing.
+
+          Creates a new DX10/DX5 cartridge object like the constructor does, but reports invalid data in the given
+          status instead of throwing a DataFormatException, e.g. for scanning many files of unknown format. The
+          status is reset first, so it can be reused for any number of calls.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    size        Size of data buffer
+          @param[in]    lazy        If true, blocks are parsed on first access
+          @param[out]   status      Receives the error, if any
+
+          @return                   Newly created cartridge object to be deleted by the caller, nullptr on error
+         */
+        static Dx10Cartridge* create(void* buffer, size_t size, bool lazy, Status& status);
+
         /// Implements InstrumentStore::dissect()
         virtual void dissect();
 
+        /**
+          Dissect raw data without throwing.
+
+          Same as dissect(), but errors are reported in the given status instead of throwing a DataFormatException.
+
+          @param[out]   status      Receives the error, if any
+
+          @return                   True if the raw data has been dissected
+         */
+        bool dissect(Status& status);
+
         /// Implements InstrumentStore::update()
         virtual void update();
 
@@ -86,7 +118,74 @@ class Dx10Cartridge : public InstrumentStore {
             return 10;
         }
 
+        /// Implements InstrumentStore::getLayout()
+        virtual void getLayout(StoreLayout& layout) const;
+
+        /**
+          Probe raw data.
+
+          Checks if the given raw data looks like a DX10/DX5 cartridge image, without parsing it or throwing
+          exceptions. As the format has no header, the size and the presets/instruments checksum are checked.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    size        Size of raw data buffer
+
+          @return                   Confidence from 0 (not a DX10/DX5 image) to 100 (certainly a DX10/DX5 image)
+         */
+        static unsigned probe(const void* buffer, size_t size);
+
+    protected:
+        /// Implements InstrumentStore::loadAll()
+        virtual void loadAll();
+
+        /// Implements InstrumentStore::loadVcf()
+        virtual void loadVcf(uint8_t block);
+
+        /// Implements InstrumentStore::loadAmpl()
+        virtual void loadAmpl(uint8_t block);
+
+        /// Implements InstrumentStore::loadFreq()
+        virtual void loadFreq(uint8_t block);
+
+        /// Implements InstrumentStore::loadWave()
+        virtual void loadWave(uint8_t block);
+
     private:
+        /**
+          Create new DX10/DX5 cartridge object without throwing.
+
+          Used by create(), errors while parsing the buffer are reported in the given status.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    size        Size of data buffer
+          @param[in]    lazy        If true, blocks are parsed on first access
+          @param[out]   status      Receives the error, if any
+         */
+        Dx10Cartridge(void* buffer, size_t size, bool lazy, Status& status);
+
+        typedef GroupLayout<SysEx::BlockType::IcBlock, 8 * 250, 20> IcbGroup;               ///< ICBs, after 8 presets
+        typedef GroupLayout<SysEx::BlockType::VcfBlock, IcbGroup::s_end, 10> VcfGroup;      ///< VCFs
+        typedef GroupLayout<SysEx::BlockType::AmplBlock, VcfGroup::s_end, 20> AmplGroup;    ///< AMPLs
+        typedef GroupLayout<SysEx::BlockType::FreqBlock, AmplGroup::s_end, 20> FreqGroup;   ///< FREQs
+        typedef GroupLayout<SysEx::BlockType::FixWaveBlock, 0x0f66, 20> WaveGroup;          ///< WAVEs, after checksum
+
+        static_assert(FreqGroup::s_end == 0x0f64, "ICB, VCF, AMPL and FREQ must end at checksum");
+        static_assert(WaveGroup::s_end == 0x1ff6, "WAVE must end before 8 KB boundary");
+
+        /**
+          Get block index.
+
+          Returns the index of a block within its group, taking the gap in the block numbers between the first and
+          second ten blocks into account.
+
+          @param[in]    block       Block number
+          @param[in]    first       First block number of group
+          @param[in]    count       Number of blocks in group
+
+          @return                   Block index or -1 if block is not part of group
+         */
+        static int getBlockIndex(uint8_t block, uint8_t first, size_t count);
+
         Dx10Cartridge(const Dx10Cartridge&);            ///< Inhibit copying objects
         Dx10Cartridge& operator=(const Dx10Cartridge&); ///< Inhibit copying objects
 };
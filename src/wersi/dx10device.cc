@@ -41,9 +41,10 @@
 #include <wersi/envelope.hh>
 #include <wersi/wave.hh>
 #include <wersi/sysex.hh>
+#include <wersi/storeconverter.hh>
 #include <exceptions.hh>
+#include <logger.hh>
 #include <cstring>
-#include <unistd.h>
 
 #ifdef HAVE_RTMIDI
 #include <RtMidi.h>
@@ -52,13 +53,26 @@
 namespace DMSToolbox {
 namespace Wersi {
 
+// Raw data buffer size, defined here as it is bound to references
+const size_t Dx10Device::s_bufferSize;
+
+// MIDI wire time per byte (31250 baud, 10 bits per byte) and response timeout limits
+const std::chrono::microseconds Dx10Device::s_byteTime(320);
+const std::chrono::microseconds Dx10Device::s_minTimeout(20000);
+const std::chrono::microseconds Dx10Device::s_maxTimeout(2000000);
+
 // Create new DX10/EX10R device object
 Dx10Device::Dx10Device(void* buffer, size_t size)
     : InstrumentStore(buffer, size)
-    , m_awaitType(0)
-    , m_awaitAddress(0)
-    , m_awaitLength(0)
-    , m_awaitDestination(nullptr)
+    , m_requests()
+    , m_requestMutex()
+    , m_requestCond()
+    , m_readWindow(4)
+    , m_cancelRead(false)
+    , m_sendBuffer()
+    , m_rttEstimate(50000)
+    , m_rttDeviation(25000)
+    , m_stats()
 {
     // Initialize ICBs
     memset(buffer, 0, size);
@@ -78,9 +92,10 @@ Dx10Device::Dx10Device(void* buffer, size_t size)
         ptr[13] = ' ';
         ptr[14] = ' ';
         ptr[15] = ' ';
-        ptr += 16;
+        ptr += IcbGroup::s_size;
     }
 
+    m_sendBuffer.reserve(SysEx::s_maxMessageSize);
     dissect();
 }
 
@@ -90,158 +105,230 @@ Dx10Device::~Dx10Device()
 }
 
 #ifdef HAVE_RTMIDI
-void Dx10Device::readBlock(RtMidiOut* outPort, SysEx::BlockType type, uint8_t address, uint8_t* ptr, uint8_t length)
+// Send block request message
+void Dx10Device::sendRequest(RtMidiOut* outPort, const BlockRequest& request)
+{
+    SysEx::encode(1, SysEx::BlockType::RequestBlock, request.m_address, &request.m_type, 1, m_sendBuffer);
+    SysEx::send(outPort, m_sendBuffer);
+}
+
+// Run block requests
+void Dx10Device::runRequests(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max),
+                             void* object)
 {
-    // Generate request message
-    SysEx::Message msg;
-    msg.m_type = SysEx::BlockType::RequestBlock;
-    msg.m_address = address;
-    msg.m_length = 1;
-    msg.m_data[0] = static_cast<uint8_t>(type);
-    unsigned char buf[sizeof(SysEx::SysExMessage) + 2];
-    auto sem = reinterpret_cast<SysEx::SysExMessage*>(buf);
-    size_t len = SysEx::toSysEx(1, msg, *sem);
-
-    // Set awaiting information
-    m_awaitType = msg.m_data[0];
-    m_awaitAddress = address;
-    m_awaitLength = length;
-    m_awaitDestination = ptr;
-    
-    printf("INFO: Awaiting message, (type %u, addr %u, len %u)\n",
-        (uint8_t)m_awaitType,
-        m_awaitAddress,
-        m_awaitLength
-    );
-
-    // Send request message
-    std::vector<unsigned char> midi;
-    for (size_t i = 0; i < len; ++i) {
-        midi.push_back(buf[i]);
+    const size_t maxRetries = 10;
+
+    std::vector<size_t> send;
+    send.reserve(m_requests.size());
+    uint32_t total = 0;
+    for (auto& i : m_requests) {
+        total += i.m_length;
     }
+    uint32_t reported = ~uint32_t(0);
+    std::unique_lock<std::mutex> lock(m_requestMutex);
+    while (true) {
+        if (m_cancelRead) {
+            m_requests.clear();
+            throw MidiException("Reading from device aborted");
+        }
+        auto now = std::chrono::steady_clock::now();
+
+        // Responses of all requests in flight share the wire, so allow for their transmission time
+        uint32_t done = 0;
+        size_t inFlight = 0;
+        size_t wireBytes = 0;
+        for (auto& i : m_requests) {
+            if (i.m_state == RequestState::InFlight) {
+                ++inFlight;
+                wireBytes += sizeof(SysEx::SysExMessage) + 2 * i.m_length;
+            }
+            else if (i.m_state == RequestState::Done) {
+                done += i.m_length;
+            }
+        }
+        auto timeout = getResponseTimeout() + s_byteTime * std::chrono::microseconds::rep(wireBytes);
+
+        // Resend only timed out requests, backing off exponentially on each retry
+        auto deadline = now + timeout;
+        for (size_t i = 0; i < m_requests.size(); ++i) {
+            auto& req = m_requests[i];
+            if (req.m_state != RequestState::InFlight) {
+                continue;
+            }
+            auto expires = req.m_sent + timeout * (1 << (req.m_retries < 4 ? req.m_retries : 4));
+            if (now >= expires) {
+                if (req.m_retries >= maxRetries) {
+                    m_requests.clear();
+                    throw MidiException("Did not receive expected data from device");
+                }
+                DMS_LOG(Debug, "Resending (type %u, addr %u, len %u)", req.m_type, req.m_address, req.m_length);
+                m_stats.recordResend(SysEx::BlockType(req.m_type));
+                ++req.m_retries;
+                req.m_sent = now;
+                send.push_back(i);
+            }
+            else if (expires < deadline) {
+                deadline = expires;
+            }
+        }
 
-    // Wait for response
-    size_t retry = 0;
-    while (retry < 200) {
-        usleep(50000);
-        if (m_awaitDestination == nullptr) {
+        // Fill up request window
+        for (size_t i = 0; i < m_requests.size() && inFlight < m_readWindow; ++i) {
+            auto& req = m_requests[i];
+            if (req.m_state == RequestState::Queued) {
+                m_stats.recordRequest(SysEx::BlockType(req.m_type));
+                req.m_state = RequestState::InFlight;
+                req.m_sent = now;
+                send.push_back(i);
+                ++inFlight;
+            }
+        }
+        if (inFlight == 0) {
             break;
-        } else {
-            // Resend
-            printf("WARNING: Resending\n");
-            outPort->sendMessage(&midi);
         }
+
+        // Send requests and report progress outside of lock, request list is not resized while reading
+        if (!send.empty() || done != reported) {
+            lock.unlock();
+            for (auto i : send) {
+                sendRequest(outPort, m_requests[i]);
+            }
+            send.clear();
+            bool cont = true;
+            if (callback != nullptr && done != reported) {
+                cont = callback(object, done, total);
+            }
+            reported = done;
+            lock.lock();
+            if (!cont) {
+                m_requests.clear();
+                throw MidiException("Reading from device aborted");
+            }
+            continue;
+        }
+
+        // Sleep until a response arrives or the next request times out
+        m_requestCond.wait_until(lock, deadline);
+    }
+    m_requests.clear();
+}
+#endif // HAVE_RTMIDI
+
+// Get response timeout
+std::chrono::microseconds Dx10Device::getResponseTimeout() const
+{
+    auto timeout = m_rttEstimate + 4 * m_rttDeviation;
+    if (timeout < s_minTimeout) {
+        return s_minTimeout;
     }
-    if (m_awaitDestination != nullptr) {
-        m_awaitDestination = nullptr;
-        throw MidiException("Did not receive expected data from device");
+    if (timeout > s_maxTimeout) {
+        return s_maxTimeout;
     }
+    return timeout;
 }
 
-// SysEx message callback
-void Dx10Device::receivedSysEx(std::vector<unsigned char>* message)
+// Update round trip time estimate
+void Dx10Device::updateRoundTrip(std::chrono::microseconds sample)
 {
-    // Check if we are awaiting a message
-    if (m_awaitDestination == nullptr) {
-        return;
+    // Smoothed estimate and mean deviation as used for TCP retransmission timeouts (RFC 6298)
+    auto error = sample - m_rttEstimate;
+    m_rttEstimate += error / 8;
+    if (error.count() < 0) {
+        error = -error;
     }
+    m_rttDeviation += (error - m_rttDeviation) / 4;
+}
 
-    // If message is not too large, take it apart
-    if (message->size() <= 512) {
-        auto buf = new unsigned char[512];
-        uint8_t* p = buf;
-        for (auto& i : *message) {
-            *p = i;
-            ++p;
-        }
-        try {
-            auto sem = reinterpret_cast<SysEx::SysExMessage*>(buf);
-            auto out = reinterpret_cast<SysEx::Message*>(buf);
-            SysEx::fromSysEx(1, *sem, *out);
-
-            // If this is what we expect, use it
-            if (static_cast<uint8_t>(out->m_type) == m_awaitType &&
-                    out->m_address == m_awaitAddress && out->m_length == m_awaitLength) {
-                printf("INFO: Got message\n");
-                memcpy(m_awaitDestination, out->m_data, m_awaitLength);
-                m_awaitDestination = nullptr;
-            } else {
-                printf("WARNING: Invalid message, got (type %u, addr %u, len %u) expected (type %u, addr %u, len %u)\n",
-                  (uint8_t)out->m_type,
-                  out->m_address,
-                  out->m_length,
-                  (uint8_t)m_awaitType,
-                  m_awaitAddress,
-                  m_awaitLength
-                );
+// SysEx message callback
+void Dx10Device::receivedSysEx(const SysEx::Message& message)
+{
+    // Look up matching outstanding request and use it
+    std::lock_guard<std::mutex> lock(m_requestMutex);
+    bool found = false;
+    for (auto& i : m_requests) {
+        if (i.m_state == RequestState::InFlight && static_cast<uint8_t>(message.m_type) == i.m_type &&
+                message.m_address == i.m_address && message.m_length == i.m_length) {
+            memcpy(i.m_destination, message.m_data, i.m_length);
+            i.m_state = RequestState::Done;
+            found = true;
+
+            // Responses to resent requests can't be assigned to a request message, don't use their latency
+            auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - i.m_sent);
+            m_stats.recordResponse(message.m_type, i.m_length, rtt, i.m_retries == 0);
+            if (i.m_retries == 0) {
+                auto bytes = sizeof(SysEx::SysExMessage) + 2 * i.m_length;
+                auto wire = s_byteTime * std::chrono::microseconds::rep(bytes);
+                updateRoundTrip(rtt > wire ? rtt - wire : std::chrono::microseconds(0));
             }
-            delete[] buf;
-        }
-        catch (...) {
-            delete[] buf;
-            throw;
+            break;
         }
     }
+    if (found) {
+        m_requestCond.notify_one();
+    }
+    else if (!m_requests.empty()) {
+        DMS_LOG(Info, "Unexpected message (type %u, addr %u, len %u)", static_cast<uint8_t>(message.m_type),
+                message.m_address, message.m_length);
+        m_stats.recordUnexpected();
+    }
 }
 
+#ifdef HAVE_RTMIDI
 // Read instrument store contents from device
 void Dx10Device::readFromDevice(RtMidiIn* /*inPort*/, RtMidiOut* outPort,
                                 bool(*callback)(void* object, uint32_t current, uint32_t max), void* object)
 {
-    uint8_t* ptr = m_buffer;
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + 66;
-        if (i >= 10) {
-            ++addr;
-        }
-        if (callback != nullptr) {
-            callback(object, ptr - m_buffer, m_size);
-        }
-        readBlock(outPort, SysEx::BlockType::IcBlock, addr, ptr, 16);
-        ptr += 16;
+    std::vector<DeviceBlock> blocks;
+    getDeviceBlocks(blocks);
+    clearSynced();
+    m_journal.clear();
+    try {
+        readBlocks(outPort, blocks, callback, object);
     }
-    for (size_t i = 0; i < 10; ++i) {
-        uint8_t addr = i + 65;
-        if (callback != nullptr) {
-            callback(object, ptr - m_buffer, m_size);
-        }
-        readBlock(outPort, SysEx::BlockType::VcfBlock, addr, ptr, 10);
-        ptr += 10;
+    catch (...) {
+        // Part of the blocks may have been received already, keep the objects consistent with the buffer
+        dissect();
+        throw;
     }
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + 65;
-        if (i >= 10) {
-            ++addr;
-        }
-        if (callback != nullptr) {
-            callback(object, ptr - m_buffer, m_size);
+    dissect();
+    markSynced();
+}
+
+// Read blocks from device
+void Dx10Device::readBlocks(RtMidiOut* outPort, const std::vector<DeviceBlock>& blocks,
+                            bool(*callback)(void* object, uint32_t current, uint32_t max), void* object)
+{
+    // Queue requests for all blocks
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        m_requests.clear();
+        m_cancelRead = false;
+        for (auto& i : blocks) {
+            m_requests.push_back(BlockRequest(static_cast<uint8_t>(i.m_type), i.m_address, i.m_length, i.m_data));
         }
-        readBlock(outPort, SysEx::BlockType::AmplBlock, addr, ptr, 44);
-        ptr += 44;
     }
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + 65;
-        if (i >= 10) {
-            ++addr;
-        }
-        if (callback != nullptr) {
-            callback(object, ptr - m_buffer, m_size);
-        }
-        readBlock(outPort, SysEx::BlockType::FreqBlock, addr, ptr, 32);
-        ptr += 32;
+
+    // Failed reads count as busy time, too
+    auto start = std::chrono::steady_clock::now();
+    try {
+        runRequests(outPort, callback, object);
     }
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + 65;
-        if (i >= 10) {
-            ++addr;
-        }
-        if (callback != nullptr) {
-            callback(object, ptr - m_buffer, m_size);
-        }
-        readBlock(outPort, SysEx::BlockType::FixWaveBlock, addr, ptr, 212);
-        ptr += 212;
+    catch (...) {
+        m_stats.recordBusy(std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - start));
+        throw;
     }
-    dissect();
+    m_stats.recordBusy(std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - start));
+}
+
+// Cancel reading from device
+void Dx10Device::cancelRead()
+{
+    std::lock_guard<std::mutex> lock(m_requestMutex);
+    m_cancelRead = true;
+    m_requestCond.notify_one();
 }
 #endif // HAVE_RTMIDI
 
@@ -251,6 +338,13 @@ void Dx10Device::dissect()
     clearLists();
 
     try {
+        // Reserve all blocks at once
+        m_icb.reserve(IcbGroup::s_count);
+        m_vcf.reserve(VcfGroup::s_count);
+        m_ampl.reserve(AmplGroup::s_count);
+        m_freq.reserve(FreqGroup::s_count);
+        m_wave.reserve(WaveGroup::s_count);
+
         // Extract ICBs
         size_t idx = 0;
         for (size_t i = 0; i < 20; ++i) {
@@ -260,7 +354,7 @@ void Dx10Device::dissect()
             }
             Icb icb(addr, &(m_buffer[idx]));
             m_icb.insert(std::pair<uint8_t, Icb>(addr, icb));
-            idx += 16;
+            idx += IcbGroup::s_size;
         }
 
         // Extract VCFs
@@ -268,7 +362,7 @@ void Dx10Device::dissect()
             uint8_t addr = i + 65;
             Vcf vcf(addr, &(m_buffer[idx]));
             m_vcf.insert(std::pair<uint8_t, Vcf>(addr, vcf));
-            idx += 10;
+            idx += VcfGroup::s_size;
         }
 
         // Extract AMPLs
@@ -277,9 +371,9 @@ void Dx10Device::dissect()
             if (i >= 10) {
                 ++addr;
             }
-            Envelope ampl(addr, &(m_buffer[idx]), 44);
+            Envelope ampl(addr, &(m_buffer[idx]), AmplGroup::s_size);
             m_ampl.insert(std::pair<uint8_t, Envelope>(addr, ampl));
-            idx += 44;
+            idx += AmplGroup::s_size;
         }
 
         // Extract FREQs
@@ -288,9 +382,9 @@ void Dx10Device::dissect()
             if (i >= 10) {
                 ++addr;
             }
-            Envelope freq(addr, &(m_buffer[idx]), 32);
+            Envelope freq(addr, &(m_buffer[idx]), FreqGroup::s_size);
             m_freq.insert(std::pair<uint8_t, Envelope>(addr, freq));
-            idx += 32;
+            idx += FreqGroup::s_size;
         }
 
         // Extract WAVEs
@@ -299,9 +393,9 @@ void Dx10Device::dissect()
             if (i >= 10) {
                 ++addr;
             }
-            Wave wave(addr, &(m_buffer[idx]), 212);
+            Wave wave(addr, &(m_buffer[idx]), WaveGroup::s_size);
             m_wave.insert(std::pair<uint8_t, Wave>(addr, wave));
-            idx += 212;
+            idx += WaveGroup::s_size;
         }
     }
     catch (DataFormatException& e) {
@@ -309,11 +403,23 @@ void Dx10Device::dissect()
         exc << e.what();
         throw e;
     }
+    republishSnapshot();
+}
+
+// Get block layout
+void Dx10Device::getLayout(StoreLayout& layout) const
+{
+    StoreLayout::addSlots(layout.m_icb, 66, IcbGroup::s_count, IcbGroup::s_offset, IcbGroup::s_size);
+    StoreLayout::addSlots(layout.m_vcf, 65, VcfGroup::s_count, VcfGroup::s_offset, VcfGroup::s_size);
+    StoreLayout::addSlots(layout.m_ampl, 65, AmplGroup::s_count, AmplGroup::s_offset, AmplGroup::s_size);
+    StoreLayout::addSlots(layout.m_freq, 65, FreqGroup::s_count, FreqGroup::s_offset, FreqGroup::s_size);
+    StoreLayout::addSlots(layout.m_wave, 65, WaveGroup::s_count, WaveGroup::s_offset, WaveGroup::s_size);
 }
 
 // Put together and update DX10/DX5 cartridge raw data
 void Dx10Device::update()
 {
+    updateBlocks(0, 0);
 }
 
 } // namespace Wersi
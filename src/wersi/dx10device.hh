@@ -38,7 +38,13 @@
 #pragma once
 
 #include <wersi/instrumentstore.hh>
+#include <wersi/blocklayout.hh>
 #include <wersi/sysex.hh>
+#include <wersi/transferstats.hh>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
 
 namespace DMSToolbox {
 namespace Wersi {
@@ -53,6 +59,9 @@ namespace Wersi {
  */
 class Dx10Device : public InstrumentStore {
     public:
+        /// Size of the raw data buffer
+        static const size_t s_bufferSize = 6180;
+
         /**
           Create new DX10/EX10R device object from buffer.
 
@@ -76,10 +85,22 @@ class Dx10Device : public InstrumentStore {
         virtual void readFromDevice(RtMidiIn* inPort, RtMidiOut* outPort,
                                     bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
 
-        /// Implements InstrumentStore::receivedSysEx()
-        virtual void receivedSysEx(std::vector<unsigned char>* message);
+        /// Implements InstrumentStore::readBlocks()
+        virtual void readBlocks(RtMidiOut* outPort, const std::vector<DeviceBlock>& blocks,
+                                bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+
+        /// Implements InstrumentStore::cancelRead()
+        virtual void cancelRead();
 #endif // HAVE_RTMIDI
 
+        /// Implements InstrumentStore::getStats()
+        virtual TransferStats* getStats() {
+            return &m_stats;
+        }
+
+        /// Implements InstrumentStore::receivedSysEx()
+        virtual void receivedSysEx(const SysEx::Message& message);
+
         /// Implements InstrumentStore::dissect()
         virtual void dissect();
 
@@ -91,25 +112,135 @@ class Dx10Device : public InstrumentStore {
             return 10;
         }
 
+        /// Implements InstrumentStore::getLayout()
+        virtual void getLayout(StoreLayout& layout) const;
+
+        /**
+          Get read window size.
+
+          Returns the maximum number of block requests kept in flight while reading from the device.
+
+          @return                   Read window size
+         */
+        size_t getReadWindow() const {
+            return m_readWindow;
+        }
+
+        /**
+          Set read window size.
+
+          Sets the maximum number of block requests kept in flight while reading from the device. A window size of 1
+          reads all blocks strictly one after the other, which is what slow or buffer-limited MIDI interfaces may
+          need. Values of 0 are treated as 1.
+
+          @param[in]    window      Read window size
+         */
+        void setReadWindow(size_t window) {
+            m_readWindow = window > 0 ? window : 1;
+        }
+
     private:
-        uint8_t     m_awaitType;                    ///< Awaiting SysEx message block type
-        uint8_t     m_awaitAddress;                 ///< Awaiting SysEx message block address
-        uint8_t     m_awaitLength;                  ///< Awaiting SysEx message block length
-        uint8_t*    m_awaitDestination;             ///< Awaiting SysEx message destination buffer
+        typedef GroupLayout<SysEx::BlockType::IcBlock, 0, 20> IcbGroup;                     ///< ICBs
+        typedef GroupLayout<SysEx::BlockType::VcfBlock, IcbGroup::s_end, 10> VcfGroup;      ///< VCFs
+        typedef GroupLayout<SysEx::BlockType::AmplBlock, VcfGroup::s_end, 20> AmplGroup;    ///< AMPLs
+        typedef GroupLayout<SysEx::BlockType::FreqBlock, AmplGroup::s_end, 20> FreqGroup;   ///< FREQs
+        typedef GroupLayout<SysEx::BlockType::FixWaveBlock, FreqGroup::s_end, 20> WaveGroup;    ///< WAVEs
+
+        static_assert(WaveGroup::s_end == s_bufferSize, "Blocks must fill the raw data buffer");
+
+        /// Block read request state
+        enum class RequestState {
+            Queued,                                 ///< Not yet requested from device
+            InFlight,                               ///< Requested, awaiting response
+            Done                                    ///< Response received and stored
+        };
+
+        /// Pending block read request
+        struct BlockRequest {
+            /// Create queued block request for given block and destination buffer
+            BlockRequest(uint8_t type, uint8_t address, uint8_t length, uint8_t* destination)
+                : m_type(type)
+                , m_address(address)
+                , m_length(length)
+                , m_destination(destination)
+                , m_state(RequestState::Queued)
+                , m_retries(0)
+                , m_sent() {
+            }
+
+            uint8_t         m_type;                 ///< Requested block type
+            uint8_t         m_address;              ///< Requested block address
+            uint8_t         m_length;               ///< Requested block length
+            uint8_t*        m_destination;          ///< Destination buffer for block data
+            RequestState    m_state;                ///< Request state
+            size_t          m_retries;              ///< Number of times the request has been resent
+
+            /// Time the request has been sent last
+            std::chrono::steady_clock::time_point   m_sent;
+        };
+
+        std::vector<BlockRequest>   m_requests;     ///< Block read requests of a running read
+        std::mutex                  m_requestMutex; ///< Mutex protecting m_requests against the MIDI callback
+        std::condition_variable     m_requestCond;  ///< Signalled by the MIDI callback when a request completed
+        size_t                      m_readWindow;   ///< Maximum number of block requests in flight
+        bool                        m_cancelRead;   ///< Set to cancel the running read, protected by m_requestMutex
+        std::vector<unsigned char>  m_sendBuffer;   ///< Reusable buffer for request messages
+
+        std::chrono::microseconds   m_rttEstimate;  ///< Smoothed device response latency
+        std::chrono::microseconds   m_rttDeviation; ///< Mean deviation of device response latency
+        TransferStats               m_stats;        ///< Transfer statistics
+
+        static const std::chrono::microseconds s_byteTime;      ///< MIDI wire time per byte
+        static const std::chrono::microseconds s_minTimeout;    ///< Lower limit for response timeout
+        static const std::chrono::microseconds s_maxTimeout;    ///< Upper limit for response timeout
+
+        /**
+          Get response timeout.
+
+          Returns the time to wait for a response before a request is resent, not including the wire time of the
+          response itself. The timeout is derived from the running estimate of the device's response latency.
+          Must be called with m_requestMutex held.
+
+          @return                   Response timeout
+         */
+        std::chrono::microseconds getResponseTimeout() const;
+
+        /**
+          Update round trip time estimate.
+
+          Updates the running estimate of the device's response latency with a new sample. Must be called with
+          m_requestMutex held.
+
+          @param[in]    sample      Measured response latency, excluding the response wire time
+         */
+        void updateRoundTrip(std::chrono::microseconds sample);
 
 #ifdef HAVE_RTMIDI
         /**
-          Read data block from device.
+          Run block requests.
+
+          Reads all data blocks listed in m_requests from the device. Up to m_readWindow requests are kept in flight,
+          the responses are received via callback and matched against the outstanding requests by block type, address
+          and length. The callback signals each completed request, so the read continues as soon as the data arrived.
+          Requests that are not answered within an adaptive timeout are resent. If a block could not be read after
+          several retries, an exception is thrown.
+
+          @param[in]    outPort     MIDI output port to send requests to
+          @param[in]    callback    Callback for progress display, may return false to abort
+          @param[in]    object      Object to pass to progress display callback
+         */
+        void runRequests(RtMidiOut* outPort, bool(*callback)(void* object, uint32_t current, uint32_t max),
+                         void* object);
+
+        /**
+          Send block request.
 
-          Reads the requested data block from the device. Request message is generated here, the response is received
-          via callback. If no response is received within a given timeout, an exception is thrown.
+          Sends the request message for the given block request to the device.
 
           @param[in]    outPort     MIDI output port to send request to
-          @param[in]    type        Block type
-          @param[in]    address     Block address
-          @param[in]    length      Block length
+          @param[in]    request     Block request to send
          */
-        void readBlock(RtMidiOut* outPort, SysEx::BlockType type, uint8_t address, uint8_t* ptr, uint8_t length);
+        void sendRequest(RtMidiOut* outPort, const BlockRequest& request);
 #endif // HAVE_RTMIDI
 
         Dx10Device(const Dx10Device&);              ///< Inhibit copying objects
@@ -0,0 +1,194 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+#include <wersi/editjournal.hh>
+#include <exceptions.hh>
+#include <algorithm>
+#include <cstring>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create new journal
+EditJournal::EditJournal(size_t limit)
+    : m_edits()
+    , m_arena()
+    , m_position(0)
+    , m_limit(limit)
+    , m_sealed(true)
+    , m_pending()
+    , m_old()
+{
+}
+
+// Destroy journal
+EditJournal::~EditJournal()
+{
+}
+
+// Begin edit
+void EditJournal::begin(SysEx::BlockType type, uint8_t block, uint32_t group, const uint8_t* data, size_t offset,
+                        size_t length)
+{
+    if (length > sizeof(m_old)) {
+        throw DataFormatException("Block too large for edit journal");
+    }
+    m_pending.m_type = type;
+    m_pending.m_block = block;
+    m_pending.m_group = group;
+    m_pending.m_offset = offset;
+    m_pending.m_length = length;
+    m_pending.m_data = 0;
+    memcpy(m_old, data, length);
+}
+
+// End edit
+const EditJournal::Edit* EditJournal::end(const uint8_t* data)
+{
+    // Find changed span
+    size_t first = 0;
+    while (first < m_pending.m_length && data[first] == m_old[first]) {
+        ++first;
+    }
+    if (first == m_pending.m_length) {
+        return nullptr;
+    }
+    size_t last = m_pending.m_length;
+    while (data[last - 1] == m_old[last - 1]) {
+        --last;
+    }
+
+    // A new edit makes all undone edits unreachable
+    if (m_position < m_edits.size()) {
+        m_arena.resize(m_edits[m_position].m_data);
+        m_edits.resize(m_position);
+    }
+
+    Edit* top = m_position > 0 ? &(m_edits[m_position - 1]) : nullptr;
+    if (top != nullptr && !m_sealed && m_pending.m_group != 0 && top->m_group == m_pending.m_group
+            && top->m_type == m_pending.m_type && top->m_block == m_pending.m_block) {
+        // Coalesce with the previous edit of the same block, which is the last one in the arena, its old bytes
+        // take precedence, all other bytes of the merged span have not been changed by it
+        size_t begin = std::min(top->m_offset - m_pending.m_offset, first);
+        size_t end = std::max(top->m_offset + top->m_length - m_pending.m_offset, last);
+        uint8_t merged[2 * sizeof(m_old)];
+        memcpy(merged, m_old + begin, end - begin);
+        memcpy(merged + (top->m_offset - m_pending.m_offset - begin), &(m_arena[top->m_data]), top->m_length);
+        memcpy(merged + (end - begin), data + begin, end - begin);
+
+        m_arena.resize(top->m_data);
+        if (memcmp(merged, merged + (end - begin), end - begin) == 0) {
+            // Back to where the group started
+            m_edits.pop_back();
+            --m_position;
+            return nullptr;
+        }
+        top->m_offset = m_pending.m_offset + begin;
+        top->m_length = end - begin;
+        m_arena.insert(m_arena.end(), merged, merged + 2 * top->m_length);
+    }
+    else {
+        Edit edit = m_pending;
+        edit.m_offset += first;
+        edit.m_length = last - first;
+        edit.m_data = m_arena.size();
+        m_arena.insert(m_arena.end(), m_old + first, m_old + last);
+        m_arena.insert(m_arena.end(), data + first, data + last);
+        m_edits.push_back(edit);
+        ++m_position;
+    }
+    m_sealed = false;
+
+    if (m_arena.size() > m_limit) {
+        trim();
+    }
+    return &(m_edits.back());
+}
+
+// Clear journal
+void EditJournal::clear()
+{
+    m_edits.clear();
+    m_arena.clear();
+    m_position = 0;
+    m_sealed = true;
+}
+
+// Undo edit
+void EditJournal::undo(uint8_t* buffer)
+{
+    if (m_position == 0) {
+        return;
+    }
+    const Edit& edit = m_edits[--m_position];
+    memcpy(buffer + edit.m_offset, &(m_arena[edit.m_data]), edit.m_length);
+    m_sealed = true;
+}
+
+// Redo edit
+void EditJournal::redo(uint8_t* buffer)
+{
+    if (m_position == m_edits.size()) {
+        return;
+    }
+    const Edit& edit = m_edits[m_position++];
+    memcpy(buffer + edit.m_offset, &(m_arena[edit.m_data + edit.m_length]), edit.m_length);
+    m_sealed = true;
+}
+
+// Drop oldest edits
+void EditJournal::trim()
+{
+    // Dropping down to half the limit keeps the cost of moving the arena at O(1) per recorded byte
+    size_t drop = 0;
+    while (drop + 1 < m_edits.size() && m_arena.size() - m_edits[drop].m_data > m_limit / 2) {
+        ++drop;
+    }
+    if (drop == 0) {
+        return;
+    }
+
+    size_t bytes = m_edits[drop].m_data;
+    m_arena.erase(m_arena.begin(), m_arena.begin() + bytes);
+    m_edits.erase(m_edits.begin(), m_edits.begin() + drop);
+    for (auto& i : m_edits) {
+        i.m_data -= bytes;
+    }
+    m_position -= std::min(m_position, drop);
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,204 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <wersi/blocklayout.hh>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Undo/redo journal of raw block data edits.
+
+  Each edit of a block records the span of bytes it changed, with the old and the new bytes, in a single arena, so
+  undoing or redoing an edit only copies the changed bytes back. Edits with the same non-zero group, e.g. all moves
+  of one slider, are coalesced into one entry until the journal is sealed, an edit of another group or block is
+  recorded or an edit is undone. Recording an edit drops all undone edits. When the arena grows above its limit,
+  the oldest edits are dropped.
+
+  The journal only knows raw data, InstrumentStore::beginEdit() and InstrumentStore::endEdit() record edits of the
+  block objects and InstrumentStore::undo() and InstrumentStore::redo() update the objects and checksums.
+ */
+class EditJournal {
+    public:
+        /// Recorded edit
+        struct Edit {
+            SysEx::BlockType    m_type;             ///< Block type
+            uint8_t             m_block;            ///< Block number
+            uint32_t            m_group;            ///< Coalescing group, 0 for none
+            size_t              m_offset;           ///< Offset of changed span in the raw data buffer
+            size_t              m_length;           ///< Length of changed span
+            size_t              m_data;             ///< Arena offset of old bytes, followed by the new bytes
+        };
+
+        /// Default arena limit in bytes
+        static const size_t s_defaultLimit = 65536;
+
+        /**
+          Create new journal.
+
+          Creates an empty journal.
+
+          @param[in]    limit       Arena limit in bytes
+         */
+        EditJournal(size_t limit = s_defaultLimit);
+
+        /**
+          Destroy journal.
+
+          Destroys the journal.
+         */
+        ~EditJournal();
+
+        /**
+          Begin edit.
+
+          Saves the current contents of the block about to be changed. Each begin() must be followed by end() with
+          the same block data. If the block is larger than a FIXWAVE block, a DataFormatException is thrown.
+
+          @param[in]    type        Block type
+          @param[in]    block       Block number
+          @param[in]    group       Coalescing group, 0 for none
+          @param[in]    data        Block data in the raw data buffer
+          @param[in]    offset      Offset of the block in the raw data buffer
+          @param[in]    length      Block length
+         */
+        void begin(SysEx::BlockType type, uint8_t block, uint32_t group, const uint8_t* data, size_t offset,
+                   size_t length);
+
+        /**
+          End edit.
+
+          Compares the block data with the contents saved by begin() and records the changed span, if any.
+
+          @param[in]    data        Block data in the raw data buffer
+
+          @return                   Recorded or coalesced edit, nullptr if nothing changed
+         */
+        const Edit* end(const uint8_t* data);
+
+        /**
+          Seal journal.
+
+          Ends coalescing, the next edit starts a new entry even if it has the same group as the previous one.
+         */
+        void seal() {
+            m_sealed = true;
+        }
+
+        /**
+          Clear journal.
+
+          Drops all edits, usually after the raw data has been changed without recording the changes.
+         */
+        void clear();
+
+        /**
+          Get edit to undo.
+
+          Returns the edit undo() would revert.
+
+          @return                   Edit to undo, nullptr if there is none
+         */
+        const Edit* getUndo() const {
+            return m_position > 0 ? &(m_edits[m_position - 1]) : nullptr;
+        }
+
+        /**
+          Get edit to redo.
+
+          Returns the edit redo() would apply again.
+
+          @return                   Edit to redo, nullptr if there is none
+         */
+        const Edit* getRedo() const {
+            return m_position < m_edits.size() ? &(m_edits[m_position]) : nullptr;
+        }
+
+        /**
+          Undo edit.
+
+          Writes the old bytes of the last edit back into the raw data buffer, does nothing if there is no edit to
+          undo.
+
+          @param[in,out]    buffer  Raw data buffer
+         */
+        void undo(uint8_t* buffer);
+
+        /**
+          Redo edit.
+
+          Writes the new bytes of the last undone edit back into the raw data buffer, does nothing if there is no
+          edit to redo.
+
+          @param[in,out]    buffer  Raw data buffer
+         */
+        void redo(uint8_t* buffer);
+
+        /**
+          Get arena size.
+
+          Returns the number of bytes used to record all edits.
+
+          @return                   Arena size in bytes
+         */
+        size_t getArenaSize() const {
+            return m_arena.size();
+        }
+
+    private:
+        std::vector<Edit>       m_edits;            ///< Recorded edits, oldest first
+        std::vector<uint8_t>    m_arena;            ///< Old and new bytes of all edits
+        size_t                  m_position;         ///< Number of edits not undone
+        size_t                  m_limit;            ///< Arena limit in bytes
+        bool                    m_sealed;           ///< Set if the last edit must not be coalesced
+        Edit                    m_pending;          ///< Edit between begin() and end()
+        uint8_t                 m_old[BlockLayout<SysEx::BlockType::FixWaveBlock>::s_size];  ///< Saved block
+
+        /**
+          Drop oldest edits.
+
+          Drops the oldest edits until the arena uses at most half its limit, keeping at least the newest edit.
+         */
+        void trim();
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
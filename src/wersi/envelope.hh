@@ -143,6 +143,17 @@ class Envelope {
          */
         void update();
 
+        /**
+          Get modified state.
+
+          Envelope data is kept in the raw envelope data buffer only, so there's never anything to write back.
+
+          @return                   Always false
+         */
+        bool isModified() const {
+            return false;
+        }
+
     private:
         uint8_t         m_blockNum;         ///< Block number
         uint8_t*        m_buffer;           ///< Associated raw buffer
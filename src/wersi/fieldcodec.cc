@@ -0,0 +1,68 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+#include <wersi/fieldcodec.hh>
+#include <exceptions.hh>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Extract field from blocks
+void FieldCodec::extract(const uint8_t* const* blocks, size_t count, const Field& field, int16_t* values)
+{
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = get(blocks[i], field);
+    }
+}
+
+// Extract field from store slots
+void FieldCodec::extract(const void* buffer, size_t size, const std::vector<StoreLayout::Slot>& slots,
+                         const Field& field, int16_t* values)
+{
+    for (auto& i : slots) {
+        if (size_t(i.m_offset) + field.m_offset >= size) {
+            throw DataFormatException("Buffer too small for store layout");
+        }
+    }
+
+    auto data = static_cast<const uint8_t*>(buffer);
+    for (size_t i = 0; i < slots.size(); ++i) {
+        values[i] = get(data + slots[i].m_offset, field);
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
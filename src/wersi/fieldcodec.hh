@@ -0,0 +1,126 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <wersi/storeconverter.hh>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Bit field codec for raw block data.
+
+  Block types like ICB and VCF pack most of their parameters into bit fields of single bytes. A field is described by
+  the offset of its byte in the block, a mask of its bits in that byte, the shift to its lowest bit and whether it is
+  a two's complement value. These helpers read and write such fields in place in the raw block buffer, without
+  dissecting the whole block into object members, and extract one field from many blocks at once for bulk
+  operations like searching or comparing whole libraries.
+ */
+class FieldCodec {
+    public:
+        /// Bit field descriptor
+        struct Field {
+            uint8_t     m_offset;               ///< Byte offset in the block
+            uint8_t     m_mask;                 ///< Mask of the field bits in the byte
+            uint8_t     m_shift;                ///< Position of the lowest field bit
+            bool        m_signed;               ///< True for two's complement values
+        };
+
+        /**
+          Get field value.
+
+          Returns the value of the field in the given raw block buffer, sign extended for signed fields.
+
+          @param[in]    block       Raw block buffer
+          @param[in]    field       Field descriptor
+
+          @return                   Field value
+         */
+        static int16_t get(const uint8_t* block, const Field& field) {
+            int16_t value = int16_t((block[field.m_offset] & field.m_mask) >> field.m_shift);
+            int16_t top = int16_t(((field.m_mask >> field.m_shift) + 1) >> 1);
+            return field.m_signed && (value & top) != 0 ? int16_t(value - (top << 1)) : value;
+        }
+
+        /**
+          Set field value.
+
+          Writes the value into the field in the given raw block buffer, leaving all other bits of its byte untouched.
+          Bits of the value not fitting into the field are dropped.
+
+          @param[in,out]    block   Raw block buffer
+          @param[in]        field   Field descriptor
+          @param[in]        value   Field value
+         */
+        static void set(uint8_t* block, const Field& field, int16_t value) {
+            block[field.m_offset] = uint8_t((block[field.m_offset] & ~field.m_mask) |
+                                            ((uint16_t(value) << field.m_shift) & field.m_mask));
+        }
+
+        /**
+          Extract field from blocks.
+
+          Reads the field from the given number of raw block buffers.
+
+          @param[in]    blocks      Raw block buffers
+          @param[in]    count       Number of blocks
+          @param[in]    field       Field descriptor
+          @param[out]   values      Field values, one per block
+         */
+        static void extract(const uint8_t* const* blocks, size_t count, const Field& field, int16_t* values);
+
+        /**
+          Extract field from store slots.
+
+          Reads the field from all slots of one block type in the raw data buffer of an instrument store, as described
+          by its layout. If the buffer is too small for a slot, a DataFormatException is thrown before reading any
+          field.
+
+          @param[in]    buffer      Raw data buffer of the store
+          @param[in]    size        Raw data buffer size
+          @param[in]    slots       Slots to read, e.g. StoreLayout::m_icb
+          @param[in]    field       Field descriptor
+          @param[out]   values      Field values, one per slot
+         */
+        static void extract(const void* buffer, size_t size, const std::vector<StoreLayout::Slot>& slots,
+                            const Field& field, int16_t* values);
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -40,6 +40,30 @@
 namespace DMSToolbox {
 namespace Wersi {
 
+// Raw data field descriptors
+const FieldCodec::Field Icb::s_fields[] = {
+    {  0, 0xff, 0, false },                 // NextIcb
+    {  1, 0xff, 0, false },                 // VcfBlock
+    {  2, 0xff, 0, false },                 // AmplBlock
+    {  3, 0xff, 0, false },                 // FreqBlock
+    {  4, 0xff, 0, false },                 // WaveBlock
+    {  5, 0x03, 0, false },                 // Dynamics
+    {  5, 0x04, 2, false },                 // LowSelect
+    {  5, 0x08, 3, false },                 // HighSelect
+    {  6, 0x01, 0, false },                 // Left
+    {  6, 0x02, 1, false },                 // Right
+    {  6, 0x04, 2, false },                 // Bright
+    {  6, 0x08, 3, false },                 // Vcf
+    {  6, 0x10, 4, false },                 // WersiVoice
+    {  7, 0xff, 0, true  },                 // Transpose
+    {  8, 0xff, 0, true  },                 // Detune
+    {  9, 0x07, 0, false },                 // WvMode
+    {  9, 0x08, 3, false },                 // WvLeft
+    {  9, 0x10, 4, false },                 // WvRight
+    {  9, 0x40, 6, false },                 // WvFbFlat
+    {  9, 0x80, 7, false },                 // WvFbDeep
+};
+
 // Create new ICB object
 Icb::Icb(uint8_t blockNum, void* buffer)
     : m_blockNum(blockNum)
@@ -66,6 +90,7 @@ Icb::Icb(uint8_t blockNum, void* buffer)
     , m_wvFbDeep(false)
     , m_name()
     , m_unknownBits(0)
+    , m_modified(false)
 {
     dissect();
 }
@@ -96,6 +121,7 @@ Icb::Icb(const Icb& source)
     , m_wvFbDeep(false)
     , m_name()
     , m_unknownBits(0)
+    , m_modified(false)
 {
     *this = source;
 }
@@ -142,11 +168,15 @@ void Icb::copy(const Icb& source)
     m_name          = source.m_name;
 
     m_unknownBits   = source.m_unknownBits;
+    m_modified      = true;
 }
 
 // Disssect ICB raw data
 void Icb::dissect()
 {
+    static_assert(sizeof(s_fields) / sizeof(s_fields[0]) == size_t(Field::NumFields),
+                  "ICB field table must cover all fields");
+
     m_nextIcb       = m_buffer[0];
     m_vcfBlock      = m_buffer[1];
     m_amplBlock     = m_buffer[2];
@@ -173,7 +203,8 @@ void Icb::dissect()
     m_name          = std::string(reinterpret_cast<char*>(&(m_buffer[10])), 6);
 
     // Unknown bits
-    m_unknownBits   = ((m_buffer[5] & 0xf0 >> 4)) | ((m_buffer[6] & 0xe0) >> 1) | ((m_buffer[9] & 0x20) << 2);
+    m_unknownBits   = ((m_buffer[5] & 0xf0) >> 4) | ((m_buffer[6] & 0xe0) >> 1) | ((m_buffer[9] & 0x20) << 2);
+    m_modified      = false;
 }
 
 // Put together and update ICB raw data
@@ -184,17 +215,21 @@ void Icb::update()
     m_buffer[2] = m_amplBlock;
     m_buffer[3] = m_freqBlock;
     m_buffer[4] = m_waveBlock;
-    m_buffer[5] = (m_dynamics   & 3) |
+    // Unknown bits are written back unchanged
+    m_buffer[5] = ((m_unknownBits & 0x0f) << 4) |
+                  (m_dynamics   & 3) |
                   (m_lowSelect  ? 0x04 : 0x00) |
                   (m_highSelect ? 0x08 : 0x00);
-    m_buffer[6] = (m_left       ? 0x01 : 0x00) |
+    m_buffer[6] = ((m_unknownBits & 0x70) << 1) |
+                  (m_left       ? 0x01 : 0x00) |
                   (m_right      ? 0x02 : 0x00) |
                   (m_bright     ? 0x04 : 0x00) |
                   (m_vcf        ? 0x08 : 0x00) |
                   (m_wv         ? 0x10 : 0x00);
     m_buffer[7] = uint8_t(m_transpose);
     m_buffer[8] = uint8_t(m_detune);
-    m_buffer[9] = (static_cast<uint8_t>(m_wvMode) & 7) |
+    m_buffer[9] = ((m_unknownBits & 0x80) >> 2) |
+                  (static_cast<uint8_t>(m_wvMode) & 7) |
                   (m_wvLeft     ? 0x08 : 0x00) |
                   (m_wvRight    ? 0x10 : 0x00) |
                   (m_wvFbFlat   ? 0x40 : 0x00) |
@@ -207,6 +242,21 @@ void Icb::update()
     m_buffer[13] = name[3];
     m_buffer[14] = name[4];
     m_buffer[15] = name[5];
+    m_modified = false;
+}
+
+// Set raw field value
+void Icb::setRaw(Field field, int16_t value)
+{
+    // Put the members together in a scratch copy, so the raw data buffer is only changed by update()
+    uint8_t scratch[BlockLayout<SysEx::BlockType::IcBlock>::s_size] = {};
+    uint8_t* buffer = m_buffer;
+    m_buffer = scratch;
+    update();
+    FieldCodec::set(m_buffer, getField(field), value);
+    dissect();
+    m_buffer = buffer;
+    m_modified = true;
 }
 
 // Return WersiVoice mode name
@@ -37,7 +37,8 @@
 
 #pragma once
 
-#include <common.hh>
+#include <wersi/blocklayout.hh>
+#include <wersi/fieldcodec.hh>
 #include <string>
 
 namespace DMSToolbox {
@@ -63,6 +64,31 @@ class Icb {
             Invalid         = 7             ///< Invalid
         };
 
+        /// Raw data fields, see getRaw() and setRaw()
+        enum class Field {
+            NextIcb,                        ///< Next ICB pointer
+            VcfBlock,                       ///< VCF block pointer
+            AmplBlock,                      ///< AMPL block pointer
+            FreqBlock,                      ///< FREQ block pointer
+            WaveBlock,                      ///< WAVE block pointer
+            Dynamics,                       ///< Dynamics level
+            LowSelect,                      ///< Low select flag
+            HighSelect,                     ///< High select flag
+            Left,                           ///< Left output flag
+            Right,                          ///< Right output flag
+            Bright,                         ///< Bright flag
+            Vcf,                            ///< VCF output flag
+            WersiVoice,                     ///< WersiVoice output flag
+            Transpose,                      ///< Transpose value
+            Detune,                         ///< Detune value
+            WvMode,                         ///< WersiVoice mode
+            WvLeft,                         ///< WersiVoice left output flag
+            WvRight,                        ///< WersiVoice right output flag
+            WvFbFlat,                       ///< WersiVoice flat feedback flag
+            WvFbDeep,                       ///< WersiVoice deep feedback flag
+            NumFields                       ///< Number of fields
+        };
+
         /**
           Create new ICB object from buffer.
 
@@ -103,6 +129,17 @@ class Icb {
             return m_buffer;
         }
 
+        /**
+          Get raw buffer size.
+
+          Returns the raw buffer size, which is fixed at 16 bytes.
+
+          @return                   Raw buffer size
+         */
+        size_t getBufferSize() const {
+            return BlockLayout<SysEx::BlockType::IcBlock>::s_size;
+        }
+
         /**
           Copy ICB object.
 
@@ -134,10 +171,23 @@ class Icb {
         /**
           Update ICB raw data buffer.
 
-          Writes back changes in the ICB object to the associated raw ICB data buffer.
+          Writes back changes in the ICB object to the associated raw ICB data buffer. Bits not decoded into
+          object members are written back as they have been parsed or copied.
          */
         void update();
 
+        /**
+          Get modified state.
+
+          Returns true if object members have been changed by a setter or copy since the last dissect() or
+          update(), so the object needs to be written back.
+
+          @return                   True if modified
+         */
+        bool isModified() const {
+            return m_modified;
+        }
+
         /**
           Get next ICB.
 
@@ -158,6 +208,7 @@ class Icb {
          */
         void setNextIcb(uint8_t icb) {
             m_nextIcb = icb;
+            m_modified = true;
         }
 
         /**
@@ -180,6 +231,7 @@ class Icb {
          */
         void setVcfBlock(uint8_t vcf) {
             m_vcfBlock = vcf;
+            m_modified = true;
         }
 
         /**
@@ -202,6 +254,7 @@ class Icb {
          */
         void setAmplBlock(uint8_t ampl) {
             m_amplBlock = ampl;
+            m_modified = true;
         }
 
         /**
@@ -224,6 +277,7 @@ class Icb {
          */
         void setFreqBlock(uint8_t freq) {
             m_freqBlock = freq;
+            m_modified = true;
         }
 
         /**
@@ -246,6 +300,7 @@ class Icb {
          */
         void setWaveBlock(uint8_t wave) {
             m_waveBlock = wave;
+            m_modified = true;
         }
 
         /**
@@ -435,6 +490,45 @@ class Icb {
             return m_unknownBits;
         }
 
+        /**
+          Get field descriptor.
+
+          Returns the bit field descriptor of the given raw data field, for use with FieldCodec.
+
+          @param[in]    field       Raw data field
+
+          @return                   Field descriptor
+         */
+        static const FieldCodec::Field& getField(Field field) {
+            return s_fields[static_cast<size_t>(field)];
+        }
+
+        /**
+          Get raw field value.
+
+          Reads the given field directly from the raw ICB data buffer, without dissecting it. Changes of the object
+          members not yet written back by update() are not seen.
+
+          @param[in]    field       Raw data field
+
+          @return                   Field value
+         */
+        int16_t getRaw(Field field) const {
+            return FieldCodec::get(m_buffer, getField(field));
+        }
+
+        /**
+          Set raw field value.
+
+          Sets the given field through the raw ICB data layout, leaving all other data untouched. The new value is
+          picked up by the object members and the object is marked modified, the raw data buffer itself is only
+          changed by update(), so the instrument store keeps its checksums up to date.
+
+          @param[in]    field       Raw data field
+          @param[in]    value       Field value
+         */
+        void setRaw(Field field, int16_t value);
+
         /**
           Get WersiVoice mode name.
 
@@ -447,6 +541,8 @@ class Icb {
         static std::string getWvModeName(WvMode mode);
 
     private:
+        static const FieldCodec::Field s_fields[];  ///< Raw data field descriptors, indexed by Field
+
         uint8_t         m_blockNum;         ///< Block number
         uint8_t*        m_buffer;           ///< Associated raw buffer
 
@@ -473,6 +569,7 @@ class Icb {
         std::string     m_name;             ///< Voice name
 
         uint8_t         m_unknownBits;      ///< Currently unknown bits
+        bool            m_modified;         ///< Members changed since last dissect() or update()
 };
 
 } // namespace Wersi
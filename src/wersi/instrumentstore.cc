@@ -40,7 +40,13 @@
 #include <wersi/vcf.hh>
 #include <wersi/envelope.hh>
 #include <wersi/wave.hh>
+#include <wersi/checksum.hh>
+#include <wersi/storeconverter.hh>
+#include <wersi/storesnapshot.hh>
+#include <wersi/storepatch.hh>
 #include <exceptions.hh>
+#include <algorithm>
+#include <cstring>
 
 #ifdef HAVE_RTMIDI
 #include <RtMidi.h>
@@ -49,10 +55,81 @@
 namespace DMSToolbox {
 namespace Wersi {
 
+// Append device blocks of a block list ordered by block number
+template<typename T> static void addDeviceBlocks(const BlockList<T>& list,
+                                                 std::vector<InstrumentStore::DeviceBlock>& blocks)
+{
+    for (size_t i = 0; i < 256; ++i) {
+        auto block = list.find(uint8_t(i));
+        if (block != list.end()) {
+            // All block buffers point into our own raw data buffer, only the accessors are const
+            InstrumentStore::DeviceBlock device = {
+                SysEx::getBlockType(block->second), block->first, uint8_t(block->second.getBufferSize()),
+                static_cast<uint8_t*>(const_cast<void*>(block->second.getBuffer()))
+            };
+            blocks.push_back(device);
+        }
+    }
+}
+
+// Update all modified blocks of a block list, returning the byte sum delta within the given range
+template<typename T> static uint16_t updateList(BlockList<T>& list, const uint8_t* buffer, size_t begin, size_t end)
+{
+    uint16_t delta = 0;
+    for (auto& i : list) {
+        if (!i.second.isModified()) {
+            continue;
+        }
+        size_t offset = static_cast<const uint8_t*>(i.second.getBuffer()) - buffer;
+        size_t first = std::max(begin, offset);
+        size_t last = std::min(end, offset + i.second.getBufferSize());
+        if (first < last) {
+            uint16_t before = Checksum::sum(&(buffer[first]), last - first);
+            i.second.update();
+            delta += Checksum::sum(&(buffer[first]), last - first) - before;
+        }
+        else {
+            i.second.update();
+        }
+    }
+    return delta;
+}
+
+// Write back or parse a block object and return its raw data
+template<typename T> static uint8_t* accessObject(T* object, bool update, bool dissect, size_t& length)
+{
+    if (object == nullptr) {
+        throw DataFormatException("Block to edit does not exist");
+    }
+    if (update) {
+        object->update();
+    }
+    if (dissect) {
+        object->dissect();
+    }
+    length = object->getBufferSize();
+    // All block buffers point into our own raw data buffer, only the accessors are const
+    return static_cast<uint8_t*>(const_cast<void*>(object->getBuffer()));
+}
+
 // Create new instrument store
-InstrumentStore::InstrumentStore(void* buffer, size_t size)
+InstrumentStore::InstrumentStore(void* buffer, size_t size, bool lazy)
     : m_buffer(static_cast<uint8_t*>(buffer))
     , m_size(size)
+    , m_synced()
+    , m_journal()
+    , m_editChecksums()
+    , m_editLayout(false)
+    , m_editType(SysEx::BlockType::IcBlock)
+    , m_editBlock(0)
+    , m_editOffset(0)
+    , m_editSum(0)
+    , m_lazy(lazy)
+    , m_snapshot()
+    , m_snapshotVersion(0)
+    , m_published(nullptr)
+    , m_snapshotReaders(0)
+    , m_retired()
     , m_icb()
     , m_vcf()
     , m_ampl()
@@ -64,74 +141,272 @@ InstrumentStore::InstrumentStore(void* buffer, size_t size)
 // Destroy instrument store
 InstrumentStore::~InstrumentStore()
 {
+    // No readers may be left once the store goes away
+    delete m_published.load();
+    for (auto i : m_retired) {
+        delete i;
+    }
+}
+
+// Load all blocks
+void InstrumentStore::loadBlocks()
+{
+    if (m_lazy) {
+        loadAll();
+    }
 }
 
 // Copy instrument store contents
 void InstrumentStore::copyContents(const InstrumentStore& source)
 {
-    // Copy ICBs
-    for (auto& i : source) {
-        Icb* icb = getIcb(i.first - 128);
-        if (icb != nullptr) {
-            icb->copy(i.second);
-            if (icb->getNextIcb() != 0) {
-                icb->setNextIcb(icb->getNextIcb() - 128);
-            }
-            icb->setVcfBlock(icb->getVcfBlock() - 128);
-            icb->setAmplBlock(icb->getAmplBlock() - 128);
-            icb->setFreqBlock(icb->getFreqBlock() - 128);
-            icb->setWaveBlock(icb->getWaveBlock() - 128);
-            icb->update();
-        }
+    StoreLayout sourceLayout;
+    StoreLayout layout;
+    source.getLayout(sourceLayout);
+    getLayout(layout);
+    copyContents(source, StoreConverter(sourceLayout, layout));
+}
+
+// Copy instrument store contents with converter
+void InstrumentStore::copyContents(const InstrumentStore& source, const StoreConverter& converter)
+{
+    converter.convert(source.m_buffer, source.m_size, m_buffer, m_size);
+    m_journal.clear();
+    reparseBlocks();
+    republishSnapshot();
+}
+
+// Create patch from this store to target store
+void InstrumentStore::diffContents(const InstrumentStore& target, StorePatch& patch) const
+{
+    StoreLayout layout;
+    StoreLayout targetLayout;
+    getLayout(layout);
+    target.getLayout(targetLayout);
+    if (m_size != target.m_size || StorePatch::hashLayout(layout) != StorePatch::hashLayout(targetLayout)) {
+        throw DataFormatException("Instrument stores have different layouts");
     }
+    patch.diff(layout, m_buffer, target.m_buffer, m_size);
+}
 
-    // Copy VCFs
-    for (size_t i = 0; i < 10; ++i) {
-        uint8_t addr = i + 65;
-        auto src = const_cast<InstrumentStore*>(&source)->getVcf(addr + 128);
-        auto dst = getVcf(addr);
-        if (src != nullptr && dst != nullptr) {
-            dst->copy(*src);
-        }
+// Apply patch
+void InstrumentStore::applyPatch(const StorePatch& patch, bool force)
+{
+    StoreLayout layout;
+    getLayout(layout);
+    patch.apply(layout, m_buffer, m_size, force);
+    m_journal.clear();
+    reparseBlocks();
+    republishSnapshot();
+}
+
+// Parse all parsed blocks again
+void InstrumentStore::reparseBlocks()
+{
+    // Parsed objects keep pointing to their blocks, they only need to parse the new data
+    for (auto& i : m_icb) {
+        i.second.dissect();
+    }
+    for (auto& i : m_vcf) {
+        i.second.dissect();
+    }
+    for (auto& i : m_ampl) {
+        i.second.dissect();
+    }
+    for (auto& i : m_freq) {
+        i.second.dissect();
+    }
+    for (auto& i : m_wave) {
+        i.second.dissect();
     }
+}
 
-    // Copy AMPLs
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + 65;
-        if (i >= 10) {
-            ++addr;
-        }
-        auto src = const_cast<InstrumentStore*>(&source)->getAmpl(addr + 128);
-        auto dst = getAmpl(addr);
-        if (src != nullptr && dst != nullptr) {
-            dst->copy(*src);
-        }
+// Get list of device blocks
+void InstrumentStore::getDeviceBlocks(std::vector<DeviceBlock>& blocks)
+{
+    loadBlocks();
+    blocks.clear();
+    addDeviceBlocks(m_icb, blocks);
+    addDeviceBlocks(m_vcf, blocks);
+    addDeviceBlocks(m_ampl, blocks);
+    addDeviceBlocks(m_freq, blocks);
+    addDeviceBlocks(m_wave, blocks);
+}
+
+// Get device blocks by address
+void InstrumentStore::getDeviceBlocks(DeviceBlockMap& blocks)
+{
+    std::vector<DeviceBlock> list;
+    getDeviceBlocks(list);
+    blocks.clear();
+    for (auto& i : list) {
+        blocks[getDeviceBlockKey(i.m_type, i.m_address)] = i;
     }
+}
 
-    // Copy FREQs
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + 65;
-        if (i >= 10) {
-            ++addr;
-        }
-        auto src = const_cast<InstrumentStore*>(&source)->getFreq(addr + 128);
-        auto dst = getFreq(addr);
-        if (src != nullptr && dst != nullptr) {
-            dst->copy(*src);
-        }
+// Get device block key
+InstrumentStore::DeviceBlockMap::key_type InstrumentStore::getDeviceBlockKey(SysEx::BlockType type,
+                                                                             uint8_t address)
+{
+    if (type == SysEx::BlockType::FixWaveBlock) {
+        type = SysEx::BlockType::RelWaveBlock;
     }
+    return DeviceBlockMap::key_type(static_cast<uint8_t>(type), address);
+}
 
-    // Copy WAVEs
-    for (size_t i = 0; i < 20; ++i) {
-        uint8_t addr = i + 65;
-        if (i >= 10) {
-            ++addr;
+// Get dirty device blocks
+void InstrumentStore::getDirtyBlocks(std::vector<DeviceBlock>& blocks)
+{
+    getDeviceBlocks(blocks);
+    if (m_synced.size() != m_size) {
+        return;
+    }
+
+    size_t dirty = 0;
+    for (auto& i : blocks) {
+        if (memcmp(i.m_data, &m_synced[i.m_data - m_buffer], i.m_length) != 0) {
+            blocks[dirty++] = i;
         }
-        auto src = const_cast<InstrumentStore*>(&source)->getWave(addr + 128);
-        auto dst = getWave(addr);
-        if (src != nullptr && dst != nullptr) {
-            dst->copy(*src);
+    }
+    blocks.resize(dirty);
+}
+
+// Mark store as synchronized
+void InstrumentStore::markSynced()
+{
+    m_synced.assign(m_buffer, m_buffer + m_size);
+}
+
+// Mark device block as synchronized
+void InstrumentStore::markSynced(const DeviceBlock& block, const uint8_t* data)
+{
+    // Without a full synchronized state, the other blocks are still unknown
+    if (m_synced.size() != m_size) {
+        return;
+    }
+    memcpy(&m_synced[block.m_data - m_buffer], data, block.m_length);
+}
+
+// Forget synchronized state
+void InstrumentStore::clearSynced()
+{
+    m_synced.clear();
+}
+
+// Begin block edit
+void InstrumentStore::beginEdit(SysEx::BlockType type, uint8_t block, uint32_t group)
+{
+    size_t length = 0;
+    uint8_t* data = accessBlock(type, block, BlockAction::None, length);
+    m_journal.begin(type, block, group, data, data - m_buffer, length);
+    m_editType = type;
+    m_editBlock = block;
+    m_editOffset = data - m_buffer;
+    m_editSum = Checksum::sum(data, length);
+}
+
+// End block edit
+void InstrumentStore::endEdit()
+{
+    size_t length = 0;
+    uint8_t* data = accessBlock(m_editType, m_editBlock, BlockAction::Update, length);
+    m_journal.end(data);
+    adjustChecksums(m_editOffset, Checksum::sum(data, length) - m_editSum);
+    republishSnapshot(m_editOffset, length);
+}
+
+// Undo block edit
+bool InstrumentStore::undo()
+{
+    auto edit = m_journal.getUndo();
+    if (edit == nullptr) {
+        return false;
+    }
+    const uint8_t* data = m_buffer + edit->m_offset;
+    uint16_t before = Checksum::sum(data, edit->m_length);
+    m_journal.undo(m_buffer);
+    adjustChecksums(edit->m_offset, Checksum::sum(data, edit->m_length) - before);
+    size_t length = 0;
+    accessBlock(edit->m_type, edit->m_block, BlockAction::Dissect, length);
+    republishSnapshot(edit->m_offset, edit->m_length);
+    return true;
+}
+
+// Redo block edit
+bool InstrumentStore::redo()
+{
+    auto edit = m_journal.getRedo();
+    if (edit == nullptr) {
+        return false;
+    }
+    const uint8_t* data = m_buffer + edit->m_offset;
+    uint16_t before = Checksum::sum(data, edit->m_length);
+    m_journal.redo(m_buffer);
+    adjustChecksums(edit->m_offset, Checksum::sum(data, edit->m_length) - before);
+    size_t length = 0;
+    accessBlock(edit->m_type, edit->m_block, BlockAction::Dissect, length);
+    republishSnapshot(edit->m_offset, edit->m_length);
+    return true;
+}
+
+// Publish snapshot
+std::shared_ptr<const StoreSnapshot> InstrumentStore::publishSnapshot()
+{
+    auto layout = std::make_shared<StoreLayout>();
+    getLayout(*layout);
+    std::shared_ptr<const StoreSnapshot> snapshot(new StoreSnapshot(m_buffer, m_size, layout, getNumIcbs(),
+                                                                    m_snapshotVersion + 1));
+    publish(snapshot);
+    return snapshot;
+}
+
+// Get last published snapshot
+std::shared_ptr<const StoreSnapshot> InstrumentStore::getSnapshot() const
+{
+    // While counted as reader, the published reference is not freed, copying it only increments its use count
+    std::shared_ptr<const StoreSnapshot> snapshot;
+    m_snapshotReaders.fetch_add(1);
+    auto published = m_published.load();
+    if (published != nullptr) {
+        snapshot = *published;
+    }
+    m_snapshotReaders.fetch_sub(1);
+    return snapshot;
+}
+
+// Publish snapshot after change, if snapshots are in use
+void InstrumentStore::republishSnapshot()
+{
+    // Only the changing thread publishes, so the version needs no atomic access
+    if (m_snapshotVersion != 0) {
+        publishSnapshot();
+    }
+}
+
+// Publish snapshot after change of a byte range, if snapshots are in use
+void InstrumentStore::republishSnapshot(size_t offset, size_t length)
+{
+    if (m_snapshotVersion != 0) {
+        publish(std::make_shared<const StoreSnapshot>(*m_snapshot, m_buffer, offset, length, m_snapshotVersion + 1));
+    }
+}
+
+// Make snapshot available to readers
+void InstrumentStore::publish(const std::shared_ptr<const StoreSnapshot>& snapshot)
+{
+    m_snapshot = snapshot;
+    ++m_snapshotVersion;
+
+    // Readers that loaded the previous reference have registered before it was replaced, so once no reader is
+    // registered, all references replaced so far can be freed
+    auto previous = m_published.exchange(new std::shared_ptr<const StoreSnapshot>(snapshot));
+    if (previous != nullptr) {
+        m_retired.push_back(previous);
+    }
+    if (m_snapshotReaders.load() == 0) {
+        for (auto i : m_retired) {
+            delete i;
         }
+        m_retired.clear();
     }
 }
 
@@ -143,33 +418,45 @@ void InstrumentStore::readFromDevice(RtMidiIn* /*inPort*/, RtMidiOut* /*outPort*
     throw MidiException("Cannot read contents for this instrument store from device");
 }
 
+// Read blocks from device
+void InstrumentStore::readBlocks(RtMidiOut* /*outPort*/, const std::vector<DeviceBlock>& /*blocks*/,
+                                 bool(* /*callback*/)(void*, uint32_t, uint32_t), void* /*object*/)
+{
+    throw MidiException("Cannot read blocks for this instrument store from device");
+}
+
+// Cancel reading from device, nothing to do by default
+void InstrumentStore::cancelRead()
+{
+}
+#endif // HAVE_RTMIDI
+
 // SysEx receive callback
-void InstrumentStore::receivedSysEx(std::vector<unsigned char>* /*message*/)
+void InstrumentStore::receivedSysEx(const SysEx::Message& /*message*/)
 {
     throw MidiException("Cannot handle SysEx message in this instrument store");
 }
-#endif // HAVE_RTMIDI
 
-// Return begin iterator to ICB map
-std::map<uint8_t, Icb>::iterator InstrumentStore::begin()
+// Return begin iterator to ICB list
+BlockList<Icb>::iterator InstrumentStore::begin()
 {
     return m_icb.begin();
 }
 
-// Return const begin iterator to ICB map
-std::map<uint8_t, Icb>::const_iterator InstrumentStore::begin() const
+// Return const begin iterator to ICB list
+BlockList<Icb>::const_iterator InstrumentStore::begin() const
 {
     return m_icb.begin();
 }
 
-// Return end iterator to ICB map
-std::map<uint8_t, Icb>::iterator InstrumentStore::end()
+// Return end iterator to ICB list
+BlockList<Icb>::iterator InstrumentStore::end()
 {
     return m_icb.end();
 }
 
-// Return const end iterator to ICB map
-std::map<uint8_t, Icb>::const_iterator InstrumentStore::end() const
+// Return const end iterator to ICB list
+BlockList<Icb>::const_iterator InstrumentStore::end() const
 {
     return m_icb.end();
 }
@@ -190,6 +477,10 @@ Icb* InstrumentStore::getIcb(uint8_t block)
 Vcf* InstrumentStore::getVcf(uint8_t block)
 {
     auto ret = m_vcf.find(block);
+    if (ret == m_vcf.end() && m_lazy) {
+        loadVcf(block);
+        ret = m_vcf.find(block);
+    }
     if (ret == m_vcf.end()) {
         return nullptr;
     }
@@ -202,6 +493,10 @@ Vcf* InstrumentStore::getVcf(uint8_t block)
 Envelope* InstrumentStore::getAmpl(uint8_t block)
 {
     auto ret = m_ampl.find(block);
+    if (ret == m_ampl.end() && m_lazy) {
+        loadAmpl(block);
+        ret = m_ampl.find(block);
+    }
     if (ret == m_ampl.end()) {
         return nullptr;
     }
@@ -214,6 +509,10 @@ Envelope* InstrumentStore::getAmpl(uint8_t block)
 Envelope* InstrumentStore::getFreq(uint8_t block)
 {
     auto ret = m_freq.find(block);
+    if (ret == m_freq.end() && m_lazy) {
+        loadFreq(block);
+        ret = m_freq.find(block);
+    }
     if (ret == m_freq.end()) {
         return nullptr;
     }
@@ -226,6 +525,10 @@ Envelope* InstrumentStore::getFreq(uint8_t block)
 Wave* InstrumentStore::getWave(uint8_t block)
 {
     auto ret = m_wave.find(block);
+    if (ret == m_wave.end() && m_lazy) {
+        loadWave(block);
+        ret = m_wave.find(block);
+    }
     if (ret == m_wave.end()) {
         return nullptr;
     }
@@ -234,6 +537,44 @@ Wave* InstrumentStore::getWave(uint8_t block)
     }
 }
 
+// Access block object
+uint8_t* InstrumentStore::accessBlock(SysEx::BlockType type, uint8_t block, BlockAction action, size_t& length)
+{
+    bool update = action == BlockAction::Update;
+    bool dissect = action == BlockAction::Dissect;
+    switch (type) {
+        case SysEx::BlockType::IcBlock:
+            return accessObject(getIcb(block), update, dissect, length);
+        case SysEx::BlockType::VcfBlock:
+            return accessObject(getVcf(block), update, dissect, length);
+        case SysEx::BlockType::AmplBlock:
+            return accessObject(getAmpl(block), update, dissect, length);
+        case SysEx::BlockType::FreqBlock:
+            return accessObject(getFreq(block), update, dissect, length);
+        case SysEx::BlockType::FixWaveBlock:
+        case SysEx::BlockType::RelWaveBlock:
+            return accessObject(getWave(block), update, dissect, length);
+        default:
+            throw DataFormatException("Invalid block type to edit");
+    }
+}
+
+// Adjust checksums after edit
+void InstrumentStore::adjustChecksums(size_t offset, uint16_t delta)
+{
+    if (!m_editLayout) {
+        StoreLayout layout;
+        getLayout(layout);
+        m_editChecksums = layout.m_checksums;
+        m_editLayout = true;
+    }
+    for (auto& i : m_editChecksums) {
+        if (offset >= i.m_begin && offset < i.m_end) {
+            Checksum::adjust(m_buffer + i.m_stored, delta);
+        }
+    }
+}
+
 // Clear all lists
 void InstrumentStore::clearLists()
 {
@@ -244,5 +585,42 @@ void InstrumentStore::clearLists()
     m_wave.clear();
 }
 
+// Update all modified blocks
+uint16_t InstrumentStore::updateBlocks(size_t begin, size_t end)
+{
+    uint16_t delta = 0;
+    delta += updateList(m_icb, m_buffer, begin, end);
+    delta += updateList(m_vcf, m_buffer, begin, end);
+    delta += updateList(m_ampl, m_buffer, begin, end);
+    delta += updateList(m_freq, m_buffer, begin, end);
+    delta += updateList(m_wave, m_buffer, begin, end);
+    return delta;
+}
+
+// Load all blocks, nothing to do by default
+void InstrumentStore::loadAll()
+{
+}
+
+// Load VCF, nothing to do by default
+void InstrumentStore::loadVcf(uint8_t /*block*/)
+{
+}
+
+// Load AMPL, nothing to do by default
+void InstrumentStore::loadAmpl(uint8_t /*block*/)
+{
+}
+
+// Load FREQ, nothing to do by default
+void InstrumentStore::loadFreq(uint8_t /*block*/)
+{
+}
+
+// Load WAVE, nothing to do by default
+void InstrumentStore::loadWave(uint8_t /*block*/)
+{
+}
+
 } // namespace Wersi
 } // namespace DMSToolbox
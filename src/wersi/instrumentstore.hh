@@ -38,7 +38,13 @@
 #pragma once
 
 #include <common.hh>
+#include <wersi/sysex.hh>
+#include <wersi/blocklist.hh>
+#include <wersi/editjournal.hh>
+#include <wersi/storeconverter.hh>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <vector>
 
 #ifdef HAVE_RTMIDI
@@ -55,6 +61,10 @@ class Icb;
 class Vcf;
 class Envelope;
 class Wave;
+class TransferStats;
+class StoreConverter;
+class StoreSnapshot;
+class StorePatch;
 
 /**
   @ingroup wersi_group
@@ -65,6 +75,17 @@ class Wave;
  */
 class InstrumentStore {
     public:
+        /// Raw data block as transferred from or to a device
+        struct DeviceBlock {
+            SysEx::BlockType    m_type;             ///< SysEx block type
+            uint8_t             m_address;          ///< Block address
+            uint8_t             m_length;           ///< Block length
+            uint8_t*            m_data;             ///< Block data in the raw data buffer
+        };
+
+        /// Device blocks by block type and address, see getDeviceBlockKey()
+        typedef std::map<std::pair<uint8_t, uint8_t>, DeviceBlock> DeviceBlockMap;
+
         /**
           Create new instrument store.
 
@@ -72,10 +93,14 @@ class InstrumentStore {
           objects is called to update their part of the buffer, then the store raw buffer is updated with this new
           information.
 
+          In lazy mode, only the ICBs are parsed by dissect(), all other blocks are parsed on first access through
+          the get methods.
+
           @param[in]    buffer      Raw data buffer
           @param[in]    size        Raw data buffer size
+          @param[in]    lazy        If true, blocks are parsed on first access
          */
-        InstrumentStore(void* buffer, size_t size);
+        InstrumentStore(void* buffer, size_t size, bool lazy = false);
 
         /**
           Destroy instrument store.
@@ -106,16 +131,223 @@ class InstrumentStore {
             return m_size;
         }
 
+        /**
+          Get lazy mode.
+
+          Returns true if blocks other than ICBs are parsed on first access.
+
+          @return                   True for lazy mode
+         */
+        bool isLazy() const {
+            return m_lazy;
+        }
+
+        /**
+          Load all blocks.
+
+          In lazy mode, parses all blocks that haven't been accessed yet. Does nothing otherwise.
+         */
+        void loadBlocks();
+
         /**
           Copy instrument store contents.
 
-          Copies as much instrument data as possible from the source store.
-          TODO this currently assumes source store is a cartridge, this store a device.
+          Copies as much instrument data as possible from the source store of any format, block slot by block slot,
+          see StoreConverter. The data is taken from the raw buffer of the source store, all parsed objects of
+          this store are updated from the copied data. The converter is set up for this single copy, repeated
+          copies between the same formats should use the converter variant.
 
           @param[in]    source      Source instrument store to copy data from
          */
         void copyContents(const InstrumentStore& source);
 
+        /**
+          Copy instrument store contents with converter.
+
+          Copies the instrument data from the source store using a converter created for the layouts of the source
+          store and this store.
+
+          @param[in]    source      Source instrument store to copy data from
+          @param[in]    converter   Converter from the source store layout to the layout of this store
+         */
+        void copyContents(const InstrumentStore& source, const StoreConverter& converter);
+
+        /**
+          Create patch to target store.
+
+          Fills the patch with all blocks of this store that differ from the target store, see StorePatch. Both
+          stores must have the same format and layout, otherwise a DataFormatException is thrown. Changes to block
+          objects must have been written back to the raw data buffers, see update().
+
+          @param[in]    target      Target instrument store
+          @param[out]   patch       Receives the blocks turning the target into this store
+         */
+        void diffContents(const InstrumentStore& target, StorePatch& patch) const;
+
+        /**
+          Apply patch.
+
+          Writes the changed blocks of the patch to the raw data buffer, corrects the checksums and updates all
+          parsed objects from the new data. If the patch has been created for another layout or, unless forced, it
+          conflicts with blocks changed in this store since the patch was created, a DataFormatException is thrown
+          and the store is left unchanged, see StorePatch::check(). Patched blocks of a store synchronized with a
+          device become dirty, so getDirtyBlocks() returns them for a delta upload.
+
+          @param[in]    patch       Patch to apply
+          @param[in]    force       If true, blocks changed on both sides are overwritten
+         */
+        void applyPatch(const StorePatch& patch, bool force = false);
+
+        /**
+          Get device blocks.
+
+          Fills the given list with all ICB, VCF, AMPL, FREQ and WAVE blocks of this instrument store in the order
+          they are transferred to or from a device, each group ordered by block number.
+
+          @param[out]   blocks      List of device blocks
+         */
+        void getDeviceBlocks(std::vector<DeviceBlock>& blocks);
+
+        /**
+          Get device blocks by address.
+
+          Fills the given map with all device blocks of this instrument store, for looking up the blocks of received
+          messages.
+
+          @param[out]   blocks      Map of device blocks
+         */
+        void getDeviceBlocks(DeviceBlockMap& blocks);
+
+        /**
+          Get device block key.
+
+          Returns the key of a block in a DeviceBlockMap. FIXWAVE and RELWAVE blocks share the wave slots, so both
+          wave block types are mapped to the same key.
+
+          @param[in]    type        Block type
+          @param[in]    address     Block address
+
+          @return                   Device block key
+         */
+        static DeviceBlockMap::key_type getDeviceBlockKey(SysEx::BlockType type, uint8_t address);
+
+        /**
+          Get dirty device blocks.
+
+          Fills the given list with all device blocks whose data differs from the state last synchronized with the
+          device, in the same order as getDeviceBlocks(). If the store has never been synchronized, all blocks are
+          dirty.
+
+          @param[out]   blocks      List of dirty device blocks
+         */
+        void getDirtyBlocks(std::vector<DeviceBlock>& blocks);
+
+        /**
+          Mark store as synchronized.
+
+          Records the current raw data buffer contents as the state synchronized with the device, usually after
+          reading all data from the device.
+         */
+        void markSynced();
+
+        /**
+          Mark device block as synchronized.
+
+          Records the given data as the state of the device block synchronized with the device. The data may differ
+          from the current block contents if the block has been modified since it was sent.
+
+          @param[in]    block       Device block of this store
+          @param[in]    data        Block data as sent to the device
+         */
+        void markSynced(const DeviceBlock& block, const uint8_t* data);
+
+        /**
+          Forget synchronized state.
+
+          Forgets the state synchronized with the device, so all blocks are dirty again.
+         */
+        void clearSynced();
+
+        /**
+          Begin block edit.
+
+          Starts recording an edit of the given block in the edit journal. The block object is changed through its
+          setters afterwards, endEdit() writes it back and records the change. Edits with the same non-zero group,
+          e.g. all moves of one slider, are coalesced into one undo step. If the block does not exist, a
+          DataFormatException is thrown.
+
+          @param[in]    type        Block type, FIXWAVE and RELWAVE both select the WAVE block
+          @param[in]    block       Block number
+          @param[in]    group       Coalescing group, 0 for none
+         */
+        void beginEdit(SysEx::BlockType type, uint8_t block, uint32_t group = 0);
+
+        /**
+          End block edit.
+
+          Writes the block object started with beginEdit() back to the raw data buffer, records the changed bytes
+          in the edit journal and keeps the checksums of the store up to date.
+         */
+        void endEdit();
+
+        /**
+          Undo block edit.
+
+          Reverts the last edit recorded in the journal in the raw data buffer, updates the checksums and parses
+          the block object again. As blocks are only dirty while they differ from the state synchronized with the
+          device, see getDirtyBlocks(), undo is uploaded like any other edit.
+
+          @return                   True if an edit has been undone
+         */
+        bool undo();
+
+        /**
+          Redo block edit.
+
+          Applies the last undone edit again, like undo().
+
+          @return                   True if an edit has been redone
+         */
+        bool redo();
+
+        /**
+          Get edit journal.
+
+          Returns the edit journal, e.g. to seal it at the end of a slider drag or to clear it.
+
+          @return                   Edit journal
+         */
+        EditJournal& getJournal() {
+            return m_journal;
+        }
+
+        /**
+          Publish snapshot.
+
+          Creates a read-only snapshot of the current raw data buffer and publishes it atomically for getSnapshot().
+          Changes to block objects must have been written back to the raw data buffer, see update(). Must be called
+          on the thread changing the store. Once a snapshot has been published, endEdit(), undo(), redo(),
+          copyContents(), applyPatch() and dissect() publish a new one automatically, so do all users replacing the
+          store contents like reading from a device, the device cache and the SysEx reader. Edits only parse the
+          edited block for the new snapshot. Stores changed by other means, e.g. through block setters followed by
+          update(), must publish again themselves.
+
+          @return                   Published snapshot
+         */
+        std::shared_ptr<const StoreSnapshot> publishSnapshot();
+
+        /**
+          Get snapshot.
+
+          Returns the last published snapshot, nullptr if none has been published yet. May be called on any thread
+          at any time, readers keep a consistent version for as long as they hold the returned pointer. Readers
+          take no lock, they register in an atomic counter while copying the published pointer, which keeps the
+          publishing thread from freeing it.
+
+          @return                   Last published snapshot or nullptr
+         */
+        std::shared_ptr<const StoreSnapshot> getSnapshot() const;
+
 #ifdef HAVE_RTMIDI
         /**
           Read instrument store contents from device.
@@ -131,15 +363,50 @@ class InstrumentStore {
                                     bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
 
         /**
-          SysEx receive callback.
+          Read blocks from device.
 
-          If a Wersi SysEx message has been received for this instrument store, this callback is called with it.
+          Reads the given blocks from the device using MIDI, storing the block data at the given data pointers. The
+          progress display callback may return false to abort reading, in which case a MidiException is thrown.
 
-          @param[in]    message     Wersi SysEx message
+          @param[in]    outPort     MIDI output port
+          @param[in]    blocks      Blocks to read
+          @param[in]    callback    Callback for progress display
+          @param[in]    object      Object to pass to progress display callback
          */
-        virtual void receivedSysEx(std::vector<unsigned char>* message);
+        virtual void readBlocks(RtMidiOut* outPort, const std::vector<DeviceBlock>& blocks,
+                                bool(*callback)(void* object, uint32_t current, uint32_t max), void* object);
+
+        /**
+          Cancel reading from device.
+
+          Requests a read running on another thread to stop before the next block, in which case the read throws a
+          MidiException. A following read starts anew. The default implementation does nothing.
+         */
+        virtual void cancelRead();
 #endif // HAVE_RTMIDI
 
+        /**
+          Get transfer statistics.
+
+          Returns the statistics of transfers from the device, nullptr for instrument stores not backed by a device,
+          which is the default.
+
+          @return                   Transfer statistics or nullptr
+         */
+        virtual TransferStats* getStats() {
+            return nullptr;
+        }
+
+        /**
+          SysEx receive callback.
+
+          If a Wersi SysEx message has been received and decoded for this instrument store, this callback is called
+          with it. It is called from the worker thread of the SysExQueue the message was received through.
+
+          @param[in]    message     Decoded Wersi SysEx message
+         */
+        virtual void receivedSysEx(const SysEx::Message& message);
+
         /**
           Dissect instrument store raw data buffer.
 
@@ -164,40 +431,50 @@ class InstrumentStore {
         virtual size_t getNumIcbs() const = 0;
 
         /**
-          Get iterator to beginning of ICB map.
+          Get block layout.
+
+          Fills the given descriptor with the slots of all blocks in the raw data buffer and the checksums covering
+          them.
+
+          @param[out]   layout      Layout descriptor to fill
+         */
+        virtual void getLayout(StoreLayout& layout) const = 0;
+
+        /**
+          Get iterator to beginning of ICB list.
 
-          Returns an iterator to the beginning of the ICB map.
+          Returns an iterator to the beginning of the ICB list.
 
-          @return                   Iterator to the beginning of the ICB map
+          @return                   Iterator to the beginning of the ICB list
          */
-        std::map<uint8_t, Icb>::iterator begin();
+        BlockList<Icb>::iterator begin();
 
         /**
-          Get const iterator to beginning of ICB map.
+          Get const iterator to beginning of ICB list.
 
-          Returns an iterator to the beginning of the ICB map.
+          Returns an iterator to the beginning of the ICB list.
 
-          @return                   Iterator to the beginning of the ICB map
+          @return                   Iterator to the beginning of the ICB list
          */
-        std::map<uint8_t, Icb>::const_iterator begin() const;
+        BlockList<Icb>::const_iterator begin() const;
 
         /**
-          Get iterator to end of ICB map.
+          Get iterator to end of ICB list.
 
-          Returns an iterator to the end of the ICB map.
+          Returns an iterator to the end of the ICB list.
 
-          @return                   Iterator to the end of the ICB map
+          @return                   Iterator to the end of the ICB list
          */
-        std::map<uint8_t, Icb>::iterator end();
+        BlockList<Icb>::iterator end();
 
         /**
-          Get const iterator to end of ICB map.
+          Get const iterator to end of ICB list.
 
-          Returns an iterator to the end of the ICB map.
+          Returns an iterator to the end of the ICB list.
 
-          @return                   Iterator to the end of the ICB map
+          @return                   Iterator to the end of the ICB list
          */
-        std::map<uint8_t, Icb>::const_iterator end() const;
+        BlockList<Icb>::const_iterator end() const;
 
         /**
           Get ICB by block number.
@@ -257,12 +534,28 @@ class InstrumentStore {
     protected:
         uint8_t*                    m_buffer;               ///< Raw data buffer
         size_t                      m_size;                 ///< Raw data buffer size
-
-        std::map<uint8_t, Icb>      m_icb;                  ///< ICB data
-        std::map<uint8_t, Vcf>      m_vcf;                  ///< VCF data
-        std::map<uint8_t, Envelope> m_ampl;                 ///< AMPL data
-        std::map<uint8_t, Envelope> m_freq;                 ///< FREQ data
-        std::map<uint8_t, Wave>     m_wave;                 ///< WAVE data
+        std::vector<uint8_t>        m_synced;               ///< Raw data as last synchronized with the device
+        EditJournal                 m_journal;              ///< Edit journal
+        std::vector<StoreLayout::ChecksumRange> m_editChecksums;    ///< Checksums kept up to date by edits
+        bool                        m_editLayout;           ///< Set once m_editChecksums has been filled
+        SysEx::BlockType            m_editType;             ///< Type of block being edited
+        uint8_t                     m_editBlock;            ///< Number of block being edited
+        size_t                      m_editOffset;           ///< Offset of block being edited
+        uint16_t                    m_editSum;              ///< Byte sum of block being edited before the edit
+        bool                        m_lazy;                 ///< Parse blocks on first access
+        std::shared_ptr<const StoreSnapshot> m_snapshot;    ///< Last published snapshot, for the changing thread
+        uint64_t                    m_snapshotVersion;      ///< Version of last published snapshot
+        /// Reference to the last published snapshot copied by readers
+        std::atomic<const std::shared_ptr<const StoreSnapshot>*> m_published;
+        mutable std::atomic<uint32_t> m_snapshotReaders;    ///< Number of readers copying the published reference
+        /// Replaced references readers may still be copying
+        std::vector<const std::shared_ptr<const StoreSnapshot>*> m_retired;
+
+        BlockList<Icb>              m_icb;                  ///< ICB data
+        BlockList<Vcf>              m_vcf;                  ///< VCF data
+        BlockList<Envelope>         m_ampl;                 ///< AMPL data
+        BlockList<Envelope>         m_freq;                 ///< FREQ data
+        BlockList<Wave>             m_wave;                 ///< WAVE data
 
         /**
           Clear all lists.
@@ -271,7 +564,140 @@ class InstrumentStore {
          */
         void clearLists();
 
+        /**
+          Update all modified blocks.
+
+          Calls the update() method of all parsed blocks modified since they have been parsed or written back, see
+          isModified() of the block classes. Returns the difference of the byte sum before and after the update
+          within the given buffer range, so a checksum covering this range can be adjusted by summing up the
+          modified blocks only.
+
+          @param[in]    begin       Start offset of checksum range
+          @param[in]    end         End offset of checksum range
+
+          @return                   Byte sum delta within range
+         */
+        uint16_t updateBlocks(size_t begin, size_t end);
+
+        /**
+          Load all blocks.
+
+          Called by loadBlocks() in lazy mode to parse all blocks not parsed yet. The default implementation does
+          nothing.
+         */
+        virtual void loadAll();
+
+        /**
+          Load VCF.
+
+          Called in lazy mode if a VCF is accessed that hasn't been parsed yet. Implementations parse the block and
+          insert it into the VCF list if it exists. The default implementation does nothing.
+
+          @param[in]    block       Block number of VCF to load
+         */
+        virtual void loadVcf(uint8_t block);
+
+        /**
+          Load AMPL.
+
+          Called in lazy mode if an AMPL is accessed that hasn't been parsed yet. Implementations parse the block and
+          insert it into the AMPL list if it exists. The default implementation does nothing.
+
+          @param[in]    block       Block number of AMPL to load
+         */
+        virtual void loadAmpl(uint8_t block);
+
+        /**
+          Load FREQ.
+
+          Called in lazy mode if a FREQ is accessed that hasn't been parsed yet. Implementations parse the block and
+          insert it into the FREQ list if it exists. The default implementation does nothing.
+
+          @param[in]    block       Block number of FREQ to load
+         */
+        virtual void loadFreq(uint8_t block);
+
+        /**
+          Load WAVE.
+
+          Called in lazy mode if a WAVE is accessed that hasn't been parsed yet. Implementations parse the block and
+          insert it into the WAVE list if it exists. The default implementation does nothing.
+
+          @param[in]    block       Block number of WAVE to load
+         */
+        virtual void loadWave(uint8_t block);
+
+        /**
+          Publish snapshot after change.
+
+          Publishes a new snapshot if one has been published before, called after the raw data buffer has changed
+          as a whole. All blocks are parsed for the new snapshot.
+         */
+        void republishSnapshot();
+
+        /**
+          Publish snapshot after change of byte range.
+
+          Publishes a new snapshot if one has been published before, called after the given range of the raw data
+          buffer has changed. Only the blocks overlapping the range are parsed for the new snapshot, all others
+          are shared with the previous one.
+
+          @param[in]    offset      Offset of changed bytes
+          @param[in]    length      Number of changed bytes
+         */
+        void republishSnapshot(size_t offset, size_t length);
+
+        /**
+          Parse all parsed blocks again.
+
+          Updates all parsed objects from the raw data buffer after it has been changed as a whole.
+         */
+        void reparseBlocks();
+
     private:
+        /// Action on a block object accessed by accessBlock()
+        enum class BlockAction {
+            None,                                           ///< Only locate the block
+            Update,                                         ///< Write the object back to the raw data buffer
+            Dissect                                         ///< Parse the raw data into the object
+        };
+
+        /**
+          Access block object.
+
+          Locates the given block object, performs the action on it and returns its raw data. If the block does
+          not exist, a DataFormatException is thrown.
+
+          @param[in]    type        Block type
+          @param[in]    block       Block number
+          @param[in]    action      Action to perform
+          @param[out]   length      Block length
+
+          @return                   Block data in the raw data buffer
+         */
+        uint8_t* accessBlock(SysEx::BlockType type, uint8_t block, BlockAction action, size_t& length);
+
+        /**
+          Make snapshot available.
+
+          Publishes the snapshot for getSnapshot() and frees the references replaced before once no reader is
+          copying one.
+
+          @param[in]    snapshot    Snapshot to publish
+         */
+        void publish(const std::shared_ptr<const StoreSnapshot>& snapshot);
+
+        /**
+          Adjust checksums after edit.
+
+          Adjusts all checksums covering the given offset by the byte sum delta of an edit. On first use, the
+          checksums are taken from the store layout.
+
+          @param[in]    offset      Offset of edited data
+          @param[in]    delta       Byte sum delta of the edit
+         */
+        void adjustChecksums(size_t offset, uint16_t delta);
+
         InstrumentStore(const InstrumentStore&);            ///< Inhibit copying objects
         InstrumentStore& operator=(const InstrumentStore&); ///< Inhibit copying objects
 };
@@ -0,0 +1,172 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/libraryindex.hh>
+#include <wersi/instrumentstore.hh>
+#include <wersi/blockpool.hh>
+#include <wersi/icb.hh>
+#include <wersi/binaryfile.hh>
+#include <exceptions.hh>
+
+using namespace std;
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Index file format
+static const BinaryFormat s_format = { { 'D', 'M', 'S', 'I' }, 1, "index file" };
+
+// Create new library index
+LibraryIndex::LibraryIndex()
+    : m_entries()
+{
+}
+
+// Destroy library index
+LibraryIndex::~LibraryIndex()
+{
+}
+
+// Load index file
+void LibraryIndex::load(const string& fileName)
+{
+    BinaryReader::load(fileName, s_format, m_entries, [this](BinaryReader& reader) {
+        size_t count = reader.get(4);
+        for (size_t i = 0; i < count; ++i) {
+            Entry entry;
+            entry.m_path = reader.getString();
+            entry.m_mtime = int64_t(reader.get(8));
+            entry.m_size = reader.get(8);
+            entry.m_hash = reader.get(8);
+            entry.m_format = reader.getString();
+            size_t num = reader.get(2);
+            for (size_t j = 0; j < num; ++j) {
+                uint8_t icb = uint8_t(reader.get(1));
+                Instrument inst = { icb, reader.getString() };
+                entry.m_instruments.push_back(inst);
+            }
+            num = reader.get(2);
+            entry.m_blocks.reserve(num);
+            for (size_t j = 0; j < num; ++j) {
+                Block block;
+                block.m_type = SysEx::BlockType(reader.get(1));
+                block.m_block = uint8_t(reader.get(1));
+                block.m_length = uint8_t(reader.get(1));
+                block.m_offset = uint16_t(reader.get(2));
+                entry.m_blocks.push_back(block);
+            }
+            m_entries[entry.m_path] = entry;
+        }
+    });
+}
+
+// Save index file
+void LibraryIndex::save(const string& fileName) const
+{
+    BinaryWriter writer(s_format);
+    writer.put(m_entries.size(), 4);
+    for (auto& i : m_entries) {
+        const Entry& entry = i.second;
+        writer.putString(entry.m_path);
+        writer.put(uint64_t(entry.m_mtime), 8);
+        writer.put(entry.m_size, 8);
+        writer.put(entry.m_hash, 8);
+        writer.putString(entry.m_format);
+        writer.put(entry.m_instruments.size(), 2);
+        for (auto& j : entry.m_instruments) {
+            writer.put(j.m_icb, 1);
+            writer.putString(j.m_name);
+        }
+        writer.put(entry.m_blocks.size(), 2);
+        for (auto& j : entry.m_blocks) {
+            writer.put(uint8_t(j.m_type), 1);
+            writer.put(j.m_block, 1);
+            writer.put(j.m_length, 1);
+            writer.put(j.m_offset, 2);
+        }
+    }
+
+    writer.save(fileName);
+}
+
+// Find entry
+const LibraryIndex::Entry* LibraryIndex::find(const string& path, int64_t mtime, uint64_t size) const
+{
+    auto i = m_entries.find(path);
+    if (i == m_entries.end() || i->second.m_mtime != mtime || i->second.m_size != size) {
+        return nullptr;
+    }
+    return &(i->second);
+}
+
+// Insert entry
+void LibraryIndex::insert(const Entry& entry)
+{
+    m_entries[entry.m_path] = entry;
+}
+
+// Remove entry
+void LibraryIndex::remove(const string& path)
+{
+    m_entries.erase(path);
+}
+
+// Describe instrument store
+void LibraryIndex::describe(Entry& entry, InstrumentStore& store, const string& format)
+{
+    auto buffer = static_cast<const uint8_t*>(store.getBuffer());
+    entry.m_hash = BlockPool::hash(buffer, store.getBufferSize());
+    entry.m_format = format;
+
+    entry.m_instruments.clear();
+    for (auto& i : store) {
+        Instrument inst = { i.first, i.second.getName() };
+        entry.m_instruments.push_back(inst);
+    }
+
+    vector<InstrumentStore::DeviceBlock> blocks;
+    store.getDeviceBlocks(blocks);
+    entry.m_blocks.clear();
+    entry.m_blocks.reserve(blocks.size());
+    for (auto& i : blocks) {
+        Block block = { i.m_type, i.m_address, i.m_length, uint16_t(i.m_data - buffer) };
+        entry.m_blocks.push_back(block);
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
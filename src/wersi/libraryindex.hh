@@ -0,0 +1,197 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <wersi/sysex.hh>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class InstrumentStore;
+
+/**
+  @ingroup wersi_group
+
+  Persistent cartridge library index.
+
+  Caches the detected format, the instrument names and the block layout of cartridge files in a compact binary index
+  file, so a library can be displayed without opening and dissecting all cartridges. Entries are keyed by file path
+  and are only valid as long as modification time and size of the file match. The content hash allows recognizing
+  unchanged contents after a file has been touched.
+ */
+class LibraryIndex {
+    public:
+        /// Instrument of an indexed cartridge
+        struct Instrument {
+            uint8_t                 m_icb;          ///< ICB block number
+            std::string             m_name;         ///< Instrument name
+        };
+
+        /// Block of an indexed cartridge
+        struct Block {
+            SysEx::BlockType        m_type;         ///< SysEx block type
+            uint8_t                 m_block;        ///< Block number
+            uint8_t                 m_length;       ///< Block length
+            uint16_t                m_offset;       ///< Block offset in cartridge image
+        };
+
+        /// Indexed cartridge file
+        struct Entry {
+            /// Create empty entry
+            Entry()
+                : m_path()
+                , m_mtime(0)
+                , m_size(0)
+                , m_hash(0)
+                , m_format()
+                , m_instruments()
+                , m_blocks() {
+            }
+
+            std::string                 m_path;         ///< File path
+            int64_t                     m_mtime;        ///< File modification time
+            uint64_t                    m_size;         ///< File size
+            uint64_t                    m_hash;         ///< Hash of file contents
+            std::string                 m_format;       ///< Cartridge format name
+            std::vector<Instrument>     m_instruments;  ///< Instruments in ICB list order
+            std::vector<Block>          m_blocks;       ///< All blocks in device block order
+        };
+
+        /**
+          Create new library index.
+
+          Creates an empty library index.
+         */
+        LibraryIndex();
+
+        /**
+          Destroy library index.
+
+          Destroys the library index.
+         */
+        ~LibraryIndex();
+
+        /**
+          Load index file.
+
+          Replaces all entries with the contents of the given index file. A SystemException is thrown if the file
+          can't be read, a DataFormatException if it is broken or has been written by an incompatible version. The
+          index is empty then.
+
+          @param[in]    fileName    Index file name
+         */
+        void load(const std::string& fileName);
+
+        /**
+          Save index file.
+
+          Writes all entries to the given index file. The file is written to a temporary file first and renamed, so
+          an interrupted write never leaves a broken index. A SystemException is thrown on errors.
+
+          @param[in]    fileName    Index file name
+         */
+        void save(const std::string& fileName) const;
+
+        /**
+          Find entry.
+
+          Returns the entry for the given file if modification time and size match, nullptr otherwise.
+
+          @param[in]    path        File path
+          @param[in]    mtime       File modification time
+          @param[in]    size        File size
+
+          @return                   Pointer to entry or nullptr
+         */
+        const Entry* find(const std::string& path, int64_t mtime, uint64_t size) const;
+
+        /**
+          Insert entry.
+
+          Inserts the entry, replacing any entry for the same file path.
+
+          @param[in]    entry       Entry to insert
+         */
+        void insert(const Entry& entry);
+
+        /**
+          Remove entry.
+
+          Removes the entry for the given file path, if any.
+
+          @param[in]    path        File path
+         */
+        void remove(const std::string& path);
+
+        /**
+          Get number of entries.
+
+          Returns the number of indexed files.
+
+          @return                   Number of entries
+         */
+        size_t size() const {
+            return m_entries.size();
+        }
+
+        /**
+          Describe instrument store.
+
+          Fills the format, hash, instrument and block members of the entry from the given instrument store and its
+          raw data. In lazy mode, all blocks of the store are parsed.
+
+          @param[out]   entry       Entry to fill, path, modification time and size are left untouched
+          @param[in]    store       Instrument store opened from the data
+          @param[in]    format      Cartridge format name
+         */
+        static void describe(Entry& entry, InstrumentStore& store, const std::string& format);
+
+    private:
+        std::map<std::string, Entry>    m_entries;      ///< Entries by file path
+
+        LibraryIndex(const LibraryIndex&);              ///< Inhibit copying objects
+        LibraryIndex& operator=(const LibraryIndex&);   ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -36,176 +36,374 @@
  */
 
 #include <wersi/mk1cartridge.hh>
+#include <wersi/checksum.hh>
+#include <wersi/storeconverter.hh>
 #include <wersi/icb.hh>
 #include <wersi/vcf.hh>
 #include <wersi/envelope.hh>
 #include <wersi/wave.hh>
-#include <exceptions.hh>
 
 using namespace std;
 
 namespace DMSToolbox {
 namespace Wersi {
 
+// Block sizes, defined here as they may be bound to references
+constexpr uint8_t Mk1Cartridge::s_icbSize;
+constexpr uint8_t Mk1Cartridge::s_vcfSize;
+constexpr uint8_t Mk1Cartridge::s_amplSize;
+constexpr uint8_t Mk1Cartridge::s_freqSize;
+
 // Create new MK1 cartridge object
-Mk1Cartridge::Mk1Cartridge(void* buffer, bool /*initialize*/)
-    : InstrumentStore(buffer, 16384)
+Mk1Cartridge::Mk1Cartridge(void* buffer, bool /*initialize*/, bool lazy)
+    : InstrumentStore(buffer, 16384, lazy)
+    , m_vcfPtr(0)
+    , m_amplPtr(0)
+    , m_freqPtr(0)
+    , m_wavePtr(0)
+    , m_maxVcf(0)
+    , m_maxAmpl(0)
+    , m_maxFreq(0)
+    , m_maxWave(0)
 {
     dissect();
 }
 
+// Create new MK1 cartridge object without throwing on invalid data
+Mk1Cartridge::Mk1Cartridge(void* buffer, bool lazy, Status& status)
+    : InstrumentStore(buffer, 16384, lazy)
+    , m_vcfPtr(0)
+    , m_amplPtr(0)
+    , m_freqPtr(0)
+    , m_wavePtr(0)
+    , m_maxVcf(0)
+    , m_maxAmpl(0)
+    , m_maxFreq(0)
+    , m_maxWave(0)
+{
+    dissect(status);
+}
+
+// Create MK1 cartridge object, nullptr on invalid data
+Mk1Cartridge* Mk1Cartridge::create(void* buffer, bool lazy, Status& status)
+{
+    status.clear();
+    Mk1Cartridge* cartridge = new Mk1Cartridge(buffer, lazy, status);
+    if (!status.isOk()) {
+        delete cartridge;
+        return nullptr;
+    }
+    return cartridge;
+}
+
 // Destroy MK1 cartridge object
 Mk1Cartridge::~Mk1Cartridge()
 {
 }
 
+// Probe raw data for MK1 cartridge image
+unsigned Mk1Cartridge::probe(const void* buffer, size_t size)
+{
+    auto data = static_cast<const uint8_t*>(buffer);
+    if (size != 16384 || data[0] != 0xff || data[1] != 0xff) {
+        return 0;
+    }
+
+    // All pointer tables and the ICBs of the 20 fixed instruments must be inside the image
+    for (size_t i = 2; i < 12; i += 2) {
+        if (((data[i] << 8) | data[i + 1]) >= 0x3ffe) {
+            return 0;
+        }
+    }
+    size_t icbPtr = (data[2] << 8) | data[3];
+    for (size_t i = 0; i < 20; ++i) {
+        size_t idx = icbPtr + i * 2;
+        if (idx + 1 >= 0x3ffe || size_t((data[idx] << 8) | data[idx + 1]) + s_icbSize > 0x3ffe) {
+            return 0;
+        }
+    }
+    return 90;
+}
+
 // Dissect raw MK1 cartridge data
 void Mk1Cartridge::dissect()
+{
+    Status status;
+    if (!dissect(status)) {
+        status.raise();
+    }
+}
+
+// Dissect raw MK1 cartridge data without throwing
+bool Mk1Cartridge::dissect(Status& status)
 {
     clearLists();
+    if (!dissectTables(status)) {
+        status.prepend("Invalid MK1 cartridge, ");
+        return false;
+    }
+    republishSnapshot();
+    return true;
+}
 
-    try {
-        // Check header bytes
-        uint16_t dummy = (m_buffer[0] << 8) | m_buffer[1];
-        if (dummy != 0xffff) {
-            throw DataFormatException("first two bytes need to be 0xff");
-        }
+// Check pointer tables and extract ICBs
+bool Mk1Cartridge::dissectTables(Status& status)
+{
+    // Check header bytes
+    uint16_t dummy = (m_buffer[0] << 8) | m_buffer[1];
+    if (dummy != 0xffff) {
+        return status.fail(Status::Code::DataFormat, "first two bytes need to be 0xff");
+    }
 
-        // Verify checksum
-        uint16_t check = 0;
-        for (size_t i = 0; i < 0x3ffe; ++i) {
-            check += m_buffer[i];
-        }
-        dummy = (m_buffer[0x3ffe] << 8) | m_buffer[0x3fff];
-        dummy += check;
-        if (dummy != 0) {
-            throw DataFormatException("checksum verification failed");
-        }
+    // Verify checksum
+    if (!Checksum::verify(m_buffer, 0x3ffe, &(m_buffer[0x3ffe]))) {
+        return status.fail(Status::Code::DataFormat, "checksum verification failed");
+    }
+
+    // Extract pointer table pointers
+    uint16_t icbPtr = (m_buffer[2] << 8) | m_buffer[3];
+    if (icbPtr >= 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid ICB table pointer");
+    }
+    m_vcfPtr = (m_buffer[4] << 8) | m_buffer[5];
+    if (m_vcfPtr >= 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid VCF table pointer");
+    }
+    m_amplPtr = (m_buffer[6] << 8) | m_buffer[7];
+    if (m_amplPtr >= 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid AMPL table pointer");
+    }
+    m_freqPtr = (m_buffer[8] << 8) | m_buffer[9];
+    if (m_freqPtr >= 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid FREQ table pointer");
+    }
+    m_wavePtr = (m_buffer[10] << 8) | m_buffer[11];
+    if (m_wavePtr >= 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid WAVE table pointer");
+    }
+
+    // Initialize extraction
+    size_t current = 129; // ICBs start counting at 1, bit 7 is for cartridge
+    size_t maxIcb = current + 19; // Dynamic number of ICBs, init with 20 instruments that are always there
+    m_maxVcf = 0;
+    m_maxAmpl = 0;
+    m_maxFreq = 0;
+    m_maxWave = 0;
+    m_icb.reserve(20);
 
-        // Extract pointer table pointers
-        uint16_t icbPtr = (m_buffer[2] << 8) | m_buffer[3];
-        if (icbPtr >= 0x3ffe) {
-            throw DataFormatException("invalid ICB table pointer");
+    // Extract ICBs, they determine the number of all other blocks
+    while (current <= maxIcb) {
+        uint16_t offset = 0;
+        if (!checkBlockOffset(icbPtr, current - 129, "ICB", s_icbSize, offset, status)) {
+            return false;
         }
-        uint16_t vcfPtr = (m_buffer[4] << 8) | m_buffer[5];
-        if (vcfPtr >= 0x3ffe) {
-            throw DataFormatException("invalid VCF table pointer");
+        Icb icb(current, &(m_buffer[offset]));
+        m_icb.insert(pair<uint8_t, Icb>(current, icb));
+        uint8_t tmp = icb.getNextIcb();
+        if (tmp > maxIcb) {
+            maxIcb = tmp;
         }
-        uint16_t amplPtr = (m_buffer[6] << 8) | m_buffer[7];
-        if (amplPtr >= 0x3ffe) {
-            throw DataFormatException("invalid AMPL table pointer");
+        tmp = icb.getVcfBlock();
+        if (tmp > m_maxVcf) {
+            m_maxVcf = tmp;
         }
-        uint16_t freqPtr = (m_buffer[8] << 8) | m_buffer[9];
-        if (freqPtr >= 0x3ffe) {
-            throw DataFormatException("invalid FREQ table pointer");
+        tmp = icb.getAmplBlock();
+        if (tmp > m_maxAmpl) {
+            m_maxAmpl = tmp;
         }
-        uint16_t wavePtr = (m_buffer[10] << 8) | m_buffer[11];
-        if (wavePtr >= 0x3ffe) {
-            throw DataFormatException("invalid WAVE table pointer");
+        tmp = icb.getFreqBlock();
+        if (tmp > m_maxFreq) {
+            m_maxFreq = tmp;
         }
-
-        // Initialize extraction
-        size_t current = 129; // ICBs start counting at 1, bit 7 is for cartridge
-        size_t maxIcb = current + 19; // Dynamic number of ICBs, init with 20 instruments that are always there
-        size_t maxVcf = 0;
-        size_t maxAmpl = 0;
-        size_t maxFreq = 0;
-        size_t maxWave = 0;
-
-        // Extract ICBs
-        while (current <= maxIcb) {
-            uint16_t idx = (current - 129) * 2 + icbPtr;
-            idx = (m_buffer[idx] << 8) | m_buffer[idx + 1];
-            if (idx >= 0x3ffe) {
-                throw DataFormatException("invalid ICB pointer");
-            }
-            Icb icb(current, &(m_buffer[idx]));
-            m_icb.insert(pair<uint8_t, Icb>(current, icb));
-            uint8_t tmp = icb.getNextIcb();
-            if (tmp > maxIcb) {
-                maxIcb = tmp;
-            }
-            tmp = icb.getVcfBlock();
-            if (tmp > maxVcf) {
-                maxVcf = tmp;
-            }
-            tmp = icb.getAmplBlock();
-            if (tmp > maxAmpl) {
-                maxAmpl = tmp;
-            }
-            tmp = icb.getFreqBlock();
-            if (tmp > maxFreq) {
-                maxFreq = tmp;
-            }
-            tmp = icb.getWaveBlock();
-            if (tmp > maxWave) {
-                maxWave = tmp;
-            }
-            ++current;
+        tmp = icb.getWaveBlock();
+        if (tmp > m_maxWave) {
+            m_maxWave = tmp;
         }
+        ++current;
+    }
 
-        // Extract VCFs
-        current = 128;
-        while (current < maxVcf) {
-            uint16_t idx = (current - 128) * 2 + vcfPtr;
-            idx = (m_buffer[idx] << 8) | m_buffer[idx + 1];
-            if (idx >= 0x3ffe) {
-                throw DataFormatException("invalid VCF pointer");
-            }
-            Vcf vcf(current, &(m_buffer[idx]));
-            m_vcf.insert(pair<uint8_t, Vcf>(current, vcf));
-            ++current;
-        }
+    // Reserve all other blocks, so lazy loading never moves blocks already handed out
+    m_vcf.reserve(m_maxVcf >= 128 ? m_maxVcf - 127 : 0);
+    m_ampl.reserve(m_maxAmpl >= 128 ? m_maxAmpl - 127 : 0);
+    m_freq.reserve(m_maxFreq >= 128 ? m_maxFreq - 127 : 0);
+    m_wave.reserve(m_maxWave >= 128 ? m_maxWave - 127 : 0);
 
-        // Extract AMPLs
-        current = 128;
-        while (current < maxAmpl) {
-            uint16_t idx = (current - 128) * 2 + amplPtr;
-            idx = (m_buffer[idx] << 8) | m_buffer[idx + 1];
-            if (idx >= 0x3ffe) {
-                throw DataFormatException("invalid AMPL pointer");
+    // Extract all other blocks now, unless they are parsed on first access. All pointers are checked first, so
+    // loading them can't throw.
+    if (!m_lazy) {
+        static const char* const names[] = { "VCF", "AMPL", "FREQ" };
+        const uint16_t tables[] = { m_vcfPtr, m_amplPtr, m_freqPtr };
+        const uint8_t maxBlocks[] = { m_maxVcf, m_maxAmpl, m_maxFreq };
+        const size_t sizes[] = { s_vcfSize, s_amplSize, s_freqSize };
+        for (size_t i = 0; i < 3; ++i) {
+            for (size_t block = 128; block <= maxBlocks[i]; ++block) {
+                uint16_t offset = 0;
+                if (!checkBlockOffset(tables[i], block - 128, names[i], sizes[i], offset, status)) {
+                    return false;
+                }
             }
-            Envelope ampl(current, &(m_buffer[idx]), 44);
-            m_ampl.insert(pair<uint8_t, Envelope>(current, ampl));
-            ++current;
         }
-
-        // Extract FREQs
-        current = 128;
-        while (current < maxFreq) {
-            uint16_t idx = (current - 128) * 2 + freqPtr;
-            idx = (m_buffer[idx] << 8) | m_buffer[idx + 1];
-            if (idx >= 0x3ffe) {
-                throw DataFormatException("invalid FREQ pointer");
+        for (size_t block = 128; block <= m_maxWave; ++block) {
+            uint16_t offset = 0;
+            size_t size = 0;
+            if (!checkWaveOffset(block - 128, offset, size, status)) {
+                return false;
             }
-            Envelope freq(current, &(m_buffer[idx]), 32);
-            m_freq.insert(pair<uint8_t, Envelope>(current, freq));
-            ++current;
         }
+        loadAll();
+    }
+    return true;
+}
 
-        // Extract WAVEs
-        current = 128;
-        while (current < maxWave) {
-            uint16_t idx = (current - 128) * 2 + wavePtr;
-            idx = (m_buffer[idx] << 8) | m_buffer[idx + 1];
-            if (idx >= 0x3ffe) {
-                throw DataFormatException("invalid WAVE pointer");
-            }
-            Wave wave(current, &(m_buffer[idx]), (m_buffer[idx] & 0x80) == 0 ? 177 : 212);
-            m_wave.insert(pair<uint8_t, Wave>(current, wave));
-            ++current;
-        }
+// Get block offset from pointer table
+uint16_t Mk1Cartridge::getBlockOffset(uint16_t table, size_t index, const char* type, size_t size) const
+{
+    Status status;
+    uint16_t offset = 0;
+    if (!checkBlockOffset(table, index, type, size, offset, status)) {
+        status.raise();
+    }
+    return offset;
+}
+
+// Get and check block offset from pointer table
+bool Mk1Cartridge::checkBlockOffset(uint16_t table, size_t index, const char* type, size_t size, uint16_t& offset,
+                                    Status& status) const
+{
+    size_t idx = index * 2 + table;
+    if (idx + 1 >= 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid %s pointer table", type);
+    }
+
+    // The whole block must be inside the checksummed data, the raw buffer may end right behind the checksum
+    offset = (m_buffer[idx] << 8) | m_buffer[idx + 1];
+    if (size_t(offset) + size > 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid %s pointer", type);
+    }
+    return true;
+}
+
+// Get and check wave offset from pointer table
+bool Mk1Cartridge::checkWaveOffset(size_t index, uint16_t& offset, size_t& size, Status& status) const
+{
+    // The header byte tells the wave size, so it is checked first
+    if (!checkBlockOffset(m_wavePtr, index, "WAVE", 1, offset, status)) {
+        return false;
     }
-    catch (DataFormatException& e) {
-        DataFormatException exc("Invalid MK1 cartridge, ");
-        exc << e.what();
-        throw exc;
+    size = WaveLayout::getBlockSize(m_buffer[offset]);
+    if (size_t(offset) + size > 0x3ffe) {
+        return status.fail(Status::Code::DataFormat, "invalid WAVE pointer");
     }
+    return true;
+}
+
+// Get wave offset from pointer table
+uint16_t Mk1Cartridge::getWaveOffset(size_t index, size_t& size) const
+{
+    Status status;
+    uint16_t offset = 0;
+    if (!checkWaveOffset(index, offset, size, status)) {
+        status.raise();
+    }
+    return offset;
+}
+
+// Load all blocks
+void Mk1Cartridge::loadAll()
+{
+    for (size_t current = 128; current <= m_maxVcf; ++current) {
+        loadVcf(current);
+    }
+    for (size_t current = 128; current <= m_maxAmpl; ++current) {
+        loadAmpl(current);
+    }
+    for (size_t current = 128; current <= m_maxFreq; ++current) {
+        loadFreq(current);
+    }
+    for (size_t current = 128; current <= m_maxWave; ++current) {
+        loadWave(current);
+    }
+}
+
+// Load VCF
+void Mk1Cartridge::loadVcf(uint8_t block)
+{
+    if (block >= 128 && block <= m_maxVcf && m_vcf.find(block) == m_vcf.end()) {
+        Vcf vcf(block, &(m_buffer[getBlockOffset(m_vcfPtr, block - 128, "VCF", s_vcfSize)]));
+        m_vcf.insert(pair<uint8_t, Vcf>(block, vcf));
+    }
+}
+
+// Load AMPL
+void Mk1Cartridge::loadAmpl(uint8_t block)
+{
+    if (block >= 128 && block <= m_maxAmpl && m_ampl.find(block) == m_ampl.end()) {
+        Envelope ampl(block, &(m_buffer[getBlockOffset(m_amplPtr, block - 128, "AMPL", s_amplSize)]), s_amplSize);
+        m_ampl.insert(pair<uint8_t, Envelope>(block, ampl));
+    }
+}
+
+// Load FREQ
+void Mk1Cartridge::loadFreq(uint8_t block)
+{
+    if (block >= 128 && block <= m_maxFreq && m_freq.find(block) == m_freq.end()) {
+        Envelope freq(block, &(m_buffer[getBlockOffset(m_freqPtr, block - 128, "FREQ", s_freqSize)]), s_freqSize);
+        m_freq.insert(pair<uint8_t, Envelope>(block, freq));
+    }
+}
+
+// Load WAVE
+void Mk1Cartridge::loadWave(uint8_t block)
+{
+    if (block >= 128 && block <= m_maxWave && m_wave.find(block) == m_wave.end()) {
+        size_t size = 0;
+        uint16_t idx = getWaveOffset(block - 128, size);
+        Wave wave(block, &(m_buffer[idx]), size);
+        m_wave.insert(pair<uint8_t, Wave>(block, wave));
+    }
+}
+
+// Get block layout
+void Mk1Cartridge::getLayout(StoreLayout& layout) const
+{
+    // Slots are taken from the pointer tables, the ICB list holds all ICBs of the instrument chains
+    uint16_t icbPtr = (m_buffer[2] << 8) | m_buffer[3];
+    for (size_t i = 0; i < m_icb.size(); ++i) {
+        StoreLayout::Slot slot = { uint8_t(129 + i), s_icbSize, getBlockOffset(icbPtr, i, "ICB", s_icbSize) };
+        layout.m_icb.push_back(slot);
+    }
+    for (size_t current = 128; current <= m_maxVcf; ++current) {
+        uint16_t idx = getBlockOffset(m_vcfPtr, current - 128, "VCF", s_vcfSize);
+        StoreLayout::Slot slot = { uint8_t(current), s_vcfSize, idx };
+        layout.m_vcf.push_back(slot);
+    }
+    for (size_t current = 128; current <= m_maxAmpl; ++current) {
+        uint16_t idx = getBlockOffset(m_amplPtr, current - 128, "AMPL", s_amplSize);
+        StoreLayout::Slot slot = { uint8_t(current), s_amplSize, idx };
+        layout.m_ampl.push_back(slot);
+    }
+    for (size_t current = 128; current <= m_maxFreq; ++current) {
+        uint16_t idx = getBlockOffset(m_freqPtr, current - 128, "FREQ", s_freqSize);
+        StoreLayout::Slot slot = { uint8_t(current), s_freqSize, idx };
+        layout.m_freq.push_back(slot);
+    }
+    for (size_t current = 128; current <= m_maxWave; ++current) {
+        size_t size = 0;
+        uint16_t idx = getWaveOffset(current - 128, size);
+        StoreLayout::Slot slot = { uint8_t(current), uint8_t(size), idx };
+        layout.m_wave.push_back(slot);
+    }
+
+    // The checksum covers the whole image except itself
+    StoreLayout::ChecksumRange checksum = { 0, 0x3ffe, 0x3ffe };
+    layout.m_checksums.push_back(checksum);
 }
 
 // Put together and update MK1 cartridge raw data
 void Mk1Cartridge::update()
 {
+    // The checksum covers the whole image except itself
+    Checksum::adjust(&(m_buffer[0x3ffe]), updateBlocks(0, 0x3ffe));
 }
 
 } // namespace Wersi
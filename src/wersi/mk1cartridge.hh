@@ -38,6 +38,7 @@
 #pragma once
 
 #include <wersi/instrumentstore.hh>
+#include <wersi/blocklayout.hh>
 
 namespace DMSToolbox {
 namespace Wersi {
@@ -60,12 +61,16 @@ class Mk1Cartridge : public InstrumentStore {
           is called, the update() method of all contained objects is called to update their part of the buffer, then
           the cartridge raw buffer is updated with this new information.
 
+          In lazy mode, only the header, checksum and ICBs are checked and parsed during creation, all other blocks
+          are parsed on first access. A DataFormatException for a broken block pointer is thrown by the access then.
+
           @todo implement double buffering for this
 
           @param[in]    buffer      Raw data buffer
           @param[in]    initialize  If true, a blank MK1 cartridge is created
+          @param[in]    lazy        If true, blocks are parsed on first access
          */
-        Mk1Cartridge(void* buffer, bool initialize = false);
+        Mk1Cartridge(void* buffer, bool initialize = false, bool lazy = false);
 
         /**
           Destroy MK1 cartridge object.
@@ -74,9 +79,35 @@ class Mk1Cartridge : public InstrumentStore {
          */
         virtual ~Mk1Cartridge();
 
+        /**
+          Create MK1 cartridge object without throwing.
+
+          Creates a new MK1 cartridge object like the constructor does, but reports invalid data in the given status
+          instead of throwing a DataFormatException, e.g. for scanning many files of unknown format. The status is
+          reset first, so it can be reused for any number of calls.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    lazy        If true, blocks are parsed on first access
+          @param[out]   status      Receives the error, if any
+
+          @return                   Newly created MK1 cartridge object to be deleted by the caller, nullptr on error
+         */
+        static Mk1Cartridge* create(void* buffer, bool lazy, Status& status);
+
         /// Implements InstrumentStore::dissect()
         virtual void dissect();
 
+        /**
+          Dissect raw data without throwing.
+
+          Same as dissect(), but errors are reported in the given status instead of throwing a DataFormatException.
+
+          @param[out]   status      Receives the error, if any
+
+          @return                   True if the raw data has been dissected
+         */
+        bool dissect(Status& status);
+
         /// Implements InstrumentStore::update()
         virtual void update();
 
@@ -85,7 +116,137 @@ class Mk1Cartridge : public InstrumentStore {
             return 20;
         }
 
+        /// Implements InstrumentStore::getLayout()
+        virtual void getLayout(StoreLayout& layout) const;
+
+        /**
+          Probe raw data.
+
+          Checks if the given raw data looks like an MK1 cartridge image, without parsing it or throwing exceptions.
+          Only the size, the header and the sanity of the pointer tables are checked, the checksum is left for
+          dissect().
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    size        Size of raw data buffer
+
+          @return                   Confidence from 0 (not an MK1 image) to 100 (certainly an MK1 image)
+         */
+        static unsigned probe(const void* buffer, size_t size);
+
+    protected:
+        /// Implements InstrumentStore::loadAll()
+        virtual void loadAll();
+
+        /// Implements InstrumentStore::loadVcf()
+        virtual void loadVcf(uint8_t block);
+
+        /// Implements InstrumentStore::loadAmpl()
+        virtual void loadAmpl(uint8_t block);
+
+        /// Implements InstrumentStore::loadFreq()
+        virtual void loadFreq(uint8_t block);
+
+        /// Implements InstrumentStore::loadWave()
+        virtual void loadWave(uint8_t block);
+
     private:
+        static constexpr uint8_t s_icbSize = BlockLayout<SysEx::BlockType::IcBlock>::s_size;      ///< ICB size
+        static constexpr uint8_t s_vcfSize = BlockLayout<SysEx::BlockType::VcfBlock>::s_size;     ///< VCF size
+        static constexpr uint8_t s_amplSize = BlockLayout<SysEx::BlockType::AmplBlock>::s_size;   ///< AMPL size
+        static constexpr uint8_t s_freqSize = BlockLayout<SysEx::BlockType::FreqBlock>::s_size;   ///< FREQ size
+
+        uint16_t    m_vcfPtr;       ///< VCF pointer table offset
+        uint16_t    m_amplPtr;      ///< AMPL pointer table offset
+        uint16_t    m_freqPtr;      ///< FREQ pointer table offset
+        uint16_t    m_wavePtr;      ///< WAVE pointer table offset
+        uint8_t     m_maxVcf;       ///< End of VCF block numbers
+        uint8_t     m_maxAmpl;      ///< End of AMPL block numbers
+        uint8_t     m_maxFreq;      ///< End of FREQ block numbers
+        uint8_t     m_maxWave;      ///< End of WAVE block numbers
+
+        /**
+          Create new MK1 cartridge object without throwing.
+
+          Used by create(), errors while parsing the buffer are reported in the given status.
+
+          @param[in]    buffer      Raw data buffer
+          @param[in]    lazy        If true, blocks are parsed on first access
+          @param[out]   status      Receives the error, if any
+         */
+        Mk1Cartridge(void* buffer, bool lazy, Status& status);
+
+        /**
+          Check pointer tables and extract ICBs.
+
+          Does the work of dissect(Status&) on cleared lists, the error message is prefixed by the caller.
+
+          @param[out]   status      Receives the error, if any
+
+          @return                   True if the raw data has been dissected
+         */
+        bool dissectTables(Status& status);
+
+        /**
+          Get and check block offset.
+
+          Looks up the offset of a block in the given pointer table and checks that the whole block is inside the
+          checksummed image, like getBlockOffset() without throwing.
+
+          @param[in]    table       Pointer table offset
+          @param[in]    index       Index of block in pointer table
+          @param[in]    type        Block type name for error messages
+          @param[in]    size        Block size
+          @param[out]   offset      Block offset in raw data buffer
+          @param[out]   status      Receives the error, if any
+
+          @return                   True if the offset is valid
+         */
+        bool checkBlockOffset(uint16_t table, size_t index, const char* type, size_t size, uint16_t& offset,
+                              Status& status) const;
+
+        /**
+          Get block offset.
+
+          Looks up the offset of a block in the given pointer table and checks that the whole block is inside the
+          checksummed image.
+
+          @param[in]    table       Pointer table offset
+          @param[in]    index       Index of block in pointer table
+          @param[in]    type        Block type name for error messages
+          @param[in]    size        Block size
+
+          @return                   Block offset in raw data buffer
+         */
+        uint16_t getBlockOffset(uint16_t table, size_t index, const char* type, size_t size) const;
+
+        /**
+          Get and check wave offset.
+
+          Looks up the offset of a wave in the WAVE pointer table and checks that the whole wave is inside the
+          checksummed image, its size is taken from the first byte of the wave, see WaveLayout::getBlockSize().
+
+          @param[in]    index       Index of wave in pointer table
+          @param[out]   offset      Wave offset in raw data buffer
+          @param[out]   size        Wave block size
+          @param[out]   status      Receives the error, if any
+
+          @return                   True if the offset is valid
+         */
+        bool checkWaveOffset(size_t index, uint16_t& offset, size_t& size, Status& status) const;
+
+        /**
+          Get wave offset.
+
+          Looks up the offset and size of a wave in the WAVE pointer table like checkWaveOffset(), but throws a
+          DataFormatException on errors.
+
+          @param[in]    index       Index of wave in pointer table
+          @param[out]   size        Wave block size
+
+          @return                   Wave offset in raw data buffer
+         */
+        uint16_t getWaveOffset(size_t index, size_t& size) const;
+
         Mk1Cartridge(const Mk1Cartridge&);              ///< Inhibit copying objects
         Mk1Cartridge& operator=(const Mk1Cartridge&);   ///< Inhibit copying objects
 };
@@ -0,0 +1,291 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/mk1writer.hh>
+#include <wersi/instrumentstore.hh>
+#include <wersi/checksum.hh>
+#include <wersi/blocklayout.hh>
+#include <wersi/icb.hh>
+#include <wersi/vcf.hh>
+#include <wersi/envelope.hh>
+#include <wersi/wave.hh>
+#include <cstring>
+
+using namespace std;
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Image size covered by the checksum
+static const size_t s_imageSize = 0x3ffe;
+
+// Size of header with magic bytes and pointer table pointers
+static const size_t s_headerSize = 12;
+
+// Size of an ICB
+static const size_t s_icbSize = BlockLayout<SysEx::BlockType::IcBlock>::s_size;
+
+// ICB offset of an unused slot
+static const uint16_t s_noBlock = 0xffff;
+
+// Store big endian word in image
+static void putWord(uint8_t* buffer, size_t offset, uint16_t value)
+{
+    buffer[offset] = value >> 8;
+    buffer[offset + 1] = value & 0xff;
+}
+
+// Set block reference in raw ICB data
+static void setReference(uint8_t* icb, Icb::Field field, uint8_t block)
+{
+    FieldCodec::set(icb, Icb::getField(field), block);
+}
+
+// Create new MK1 cartridge writer
+Mk1Writer::Mk1Writer()
+    : m_arena()
+    , m_icbOffsets(s_numSlots, s_noBlock)
+    , m_vcf()
+    , m_ampl()
+    , m_freq()
+    , m_wave()
+    , m_numInstruments(0)
+{
+}
+
+// Destroy MK1 cartridge writer
+Mk1Writer::~Mk1Writer()
+{
+}
+
+// Add instrument
+bool Mk1Writer::addInstrument(InstrumentStore& source, uint8_t icb)
+{
+    if (m_numInstruments >= s_numSlots || source.getIcb(icb) == nullptr) {
+        return false;
+    }
+
+    // Collect the ICB chain of layered voices and assign new ICB numbers, ICBs start counting at 129
+    vector<uint8_t> chain;
+    map<uint8_t, uint8_t> numbers;
+    for (uint8_t current = icb; current != 0 && numbers.find(current) == numbers.end();) {
+        Icb* src = source.getIcb(current);
+        if (src == nullptr) {
+            break;
+        }
+        size_t index = chain.empty() ? m_numInstruments : m_icbOffsets.size() + chain.size() - 1;
+        if (index > 126) {
+            return false;
+        }
+        numbers[current] = 129 + index;
+        chain.push_back(current);
+        current = src->getNextIcb();
+    }
+
+    // Remember state for rollback
+    size_t arenaSize = m_arena.size();
+    size_t icbCount = m_icbOffsets.size();
+    size_t vcfCount = m_vcf.m_offsets.size();
+    size_t amplCount = m_ampl.m_offsets.size();
+    size_t freqCount = m_freq.m_offsets.size();
+    size_t waveCount = m_wave.m_offsets.size();
+
+    // Copy all ICBs, renumbering the references to the other blocks, all other bits are copied unchanged
+    for (auto current : chain) {
+        Icb* src = source.getIcb(current);
+        uint8_t data[s_icbSize];
+        memcpy(data, src->getBuffer(), s_icbSize);
+
+        auto next = numbers.find(src->getNextIcb());
+        setReference(data, Icb::Field::NextIcb, next != numbers.end() ? next->second : 0);
+
+        Vcf* vcf = source.getVcf(src->getVcfBlock());
+        setReference(data, Icb::Field::VcfBlock,
+                     vcf != nullptr ? allocate(m_vcf, vcf->getBuffer(), vcf->getBufferSize()) : 0);
+        Envelope* ampl = source.getAmpl(src->getAmplBlock());
+        setReference(data, Icb::Field::AmplBlock,
+                     ampl != nullptr ? allocate(m_ampl, ampl->getBuffer(), ampl->getBufferSize()) : 0);
+        Envelope* freq = source.getFreq(src->getFreqBlock());
+        setReference(data, Icb::Field::FreqBlock,
+                     freq != nullptr ? allocate(m_freq, freq->getBuffer(), freq->getBufferSize()) : 0);
+        Wave* wave = source.getWave(src->getWaveBlock());
+        if (wave != nullptr) {
+            // Relative formant waves don't use the fixed formant area at the end of the block
+            auto waveData = static_cast<const uint8_t*>(wave->getBuffer());
+            size_t size = WaveLayout::getBlockSize(waveData[0]);
+            setReference(data, Icb::Field::WaveBlock,
+                         allocate(m_wave, waveData, size < wave->getBufferSize() ? size : wave->getBufferSize()));
+        }
+        else {
+            setReference(data, Icb::Field::WaveBlock, 0);
+        }
+
+        if (current == icb) {
+            m_icbOffsets[m_numInstruments] = m_arena.size();
+        }
+        else {
+            m_icbOffsets.push_back(m_arena.size());
+        }
+        m_arena.insert(m_arena.end(), data, data + s_icbSize);
+    }
+
+    // Check for block number overflows and cartridge size
+    bool overflow = m_vcf.m_offsets.size() > 128 || m_ampl.m_offsets.size() > 128
+                    || m_freq.m_offsets.size() > 128 || m_wave.m_offsets.size() > 128;
+    ++m_numInstruments;
+    if (overflow || getSize() > s_imageSize + 2) {
+        --m_numInstruments;
+        m_arena.resize(arenaSize);
+        m_icbOffsets.resize(icbCount);
+        m_icbOffsets[m_numInstruments] = s_noBlock;
+        rollback(m_vcf, vcfCount);
+        rollback(m_ampl, amplCount);
+        rollback(m_freq, freqCount);
+        rollback(m_wave, waveCount);
+        return false;
+    }
+    return true;
+}
+
+// Add instruments
+size_t Mk1Writer::addInstruments(InstrumentStore& source)
+{
+    size_t count = 0;
+    size_t primary = 0;
+    for (auto i = source.begin(); i != source.end() && primary < source.getNumIcbs(); ++i, ++primary) {
+        if (!addInstrument(source, i->first)) {
+            break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+// Get image size
+size_t Mk1Writer::getSize() const
+{
+    size_t size = s_headerSize + m_arena.size() + 2;
+    size += (m_icbOffsets.size() + m_vcf.m_offsets.size() + m_ampl.m_offsets.size() + m_freq.m_offsets.size()
+             + m_wave.m_offsets.size()) * 2;
+    if (m_numInstruments < s_numSlots) {
+        // Unused slots share one empty ICB
+        size += s_icbSize;
+    }
+    return size;
+}
+
+// Write cartridge image
+void Mk1Writer::write(void* buffer) const
+{
+    auto data = static_cast<uint8_t*>(buffer);
+    memset(data, 0xff, s_imageSize + 2);
+
+    // Pointer tables follow the header, block data follows the pointer tables
+    uint16_t icbPtr = s_headerSize;
+    uint16_t vcfPtr = icbPtr + m_icbOffsets.size() * 2;
+    uint16_t amplPtr = vcfPtr + m_vcf.m_offsets.size() * 2;
+    uint16_t freqPtr = amplPtr + m_ampl.m_offsets.size() * 2;
+    uint16_t wavePtr = freqPtr + m_freq.m_offsets.size() * 2;
+    uint16_t dataPtr = wavePtr + m_wave.m_offsets.size() * 2;
+    putWord(data, 2, icbPtr);
+    putWord(data, 4, vcfPtr);
+    putWord(data, 6, amplPtr);
+    putWord(data, 8, freqPtr);
+    putWord(data, 10, wavePtr);
+
+    // Block data, with the empty ICB for unused slots behind it
+    if (!m_arena.empty()) {
+        memcpy(&(data[dataPtr]), &(m_arena[0]), m_arena.size());
+    }
+    uint16_t emptyIcb = dataPtr + m_arena.size();
+    if (m_numInstruments < s_numSlots) {
+        memset(&(data[emptyIcb]), 0, s_icbSize);
+    }
+
+    // Pointer tables
+    for (size_t i = 0; i < m_icbOffsets.size(); ++i) {
+        putWord(data, icbPtr + i * 2, m_icbOffsets[i] != s_noBlock ? dataPtr + m_icbOffsets[i] : emptyIcb);
+    }
+    for (size_t i = 0; i < m_vcf.m_offsets.size(); ++i) {
+        putWord(data, vcfPtr + i * 2, dataPtr + m_vcf.m_offsets[i]);
+    }
+    for (size_t i = 0; i < m_ampl.m_offsets.size(); ++i) {
+        putWord(data, amplPtr + i * 2, dataPtr + m_ampl.m_offsets[i]);
+    }
+    for (size_t i = 0; i < m_freq.m_offsets.size(); ++i) {
+        putWord(data, freqPtr + i * 2, dataPtr + m_freq.m_offsets[i]);
+    }
+    for (size_t i = 0; i < m_wave.m_offsets.size(); ++i) {
+        putWord(data, wavePtr + i * 2, dataPtr + m_wave.m_offsets[i]);
+    }
+
+    Checksum::store(data, s_imageSize, &(data[s_imageSize]));
+}
+
+// Allocate block
+uint8_t Mk1Writer::allocate(Table& table, const void* data, size_t size)
+{
+    string key(static_cast<const char*>(data), size);
+    auto i = table.m_blocks.find(key);
+    if (i != table.m_blocks.end()) {
+        return i->second;
+    }
+
+    // Blocks start counting at 128, the block list may overflow here, which is checked by the caller
+    uint8_t block = 128 + table.m_offsets.size();
+    table.m_offsets.push_back(m_arena.size());
+    m_arena.insert(m_arena.end(), key.begin(), key.end());
+    table.m_blocks.insert(make_pair(key, block));
+    return block;
+}
+
+// Roll back table
+void Mk1Writer::rollback(Table& table, size_t count)
+{
+    table.m_offsets.resize(count);
+    for (auto i = table.m_blocks.begin(); i != table.m_blocks.end();) {
+        if (i->second >= 128 + count) {
+            table.m_blocks.erase(i++);
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
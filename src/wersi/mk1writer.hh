@@ -0,0 +1,189 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class InstrumentStore;
+
+/**
+  @ingroup wersi_group
+
+  Wersi DMS-System MK1 cartridge writer class.
+
+  Builds a complete MK1 cartridge image from instruments of arbitrary instrument stores. All blocks are renumbered
+  and laid out back to back behind the pointer tables, identical VCF, AMPL, FREQ and WAVE blocks are stored only once
+  and shared by all instruments using them. Relative formant waves only occupy 177 bytes instead of 212, so the
+  number of instruments fitting a cartridge depends on the waves used.
+
+  Block data is taken from the raw buffer of the source store, so changes to its objects must be written back with
+  InstrumentStore::update() before adding instruments.
+ */
+class Mk1Writer {
+    public:
+        /**
+          Create new MK1 cartridge writer.
+
+          Creates a new MK1 cartridge writer without any instruments.
+         */
+        Mk1Writer();
+
+        /**
+          Destroy MK1 cartridge writer.
+
+          Destroys the MK1 cartridge writer.
+         */
+        ~Mk1Writer();
+
+        /**
+          Add instrument.
+
+          Adds the instrument with the given ICB from the source store to the next free instrument slot, including
+          all ICBs layered with it and all blocks they refer to. If the instrument doesn't exist, all slots are used
+          or the image would exceed the cartridge size, nothing is added.
+
+          @param[in]    source      Source instrument store
+          @param[in]    icb         Block number of the instrument's ICB in the source store
+
+          @return                   True if the instrument has been added
+         */
+        bool addInstrument(InstrumentStore& source, uint8_t icb);
+
+        /**
+          Add instruments.
+
+          Adds all primary instruments of the source store in the order of its ICB list, until all slots are used or
+          the cartridge is full.
+
+          @param[in]    source      Source instrument store
+
+          @return                   Number of instruments added
+         */
+        size_t addInstruments(InstrumentStore& source);
+
+        /**
+          Get number of instruments.
+
+          Returns the number of instrument slots used.
+
+          @return                   Number of instruments
+         */
+        size_t getNumInstruments() const {
+            return m_numInstruments;
+        }
+
+        /**
+          Get image size.
+
+          Returns the number of bytes the image occupies in the cartridge, including header, pointer tables and
+          checksum.
+
+          @return                   Image size in bytes
+         */
+        size_t getSize() const;
+
+        /**
+          Write cartridge image.
+
+          Writes the complete cartridge image including pointer tables and checksum to the given buffer. Unused
+          instrument slots are filled with an empty instrument, unused space is filled with 0xff.
+
+          @param[out]   buffer      Buffer of 16384 bytes to write image to
+         */
+        void write(void* buffer) const;
+
+        static const size_t s_numSlots = 20;    ///< Number of primary instrument slots
+
+    private:
+        /// Pointer table of one block type under construction
+        struct Table {
+            /// Create empty pointer table
+            Table()
+                : m_offsets()
+                , m_blocks() {
+            }
+
+            std::vector<uint16_t>           m_offsets;  ///< Block offsets in m_arena, indexed by block number
+            std::map<std::string, uint8_t>  m_blocks;   ///< Block numbers by block contents, for deduplication
+        };
+
+        std::vector<uint8_t>    m_arena;            ///< Data of all blocks, in allocation order
+        std::vector<uint16_t>   m_icbOffsets;       ///< ICB offsets in m_arena, primary slots first
+        Table                   m_vcf;              ///< VCF pointer table
+        Table                   m_ampl;             ///< AMPL pointer table
+        Table                   m_freq;             ///< FREQ pointer table
+        Table                   m_wave;             ///< WAVE pointer table
+        size_t                  m_numInstruments;   ///< Number of primary instrument slots used
+
+        /**
+          Allocate block.
+
+          Returns the number of the block with the given contents in the table, appending the data to the arena if
+          there is no such block yet.
+
+          @param[in]    table       Pointer table of block type
+          @param[in]    data        Block data
+          @param[in]    size        Block size
+
+          @return                   Block number
+         */
+        uint8_t allocate(Table& table, const void* data, size_t size);
+
+        /**
+          Roll back table.
+
+          Removes all blocks with an index at or above the given count from the table.
+
+          @param[in]    table       Pointer table of block type
+          @param[in]    count       Number of blocks to keep
+         */
+        static void rollback(Table& table, size_t count);
+
+        Mk1Writer(const Mk1Writer&);                ///< Inhibit copying objects
+        Mk1Writer& operator=(const Mk1Writer&);     ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,341 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+#include <wersi/similarityindex.hh>
+#include <wersi/blocklayout.hh>
+#include <exceptions.hh>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMILARITY_NEON
+#endif
+
+using namespace std;
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/// Pi, M_PI is not standard C++
+static const double s_pi = 3.14159265358979;
+
+/// Number of harmonics per wave part
+static const size_t s_numHarmonics = 8;
+
+/// Length of the DFT table, the longest wave part
+static const size_t s_tableSize = WaveLayout::s_bassSize;
+
+/// DFT table of one period
+struct DftTable {
+    /// Create table
+    DftTable()
+        : m_cos()
+        , m_sin() {
+        for (size_t i = 0; i < s_tableSize; ++i) {
+            m_cos[i] = float(cos(2.0 * s_pi * i / s_tableSize));
+            m_sin[i] = float(sin(2.0 * s_pi * i / s_tableSize));
+        }
+    }
+
+    float   m_cos[s_tableSize];             ///< Cosine of one period
+    float   m_sin[s_tableSize];             ///< Sine of one period
+};
+
+static_assert(SimilarityIndex::s_numFeatures == 4 * s_numHarmonics, "Wave features must fill the feature vector");
+
+// Calculate normalized harmonic spectrum of a wave part
+static void getSpectrum(const uint8_t* samples, size_t size, uint8_t* features)
+{
+    // Initialization of local statics is thread safe
+    static const DftTable table;
+    const size_t stride = s_tableSize / size;
+
+    // Harmonics of unsigned samples, the DC offset doesn't contribute to them
+    float magnitudes[s_numHarmonics];
+    float energy = 0.0f;
+    for (size_t h = 0; h < s_numHarmonics; ++h) {
+        float re = 0.0f;
+        float im = 0.0f;
+        for (size_t i = 0; i < size; ++i) {
+            size_t pos = ((h + 1) * i * stride) % s_tableSize;
+            re += samples[i] * table.m_cos[pos];
+            im += samples[i] * table.m_sin[pos];
+        }
+        magnitudes[h] = sqrt(re * re + im * im);
+        energy += magnitudes[h] * magnitudes[h];
+    }
+
+    float scale = energy > 0.0f ? 255.0f / sqrt(energy) : 0.0f;
+    for (size_t h = 0; h < s_numHarmonics; ++h) {
+        features[h] = uint8_t(min(255.0f, magnitudes[h] * scale + 0.5f));
+    }
+}
+
+// Create new similarity index
+SimilarityIndex::SimilarityIndex()
+    : m_owners()
+    , m_paths()
+    , m_features()
+    , m_items()
+    , m_mutex()
+{
+}
+
+// Destroy similarity index
+SimilarityIndex::~SimilarityIndex()
+{
+}
+
+// Add cartridge
+bool SimilarityIndex::add(const LibraryIndex::Entry& entry, const void* data, size_t size)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        auto i = m_paths.find(entry.m_path);
+        if (i != m_paths.end() && m_owners[i->second].m_hash == entry.m_hash) {
+            return false;
+        }
+    }
+
+    // Features are calculated without holding the mutex, so cartridges can be added in parallel
+    const size_t numKinds = static_cast<size_t>(Kind::NumKinds);
+    vector<uint8_t> features[numKinds];
+    vector<uint8_t> blocks[numKinds];
+    auto image = static_cast<const uint8_t*>(data);
+    for (auto& i : entry.m_blocks) {
+        if (size_t(i.m_offset) + i.m_length > size) {
+            throw DataFormatException("Indexed block outside of cartridge image");
+        }
+        Kind kind = Kind::Wave;
+        Features block;
+        if (getFeatures(i.m_type, image + i.m_offset, i.m_length, kind, block)) {
+            size_t k = static_cast<size_t>(kind);
+            features[k].insert(features[k].end(), block.m_values, block.m_values + s_numFeatures);
+            blocks[k].push_back(i.m_block);
+        }
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    auto path = m_paths.find(entry.m_path);
+    uint32_t owner = 0;
+    if (path != m_paths.end()) {
+        if (m_owners[path->second].m_hash == entry.m_hash) {
+            return false;
+        }
+        owner = path->second;
+        removeOwner(owner);
+    }
+    else {
+        // Reuse a free slot, so owner numbers stay small
+        owner = uint32_t(find_if(m_owners.begin(), m_owners.end(), [](const Owner& o) {
+            return o.m_path.empty();
+        }) - m_owners.begin());
+        if (owner == m_owners.size()) {
+            m_owners.push_back(Owner());
+        }
+    }
+    m_owners[owner].m_path = entry.m_path;
+    m_owners[owner].m_hash = entry.m_hash;
+    m_paths[entry.m_path] = owner;
+
+    for (size_t k = 0; k < numKinds; ++k) {
+        m_features[k].insert(m_features[k].end(), features[k].begin(), features[k].end());
+        for (auto i : blocks[k]) {
+            Item item = { owner, i };
+            m_items[k].push_back(item);
+        }
+    }
+    return true;
+}
+
+// Remove cartridge
+void SimilarityIndex::remove(const string& path)
+{
+    lock_guard<mutex> lock(m_mutex);
+    auto i = m_paths.find(path);
+    if (i == m_paths.end()) {
+        return;
+    }
+    uint32_t owner = i->second;
+    removeOwner(owner);
+    m_owners[owner].m_path.clear();
+    m_paths.erase(i);
+}
+
+// Get number of blocks
+size_t SimilarityIndex::size(Kind kind) const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_items[static_cast<size_t>(kind)].size();
+}
+
+// Calculate squared euclidean distance of two feature vectors
+static uint32_t getDistance(const uint8_t* features, const uint8_t* query, size_t size)
+{
+    uint32_t distance = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // Absolute differences are widened to 16 bits, multiply-add squares them and sums pairs into 32 bit lanes
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(features + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(query + i));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+        __m128i lo = _mm_unpacklo_epi8(diff, zero);
+        __m128i hi = _mm_unpackhi_epi8(diff, zero);
+        acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    distance = uint32_t(_mm_cvtsi128_si32(acc));
+#elif defined(SIMILARITY_NEON)
+    // Squares of byte differences fit 16 bits, pairwise add accumulates them into 32 bit lanes
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(features + i), vld1q_u8(query + i));
+        acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+        acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, acc);
+    for (auto lane : lanes) {
+        distance += lane;
+    }
+#endif
+    for (; i < size; ++i) {
+        int32_t diff = int32_t(features[i]) - int32_t(query[i]);
+        distance += uint32_t(diff * diff);
+    }
+    return distance;
+}
+
+// Find nearest blocks
+void SimilarityIndex::findNearest(Kind kind, const Features& query, size_t count, vector<Match>& matches) const
+{
+    matches.clear();
+    if (count == 0) {
+        return;
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    const vector<Item>& items = m_items[static_cast<size_t>(kind)];
+    const uint8_t* features = m_features[static_cast<size_t>(kind)].data();
+
+    // Max heap of the nearest blocks found so far, the farthest one on top
+    vector<pair<uint32_t, size_t>> nearest;
+    nearest.reserve(count + 1);
+    for (size_t i = 0; i < items.size(); ++i, features += s_numFeatures) {
+        uint32_t distance = getDistance(features, query.m_values, s_numFeatures);
+        if (nearest.size() < count || distance < nearest.front().first) {
+            nearest.push_back(make_pair(distance, i));
+            push_heap(nearest.begin(), nearest.end());
+            if (nearest.size() > count) {
+                pop_heap(nearest.begin(), nearest.end());
+                nearest.pop_back();
+            }
+        }
+    }
+
+    sort_heap(nearest.begin(), nearest.end());
+    for (auto& i : nearest) {
+        const Item& item = items[i.second];
+        Match match = { m_owners[item.m_owner].m_path, item.m_block, i.first };
+        matches.push_back(match);
+    }
+}
+
+// Calculate block features
+bool SimilarityIndex::getFeatures(SysEx::BlockType type, const uint8_t* data, size_t length, Kind& kind,
+                                  Features& features)
+{
+    switch (type) {
+        case SysEx::BlockType::FixWaveBlock:
+        case SysEx::BlockType::RelWaveBlock:
+            if (length < BlockLayout<SysEx::BlockType::RelWaveBlock>::s_size) {
+                return false;
+            }
+            kind = Kind::Wave;
+            getSpectrum(data + WaveLayout::s_bassOffset, WaveLayout::s_bassSize, features.m_values);
+            getSpectrum(data + WaveLayout::s_tenorOffset, WaveLayout::s_tenorSize,
+                        features.m_values + s_numHarmonics);
+            getSpectrum(data + WaveLayout::s_altoOffset, WaveLayout::s_altoSize,
+                        features.m_values + 2 * s_numHarmonics);
+            getSpectrum(data + WaveLayout::s_sopranoOffset, WaveLayout::s_sopranoSize,
+                        features.m_values + 3 * s_numHarmonics);
+            return true;
+
+        case SysEx::BlockType::AmplBlock:
+        case SysEx::BlockType::FreqBlock:
+            kind = type == SysEx::BlockType::AmplBlock ? Kind::Ampl : Kind::Freq;
+            for (size_t i = 0; i < s_numFeatures; ++i) {
+                features.m_values[i] = i < length ? data[i] : 0;
+            }
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Remove owner
+void SimilarityIndex::removeOwner(size_t owner)
+{
+    for (size_t k = 0; k < static_cast<size_t>(Kind::NumKinds); ++k) {
+        vector<Item>& items = m_items[k];
+        vector<uint8_t>& features = m_features[k];
+        size_t kept = 0;
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (items[i].m_owner == owner) {
+                continue;
+            }
+            if (kept != i) {
+                items[kept] = items[i];
+                copy(features.begin() + i * s_numFeatures, features.begin() + (i + 1) * s_numFeatures,
+                     features.begin() + kept * s_numFeatures);
+            }
+            ++kept;
+        }
+        items.resize(kept);
+        features.resize(kept * s_numFeatures);
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,206 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <wersi/libraryindex.hh>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Similarity search index over waves and envelopes.
+
+  Keeps a compact feature vector of every WAVE, AMPL and FREQ block of a cartridge library and answers k nearest
+  neighbour queries by scanning all vectors of one block kind. Wave features are the magnitudes of the first eight
+  harmonics of the bass, tenor, alto and soprano waves, each part normalized to unit energy, so waves are compared
+  by timbre regardless of their level. Envelope programs are not decoded yet, their features are the raw program
+  bytes, so envelopes are compared by contents, see VoiceRenderer. All features are quantized to bytes and kept
+  back to back, the distance scan runs over contiguous memory with an SSE2 or NEON squared distance kernel.
+
+  Cartridges are added with their library index entry, which provides the block layout, so no instrument store
+  needs to be opened. Entries whose path and content hash are already indexed are skipped, so the index can be
+  updated incrementally whenever the library index is. All functions may be called from multiple threads.
+ */
+class SimilarityIndex {
+    public:
+        /// Indexed block kind
+        enum class Kind {
+            Wave,                           ///< RELWAVE and FIXWAVE blocks
+            Ampl,                           ///< AMPL envelopes
+            Freq,                           ///< FREQ envelopes
+            NumKinds                        ///< Number of block kinds
+        };
+
+        /// Number of features per block
+        static const size_t s_numFeatures = 32;
+
+        /// Feature vector
+        struct Features {
+            uint8_t         m_values[s_numFeatures];    ///< Quantized features
+        };
+
+        /// Query match
+        struct Match {
+            std::string     m_path;         ///< File path of the cartridge
+            uint8_t         m_block;        ///< Block number
+            uint32_t        m_distance;     ///< Squared distance to the query
+        };
+
+        /**
+          Create new similarity index.
+
+          Creates an empty similarity index.
+         */
+        SimilarityIndex();
+
+        /**
+          Destroy similarity index.
+
+          Destroys the similarity index.
+         */
+        ~SimilarityIndex();
+
+        /**
+          Add cartridge.
+
+          Adds all WAVE, AMPL and FREQ blocks of a cartridge, replacing the blocks of an older version of the same
+          file. If the file is already indexed with the same content hash, nothing is done. If a block of the entry
+          lies outside the data, a DataFormatException is thrown and the index is left unchanged.
+
+          @param[in]    entry       Library index entry of the cartridge
+          @param[in]    data        Cartridge image
+          @param[in]    size        Cartridge image size
+
+          @return                   True if the cartridge has been indexed, false if it was up to date
+         */
+        bool add(const LibraryIndex::Entry& entry, const void* data, size_t size);
+
+        /**
+          Remove cartridge.
+
+          Removes all blocks of the given file, if any.
+
+          @param[in]    path        File path
+         */
+        void remove(const std::string& path);
+
+        /**
+          Get number of blocks.
+
+          Returns the number of indexed blocks of the given kind.
+
+          @param[in]    kind        Block kind
+
+          @return                   Number of blocks
+         */
+        size_t size(Kind kind) const;
+
+        /**
+          Find nearest blocks.
+
+          Fills the list with the blocks of the given kind closest to the query features, nearest first, at most
+          the given number.
+
+          @param[in]    kind        Block kind
+          @param[in]    query       Query features
+          @param[in]    count       Maximum number of matches
+          @param[out]   matches     List of matches
+         */
+        void findNearest(Kind kind, const Features& query, size_t count, std::vector<Match>& matches) const;
+
+        /**
+          Calculate block features.
+
+          Calculates the features of a raw WAVE, AMPL or FREQ block.
+
+          @param[in]    type        Block type
+          @param[in]    data        Block data
+          @param[in]    length      Block length
+          @param[out]   kind        Block kind
+          @param[out]   features    Block features
+
+          @return                   True if the block type is indexed and the block is large enough
+         */
+        static bool getFeatures(SysEx::BlockType type, const uint8_t* data, size_t length, Kind& kind,
+                                Features& features);
+
+    private:
+        /// Indexed block
+        struct Item {
+            uint32_t        m_owner;        ///< Index of owning cartridge in m_owners
+            uint8_t         m_block;        ///< Block number
+        };
+
+        /// Indexed cartridge
+        struct Owner {
+            /// Create free slot
+            Owner()
+                : m_path()
+                , m_hash(0) {
+            }
+
+            std::string     m_path;         ///< File path
+            uint64_t        m_hash;         ///< Content hash
+        };
+
+        std::vector<Owner>      m_owners;                                       ///< Cartridges, empty path if free
+        std::map<std::string, uint32_t> m_paths;                                ///< Cartridges by file path
+        std::vector<uint8_t>    m_features[static_cast<size_t>(Kind::NumKinds)];    ///< Features by kind
+        std::vector<Item>       m_items[static_cast<size_t>(Kind::NumKinds)];   ///< Blocks by kind
+        mutable std::mutex      m_mutex;                                        ///< Mutex protecting all members
+
+        /**
+          Remove owner.
+
+          Removes all blocks of the given cartridge and frees its slot. Must be called with the mutex held.
+
+          @param[in]    owner       Index of cartridge in m_owners
+         */
+        void removeOwner(size_t owner);
+
+        SimilarityIndex(const SimilarityIndex&);                ///< Inhibit copying objects
+        SimilarityIndex& operator=(const SimilarityIndex&);     ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,158 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/storeconverter.hh>
+#include <wersi/checksum.hh>
+#include <exceptions.hh>
+#include <algorithm>
+#include <cstring>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create empty layout
+StoreLayout::StoreLayout()
+    : m_icb()
+    , m_vcf()
+    , m_ampl()
+    , m_freq()
+    , m_wave()
+    , m_checksums()
+{
+}
+
+// Add range of slots
+void StoreLayout::addSlots(std::vector<Slot>& slots, uint8_t first, size_t count, size_t offset, uint8_t size)
+{
+    for (size_t i = 0; i < count; ++i) {
+        Slot slot = { uint8_t(first + i + (i >= 10 ? 1 : 0)), size, uint16_t(offset + i * size) };
+        slots.push_back(slot);
+    }
+}
+
+// Create new converter
+StoreConverter::StoreConverter(const StoreLayout& source, const StoreLayout& destination)
+    : m_copies()
+    , m_numIcbs(0)
+    , m_remap()
+    , m_checksums(destination.m_checksums)
+    , m_sourceSize(0)
+    , m_destSize(0)
+{
+    if (m_checksums.size() > s_maxChecksums) {
+        throw DataFormatException("Too many checksums in destination layout");
+    }
+    for (auto& i : m_checksums) {
+        m_destSize = std::max(m_destSize, size_t(std::max(i.m_end, uint16_t(i.m_stored + 2))));
+    }
+
+    // ICBs come first, so their references can be patched right after copying them
+    addCopies(source.m_icb, destination.m_icb, m_remap[0]);
+    m_numIcbs = m_copies.size();
+    addCopies(source.m_vcf, destination.m_vcf, m_remap[1]);
+    addCopies(source.m_ampl, destination.m_ampl, m_remap[2]);
+    addCopies(source.m_freq, destination.m_freq, m_remap[3]);
+    addCopies(source.m_wave, destination.m_wave, m_remap[4]);
+}
+
+// Destroy converter
+StoreConverter::~StoreConverter()
+{
+}
+
+// Add block copies
+void StoreConverter::addCopies(const std::vector<StoreLayout::Slot>& source,
+                               const std::vector<StoreLayout::Slot>& destination, uint8_t* remap)
+{
+    size_t count = std::min(source.size(), destination.size());
+    for (size_t i = 0; i < count; ++i) {
+        const StoreLayout::Slot& src = source[i];
+        const StoreLayout::Slot& dst = destination[i];
+        Copy copy;
+        copy.m_source = src.m_offset;
+        copy.m_destination = dst.m_offset;
+        copy.m_size = std::min(src.m_size, dst.m_size);
+        copy.m_fill = dst.m_size - copy.m_size;
+        copy.m_checksum = -1;
+        for (size_t j = 0; j < m_checksums.size(); ++j) {
+            if (dst.m_offset >= m_checksums[j].m_begin && dst.m_offset < m_checksums[j].m_end) {
+                copy.m_checksum = int8_t(j);
+                break;
+            }
+        }
+        m_copies.push_back(copy);
+        remap[src.m_block] = dst.m_block;
+        m_sourceSize = std::max(m_sourceSize, size_t(src.m_offset + copy.m_size));
+        m_destSize = std::max(m_destSize, size_t(dst.m_offset + dst.m_size));
+    }
+}
+
+// Convert raw data
+void StoreConverter::convert(const void* source, size_t sourceSize, void* destination, size_t destSize) const
+{
+    if (sourceSize < m_sourceSize || destSize < m_destSize) {
+        throw DataFormatException("Buffer too small for store layout");
+    }
+
+    auto src = static_cast<const uint8_t*>(source);
+    auto dst = static_cast<uint8_t*>(destination);
+    uint16_t delta[s_maxChecksums] = { 0 };
+    for (size_t i = 0; i < m_copies.size(); ++i) {
+        const Copy& copy = m_copies[i];
+        uint8_t* block = dst + copy.m_destination;
+        size_t size = size_t(copy.m_size) + copy.m_fill;
+        if (copy.m_checksum >= 0) {
+            delta[copy.m_checksum] -= Checksum::sum(block, size);
+        }
+        memcpy(block, src + copy.m_source, copy.m_size);
+        memset(block + copy.m_size, 0, copy.m_fill);
+        if (i < m_numIcbs) {
+            for (size_t j = 0; j < s_numReferences; ++j) {
+                block[j] = m_remap[j][block[j]];
+            }
+        }
+        if (copy.m_checksum >= 0) {
+            delta[copy.m_checksum] += Checksum::sum(block, size);
+        }
+    }
+    for (size_t i = 0; i < m_checksums.size(); ++i) {
+        Checksum::adjust(dst + m_checksums[i].m_stored, delta[i]);
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
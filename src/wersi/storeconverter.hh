@@ -0,0 +1,192 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Instrument store layout descriptor.
+
+  Describes where the blocks of an instrument store format are located in its raw data buffer and which checksums
+  cover them. The slots of each block type are listed in slot order, which is the order blocks correspond to each
+  other when converting between formats. Formats with fixed layouts always return the same descriptor, the layout
+  of an MK1 cartridge depends on its pointer tables.
+ */
+struct StoreLayout {
+    /// Block slot in the raw data buffer
+    struct Slot {
+        uint8_t     m_block;                ///< Block number
+        uint8_t     m_size;                 ///< Block size in bytes, 177 for RELWAVE and 212 for FIXWAVE slots
+        uint16_t    m_offset;               ///< Block offset in the raw data buffer
+    };
+
+    /// Checksum protecting a range of the raw data buffer
+    struct ChecksumRange {
+        uint16_t    m_begin;                ///< Start offset of protected range
+        uint16_t    m_end;                  ///< End offset of protected range
+        uint16_t    m_stored;               ///< Offset of the stored big endian checksum word
+    };
+
+    /// Create empty layout
+    StoreLayout();
+
+    /**
+      Add range of slots.
+
+      Adds the given number of consecutive slots of the same size. Like on all Wersi devices, block numbers of a
+      group of 20 skip one number between the first and second ten blocks.
+
+      @param[in,out]    slots       Slot list to add to
+      @param[in]        first       First block number
+      @param[in]        count       Number of slots
+      @param[in]        offset      Offset of first slot in the raw data buffer
+      @param[in]        size        Slot size
+     */
+    static void addSlots(std::vector<Slot>& slots, uint8_t first, size_t count, size_t offset, uint8_t size);
+
+    std::vector<Slot>           m_icb;      ///< ICB slots
+    std::vector<Slot>           m_vcf;      ///< VCF slots
+    std::vector<Slot>           m_ampl;     ///< AMPL slots
+    std::vector<Slot>           m_freq;     ///< FREQ slots
+    std::vector<Slot>           m_wave;     ///< WAVE slots
+    std::vector<ChecksumRange>  m_checksums;    ///< Checksums to keep up to date
+};
+
+/**
+  @ingroup wersi_group
+
+  Instrument store format converter.
+
+  Converts the raw data of one instrument store format into another one. On creation, the layouts of both formats
+  are turned into a list of block copies, slot by slot for each block type, and into remap tables translating the
+  block references of the ICBs. Converting then only copies memory and patches the references of the copied ICBs,
+  without any lookups, so a converter created once for a pair of formats can be reused for any number of stores
+  with these layouts. References to blocks without a corresponding destination slot are cleared.
+
+  Block data is taken from the raw buffer of the source, so changes to its objects must be written back with
+  InstrumentStore::update() before converting.
+ */
+class StoreConverter {
+    public:
+        /**
+          Create new converter.
+
+          Creates a converter from stores with the source layout to stores with the destination layout. If the
+          destination layout has more checksums than supported, a DataFormatException is thrown.
+
+          @param[in]    source      Source store layout
+          @param[in]    destination Destination store layout
+         */
+        StoreConverter(const StoreLayout& source, const StoreLayout& destination);
+
+        /**
+          Destroy converter.
+
+          Destroys the converter.
+         */
+        ~StoreConverter();
+
+        /**
+          Convert raw data.
+
+          Copies all blocks from the source raw data buffer to their slots in the destination raw data buffer,
+          translates the block references of the copied ICBs and corrects the destination checksums. If a buffer is
+          too small for its layout, a DataFormatException is thrown.
+
+          @param[in]    source      Source raw data buffer
+          @param[in]    sourceSize  Source raw data buffer size
+          @param[out]   destination Destination raw data buffer
+          @param[in]    destSize    Destination raw data buffer size
+         */
+        void convert(const void* source, size_t sourceSize, void* destination, size_t destSize) const;
+
+        /**
+          Get number of block copies.
+
+          Returns the number of blocks copied by each conversion.
+
+          @return                   Number of blocks copied
+         */
+        size_t getNumCopies() const {
+            return m_copies.size();
+        }
+
+    private:
+        /// Block copy
+        struct Copy {
+            uint16_t    m_source;           ///< Source offset
+            uint16_t    m_destination;      ///< Destination offset
+            uint8_t     m_size;             ///< Number of bytes to copy
+            uint8_t     m_fill;             ///< Number of bytes to clear behind the copied data
+            int8_t      m_checksum;         ///< Index of destination checksum covering the slot, -1 for none
+        };
+
+        /// Number of block references in an ICB, next ICB, VCF, AMPL, FREQ and WAVE
+        static const size_t s_numReferences = 5;
+
+        /// Maximum number of destination checksums
+        static const size_t s_maxChecksums = 4;
+
+        std::vector<Copy>       m_copies;       ///< Block copies, ICBs first
+        size_t                  m_numIcbs;      ///< Number of ICB copies at the start of m_copies
+        uint8_t                 m_remap[s_numReferences][256];  ///< Destination block numbers by source number
+        std::vector<StoreLayout::ChecksumRange> m_checksums;    ///< Destination checksums
+        size_t                  m_sourceSize;   ///< Minimum source buffer size
+        size_t                  m_destSize;     ///< Minimum destination buffer size
+
+        /**
+          Add block copies.
+
+          Adds the copies of corresponding slots of one block type and fills the remap table for its references.
+
+          @param[in]    source      Source slots
+          @param[in]    destination Destination slots
+          @param[out]   remap       Remap table to fill
+         */
+        void addCopies(const std::vector<StoreLayout::Slot>& source, const std::vector<StoreLayout::Slot>& destination,
+                       uint8_t* remap);
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
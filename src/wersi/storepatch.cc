@@ -0,0 +1,306 @@
+// vim:set ts=4 sw=4 et cin:
+
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/storepatch.hh>
+#include <wersi/blockpool.hh>
+#include <wersi/checksum.hh>
+#include <wersi/binaryfile.hh>
+#include <exceptions.hh>
+#include <cstring>
+
+using namespace std;
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Patch file format
+static const BinaryFormat s_format = { { 'D', 'M', 'S', 'P' }, 1, "patch file" };
+
+// Slot groups of a layout in slot order
+struct SlotGroup {
+    SysEx::BlockType                    m_type;     // Block type
+    const vector<StoreLayout::Slot>*    m_slots;    // Slots
+};
+
+// Get slot groups of a layout
+static void getGroups(const StoreLayout& layout, SlotGroup (&groups)[5])
+{
+    groups[0].m_type = SysEx::BlockType::IcBlock;
+    groups[0].m_slots = &(layout.m_icb);
+    groups[1].m_type = SysEx::BlockType::VcfBlock;
+    groups[1].m_slots = &(layout.m_vcf);
+    groups[2].m_type = SysEx::BlockType::AmplBlock;
+    groups[2].m_slots = &(layout.m_ampl);
+    groups[3].m_type = SysEx::BlockType::FreqBlock;
+    groups[3].m_slots = &(layout.m_freq);
+    groups[4].m_type = SysEx::BlockType::FixWaveBlock;
+    groups[4].m_slots = &(layout.m_wave);
+}
+
+// Create empty patch
+StorePatch::StorePatch()
+    : m_layout(0)
+    , m_size(0)
+    , m_changes()
+    , m_data()
+{
+}
+
+// Destroy patch
+StorePatch::~StorePatch()
+{
+}
+
+// Calculate block hashes
+void StorePatch::hashBlocks(const StoreLayout& layout, const void* data, size_t size, vector<uint64_t>& hashes)
+{
+    auto bytes = static_cast<const uint8_t*>(data);
+    SlotGroup groups[5];
+    getGroups(layout, groups);
+    hashes.clear();
+    for (auto& i : groups) {
+        for (auto& j : *i.m_slots) {
+            if (size_t(j.m_offset) + j.m_size > size) {
+                throw DataFormatException("Store layout exceeds raw data");
+            }
+            hashes.push_back(BlockPool::hash(bytes + j.m_offset, j.m_size));
+        }
+    }
+}
+
+// Calculate layout hash
+uint64_t StorePatch::hashLayout(const StoreLayout& layout)
+{
+    // The descriptor is serialized little endian, so the hash is the same on all machines
+    vector<uint8_t> descriptor;
+    SlotGroup groups[5];
+    getGroups(layout, groups);
+    for (auto& i : groups) {
+        descriptor.push_back(uint8_t(i.m_type));
+        for (auto& j : *i.m_slots) {
+            uint8_t slot[] = { j.m_block, j.m_size, uint8_t(j.m_offset), uint8_t(j.m_offset >> 8) };
+            descriptor.insert(descriptor.end(), slot, slot + sizeof(slot));
+        }
+    }
+    for (auto& i : layout.m_checksums) {
+        uint8_t range[] = {
+            uint8_t(i.m_begin), uint8_t(i.m_begin >> 8), uint8_t(i.m_end), uint8_t(i.m_end >> 8),
+            uint8_t(i.m_stored), uint8_t(i.m_stored >> 8)
+        };
+        descriptor.insert(descriptor.end(), range, range + sizeof(range));
+    }
+    return BlockPool::hash(&(descriptor[0]), descriptor.size());
+}
+
+// Create patch from two buffers
+void StorePatch::diff(const StoreLayout& layout, const void* source, const void* target, size_t size)
+{
+    begin(layout, size);
+    auto src = static_cast<const uint8_t*>(source);
+    auto dst = static_cast<const uint8_t*>(target);
+    SlotGroup groups[5];
+    getGroups(layout, groups);
+    for (auto& i : groups) {
+        for (auto& j : *i.m_slots) {
+            if (memcmp(src + j.m_offset, dst + j.m_offset, j.m_size) != 0) {
+                add(i.m_type, j, src + j.m_offset, BlockPool::hash(dst + j.m_offset, j.m_size));
+            }
+        }
+    }
+}
+
+// Create patch from target hashes
+void StorePatch::diff(const StoreLayout& layout, const void* source, size_t size, const vector<uint64_t>& hashes)
+{
+    begin(layout, size);
+    auto src = static_cast<const uint8_t*>(source);
+    SlotGroup groups[5];
+    getGroups(layout, groups);
+    size_t slot = 0;
+    for (auto& i : groups) {
+        for (auto& j : *i.m_slots) {
+            if (slot >= hashes.size()) {
+                clear();
+                throw DataFormatException("Number of block hashes doesn't match store layout");
+            }
+            if (BlockPool::hash(src + j.m_offset, j.m_size) != hashes[slot]) {
+                add(i.m_type, j, src + j.m_offset, hashes[slot]);
+            }
+            ++slot;
+        }
+    }
+    if (slot != hashes.size()) {
+        clear();
+        throw DataFormatException("Number of block hashes doesn't match store layout");
+    }
+}
+
+// Check target for blocks changed since the patch was created
+bool StorePatch::check(const StoreLayout& layout, const void* data, size_t size, vector<size_t>& conflicts) const
+{
+    verify(layout, size);
+    auto dst = static_cast<const uint8_t*>(data);
+    conflicts.clear();
+    for (size_t i = 0; i < m_changes.size(); ++i) {
+        const Change& change = m_changes[i];
+        const uint8_t* block = dst + change.m_offset;
+        if (BlockPool::hash(block, change.m_length) != change.m_base
+                && memcmp(block, getData(change), change.m_length) != 0) {
+            conflicts.push_back(i);
+        }
+    }
+    return conflicts.empty();
+}
+
+// Apply patch
+void StorePatch::apply(const StoreLayout& layout, void* data, size_t size, bool force) const
+{
+    vector<size_t> conflicts;
+    if (!check(layout, data, size, conflicts) && !force) {
+        DataFormatException exc("Patch conflicts with ");
+        exc << conflicts.size() << " changed blocks";
+        throw exc;
+    }
+
+    auto dst = static_cast<uint8_t*>(data);
+    vector<uint16_t> delta(layout.m_checksums.size(), 0);
+    for (auto& i : m_changes) {
+        uint8_t* block = dst + i.m_offset;
+        uint16_t before = Checksum::sum(block, i.m_length);
+        memcpy(block, getData(i), i.m_length);
+        uint16_t change = Checksum::sum(block, i.m_length) - before;
+        for (size_t j = 0; j < layout.m_checksums.size(); ++j) {
+            if (i.m_offset >= layout.m_checksums[j].m_begin && i.m_offset < layout.m_checksums[j].m_end) {
+                delta[j] += change;
+            }
+        }
+    }
+    for (size_t i = 0; i < layout.m_checksums.size(); ++i) {
+        Checksum::adjust(dst + layout.m_checksums[i].m_stored, delta[i]);
+    }
+}
+
+// Clear patch
+void StorePatch::clear()
+{
+    m_layout = 0;
+    m_size = 0;
+    m_changes.clear();
+    m_data.clear();
+}
+
+// Load patch file
+void StorePatch::load(const string& fileName)
+{
+    BinaryReader::load(fileName, s_format, *this, [this](BinaryReader& reader) {
+        m_layout = reader.get(8);
+        m_size = reader.get(4);
+        size_t count = reader.get(4);
+        for (size_t i = 0; i < count; ++i) {
+            Change change;
+            change.m_type = SysEx::BlockType(reader.get(1));
+            change.m_block = uint8_t(reader.get(1));
+            change.m_length = uint8_t(reader.get(1));
+            change.m_offset = uint16_t(reader.get(2));
+            change.m_base = reader.get(8);
+            change.m_data = m_data.size();
+            if (size_t(change.m_offset) + change.m_length > m_size) {
+                throw DataFormatException("Invalid block in patch file");
+            }
+            m_data.resize(m_data.size() + change.m_length);
+            reader.getData(&(m_data[change.m_data]), change.m_length);
+            m_changes.push_back(change);
+        }
+    });
+}
+
+// Save patch file
+void StorePatch::save(const string& fileName) const
+{
+    BinaryWriter writer(s_format);
+    writer.put(m_layout, 8);
+    writer.put(m_size, 4);
+    writer.put(m_changes.size(), 4);
+    for (auto& i : m_changes) {
+        writer.put(uint8_t(i.m_type), 1);
+        writer.put(i.m_block, 1);
+        writer.put(i.m_length, 1);
+        writer.put(i.m_offset, 2);
+        writer.put(i.m_base, 8);
+        writer.putData(getData(i), i.m_length);
+    }
+
+    writer.save(fileName);
+}
+
+// Start new patch
+void StorePatch::begin(const StoreLayout& layout, size_t size)
+{
+    clear();
+    SlotGroup groups[5];
+    getGroups(layout, groups);
+    for (auto& i : groups) {
+        for (auto& j : *i.m_slots) {
+            if (size_t(j.m_offset) + j.m_size > size) {
+                throw DataFormatException("Store layout exceeds raw data");
+            }
+        }
+    }
+    m_layout = hashLayout(layout);
+    m_size = size;
+}
+
+// Add change
+void StorePatch::add(SysEx::BlockType type, const StoreLayout::Slot& slot, const uint8_t* data, uint64_t base)
+{
+    Change change = { type, slot.m_block, slot.m_size, slot.m_offset, base, m_data.size() };
+    m_data.insert(m_data.end(), data, data + slot.m_size);
+    m_changes.push_back(change);
+}
+
+// Verify target layout and size
+void StorePatch::verify(const StoreLayout& layout, size_t size) const
+{
+    if (size != m_size || hashLayout(layout) != m_layout) {
+        throw DataFormatException("Patch doesn't match store layout");
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
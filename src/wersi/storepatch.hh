@@ -0,0 +1,267 @@
+// vim:set ts=4 sw=4 et cin:
+
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wersi/sysex.hh>
+#include <wersi/storeconverter.hh>
+#include <string>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Block level instrument store patch.
+
+  Records the blocks that differ between a source and a target store of the same layout, so the target can be turned
+  into the source by shipping only the changed blocks. Blocks are compared slot by slot, either directly or against
+  per slot hashes of a target that isn't available locally, e.g. a copy of a library on another machine. Applying a
+  patch writes the changed blocks in place and corrects the checksums of the layout, the rest of the raw data is
+  left alone. Each change also records the hash of the target block it replaces, so blocks changed on the target
+  since the patch was created are detected as conflicts instead of being overwritten.
+
+  Patches can only be applied to raw data of the layout they have been created for, which is verified by a hash of
+  the layout. A DataFormatException is thrown otherwise.
+ */
+class StorePatch {
+    public:
+        /// Changed block
+        struct Change {
+            SysEx::BlockType    m_type;     ///< Block type, FIXWAVE for all WAVE slots
+            uint8_t             m_block;    ///< Block number
+            uint8_t             m_length;   ///< Block length
+            uint16_t            m_offset;   ///< Block offset in the raw data buffer
+            uint64_t            m_base;     ///< Hash of the target block replaced by this change
+            size_t              m_data;     ///< Offset of the new block data in the patch data
+        };
+
+        /**
+          Create empty patch.
+
+          Creates a patch without any changes.
+         */
+        StorePatch();
+
+        /**
+          Destroy patch.
+
+          Destroys the patch.
+         */
+        ~StorePatch();
+
+        /**
+          Calculate block hashes.
+
+          Calculates the hash of every slot of the layout, in the order of the ICB, VCF, AMPL, FREQ and WAVE slots.
+          Sending these hashes is enough for the other side to create a patch against this raw data. If the layout
+          exceeds the raw data, a DataFormatException is thrown.
+
+          @param[in]    layout      Block layout
+          @param[in]    data        Raw data buffer
+          @param[in]    size        Raw data buffer size
+          @param[out]   hashes      Receives the slot hashes
+         */
+        static void hashBlocks(const StoreLayout& layout, const void* data, size_t size, std::vector<uint64_t>& hashes);
+
+        /**
+          Calculate layout hash.
+
+          Calculates a hash of all slots and checksums of the layout, patches are only applied to raw data with the
+          same layout hash.
+
+          @param[in]    layout      Block layout
+
+          @return                   Layout hash
+         */
+        static uint64_t hashLayout(const StoreLayout& layout);
+
+        /**
+          Create patch from two buffers.
+
+          Replaces the contents of the patch with all blocks of the source that differ from the target. Both buffers
+          must have the given layout.
+
+          @param[in]    layout      Block layout of source and target
+          @param[in]    source      Source raw data buffer
+          @param[in]    target      Target raw data buffer
+          @param[in]    size        Size of both raw data buffers
+         */
+        void diff(const StoreLayout& layout, const void* source, const void* target, size_t size);
+
+        /**
+          Create patch from target hashes.
+
+          Replaces the contents of the patch with all blocks of the source whose hash differs from the target hash of
+          the same slot, see hashBlocks(). If the number of hashes doesn't match the layout, a DataFormatException is
+          thrown.
+
+          @param[in]    layout      Block layout of source and target
+          @param[in]    source      Source raw data buffer
+          @param[in]    size        Size of source raw data buffer
+          @param[in]    hashes      Slot hashes of target
+         */
+        void diff(const StoreLayout& layout, const void* source, size_t size, const std::vector<uint64_t>& hashes);
+
+        /**
+          Check target.
+
+          Lists the changes whose target block is neither the block the patch has been created against nor already
+          the new block, i.e. blocks changed on both sides. Applying the patch would overwrite these changes.
+
+          @param[in]    layout      Block layout of target
+          @param[in]    data        Target raw data buffer
+          @param[in]    size        Target raw data buffer size
+          @param[out]   conflicts   Receives the indices of conflicting changes
+
+          @return                   True if there are no conflicts
+         */
+        bool check(const StoreLayout& layout, const void* data, size_t size, std::vector<size_t>& conflicts) const;
+
+        /**
+          Apply patch.
+
+          Writes all changed blocks to the target raw data buffer and corrects the checksums of the layout. Unless
+          forced, the target is checked first, see check(), and a DataFormatException is thrown without changing
+          the target if any change conflicts.
+
+          @param[in]    layout      Block layout of target
+          @param[in,out] data       Target raw data buffer
+          @param[in]    size        Target raw data buffer size
+          @param[in]    force       If true, blocks changed on both sides are overwritten
+         */
+        void apply(const StoreLayout& layout, void* data, size_t size, bool force = false) const;
+
+        /**
+          Get changes.
+
+          @return                   List of changed blocks in slot order
+         */
+        const std::vector<Change>& getChanges() const {
+            return m_changes;
+        }
+
+        /**
+          Get new block data.
+
+          @param[in]    change      Change of this patch
+
+          @return                   New data of the changed block
+         */
+        const uint8_t* getData(const Change& change) const {
+            return &(m_data[change.m_data]);
+        }
+
+        /**
+          Check for empty patch.
+
+          @return                   True if the patch has no changes
+         */
+        bool empty() const {
+            return m_changes.empty();
+        }
+
+        /**
+          Clear patch.
+
+          Removes all changes.
+         */
+        void clear();
+
+        /**
+          Load patch file.
+
+          Replaces the contents of the patch with the contents of the file. A SystemException is thrown if the file
+          can't be read, a DataFormatException if it is broken, the patch is empty then.
+
+          @param[in]    fileName    Patch file name
+         */
+        void load(const std::string& fileName);
+
+        /**
+          Save patch file.
+
+          Writes the patch to the file. A SystemException is thrown on errors.
+
+          @param[in]    fileName    Patch file name
+         */
+        void save(const std::string& fileName) const;
+
+    private:
+        uint64_t                m_layout;       ///< Layout hash
+        size_t                  m_size;         ///< Raw data buffer size
+        std::vector<Change>     m_changes;      ///< Changed blocks in slot order
+        std::vector<uint8_t>    m_data;         ///< New data of all changed blocks
+
+        /**
+          Start new patch.
+
+          Clears the patch and records layout and size, throwing a DataFormatException if the layout exceeds the
+          raw data.
+
+          @param[in]    layout      Block layout
+          @param[in]    size        Raw data buffer size
+         */
+        void begin(const StoreLayout& layout, size_t size);
+
+        /**
+          Add change.
+
+          @param[in]    type        Block type
+          @param[in]    slot        Slot of the changed block
+          @param[in]    data        New block data
+          @param[in]    base        Hash of target block
+         */
+        void add(SysEx::BlockType type, const StoreLayout::Slot& slot, const uint8_t* data, uint64_t base);
+
+        /**
+          Verify target.
+
+          Throws a DataFormatException unless the target has the layout and size of the patch.
+
+          @param[in]    layout      Block layout of target
+          @param[in]    size        Target raw data buffer size
+         */
+        void verify(const StoreLayout& layout, size_t size) const;
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,180 @@
+// vim:set ts=4 sw=4 et cin:
+
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/storesnapshot.hh>
+#include <exceptions.hh>
+#include <cstring>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Node data size of the block types, AMPL and FREQ share the envelope type
+template<typename T> struct NodeSize;
+template<> struct NodeSize<Icb> {
+    static const size_t s_size = BlockLayout<SysEx::BlockType::IcBlock>::s_size;
+};
+template<> struct NodeSize<Vcf> {
+    static const size_t s_size = BlockLayout<SysEx::BlockType::VcfBlock>::s_size;
+};
+template<> struct NodeSize<Envelope> {
+    static const size_t s_size = BlockLayout<SysEx::BlockType::AmplBlock>::s_size;
+};
+template<> struct NodeSize<Wave> {
+    static const size_t s_size = BlockLayout<SysEx::BlockType::FixWaveBlock>::s_size;
+};
+
+static_assert(BlockLayout<SysEx::BlockType::FreqBlock>::s_size <= NodeSize<Envelope>::s_size,
+              "FREQ must fit into envelope nodes");
+
+// Create block object, envelopes and waves need their size
+template<typename T> static T makeBlock(uint8_t block, uint8_t* data, size_t size)
+{
+    return T(block, data, size);
+}
+
+// Create ICB object
+template<> Icb makeBlock<Icb>(uint8_t block, uint8_t* data, size_t /*size*/)
+{
+    return Icb(block, data);
+}
+
+// Create VCF object
+template<> Vcf makeBlock<Vcf>(uint8_t block, uint8_t* data, size_t /*size*/)
+{
+    return Vcf(block, data);
+}
+
+// Immutable block with its raw data
+template<typename T> struct Node {
+    // Copy raw data and parse block from the copy
+    Node(uint8_t block, const uint8_t* data, size_t size)
+        : m_data()
+        , m_block(makeBlock<T>(block, static_cast<uint8_t*>(memcpy(m_data, data, size)), size)) {
+    }
+
+    uint8_t     m_data[NodeSize<T>::s_size];    // Raw data copy
+    T           m_block;                        // Block parsed from the copy
+};
+
+// Create block node, the returned pointer shares ownership of the node
+template<typename T> static std::shared_ptr<const T> makeNode(const StoreLayout::Slot& slot, const uint8_t* data)
+{
+    if (slot.m_size > NodeSize<T>::s_size) {
+        throw DataFormatException("Block slot too large for block type");
+    }
+    auto node = std::make_shared<Node<T>>(slot.m_block, data + slot.m_offset, slot.m_size);
+    return std::shared_ptr<const T>(node, &(node->m_block));
+}
+
+// Create snapshot
+StoreSnapshot::StoreSnapshot(const void* data, size_t size, const std::shared_ptr<const StoreLayout>& layout,
+                             size_t numIcbs, uint64_t version)
+    : m_size(size)
+    , m_layout(layout)
+    , m_numIcbs(numIcbs)
+    , m_version(version)
+    , m_icb(parse<Icb>(layout->m_icb, static_cast<const uint8_t*>(data), size))
+    , m_vcf(parse<Vcf>(layout->m_vcf, static_cast<const uint8_t*>(data), size))
+    , m_ampl(parse<Envelope>(layout->m_ampl, static_cast<const uint8_t*>(data), size))
+    , m_freq(parse<Envelope>(layout->m_freq, static_cast<const uint8_t*>(data), size))
+    , m_wave(parse<Wave>(layout->m_wave, static_cast<const uint8_t*>(data), size))
+{
+}
+
+// Create snapshot after change
+StoreSnapshot::StoreSnapshot(const StoreSnapshot& previous, const void* data, size_t offset, size_t length,
+                             uint64_t version)
+    : m_size(previous.m_size)
+    , m_layout(previous.m_layout)
+    , m_numIcbs(previous.m_numIcbs)
+    , m_version(version)
+    , m_icb(reparse<Icb>(previous.m_icb, m_layout->m_icb, static_cast<const uint8_t*>(data), offset, length))
+    , m_vcf(reparse<Vcf>(previous.m_vcf, m_layout->m_vcf, static_cast<const uint8_t*>(data), offset, length))
+    , m_ampl(reparse<Envelope>(previous.m_ampl, m_layout->m_ampl, static_cast<const uint8_t*>(data), offset,
+                               length))
+    , m_freq(reparse<Envelope>(previous.m_freq, m_layout->m_freq, static_cast<const uint8_t*>(data), offset,
+                               length))
+    , m_wave(reparse<Wave>(previous.m_wave, m_layout->m_wave, static_cast<const uint8_t*>(data), offset, length))
+{
+}
+
+// Destroy snapshot
+StoreSnapshot::~StoreSnapshot()
+{
+}
+
+// Parse blocks of one type
+template<typename T> std::shared_ptr<const BlockList<std::shared_ptr<const T>>>
+StoreSnapshot::parse(const std::vector<StoreLayout::Slot>& slots, const uint8_t* data, size_t size)
+{
+    auto list = std::make_shared<BlockList<std::shared_ptr<const T>>>();
+    list->reserve(slots.size());
+    for (auto& i : slots) {
+        if (size_t(i.m_offset) + i.m_size > size) {
+            throw DataFormatException("Store layout exceeds raw data");
+        }
+        list->insert(std::make_pair(i.m_block, makeNode<T>(i, data)));
+    }
+    return list;
+}
+
+// Parse changed blocks of one type
+template<typename T> std::shared_ptr<const BlockList<std::shared_ptr<const T>>>
+StoreSnapshot::reparse(const std::shared_ptr<const BlockList<std::shared_ptr<const T>>>& previous,
+                       const std::vector<StoreLayout::Slot>& slots, const uint8_t* data, size_t offset,
+                       size_t length)
+{
+    // Slots have been checked against the raw data size when parsing the first snapshot
+    std::shared_ptr<BlockList<std::shared_ptr<const T>>> list;
+    for (auto& i : slots) {
+        if (i.m_offset < offset + length && offset < size_t(i.m_offset) + i.m_size) {
+            if (!list) {
+                list = std::make_shared<BlockList<std::shared_ptr<const T>>>(*previous);
+            }
+            list->find(i.m_block)->second = makeNode<T>(i, data);
+        }
+    }
+    if (!list) {
+        return previous;
+    }
+    return list;
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
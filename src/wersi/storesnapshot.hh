@@ -0,0 +1,287 @@
+// vim:set ts=4 sw=4 et cin:
+
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wersi/blocklist.hh>
+#include <wersi/storeconverter.hh>
+#include <wersi/icb.hh>
+#include <wersi/vcf.hh>
+#include <wersi/envelope.hh>
+#include <wersi/wave.hh>
+#include <memory>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Read-only instrument store snapshot.
+
+  Holds all blocks of an instrument store at one point in time together with the store layout. A snapshot never
+  changes after creation and parses all blocks up front, so any number of threads may read it at the same time
+  without locking, e.g. for indexing, rendering or converting while the editor keeps changing the store.
+
+  Every block is kept in an immutable node with a private copy of its raw data. A snapshot created after an edit
+  only parses the blocks overlapping the edited bytes again and shares all other nodes, the block lists of
+  unchanged block types and the layout with the previous snapshot, so publishing an edit costs about as much as
+  the edit itself. Snapshots are shared through std::shared_ptr and are freed when the last reader drops its
+  reference, see InstrumentStore::publishSnapshot() and InstrumentStore::getSnapshot().
+ */
+class StoreSnapshot {
+    public:
+        typedef BlockList<std::shared_ptr<const Icb>>       IcbList;        ///< ICB list
+        typedef BlockList<std::shared_ptr<const Vcf>>       VcfList;        ///< VCF list
+        typedef BlockList<std::shared_ptr<const Envelope>>  EnvelopeList;   ///< AMPL or FREQ list
+        typedef BlockList<std::shared_ptr<const Wave>>      WaveList;       ///< WAVE list
+
+        /**
+          Create snapshot.
+
+          Parses all blocks listed in the layout from the raw data. If the layout exceeds the raw data, a
+          DataFormatException is thrown.
+
+          @param[in]    data        Raw data buffer
+          @param[in]    size        Raw data buffer size
+          @param[in]    layout      Block layout of the raw data
+          @param[in]    numIcbs     Number of primary ICBs
+          @param[in]    version     Version number of the snapshot
+         */
+        StoreSnapshot(const void* data, size_t size, const std::shared_ptr<const StoreLayout>& layout,
+                      size_t numIcbs, uint64_t version);
+
+        /**
+          Create snapshot after change.
+
+          Creates a snapshot of the raw data after the given byte range has changed since the previous snapshot was
+          created. Blocks overlapping the range are parsed from the raw data again, all others are shared with the
+          previous snapshot.
+
+          @param[in]    previous    Previous snapshot of the same raw data buffer
+          @param[in]    data        Raw data buffer
+          @param[in]    offset      Offset of changed bytes
+          @param[in]    length      Number of changed bytes
+          @param[in]    version     Version number of the snapshot
+         */
+        StoreSnapshot(const StoreSnapshot& previous, const void* data, size_t offset, size_t length,
+                      uint64_t version);
+
+        /**
+          Destroy snapshot.
+
+          Destroys the snapshot.
+         */
+        ~StoreSnapshot();
+
+        /**
+          Get version.
+
+          Returns the version number of the snapshot, snapshots published later by the same store have higher
+          numbers.
+
+          @return                   Version number
+         */
+        uint64_t getVersion() const {
+            return m_version;
+        }
+
+        /**
+          Get raw data size.
+
+          @return                   Size of the raw data the snapshot has been taken from
+         */
+        size_t getSize() const {
+            return m_size;
+        }
+
+        /**
+          Get block layout.
+
+          @return                   Block layout of the raw data
+         */
+        const StoreLayout& getLayout() const {
+            return *m_layout;
+        }
+
+        /**
+          Get number of primary ICBs.
+
+          @return                   Number of primary ICBs
+         */
+        size_t getNumIcbs() const {
+            return m_numIcbs;
+        }
+
+        /**
+          Get iterator to beginning of ICB list.
+
+          @return                   Iterator to the beginning of the ICB list
+         */
+        IcbList::const_iterator begin() const {
+            return m_icb->begin();
+        }
+
+        /**
+          Get iterator to end of ICB list.
+
+          @return                   Iterator to the end of the ICB list
+         */
+        IcbList::const_iterator end() const {
+            return m_icb->end();
+        }
+
+        /**
+          Get ICB by block number.
+
+          @param[in]    block       Block number to look up ICB for
+
+          @return                   Pointer to ICB or nullptr if not found
+         */
+        const Icb* getIcb(uint8_t block) const {
+            return find(*m_icb, block);
+        }
+
+        /**
+          Get VCF by block number.
+
+          @param[in]    block       Block number to look up VCF for
+
+          @return                   Pointer to VCF or nullptr if not found
+         */
+        const Vcf* getVcf(uint8_t block) const {
+            return find(*m_vcf, block);
+        }
+
+        /**
+          Get AMPL by block number.
+
+          @param[in]    block       Block number to look up AMPL for
+
+          @return                   Pointer to AMPL or nullptr if not found
+         */
+        const Envelope* getAmpl(uint8_t block) const {
+            return find(*m_ampl, block);
+        }
+
+        /**
+          Get FREQ by block number.
+
+          @param[in]    block       Block number to look up FREQ for
+
+          @return                   Pointer to FREQ or nullptr if not found
+         */
+        const Envelope* getFreq(uint8_t block) const {
+            return find(*m_freq, block);
+        }
+
+        /**
+          Get WAVE by block number.
+
+          @param[in]    block       Block number to look up WAVE for
+
+          @return                   Pointer to WAVE or nullptr if not found
+         */
+        const Wave* getWave(uint8_t block) const {
+            return find(*m_wave, block);
+        }
+
+    private:
+        size_t                                  m_size;     ///< Raw data size
+        std::shared_ptr<const StoreLayout>      m_layout;   ///< Block layout
+        size_t                                  m_numIcbs;  ///< Number of primary ICBs
+        uint64_t                                m_version;  ///< Version number
+        std::shared_ptr<const IcbList>          m_icb;      ///< ICB data
+        std::shared_ptr<const VcfList>          m_vcf;      ///< VCF data
+        std::shared_ptr<const EnvelopeList>     m_ampl;     ///< AMPL data
+        std::shared_ptr<const EnvelopeList>     m_freq;     ///< FREQ data
+        std::shared_ptr<const WaveList>         m_wave;     ///< WAVE data
+
+        /**
+          Find block in block list.
+
+          @param[in]    list        Block list
+          @param[in]    block       Block number
+
+          @return                   Pointer to block or nullptr if not found
+         */
+        template<typename T> static const T* find(const BlockList<std::shared_ptr<const T>>& list, uint8_t block) {
+            auto i = list.find(block);
+            return i != list.end() ? i->second.get() : nullptr;
+        }
+
+        /**
+          Parse blocks of one type.
+
+          Parses the blocks of all slots from the raw data into a new list.
+
+          @param[in]    slots       Slots to parse
+          @param[in]    data        Raw data buffer
+          @param[in]    size        Raw data buffer size
+
+          @return                   Block list
+         */
+        template<typename T> static std::shared_ptr<const BlockList<std::shared_ptr<const T>>>
+        parse(const std::vector<StoreLayout::Slot>& slots, const uint8_t* data, size_t size);
+
+        /**
+          Parse changed blocks of one type.
+
+          Returns the previous list if no slot overlaps the changed byte range, otherwise a copy of it with the
+          overlapping blocks parsed from the raw data again.
+
+          @param[in]    previous    Block list of previous snapshot
+          @param[in]    slots       Slots of the block type
+          @param[in]    data        Raw data buffer
+          @param[in]    offset      Offset of changed bytes
+          @param[in]    length      Number of changed bytes
+
+          @return                   Block list
+         */
+        template<typename T> static std::shared_ptr<const BlockList<std::shared_ptr<const T>>>
+        reparse(const std::shared_ptr<const BlockList<std::shared_ptr<const T>>>& previous,
+                const std::vector<StoreLayout::Slot>& slots, const uint8_t* data, size_t offset, size_t length);
+
+        StoreSnapshot(const StoreSnapshot&);                ///< Inhibit copying objects
+        StoreSnapshot& operator=(const StoreSnapshot&);     ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -36,13 +36,23 @@
  */
 
 #include <wersi/sysex.hh>
+#include <wersi/blocklayout.hh>
 #include <wersi/icb.hh>
 #include <wersi/vcf.hh>
 #include <wersi/envelope.hh>
 #include <wersi/wave.hh>
-#include <wersi/instrumentstore.hh>
-#include <exceptions.hh>
+#include <wersi/sysexqueue.hh>
+#include <atomic>
 #include <cstring>
+#include <map>
+#include <mutex>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SYSEX_NEON
+#endif
 
 namespace DMSToolbox {
 namespace Wersi {
@@ -54,176 +64,251 @@ inline void byteToSysEx(uint8_t type, uint8_t byte, uint8_t& lo, uint8_t& hi)
     hi = (type << 5) | ((byte >> 4) & 0x0f);
 }
 
-// Convert two SysEx bytes to raw byte
-inline uint8_t byteFromSysEx(uint8_t type, uint8_t lo, uint8_t hi)
+// Convert two SysEx bytes to raw byte, false if the tag bits don't match
+inline bool byteFromSysEx(uint8_t type, uint8_t lo, uint8_t hi, uint8_t& byte)
+{
+    byte = (lo & 0x0f) | ((hi & 0x0f) << 4);
+    return (lo & 0xf0) == ((type << 5) | 0x10) && (hi & 0xf0) == (type << 5);
+}
+
+// Expand raw data bytes to SysEx data byte pairs, reference implementation is byteToSysEx()
+inline void dataToSysEx(const uint8_t* data, size_t length, uint8_t* out)
 {
-    if ((lo & 0xf0) != ((type << 5) | 0x10) || (hi & 0xf0) != (type << 5)) {
-        throw MidiException("Invalid Wersi SysEx data");
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i loMask = _mm_set1_epi8(0x0f);
+    const __m128i loTag = _mm_set1_epi8(0x10);
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i lo = _mm_or_si128(_mm_and_si128(v, loMask), loTag);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), loMask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(lo, hi));
+    }
+#elif defined(SYSEX_NEON)
+    const uint8x16_t loMask = vdupq_n_u8(0x0f);
+    const uint8x16_t loTag = vdupq_n_u8(0x10);
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t v = vld1q_u8(data + i);
+        uint8x16x2_t pair;
+        pair.val[0] = vorrq_u8(vandq_u8(v, loMask), loTag);
+        pair.val[1] = vshrq_n_u8(v, 4);
+        vst2q_u8(out + 2 * i, pair);
+    }
+#endif
+    for (; i < length; ++i) {
+        byteToSysEx(0, data[i], out[2 * i], out[2 * i + 1]);
     }
-    return (lo & 0x0f) | ((hi & 0x0f) << 4);
 }
 
-// Create SysEx message from raw message data
-size_t SysEx::toSysEx(uint8_t device, const Message& message, SysExMessage& sysEx)
+// Compact SysEx data byte pairs to raw data bytes, reference implementation is byteFromSysEx()
+inline bool dataFromSysEx(const uint8_t* in, size_t length, uint8_t* data)
 {
-    sysEx.m_start = 0xf0;
-    sysEx.m_vendor = 0x25;
-    sysEx.m_device = device;
-    byteToSysEx(3, static_cast<uint8_t>(message.m_type), sysEx.m_typeLo, sysEx.m_typeHi);
-    byteToSysEx(2, message.m_address, sysEx.m_addressLo, sysEx.m_addressHi);
-    byteToSysEx(1, message.m_length, sysEx.m_lengthLo, sysEx.m_lengthHi);
-    const uint8_t* s = message.m_data;
-    uint8_t* d = sysEx.m_data;
-    for (size_t i = 0; i < message.m_length; ++i) {
-        byteToSysEx(0, *s, d[0], d[1]);
-        ++s;
-        d += 2;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // Tag bits of all pairs are collected and checked once for the whole frame
+    const __m128i tagMask = _mm_set1_epi8(static_cast<char>(0xf0));
+    const __m128i tag = _mm_set1_epi16(0x0010);
+    const __m128i loMask = _mm_set1_epi16(0x000f);
+    const __m128i hiMask = _mm_set1_epi16(0x00f0);
+    __m128i invalid = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i + 16));
+        invalid = _mm_or_si128(invalid, _mm_xor_si128(_mm_and_si128(v0, tagMask), tag));
+        invalid = _mm_or_si128(invalid, _mm_xor_si128(_mm_and_si128(v1, tagMask), tag));
+        __m128i b0 = _mm_or_si128(_mm_and_si128(v0, loMask), _mm_and_si128(_mm_srli_epi16(v0, 4), hiMask));
+        __m128i b1 = _mm_or_si128(_mm_and_si128(v1, loMask), _mm_and_si128(_mm_srli_epi16(v1, 4), hiMask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_packus_epi16(b0, b1));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xffff) {
+        return false;
+    }
+#elif defined(SYSEX_NEON)
+    // Tag bits of all pairs are collected and checked once for the whole frame
+    const uint8x16_t tagMask = vdupq_n_u8(0xf0);
+    const uint8x16_t loTag = vdupq_n_u8(0x10);
+    const uint8x16_t loMask = vdupq_n_u8(0x0f);
+    uint8x16_t invalid = vdupq_n_u8(0);
+    for (; i + 16 <= length; i += 16) {
+        uint8x16x2_t pair = vld2q_u8(in + 2 * i);
+        invalid = vorrq_u8(invalid, veorq_u8(vandq_u8(pair.val[0], tagMask), loTag));
+        invalid = vorrq_u8(invalid, vandq_u8(pair.val[1], tagMask));
+        vst1q_u8(data + i, vorrq_u8(vandq_u8(pair.val[0], loMask), vshlq_n_u8(pair.val[1], 4)));
     }
-    *d = 0xf7;
+    uint64x2_t lanes = vreinterpretq_u64_u8(invalid);
+    if ((vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) != 0) {
+        return false;
+    }
+#endif
+    for (; i < length; ++i) {
+        if (!byteFromSysEx(0, in[2 * i], in[2 * i + 1], data[i])) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    return sizeof(SysExMessage) + (2 * message.m_length);
+// Encode SysEx message header and data to raw output buffer
+inline size_t encodeMessage(uint8_t device, SysEx::BlockType type, uint8_t address, const uint8_t* data,
+                            uint8_t length, uint8_t* out)
+{
+    out[0] = 0xf0;
+    out[1] = 0x25;
+    out[2] = device;
+    byteToSysEx(3, static_cast<uint8_t>(type), out[3], out[4]);
+    byteToSysEx(2, address, out[5], out[6]);
+    byteToSysEx(1, length, out[7], out[8]);
+    dataToSysEx(data, length, out + 9);
+    out[9 + 2 * size_t(length)] = 0xf7;
+
+    return sizeof(SysEx::SysExMessage) + (2 * length);
+}
+
+// Create SysEx message from raw message data
+size_t SysEx::toSysEx(uint8_t device, const Message& message, SysExMessage& sysEx)
+{
+    return encodeMessage(device, message.m_type, message.m_address, message.m_data, message.m_length,
+                         reinterpret_cast<uint8_t*>(&sysEx));
 }
 
 // Convert SysEx message to raw message data
-void SysEx::fromSysEx(uint8_t device, const SysExMessage& sysEx, Message& message)
+void SysEx::fromSysEx(uint8_t device, const SysExMessage& sysEx, Message& message, size_t size)
 {
-    if (sysEx.m_start != 0xf0 || (sysEx.m_vendor != 0x25 && sysEx.m_vendor != 0x3b) || sysEx.m_device != device) {
-        throw MidiException("Invalid Wersi SysEx message");
-    }
-    message.m_type = static_cast<BlockType>(byteFromSysEx(3, sysEx.m_typeLo, sysEx.m_typeHi));
-    message.m_address = byteFromSysEx(2, sysEx.m_addressLo, sysEx.m_addressHi);
-    message.m_length = byteFromSysEx(1, sysEx.m_lengthLo, sysEx.m_lengthHi);
-    const uint8_t* s = sysEx.m_data;
-    uint8_t* d = message.m_data;
-    for (size_t i = 0; i < message.m_length; ++i) {
-        *d = byteFromSysEx(0, s[0], s[1]);
-        s += 2;
-        ++d;
+    Status status;
+    if (!fromSysEx(device, sysEx, message, size, status)) {
+        status.raise();
     }
 }
 
-#ifdef HAVE_RTMIDI
-// Send ICB to device
-void SysEx::sendIcb(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Icb& icb)
-{
-    // Construct raw message
-    uint8_t buf[sizeof(Message) + 15];
-    auto msg = reinterpret_cast<Message*>(buf);
-    msg->m_type = BlockType::IcBlock;
-    msg->m_address = blockNum;
-    msg->m_length = 16;
-    memcpy(msg->m_data, icb.getBuffer(), 16);
-
-    // Convert to SysEx message
-    uint8_t out[sizeof(SysExMessage) + 32];
-    auto omsg = reinterpret_cast<SysExMessage*>(out);
-    size_t length = toSysEx(type, *msg, *omsg);
-
-    // Create MIDI message vector and send it
-    std::vector<unsigned char> data;
-    for (size_t i = 0; i < length; ++i) {
-        data.push_back(out[i]);
+// Convert SysEx message to raw message data without throwing
+bool SysEx::fromSysEx(uint8_t device, const SysExMessage& sysEx, Message& message, size_t size, Status& status)
+{
+    if (sysEx.m_start != 0xf0 || (sysEx.m_vendor != 0x25 && sysEx.m_vendor != 0x3b) || sysEx.m_device != device) {
+        return status.fail(Status::Code::Midi, "Invalid Wersi SysEx message");
     }
-    midi->sendMessage(&data);
+    uint8_t type;
+    if (!byteFromSysEx(3, sysEx.m_typeLo, sysEx.m_typeHi, type)
+            || !byteFromSysEx(2, sysEx.m_addressLo, sysEx.m_addressHi, message.m_address)
+            || !byteFromSysEx(1, sysEx.m_lengthLo, sysEx.m_lengthHi, message.m_length)) {
+        return status.fail(Status::Code::Midi, "Invalid Wersi SysEx data");
+    }
+    message.m_type = static_cast<BlockType>(type);
+    if (sizeof(SysExMessage) + 2 * size_t(message.m_length) > size) {
+        return status.fail(Status::Code::Midi, "Truncated Wersi SysEx message");
+    }
+    if (!dataFromSysEx(sysEx.m_data, message.m_length, message.m_data)) {
+        return status.fail(Status::Code::Midi, "Invalid Wersi SysEx data");
+    }
+    return true;
 }
 
-// Send VCF to device
-void SysEx::sendVcf(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Vcf& vcf)
+// Encode block as SysEx message into output buffer
+size_t SysEx::encode(uint8_t device, BlockType type, uint8_t address, const void* data, uint8_t length,
+                     std::vector<unsigned char>& buffer)
 {
-    // Construct raw message
-    uint8_t buf[sizeof(Message) + 9];
-    auto msg = reinterpret_cast<Message*>(buf);
-    msg->m_type = BlockType::VcfBlock;
-    msg->m_address = blockNum;
-    msg->m_length = 10;
-    memcpy(msg->m_data, vcf.getBuffer(), 10);
+    buffer.resize(sizeof(SysExMessage) + (2 * length));
+    return encodeMessage(device, type, address, static_cast<const uint8_t*>(data), length, &buffer[0]);
+}
 
-    // Convert to SysEx message
-    uint8_t out[sizeof(SysExMessage) + 20];
-    auto omsg = reinterpret_cast<SysExMessage*>(out);
-    size_t length = toSysEx(type, *msg, *omsg);
+// Compare vectorised and reference data codec
+bool SysEx::verifyCodec(const void* data, const void* pairs, uint8_t length, Status& status)
+{
+    auto raw = static_cast<const uint8_t*>(data);
+    auto in = static_cast<const uint8_t*>(pairs);
+    uint8_t encoded[2 * 255] = {};
+    uint8_t reference[2 * 255] = {};
+    dataToSysEx(raw, length, encoded);
+    for (size_t i = 0; i < length; ++i) {
+        byteToSysEx(0, raw[i], reference[2 * i], reference[2 * i + 1]);
+    }
+    if (memcmp(encoded, reference, 2 * size_t(length)) != 0) {
+        return status.fail(Status::Code::DataFormat, "Vectorised SysEx encoding differs from reference");
+    }
 
-    // Create MIDI message vector and send it
-    std::vector<unsigned char> data;
+    // Encoded data is decoded back, the given pairs are compared with the reference decoder
+    uint8_t decoded[255] = {};
+    if (!dataFromSysEx(encoded, length, decoded) || memcmp(decoded, raw, length) != 0) {
+        return status.fail(Status::Code::DataFormat, "Vectorised SysEx decoding does not restore data");
+    }
+    bool valid = true;
     for (size_t i = 0; i < length; ++i) {
-        data.push_back(out[i]);
+        valid = byteFromSysEx(0, in[2 * i], in[2 * i + 1], reference[i]) && valid;
+    }
+    if (dataFromSysEx(in, length, decoded) != valid) {
+        return status.fail(Status::Code::DataFormat, "Vectorised SysEx decoding differs from reference in validity");
     }
-    midi->sendMessage(&data);
+    if (valid && memcmp(decoded, reference, length) != 0) {
+        return status.fail(Status::Code::DataFormat, "Vectorised SysEx decoding differs from reference");
+    }
+    return true;
 }
 
-// Send AMPL to device
-void SysEx::sendAmpl(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Envelope& ampl)
+// Return block type for ICB
+SysEx::BlockType SysEx::getBlockType(const Icb& /*icb*/)
 {
-    // Construct raw message
-    uint8_t buf[sizeof(Message) + 43];
-    auto msg = reinterpret_cast<Message*>(buf);
-    msg->m_type = BlockType::AmplBlock;
-    msg->m_address = blockNum;
-    msg->m_length = ampl.getBufferSize();
-    memcpy(msg->m_data, ampl.getBuffer(), msg->m_length);
+    return BlockType::IcBlock;
+}
 
-    // Convert to SysEx message
-    uint8_t out[sizeof(SysExMessage) + 88];
-    auto omsg = reinterpret_cast<SysExMessage*>(out);
-    size_t length = toSysEx(type, *msg, *omsg);
+// Return block type for VCF
+SysEx::BlockType SysEx::getBlockType(const Vcf& /*vcf*/)
+{
+    return BlockType::VcfBlock;
+}
 
-    // Create MIDI message vector and send it
-    std::vector<unsigned char> data;
-    for (size_t i = 0; i < length; ++i) {
-        data.push_back(out[i]);
+// Return block type for envelope
+SysEx::BlockType SysEx::getBlockType(const Envelope& envelope)
+{
+    if (envelope.getBufferSize() == BlockLayout<BlockType::AmplBlock>::s_size) {
+        return BlockType::AmplBlock;
     }
-    midi->sendMessage(&data);
+    return BlockType::FreqBlock;
 }
 
-// Send FREQ to device
-void SysEx::sendFreq(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Envelope& freq)
+// Return block type for wave
+SysEx::BlockType SysEx::getBlockType(const Wave& wave)
 {
-    // Construct raw message
-    uint8_t buf[sizeof(Message) + 31];
-    auto msg = reinterpret_cast<Message*>(buf);
-    msg->m_type = BlockType::FreqBlock;
-    msg->m_address = blockNum;
-    msg->m_length = freq.getBufferSize();
-    memcpy(msg->m_data, freq.getBuffer(), msg->m_length);
+    if (wave.getBufferSize() < BlockLayout<BlockType::FixWaveBlock>::s_size) {
+        return BlockType::RelWaveBlock;
+    }
+    return BlockType::FixWaveBlock;
+}
+
+#ifdef HAVE_RTMIDI
+/// Loopback receiver callback and object
+typedef std::pair<void(*)(void* object, const std::vector<unsigned char>& message), void*> Loopback;
 
-    // Convert to SysEx message
-    uint8_t out[sizeof(SysExMessage) + 64];
-    auto omsg = reinterpret_cast<SysExMessage*>(out);
-    size_t length = toSysEx(type, *msg, *omsg);
+static std::mutex s_loopbackMutex;                                  ///< Mutex protecting the loopback registry
+static std::map<const RtMidiOut*, Loopback> s_loopbacks;            ///< Loopback receivers by MIDI port
+static std::atomic<size_t> s_numLoopbacks(0);                       ///< Number of registered loopback receivers
 
-    // Create MIDI message vector and send it
-    std::vector<unsigned char> data;
-    for (size_t i = 0; i < length; ++i) {
-        data.push_back(out[i]);
+// Send message to device
+void SysEx::send(RtMidiOut* midi, std::vector<unsigned char>& message)
+{
+    // Without any loopback registered, sending doesn't need to take the lock
+    if (s_numLoopbacks.load(std::memory_order_acquire) != 0) {
+        std::lock_guard<std::mutex> lock(s_loopbackMutex);
+        auto loopback = s_loopbacks.find(midi);
+        if (loopback != s_loopbacks.end()) {
+            loopback->second.first(loopback->second.second, message);
+            return;
+        }
     }
-    midi->sendMessage(&data);
+    midi->sendMessage(&message);
 }
 
-// Send WAVE to device
-void SysEx::sendWave(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Wave& wave)
+// Register loopback receiver
+void SysEx::setLoopback(const RtMidiOut* midi, void(*receiver)(void* object, const std::vector<unsigned char>& message),
+                        void* object)
 {
-    // Construct raw message
-    uint8_t buf[sizeof(Message) + 211];
-    auto msg = reinterpret_cast<Message*>(buf);
-    msg->m_type = BlockType::FixWaveBlock;
-    msg->m_address = blockNum;
-    msg->m_length = wave.getBufferSize();
-    if (msg->m_length < 212) {
-        msg->m_type = BlockType::RelWaveBlock;
+    std::lock_guard<std::mutex> lock(s_loopbackMutex);
+    if (receiver != nullptr) {
+        s_loopbacks[midi] = Loopback(receiver, object);
     }
-    memcpy(msg->m_data, wave.getBuffer(), msg->m_length);
-
-    // Convert to SysEx message
-    uint8_t out[sizeof(SysExMessage) + 424];
-    auto omsg = reinterpret_cast<SysExMessage*>(out);
-    size_t length = toSysEx(type, *msg, *omsg);
-
-    // Create MIDI message vector and send it
-    std::vector<unsigned char> data;
-    for (size_t i = 0; i < length; ++i) {
-        data.push_back(out[i]);
+    else {
+        s_loopbacks.erase(midi);
     }
-    midi->sendMessage(&data);
+    s_numLoopbacks.store(s_loopbacks.size(), std::memory_order_release);
 }
 
 // MIDI receive callback
@@ -231,8 +316,8 @@ void SysEx::rtMidiCallback(double /*timestamp*/, std::vector<unsigned char>* mes
 {
     if (userData != nullptr && message->size() >= 8 &&
             message->at(0) == 0xf0 && (message->at(1) == 0x25 || message->at(1) == 0x3b)) {
-        auto is = static_cast<InstrumentStore*>(userData);
-        is->receivedSysEx(message);
+        auto queue = static_cast<SysExQueue*>(userData);
+        queue->push(&(message->at(0)), message->size());
     }
 }
 #endif // HAVE_RTMIDI
@@ -38,6 +38,8 @@
 #pragma once
 
 #include <common.hh>
+#include <status.hh>
+#include <vector>
 
 #ifdef HAVE_RTMIDI
 #include <RtMidi.h>
@@ -116,84 +118,159 @@ class SysEx {
           Converts the SysEx message to raw data. The m_data field must be large enough to hold twice the amount
           given in the m_length field in the SysEx message, the m_data field in the raw message must have enough room
           to hold this amount of data.
-          If an error occurs during parsing the message or if the device type doesn't match, a MidiException is thrown.
+          If an error occurs during parsing the message, if the device type doesn't match or if the message is shorter
+          than the given size of the SysEx data, a MidiException is thrown.
 
           @param[in]        device      Device type to check for
           @param[in]        sysEx       Message data in SysEx format
           @param[in,out]    message     Message data
+          @param[in]        size        Size of the SysEx message data available, if known
          */
-        static void fromSysEx(uint8_t device, const SysExMessage& sysEx, Message& message);
+        static void fromSysEx(uint8_t device, const SysExMessage& sysEx, Message& message, size_t size = SIZE_MAX);
+
+        /**
+          Convert SysEx message to raw block without throwing.
+
+          Same as fromSysEx() above, but errors are reported in the given status instead of throwing a MidiException,
+          so stray frames on a busy MIDI bus can be dropped cheaply.
+
+          @param[in]        device      Device type to check for
+          @param[in]        sysEx       Message data in SysEx format
+          @param[in,out]    message     Message data
+          @param[in]        size        Size of the SysEx message data available
+          @param[out]       status      Receives the error, if any
+
+          @return                       True if the message has been converted
+         */
+        static bool fromSysEx(uint8_t device, const SysExMessage& sysEx, Message& message, size_t size,
+                              Status& status);
+
+        /// Size of the largest Wersi SysEx message (FIXWAVE block) including start and end bytes
+        static const size_t s_maxMessageSize = 10 + 2 * 212;
+
+        /**
+          Encode block as SysEx message.
+
+          Encodes the given raw block data into a complete SysEx message in the given output buffer. The buffer is
+          resized to the message length, so if its capacity has been reserved to s_maxMessageSize once, encoding
+          never allocates memory.
+
+          @param[in]        device      Device type to create message for
+          @param[in]        type        Block type
+          @param[in]        address     Block address
+          @param[in]        data        Raw block data
+          @param[in]        length      Raw block data length
+          @param[in,out]    buffer      Output buffer receiving the SysEx message
+
+          @return                       Length of the full message
+         */
+        static size_t encode(uint8_t device, BlockType type, uint8_t address, const void* data, uint8_t length,
+                             std::vector<unsigned char>& buffer);
+
+        /**
+          Verify data codec.
+
+          Runs the given raw data and SysEx data byte pairs through the vectorised (SSE2/NEON) and the byte wise
+          reference implementation of the data codec and compares the results byte for byte. The raw data is
+          encoded and decoded again, the byte pairs may be corrupted and are decoded only, both implementations
+          must reject them alike. Without SSE2 or NEON, both implementations are the same.
+
+          @param[in]        data        Raw data
+          @param[in]        pairs       SysEx data byte pairs, twice the length of the raw data
+          @param[in]        length      Raw data length
+          @param[out]       status      Receives the difference, if any
+
+          @return                       True if both implementations give the same results
+         */
+        static bool verifyCodec(const void* data, const void* pairs, uint8_t length, Status& status);
+
+        /**
+          Get block type for ICB.
+
+          Returns the SysEx block type used to transfer the given ICB.
+
+          @param[in]        icb         ICB to get block type for
+
+          @return                       SysEx block type
+         */
+        static BlockType getBlockType(const Icb& icb);
 
-#ifdef HAVE_RTMIDI
         /**
-          Send ICB to device.
+          Get block type for VCF.
+
+          Returns the SysEx block type used to transfer the given VCF.
 
-          Sends the given ICB with given block number to device with given type.
+          @param[in]        vcf         VCF to get block type for
 
-          @param[in]        midi        MIDI port to use (must be opened)
-          @param[in]        type        Device type
-          @param[in]        blockNum    Block number
-          @param[in]        icb         ICB to send to device
+          @return                       SysEx block type
          */
-        static void sendIcb(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Icb& icb);
+        static BlockType getBlockType(const Vcf& vcf);
 
         /**
-          Send VCF to device.
+          Get block type for envelope.
 
-          Sends the given VCF with given block number to device with given type.
+          Returns the SysEx block type used to transfer the given envelope, AMPL and FREQ envelopes are told apart
+          by their size.
 
-          @param[in]        midi        MIDI port to use (must be opened)
-          @param[in]        type        Device type
-          @param[in]        blockNum    Block number
-          @param[in]        vcf         VCF to send to device
+          @param[in]        envelope    Envelope to get block type for
+
+          @return                       SysEx block type
          */
-        static void sendVcf(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Vcf& vcf);
+        static BlockType getBlockType(const Envelope& envelope);
 
         /**
-          Send AMPL to device.
+          Get block type for wave.
+
+          Returns the SysEx block type used to transfer the given wave, which is RELWAVE for waves without fixed
+          formant data and FIXWAVE otherwise.
 
-          Sends the given AMPL with given block number to device with given type.
+          @param[in]        wave        Wave to get block type for
 
-          @param[in]        midi        MIDI port to use (must be opened)
-          @param[in]        type        Device type
-          @param[in]        blockNum    Block number
-          @param[in]        ampl        AMPL to send to device
+          @return                       SysEx block type
          */
-        static void sendAmpl(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Envelope& ampl);
+        static BlockType getBlockType(const Wave& wave);
 
+#ifdef HAVE_RTMIDI
         /**
-          Send FREQ to device.
+          Send message to device.
+
+          Sends the given SysEx message to the given MIDI port. If a loopback receiver is registered for the port, the
+          message is handed to it instead, so the port doesn't even have to be a real RtMidi port in that case. All
+          messages to devices must be sent through this function.
 
-          Sends the given FREQ with given block number to device with given type.
+          The message is not changed, it is only taken by non-const reference as RtMidi 2.x expects a non-const
+          message pointer.
 
-          @param[in]        midi        MIDI port to use (must be opened)
-          @param[in]        type        Device type
-          @param[in]        blockNum    Block number
-          @param[in]        ampl        FREQ to send to device
+          @param[in]        midi        MIDI port to use (must be opened unless a loopback is registered)
+          @param[in]        message     Complete SysEx message
          */
-        static void sendFreq(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Envelope& freq);
+        static void send(RtMidiOut* midi, std::vector<unsigned char>& message);
 
         /**
-          Send WAVE to device.
+          Register loopback receiver.
 
-          Sends the given WAVE with given block number to device with given type.
+          Registers a receiver for all messages sent to the given MIDI port, replacing any previous receiver of the
+          port. Passing nullptr as receiver removes the registration. The receiver is called on the sending thread,
+          once it has been removed it is guaranteed not to be called any more.
 
-          @param[in]        midi        MIDI port to use (must be opened)
-          @param[in]        type        Device type
-          @param[in]        blockNum    Block number
-          @param[in]        ampl        WAVE to send to device
+          @param[in]        midi        MIDI port to intercept
+          @param[in]        receiver    Receiver callback or nullptr
+          @param[in]        object      Object to pass to receiver callback
          */
-        static void sendWave(RtMidiOut* midi, uint8_t type, uint8_t blockNum, const Wave& wave);
+        static void setLoopback(const RtMidiOut* midi,
+                                void(*receiver)(void* object, const std::vector<unsigned char>& message),
+                                void* object);
 
         /**
           RtMidi callback.
 
           This is the RtMidi receive callback to keep the input queue tidy. It throws away all message that are
-          not Wersi SysEx and routes the remaining messages to the instrument store pointed to by the userData pointer.
+          not Wersi SysEx and pushes the remaining messages to the SysEx queue pointed to by the userData pointer,
+          which decodes them and routes them to its instrument store outside of the MIDI driver thread.
 
           @param[in]        timeStamp   MIDI timestamp, ignored
           @param[in]        message     MIDI message just received
-          @param[in]        userData    InstrumentStore pointer to route Wersi SysEx messages to
+          @param[in]        userData    SysExQueue pointer to route Wersi SysEx messages to
          */
         static void rtMidiCallback(double timestamp, std::vector<unsigned char>* message, void* userData);
 #endif // HAVE_RTMIDI
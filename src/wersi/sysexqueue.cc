@@ -0,0 +1,154 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/sysexqueue.hh>
+#include <wersi/sysex.hh>
+#include <wersi/instrumentstore.hh>
+#include <wersi/transferstats.hh>
+#include <exceptions.hh>
+#include <chrono>
+#include <cstring>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create new SysEx queue
+SysExQueue::SysExQueue(InstrumentStore* store, uint8_t device, size_t slots)
+    : m_store(store)
+    , m_device(device)
+    , m_slots()
+    , m_mask(0)
+    , m_decoded(sizeof(SysEx::Message) + 255)
+    , m_head(0)
+    , m_tail(0)
+    , m_overflows(0)
+    , m_highWater(0)
+    , m_invalid(0)
+    , m_running(true)
+    , m_wakeMutex()
+    , m_wakeCond()
+    , m_worker()
+{
+    size_t size = 1;
+    while (size < slots) {
+        size <<= 1;
+    }
+    m_slots.resize(size);
+    m_mask = size - 1;
+    m_worker = std::thread(&SysExQueue::run, this);
+}
+
+// Destroy SysEx queue
+SysExQueue::~SysExQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_running = false;
+    }
+    m_wakeCond.notify_one();
+    m_worker.join();
+}
+
+// Push raw SysEx message
+bool SysExQueue::push(const uint8_t* data, size_t size)
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t used = head - m_tail.load(std::memory_order_acquire);
+    if (size > s_slotSize || used >= m_slots.size()) {
+        m_overflows.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Slot& slot = m_slots[head & m_mask];
+    memcpy(slot.m_data, data, size);
+    slot.m_size = size;
+    m_head.store(head + 1, std::memory_order_release);
+
+    // Only the producer updates the high-water mark
+    if (used + 1 > m_highWater.load(std::memory_order_relaxed)) {
+        m_highWater.store(used + 1, std::memory_order_relaxed);
+    }
+
+    // Wake up worker without taking the lock, a lost wakeup is caught by the worker's wait timeout
+    m_wakeCond.notify_one();
+    return true;
+}
+
+// Worker thread main loop
+void SysExQueue::run()
+{
+    auto msg = reinterpret_cast<SysEx::Message*>(&m_decoded[0]);
+    Status status;
+    while (m_running) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) {
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            if (m_running && tail == m_head.load(std::memory_order_acquire)) {
+                m_wakeCond.wait_for(lock, std::chrono::milliseconds(5));
+            }
+            continue;
+        }
+
+        // Decode and deliver message, the slot is released afterwards
+        const Slot& slot = m_slots[tail & m_mask];
+        auto sem = reinterpret_cast<const SysEx::SysExMessage*>(slot.m_data);
+
+        // Message must be at least a header, the terminating byte and the announced data length, stray frames are
+        // dropped without throwing
+        bool valid = slot.m_size >= sizeof(SysEx::SysExMessage)
+                     && SysEx::fromSysEx(m_device, *sem, *msg, slot.m_size, status);
+        if (valid) {
+            try {
+                m_store->receivedSysEx(*msg);
+            }
+            catch (Exception&) {
+                valid = false;
+            }
+        }
+        if (!valid) {
+            m_invalid.fetch_add(1, std::memory_order_relaxed);
+            auto stats = m_store->getStats();
+            if (stats != nullptr) {
+                stats->recordInvalid();
+            }
+        }
+        m_tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
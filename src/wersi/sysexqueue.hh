@@ -0,0 +1,182 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class InstrumentStore;
+
+/**
+  @ingroup wersi_group
+
+  Wersi SysEx ingress queue.
+
+  This class decouples the MIDI driver thread from SysEx decoding. The producer side (usually the RtMidi callback)
+  only copies the raw message bytes into one of a fixed number of preallocated slots of a lock-free single-producer/
+  single-consumer ring. A worker thread drains the ring, decodes the messages using SysEx::fromSysEx() and passes them
+  on to the associated instrument store. Messages that don't fit into a slot or arrive while the ring is full are
+  dropped and counted, the high-water mark of the ring occupancy is tracked to allow sizing the ring.
+ */
+class SysExQueue {
+    public:
+        /// Maximum size of a raw SysEx message, large enough for a FIXWAVE block
+        static const size_t s_slotSize = 512;
+
+        /**
+          Create new SysEx queue.
+
+          Creates a new SysEx queue with the given number of slots and starts the worker thread delivering decoded
+          messages to the given instrument store.
+
+          @param[in]    store       Instrument store to deliver decoded messages to
+          @param[in]    device      Device type to check decoded messages for
+          @param[in]    slots       Number of message slots, rounded up to the next power of two
+         */
+        SysExQueue(InstrumentStore* store, uint8_t device, size_t slots = 128);
+
+        /**
+          Destroy SysEx queue.
+
+          Stops the worker thread and destroys the SysEx queue. Messages still in the ring are discarded. The producer
+          must not push any more messages while or after destroying the queue.
+         */
+        ~SysExQueue();
+
+        /**
+          Push raw SysEx message.
+
+          Copies the raw SysEx message into the next free slot. This must only be called from a single thread at a
+          time, it never blocks and never allocates memory.
+
+          @param[in]    data        Raw SysEx message data
+          @param[in]    size        Raw SysEx message size
+
+          @return                   True if the message was queued, false if it was dropped
+         */
+        bool push(const uint8_t* data, size_t size);
+
+        /**
+          Get capacity.
+
+          Returns the number of message slots of the ring.
+
+          @return                   Number of message slots
+         */
+        size_t getCapacity() const {
+            return m_slots.size();
+        }
+
+        /**
+          Get overflow count.
+
+          Returns the number of messages dropped because the ring was full or the message too large.
+
+          @return                   Number of dropped messages
+         */
+        size_t getOverflows() const {
+            return m_overflows.load(std::memory_order_relaxed);
+        }
+
+        /**
+          Get high-water mark.
+
+          Returns the highest number of slots that have been occupied at the same time.
+
+          @return                   High-water mark of ring occupancy
+         */
+        size_t getHighWaterMark() const {
+            return m_highWater.load(std::memory_order_relaxed);
+        }
+
+        /**
+          Get invalid message count.
+
+          Returns the number of queued messages that could not be decoded or were rejected by the instrument store.
+
+          @return                   Number of invalid messages
+         */
+        size_t getInvalid() const {
+            return m_invalid.load(std::memory_order_relaxed);
+        }
+
+    private:
+        /// Raw message slot
+        struct Slot {
+            size_t      m_size;                     ///< Raw message size
+            uint8_t     m_data[s_slotSize];         ///< Raw message data
+        };
+
+        InstrumentStore*        m_store;            ///< Instrument store to deliver messages to
+        uint8_t                 m_device;           ///< Device type to check for
+        std::vector<Slot>       m_slots;            ///< Preallocated message slots
+        size_t                  m_mask;             ///< Slot index mask
+        std::vector<uint8_t>    m_decoded;          ///< Preallocated buffer for decoded messages
+
+        std::atomic<size_t>     m_head;             ///< Next slot to write, only modified by producer
+        std::atomic<size_t>     m_tail;             ///< Next slot to read, only modified by consumer
+        std::atomic<size_t>     m_overflows;        ///< Number of dropped messages
+        std::atomic<size_t>     m_highWater;        ///< High-water mark of ring occupancy
+        std::atomic<size_t>     m_invalid;          ///< Number of invalid messages
+
+        std::atomic<bool>       m_running;          ///< Worker thread keeps running while true
+        std::mutex              m_wakeMutex;        ///< Mutex for worker wakeup
+        std::condition_variable m_wakeCond;         ///< Worker wakeup condition
+        std::thread             m_worker;           ///< Worker thread
+
+        /**
+          Worker thread main loop.
+
+          Drains the ring and delivers all decoded messages until the queue is destroyed.
+         */
+        void run();
+
+        SysExQueue(const SysExQueue&);              ///< Inhibit copying objects
+        SysExQueue& operator=(const SysExQueue&);   ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
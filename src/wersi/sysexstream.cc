@@ -0,0 +1,221 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/sysexstream.hh>
+#include <wersi/transferstats.hh>
+#include <exceptions.hh>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/// Size of the chunks read from input streams
+static const size_t s_chunkSize = 4096;
+
+// Create new SysEx reader
+SysExReader::SysExReader(InstrumentStore& store, uint8_t device)
+    : m_store(store)
+    , m_device(device)
+    , m_blocks()
+    , m_frame()
+    , m_inFrame(false)
+    , m_overflow(false)
+    , m_decoded(sizeof(SysEx::Message) + 255)
+    , m_frames(0)
+    , m_applied(0)
+    , m_skipped(0)
+{
+    m_store.getDeviceBlocks(m_blocks);
+    m_frame.reserve(SysEx::s_maxMessageSize);
+}
+
+// Destroy SysEx reader
+SysExReader::~SysExReader()
+{
+}
+
+// Feed input data
+void SysExReader::feed(const void* data, size_t size)
+{
+    auto ptr = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t byte = ptr[i];
+        if (byte == 0xf0) {
+            // A new start byte ends an unterminated frame
+            if (m_inFrame) {
+                ++m_skipped;
+            }
+            m_frame.clear();
+            m_frame.push_back(byte);
+            m_inFrame = true;
+            m_overflow = false;
+        }
+        else if (!m_inFrame || byte >= 0xf8) {
+            // Data between frames and real time messages within frames are ignored
+        }
+        else if (byte == 0xf7) {
+            m_inFrame = false;
+            ++m_frames;
+            if (m_overflow) {
+                ++m_skipped;
+            }
+            else {
+                m_frame.push_back(byte);
+                applyFrame();
+            }
+        }
+        else if (byte & 0x80) {
+            // Any other status byte aborts the frame
+            m_inFrame = false;
+            ++m_skipped;
+        }
+        else if (m_frame.size() < SysEx::s_maxMessageSize) {
+            m_frame.push_back(byte);
+        }
+        else {
+            m_overflow = true;
+        }
+    }
+}
+
+// Read input stream
+void SysExReader::read(std::istream& in)
+{
+    auto start = std::chrono::steady_clock::now();
+    char chunk[s_chunkSize];
+    while (in) {
+        in.read(chunk, sizeof(chunk));
+        feed(chunk, size_t(in.gcount()));
+    }
+    if (in.bad()) {
+        throw SystemException("Cannot read SysEx data");
+    }
+    finish();
+
+    auto stats = m_store.getStats();
+    if (stats != nullptr) {
+        stats->recordBusy(std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - start));
+    }
+}
+
+// Finish reading
+void SysExReader::finish()
+{
+    if (m_inFrame) {
+        m_inFrame = false;
+        ++m_skipped;
+    }
+    if (m_applied != 0) {
+        m_store.dissect();
+    }
+}
+
+// Apply frame
+void SysExReader::applyFrame()
+{
+    auto message = reinterpret_cast<SysEx::Message*>(&m_decoded[0]);
+    auto stats = m_store.getStats();
+    Status status;
+    if (m_frame.size() < sizeof(SysEx::SysExMessage)
+            || !SysEx::fromSysEx(m_device, *reinterpret_cast<const SysEx::SysExMessage*>(&m_frame[0]), *message,
+                                 m_frame.size(), status)) {
+        ++m_skipped;
+        if (stats != nullptr) {
+            stats->recordInvalid();
+        }
+        return;
+    }
+
+    auto block = m_blocks.find(InstrumentStore::getDeviceBlockKey(message->m_type, message->m_address));
+    if (block == m_blocks.end()) {
+        ++m_skipped;
+        if (stats != nullptr) {
+            stats->recordUnexpected();
+        }
+        return;
+    }
+    memcpy(block->second.m_data, message->m_data, std::min(message->m_length, block->second.m_length));
+    ++m_applied;
+
+    // There are no requests for stored data, so there is no latency either
+    if (stats != nullptr) {
+        stats->recordResponse(message->m_type, message->m_length, std::chrono::microseconds(0), false);
+    }
+}
+
+// Create new SysEx writer
+SysExWriter::SysExWriter(std::ostream& out, uint8_t device)
+    : m_out(out)
+    , m_device(device)
+    , m_buffer()
+{
+    m_buffer.reserve(SysEx::s_maxMessageSize);
+}
+
+// Destroy SysEx writer
+SysExWriter::~SysExWriter()
+{
+}
+
+// Write block
+void SysExWriter::write(SysEx::BlockType type, uint8_t address, const void* data, uint8_t length)
+{
+    size_t size = SysEx::encode(m_device, type, address, data, length, m_buffer);
+    m_out.write(reinterpret_cast<const char*>(&m_buffer[0]), size);
+    if (!m_out) {
+        throw SystemException("Cannot write SysEx data");
+    }
+}
+
+// Write instrument store
+size_t SysExWriter::write(InstrumentStore& store)
+{
+    std::vector<InstrumentStore::DeviceBlock> blocks;
+    store.getDeviceBlocks(blocks);
+    for (auto& i : blocks) {
+        write(i.m_type, i.m_address, i.m_data, i.m_length);
+    }
+    return blocks.size();
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
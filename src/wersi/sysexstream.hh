@@ -0,0 +1,228 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <wersi/instrumentstore.hh>
+#include <wersi/sysex.hh>
+#include <iosfwd>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Streaming SysEx reader.
+
+  Reads Wersi SysEx messages from a .syx file, a pipe or any other byte stream and applies the contained blocks to an
+  instrument store. Input is processed incrementally in chunks of any size, message frames are split on the SysEx
+  start (F0) and end (F7) bytes, so memory usage does not depend on the input size. Each frame is decoded with
+  SysEx::fromSysEx() and its data is copied to the store block with the same type and address. Frames of other
+  vendors or devices, undecodable frames and blocks not present in the store are skipped and counted. RELWAVE and
+  FIXWAVE blocks are interchangeable, only as much data as both sizes allow is copied.
+
+  The store buffer is written directly while reading, the store objects are updated by finish(). If the store keeps
+  transfer statistics, applied blocks, skipped and invalid frames and the time spent in read() are recorded there.
+ */
+class SysExReader {
+    public:
+        /**
+          Create new SysEx reader.
+
+          Creates a new SysEx reader applying blocks to the given instrument store.
+
+          @param[in]    store       Instrument store to apply blocks to
+          @param[in]    device      Device type to accept messages for
+         */
+        SysExReader(InstrumentStore& store, uint8_t device);
+
+        /**
+          Destroy SysEx reader.
+
+          Destroys the SysEx reader. An incomplete frame at the end of the input is discarded.
+         */
+        ~SysExReader();
+
+        /**
+          Feed input data.
+
+          Processes the next chunk of input data, applying all messages completed by it.
+
+          @param[in]    data        Input data
+          @param[in]    size        Input data size
+         */
+        void feed(const void* data, size_t size);
+
+        /**
+          Read input stream.
+
+          Feeds the whole input stream in fixed size chunks, then calls finish().
+
+          @param[in]    in          Input stream, should be opened in binary mode
+         */
+        void read(std::istream& in);
+
+        /**
+          Finish reading.
+
+          Discards an incomplete frame and parses the instrument store again if any block has been applied.
+         */
+        void finish();
+
+        /**
+          Get number of frames.
+
+          Returns the number of complete SysEx frames read so far.
+
+          @return                   Number of frames
+         */
+        size_t getNumFrames() const {
+            return m_frames;
+        }
+
+        /**
+          Get number of applied blocks.
+
+          Returns the number of blocks copied to the instrument store so far.
+
+          @return                   Number of applied blocks
+         */
+        size_t getNumApplied() const {
+            return m_applied;
+        }
+
+        /**
+          Get number of skipped frames.
+
+          Returns the number of frames not applied to the instrument store, including truncated frames.
+
+          @return                   Number of skipped frames
+         */
+        size_t getNumSkipped() const {
+            return m_skipped;
+        }
+
+    private:
+        InstrumentStore&                    m_store;                ///< Instrument store to apply blocks to
+        uint8_t                             m_device;               ///< Device type to accept
+        InstrumentStore::DeviceBlockMap     m_blocks;               ///< Store blocks by type and address
+        std::vector<uint8_t>                m_frame;                ///< Current frame, at most one maximum message
+        bool                                m_inFrame;              ///< Inside a frame
+        bool                                m_overflow;             ///< Current frame too large for any message
+        std::vector<uint8_t>                m_decoded;              ///< Buffer for decoded messages
+        size_t                              m_frames;               ///< Number of complete frames
+        size_t                              m_applied;              ///< Number of applied blocks
+        size_t                              m_skipped;              ///< Number of skipped frames
+
+        /**
+          Apply frame.
+
+          Decodes the current frame and copies its data to the matching store block.
+         */
+        void applyFrame();
+
+        // Inhibit copying
+        SysExReader(const SysExReader&);
+        SysExReader& operator=(const SysExReader&);
+};
+
+/**
+  @ingroup wersi_group
+
+  Streaming SysEx writer.
+
+  Writes the blocks of instrument stores as Wersi SysEx messages to a stream, e.g. to create .syx files or to pipe
+  stores to other tools. Messages are encoded one at a time into a reused buffer.
+ */
+class SysExWriter {
+    public:
+        /**
+          Create new SysEx writer.
+
+          Creates a new SysEx writer for the given output stream.
+
+          @param[in]    out         Output stream, should be opened in binary mode
+          @param[in]    device      Device type to create messages for
+         */
+        SysExWriter(std::ostream& out, uint8_t device);
+
+        /**
+          Destroy SysEx writer.
+
+          Destroys the SysEx writer, the output stream is not closed.
+         */
+        ~SysExWriter();
+
+        /**
+          Write block.
+
+          Writes a single block as SysEx message.
+
+          @param[in]    type        Block type
+          @param[in]    address     Block address
+          @param[in]    data        Raw block data
+          @param[in]    length      Raw block data length
+         */
+        void write(SysEx::BlockType type, uint8_t address, const void* data, uint8_t length);
+
+        /**
+          Write instrument store.
+
+          Writes all device blocks of the instrument store in transfer order. The store should be up to date, its
+          raw data buffer is written as is.
+
+          @param[in]    store       Instrument store to write
+
+          @return                   Number of messages written
+         */
+        size_t write(InstrumentStore& store);
+
+    private:
+        std::ostream&                       m_out;                  ///< Output stream
+        uint8_t                             m_device;               ///< Device type
+        std::vector<unsigned char>          m_buffer;               ///< Reused message buffer
+
+        // Inhibit copying
+        SysExWriter(const SysExWriter&);
+        SysExWriter& operator=(const SysExWriter&);
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
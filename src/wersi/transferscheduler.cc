@@ -0,0 +1,212 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/transferscheduler.hh>
+#include <exceptions.hh>
+#include <algorithm>
+
+#ifdef HAVE_RTMIDI
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Create new transfer scheduler
+TransferScheduler::TransferScheduler()
+    : m_ports()
+    , m_mutex()
+    , m_cond()
+    , m_stopping(false)
+    , m_sequence(0)
+    , m_failures()
+{
+}
+
+// Destroy transfer scheduler
+TransferScheduler::~TransferScheduler()
+{
+    shutdown();
+}
+
+// Submit transfer
+void TransferScheduler::submit(DeviceTransfer* transfer, const std::string& interface, Priority priority,
+                               void(*callback)(void* object, DeviceTransfer* transfer, bool done), void* object)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping) {
+        throw MidiException("Transfer scheduler has been shut down");
+    }
+    Job job = { transfer, priority, m_sequence++, callback, object };
+    std::unique_ptr<Port>& port = m_ports[interface];
+    if (!port) {
+        port.reset(new Port());
+        Port* worker = port.get();
+        port->m_thread = std::thread([this, worker]() {
+            work(worker);
+        });
+    }
+
+    // Keep the queue ordered, jobs of the same priority run in submission order
+    auto pos = std::upper_bound(port->m_jobs.begin(), port->m_jobs.end(), job, [](const Job& a, const Job& b) {
+        return a.m_priority < b.m_priority || (a.m_priority == b.m_priority && a.m_sequence < b.m_sequence);
+    });
+    port->m_jobs.insert(pos, job);
+    m_cond.notify_all();
+}
+
+// Cancel transfer
+void TransferScheduler::cancel(DeviceTransfer* transfer)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (auto& i : m_ports) {
+        auto& jobs = i.second->m_jobs;
+        for (auto j = jobs.begin(); j != jobs.end(); ++j) {
+            if (j->m_transfer == transfer) {
+                // A cancelled transfer fails without accessing the device, it can be completed right here
+                Job job = *j;
+                jobs.erase(j);
+                lock.unlock();
+                transfer->cancel();
+                runJob(job);
+                return;
+            }
+        }
+    }
+    lock.unlock();
+    transfer->cancel();
+}
+
+// Shut down scheduler
+void TransferScheduler::shutdown()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopping = true;
+    for (auto& i : m_ports) {
+        for (auto& j : i.second->m_jobs) {
+            j.m_transfer->cancel();
+        }
+        if (i.second->m_running != nullptr) {
+            i.second->m_running->cancel();
+        }
+    }
+    m_cond.notify_all();
+    lock.unlock();
+
+    // Workers complete their cancelled jobs before stopping
+    for (auto& i : m_ports) {
+        if (i.second->m_thread.joinable()) {
+            i.second->m_thread.join();
+        }
+    }
+}
+
+// Get number of pending transfers
+size_t TransferScheduler::getNumPending() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t pending = 0;
+    for (auto& i : m_ports) {
+        pending += i.second->m_jobs.size() + (i.second->m_running != nullptr ? 1 : 0);
+    }
+    return pending;
+}
+
+// Get failures
+void TransferScheduler::getFailures(std::vector<Failure>& failures)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    failures.clear();
+    failures.swap(m_failures);
+}
+
+// Worker thread main loop
+void TransferScheduler::work(Port* port)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cond.wait(lock, [this, port]() {
+            return m_stopping || !port->m_jobs.empty();
+        });
+        if (port->m_jobs.empty()) {
+            break;
+        }
+
+        // Jobs queued during shutdown have been cancelled already and complete right away
+        Job job = port->m_jobs.front();
+        port->m_jobs.erase(port->m_jobs.begin());
+        port->m_running = job.m_transfer;
+        lock.unlock();
+        runJob(job);
+        lock.lock();
+        port->m_running = nullptr;
+    }
+}
+
+// Run job
+void TransferScheduler::runJob(const Job& job)
+{
+    Context context = { this, &job };
+    job.m_transfer->run(notify, &context);
+}
+
+// Transfer notification callback
+void TransferScheduler::notify(void* object, DeviceTransfer* transfer, bool done)
+{
+    // The failure is recorded before the completion is passed on, the transfer may be destroyed after that
+    auto context = static_cast<Context*>(object);
+    if (done && transfer->getError()) {
+        Failure failure = { &(transfer->getStore()), transfer->getType(), std::string() };
+        try {
+            std::rethrow_exception(transfer->getError());
+        }
+        catch (std::exception& e) {
+            failure.m_message = e.what();
+        }
+        catch (...) {
+            failure.m_message = "Unknown error";
+        }
+        std::lock_guard<std::mutex> lock(context->m_scheduler->m_mutex);
+        context->m_scheduler->m_failures.push_back(failure);
+    }
+    if (context->m_job->m_callback != nullptr) {
+        context->m_job->m_callback(context->m_job->m_object, transfer, done);
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
+
+#endif // HAVE_RTMIDI
@@ -0,0 +1,231 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wersi/devicetransfer.hh>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_RTMIDI
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Device transfer scheduler.
+
+  Runs device transfers with one worker thread per MIDI interface, so transfers of devices on different interfaces run
+  in parallel, while transfers sharing an interface are run one after the other instead of mixing their messages on
+  the wire. A backup or restore of several devices takes as long as the slowest interface then. Interfaces are
+  identified by the name of their MIDI output port, not by the RtMidiOut object, as every device opens the port with
+  its own object, even if it shares the interface with other devices.
+
+  Each interface has a queue ordered by priority, interactive transfers like writing a single edited block are run
+  before bulk transfers queued earlier, a running transfer is not interrupted though. Progress and completion of each
+  transfer are reported through its callback from the worker thread, as for DeviceTransfer::start(). Failed transfers
+  are collected, so the caller can report them together after a batch of transfers. Transfers are not owned by the
+  scheduler, they must stay alive until their completion has been reported.
+ */
+class TransferScheduler {
+    public:
+        /// Transfer priority
+        enum class Priority {
+            Interactive     = 0,            ///< Small transfer the user is waiting for
+            Bulk            = 1             ///< Backup or restore of a whole device
+        };
+
+        /// Failed transfer
+        struct Failure {
+            InstrumentStore*        m_store;        ///< Instrument store of the transfer
+            DeviceTransfer::Type    m_type;         ///< Transfer direction
+            std::string             m_message;      ///< Error message
+        };
+
+        /**
+          Create new transfer scheduler.
+
+          Creates a transfer scheduler without any workers, they are started for each MIDI interface on demand.
+         */
+        TransferScheduler();
+
+        /**
+          Destroy transfer scheduler.
+
+          Cancels all transfers and stops the workers, see shutdown().
+         */
+        ~TransferScheduler();
+
+        /**
+          Submit transfer.
+
+          Queues the transfer for the given MIDI interface, starting a worker for the interface if there is none yet.
+          The transfer must not be started otherwise.
+
+          @param[in]    transfer    Transfer to run
+          @param[in]    interface   Name of the MIDI output port the transfer's output port is opened on
+          @param[in]    priority    Transfer priority
+          @param[in]    callback    Notification callback, see DeviceTransfer::start()
+          @param[in]    object      Object to pass to notification callback
+         */
+        void submit(DeviceTransfer* transfer, const std::string& interface, Priority priority,
+                    void(*callback)(void* object, DeviceTransfer* transfer, bool done), void* object);
+
+        /**
+          Cancel transfer.
+
+          Cancels a running transfer, which then finishes with a MidiException. A queued transfer is removed from its
+          queue and completes with a MidiException right away, the callback is called from the calling thread then.
+
+          @param[in]    transfer    Transfer to cancel
+         */
+        void cancel(DeviceTransfer* transfer);
+
+        /**
+          Shut down scheduler.
+
+          Cancels all queued and running transfers and waits for the workers to finish. Completion is reported for all
+          of them. No transfers may be submitted afterwards.
+         */
+        void shutdown();
+
+        /**
+          Get number of pending transfers.
+
+          Returns the number of transfers queued or running.
+
+          @return                   Number of pending transfers
+         */
+        size_t getNumPending() const;
+
+        /**
+          Get failures.
+
+          Moves the failures collected since the last call into the given list.
+
+          @param[out]   failures    List of failed transfers
+         */
+        void getFailures(std::vector<Failure>& failures);
+
+    private:
+        /// Queued transfer
+        struct Job {
+            DeviceTransfer*         m_transfer;     ///< Transfer to run
+            Priority                m_priority;     ///< Transfer priority
+            uint64_t                m_sequence;     ///< Submission order within the same priority
+            /// Notification callback
+            void                    (*m_callback)(void* object, DeviceTransfer* transfer, bool done);
+            void*                   m_object;       ///< Object to pass to notification callback
+        };
+
+        /// Context of a running job
+        struct Context {
+            TransferScheduler*      m_scheduler;    ///< Scheduler running the job
+            const Job*              m_job;          ///< Job being run
+        };
+
+        /// Queue and worker of a MIDI interface
+        struct Port {
+            /// Create idle port
+            Port()
+                : m_jobs()
+                , m_running(nullptr)
+                , m_thread() {
+            }
+
+            std::vector<Job>        m_jobs;         ///< Queued jobs, by priority and sequence
+            DeviceTransfer*         m_running;      ///< Running transfer, nullptr if idle
+            std::thread             m_thread;       ///< Worker thread
+
+            private:
+                // Inhibit copying
+                Port(const Port&);
+                Port& operator=(const Port&);
+        };
+
+        std::map<std::string, std::unique_ptr<Port>> m_ports;   ///< Ports by MIDI interface name
+        mutable std::mutex          m_mutex;        ///< Mutex protecting all members
+        std::condition_variable     m_cond;         ///< Signalled when jobs are queued or on shutdown
+        bool                        m_stopping;     ///< Set when shutting down
+        uint64_t                    m_sequence;     ///< Next submission sequence number
+        std::vector<Failure>        m_failures;     ///< Collected failures
+
+        /**
+          Worker thread main loop.
+
+          Runs the jobs of the port until the scheduler is shut down.
+
+          @param[in]    port        Port to work on
+         */
+        void work(Port* port);
+
+        /**
+          Run job.
+
+          Runs a job on the calling thread and records its failure.
+
+          @param[in]    job         Job to run
+         */
+        void runJob(const Job& job);
+
+        /**
+          Transfer notification callback.
+
+          Records the failure of a finished transfer and passes the notification on to the job's callback.
+
+          @param[in]    object      Context of the running job
+          @param[in]    transfer    Transfer notifying
+          @param[in]    done        True if the transfer finished
+         */
+        static void notify(void* object, DeviceTransfer* transfer, bool done);
+
+        // Inhibit copying
+        TransferScheduler(const TransferScheduler&);
+        TransferScheduler& operator=(const TransferScheduler&);
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
+
+#endif // HAVE_RTMIDI
@@ -0,0 +1,198 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/transferstats.hh>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Static constants used by reference
+const size_t TransferStats::s_numBuckets;
+const uint32_t TransferStats::s_wireRate;
+
+// Create empty block statistics
+TransferStats::BlockStats::BlockStats()
+    : m_requests(0)
+    , m_resends(0)
+    , m_responses(0)
+    , m_bytes(0)
+    , m_latencyCount(0)
+    , m_latencySum(0)
+    , m_latencyMax(0)
+{
+    memset(m_histogram, 0, sizeof(m_histogram));
+}
+
+// Create new transfer statistics
+TransferStats::TransferStats()
+    : m_mutex()
+    , m_data()
+{
+}
+
+// Reset statistics
+void TransferStats::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_data = Snapshot();
+}
+
+// Record request
+void TransferStats::recordRequest(SysEx::BlockType type)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_data.m_blocks[type].m_requests;
+}
+
+// Record resend
+void TransferStats::recordResend(SysEx::BlockType type)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_data.m_blocks[type].m_resends;
+}
+
+// Record response
+void TransferStats::recordResponse(SysEx::BlockType type, size_t length, std::chrono::microseconds latency,
+                                   bool measured)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    BlockStats& stats = m_data.m_blocks[type];
+    ++stats.m_responses;
+    stats.m_bytes += length;
+    m_data.m_wireBytes += sizeof(SysEx::SysExMessage) + 2 * length;
+    if (measured) {
+        uint64_t us = latency.count() > 0 ? uint64_t(latency.count()) : 0;
+        ++stats.m_latencyCount;
+        stats.m_latencySum += us;
+        if (us > stats.m_latencyMax) {
+            stats.m_latencyMax = us;
+        }
+        size_t bucket = 0;
+        while (bucket < s_numBuckets - 1 && us >= (uint64_t(1000) << bucket)) {
+            ++bucket;
+        }
+        ++stats.m_histogram[bucket];
+    }
+}
+
+// Record unexpected frame
+void TransferStats::recordUnexpected()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_data.m_unexpected;
+}
+
+// Record invalid frame
+void TransferStats::recordInvalid()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_data.m_invalid;
+}
+
+// Record busy time
+void TransferStats::recordBusy(std::chrono::microseconds time)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_data.m_busyTime += time.count() > 0 ? uint64_t(time.count()) : 0;
+}
+
+// Get statistics
+void TransferStats::getSnapshot(Snapshot& snapshot) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    snapshot = m_data;
+}
+
+// Summarize statistics
+std::string TransferStats::summarize(const Snapshot& snapshot)
+{
+    BlockStats total;
+    for (auto& i : snapshot.m_blocks) {
+        total.m_responses += i.second.m_responses;
+        total.m_resends += i.second.m_resends;
+        total.m_latencyCount += i.second.m_latencyCount;
+        total.m_latencySum += i.second.m_latencySum;
+        if (i.second.m_latencyMax > total.m_latencyMax) {
+            total.m_latencyMax = i.second.m_latencyMax;
+        }
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << total.m_responses << " blocks, " << total.m_resends << " resends, " << snapshot.m_unexpected
+        << " unexpected, " << snapshot.m_invalid << " invalid";
+    if (total.m_latencyCount > 0) {
+        out << ", latency " << double(total.m_latencySum) / total.m_latencyCount / 1000 << " ms avg, "
+            << double(total.m_latencyMax) / 1000 << " ms max";
+    }
+    if (snapshot.m_busyTime > 0) {
+        double rate = double(snapshot.m_wireBytes) * 1000000 / snapshot.m_busyTime;
+        out << ", " << std::setprecision(0) << rate << " B/s (" << rate * 100 / s_wireRate << "% of wire rate)";
+    }
+    return out.str();
+}
+
+// Print statistics
+void TransferStats::print(std::ostream& out, const Snapshot& snapshot)
+{
+    out << summarize(snapshot) << std::endl;
+    for (auto& i : snapshot.m_blocks) {
+        const BlockStats& stats = i.second;
+        out << "  " << char(i.first) << ": " << stats.m_requests << " requests, " << stats.m_resends
+            << " resends, " << stats.m_responses << " responses, " << stats.m_bytes << " bytes";
+        if (stats.m_latencyCount > 0) {
+            out << ", latency [ms]";
+            for (size_t j = 0; j < s_numBuckets; ++j) {
+                if (stats.m_histogram[j] > 0) {
+                    if (j < s_numBuckets - 1) {
+                        out << " <" << (1 << j) << ":" << stats.m_histogram[j];
+                    }
+                    else {
+                        out << " >=" << (1 << (j - 1)) << ":" << stats.m_histogram[j];
+                    }
+                }
+            }
+        }
+        out << std::endl;
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,209 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <wersi/sysex.hh>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/**
+  @ingroup wersi_group
+
+  Device transfer statistics.
+
+  Collects counters and latency histograms of block transfers per block type, so problems in the MIDI path like
+  slow responses, resends or garbled frames become visible. All methods may be called from any thread, the counters
+  are accumulated until reset() is called.
+ */
+class TransferStats {
+    public:
+        /// Number of latency histogram buckets, bucket n counts latencies below 2^n ms, the last one all others
+        static const size_t s_numBuckets = 12;
+
+        /// MIDI wire rate in bytes per second, 31250 baud with 10 bits per byte
+        static const uint32_t s_wireRate = 3125;
+
+        /// Statistics of one block type
+        struct BlockStats {
+            /// Create empty block statistics
+            BlockStats();
+
+            uint64_t    m_requests;                 ///< Number of requests sent, not counting resends
+            uint64_t    m_resends;                  ///< Number of requests resent after a timeout
+            uint64_t    m_responses;                ///< Number of responses received
+            uint64_t    m_bytes;                    ///< Block data bytes received
+            uint64_t    m_latencyCount;             ///< Number of latency samples
+            uint64_t    m_latencySum;               ///< Sum of latency samples in microseconds
+            uint64_t    m_latencyMax;               ///< Maximum latency sample in microseconds
+            uint64_t    m_histogram[s_numBuckets];  ///< Latency histogram
+        };
+
+        /// Copy of all statistics
+        struct Snapshot {
+            /// Create empty snapshot
+            Snapshot()
+                : m_blocks()
+                , m_unexpected(0)
+                , m_invalid(0)
+                , m_wireBytes(0)
+                , m_busyTime(0) {
+            }
+
+            std::map<SysEx::BlockType, BlockStats>  m_blocks;       ///< Statistics by block type
+            uint64_t                                m_unexpected;   ///< Frames not matching any request
+            uint64_t                                m_invalid;      ///< Frames that could not be decoded
+            uint64_t                                m_wireBytes;    ///< Bytes of all responses on the wire
+            uint64_t                                m_busyTime;     ///< Time spent transferring in microseconds
+        };
+
+        /**
+          Create new transfer statistics.
+
+          Creates transfer statistics with all counters cleared.
+         */
+        TransferStats();
+
+        /**
+          Reset statistics.
+
+          Clears all counters.
+         */
+        void reset();
+
+        /**
+          Record request.
+
+          Counts a block request sent for the first time.
+
+          @param[in]    type        Requested block type
+         */
+        void recordRequest(SysEx::BlockType type);
+
+        /**
+          Record resend.
+
+          Counts a block request resent after the response timed out.
+
+          @param[in]    type        Requested block type
+         */
+        void recordResend(SysEx::BlockType type);
+
+        /**
+          Record response.
+
+          Counts a received block. The latency is only added to the histogram if it has been measured, responses to
+          resent requests can't be assigned to a request message.
+
+          @param[in]    type        Block type
+          @param[in]    length      Block data length
+          @param[in]    latency     Time from request to response
+          @param[in]    measured    True if the latency is valid
+         */
+        void recordResponse(SysEx::BlockType type, size_t length, std::chrono::microseconds latency, bool measured);
+
+        /**
+          Record unexpected frame.
+
+          Counts a valid frame that didn't match any outstanding request.
+         */
+        void recordUnexpected();
+
+        /**
+          Record invalid frame.
+
+          Counts a frame that could not be decoded.
+         */
+        void recordInvalid();
+
+        /**
+          Record busy time.
+
+          Adds the duration of a transfer, which is the base for the throughput.
+
+          @param[in]    time        Transfer duration
+         */
+        void recordBusy(std::chrono::microseconds time);
+
+        /**
+          Get statistics.
+
+          Copies all counters consistently.
+
+          @param[out]   snapshot    Snapshot to fill
+         */
+        void getSnapshot(Snapshot& snapshot) const;
+
+        /**
+          Summarize statistics.
+
+          Returns a single line summary of block count, resends, bad frames, average latency and throughput, e.g. for
+          a status bar.
+
+          @param[in]    snapshot    Statistics to summarize
+
+          @return                   Summary line
+         */
+        static std::string summarize(const Snapshot& snapshot);
+
+        /**
+          Print statistics.
+
+          Prints the summary followed by one line of counters and the latency histogram per block type.
+
+          @param[in]    out         Output stream
+          @param[in]    snapshot    Statistics to print
+         */
+        static void print(std::ostream& out, const Snapshot& snapshot);
+
+    private:
+        mutable std::mutex  m_mutex;                ///< Mutex protecting the statistics
+        Snapshot            m_data;                 ///< Current statistics
+
+        TransferStats(const TransferStats&);                ///< Inhibit copying objects
+        TransferStats& operator=(const TransferStats&);     ///< Inhibit copying objects
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
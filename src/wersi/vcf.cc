@@ -40,6 +40,29 @@
 namespace DMSToolbox {
 namespace Wersi {
 
+// Raw data field descriptors
+const FieldCodec::Field Vcf::s_fields[] = {
+    {  0, 0x01, 0, false },                 // Left
+    {  0, 0x02, 1, false },                 // Right
+    {  0, 0x04, 2, false },                 // LowPass
+    {  0, 0x08, 3, false },                 // FourPoles
+    {  0, 0x10, 4, false },                 // WersiVoice
+    {  0, 0x20, 5, false },                 // Noise
+    {  0, 0x40, 6, false },                 // Distortion
+    {  1, 0xff, 0, true  },                 // Frequency
+    {  2, 0xff, 0, false },                 // Quality
+    {  3, 0x0c, 2, false },                 // NoiseType
+    {  3, 0x10, 4, false },                 // Retrigger
+    {  3, 0x60, 5, false },                 // EnvMode
+    {  3, 0x80, 7, false },                 // Tracking
+    {  4, 0xff, 0, false },                 // T1Time
+    {  5, 0xff, 0, false },                 // T2Time
+    {  6, 0xff, 0, true  },                 // T1Intensity
+    {  7, 0xff, 0, true  },                 // T1Offset
+    {  8, 0xff, 0, true  },                 // T2Intensity
+    {  9, 0xff, 0, true  },                 // T2Offset
+};
+
 // Create new VCF object
 Vcf::Vcf(uint8_t blockNum, void* buffer)
     : m_blockNum(blockNum)
@@ -64,6 +87,7 @@ Vcf::Vcf(uint8_t blockNum, void* buffer)
     , m_t2Intensity(0)
     , m_t2Offset(0)
     , m_unknownBits(0)
+    , m_modified(false)
 {
     dissect();
 }
@@ -92,6 +116,7 @@ Vcf::Vcf(const Vcf& source)
     , m_t2Intensity(0)
     , m_t2Offset(0)
     , m_unknownBits(0)
+    , m_modified(false)
 {
     *this = source;
 }
@@ -136,11 +161,15 @@ void Vcf::copy(const Vcf& source)
     m_t2Offset      = source.m_t2Offset;
 
     m_unknownBits   = source.m_unknownBits;
+    m_modified      = true;
 }
 
 // Dissect VCF raw data
 void Vcf::dissect()
 {
+    static_assert(sizeof(s_fields) / sizeof(s_fields[0]) == size_t(Field::NumFields),
+                  "VCF field table must cover all fields");
+
     m_left          = (m_buffer[0] & 0x01) != 0;
     m_right         = (m_buffer[0] & 0x02) != 0;
     m_lowPass       = (m_buffer[0] & 0x04) != 0;
@@ -164,12 +193,15 @@ void Vcf::dissect()
     m_t2Offset      = int8_t(m_buffer[9]);
 
     m_unknownBits   = (m_buffer[3] & 0x03) | (m_buffer[0] & 0x80);
+    m_modified      = false;
 }
 
 // Put together and update VCF raw data
 void Vcf::update()
 {
-    m_buffer[0] = (m_left       ? 0x01 : 0x00) |
+    // Unknown bits are written back unchanged
+    m_buffer[0] = (m_unknownBits & 0x80) |
+                  (m_left       ? 0x01 : 0x00) |
                   (m_right      ? 0x02 : 0x00) |
                   (m_lowPass    ? 0x04 : 0x00) |
                   (m_fourPoles  ? 0x08 : 0x00) |
@@ -178,16 +210,32 @@ void Vcf::update()
                   (m_distortion ? 0x40 : 0x00);
     m_buffer[1] = uint8_t(m_frequency);
     m_buffer[2] = m_quality;
-    m_buffer[3] = ((static_cast<uint8_t>(m_noiseType) & 3) << 2) |
+    m_buffer[3] = (m_unknownBits & 0x03) |
+                  ((static_cast<uint8_t>(m_noiseType) & 3) << 2) |
                   (m_retrigger  ? 0x10 : 0x00) |
                   ((static_cast<uint8_t>(m_envMode) & 3) << 5) |
-                  (m_lowPass    ? 0x80 : 0x00);
+                  (m_tracking   ? 0x80 : 0x00);
     m_buffer[4] = m_t1Time;
     m_buffer[5] = m_t2Time;
     m_buffer[6] = uint8_t(m_t1Intensity);
     m_buffer[7] = uint8_t(m_t1Offset);
     m_buffer[8] = uint8_t(m_t2Intensity);
     m_buffer[9] = uint8_t(m_t2Offset);
+    m_modified = false;
+}
+
+// Set raw field value
+void Vcf::setRaw(Field field, int16_t value)
+{
+    // Put the members together in a scratch copy, so the raw data buffer is only changed by update()
+    uint8_t scratch[BlockLayout<SysEx::BlockType::VcfBlock>::s_size] = {};
+    uint8_t* buffer = m_buffer;
+    m_buffer = scratch;
+    update();
+    FieldCodec::set(m_buffer, getField(field), value);
+    dissect();
+    m_buffer = buffer;
+    m_modified = true;
 }
 
 // Return noise type name
@@ -37,7 +37,8 @@
 
 #pragma once
 
-#include <common.hh>
+#include <wersi/blocklayout.hh>
+#include <wersi/fieldcodec.hh>
 #include <string>
 
 namespace DMSToolbox {
@@ -68,6 +69,30 @@ class Vcf {
             Rotor   = 3,                    ///< Rotor
         };
 
+        /// Raw data fields, see getRaw() and setRaw()
+        enum class Field {
+            Left,                           ///< Left output flag
+            Right,                          ///< Right output flag
+            LowPass,                        ///< Low pass flag
+            FourPoles,                      ///< Four poles flag
+            WersiVoice,                     ///< WersiVoice output flag
+            Noise,                          ///< Noise flag
+            Distortion,                     ///< Distortion flag
+            Frequency,                      ///< Filter frequency
+            Quality,                        ///< Filter quality
+            NoiseType,                      ///< Noise type
+            Retrigger,                      ///< Retrigger flag
+            EnvMode,                        ///< Envelope mode
+            Tracking,                       ///< Tracking flag
+            T1Time,                         ///< T1 time
+            T2Time,                         ///< T2 time
+            T1Intensity,                    ///< T1 intensity
+            T1Offset,                       ///< T1 offset
+            T2Intensity,                    ///< T2 intensity
+            T2Offset,                       ///< T2 offset
+            NumFields                       ///< Number of fields
+        };
+
         /**
           Create new VCF object from buffer.
 
@@ -108,6 +133,17 @@ class Vcf {
             return m_buffer;
         }
 
+        /**
+          Get raw buffer size.
+
+          Returns the raw buffer size, which is fixed at 10 bytes.
+
+          @return                   Raw buffer size
+         */
+        size_t getBufferSize() const {
+            return BlockLayout<SysEx::BlockType::VcfBlock>::s_size;
+        }
+
         /**
           Copy VCF object.
 
@@ -139,10 +175,23 @@ class Vcf {
         /**
           Update VCF raw data buffer.
 
-          Writes back changes in the VCF object to the associated raw VCF data buffer.
+          Writes back changes in the VCF object to the associated raw VCF data buffer. Bits not decoded into
+          object members are written back as they have been parsed or copied.
          */
         void update();
 
+        /**
+          Get modified state.
+
+          Returns true if object members have been changed by a copy since the last dissect() or update(), so the
+          object needs to be written back.
+
+          @return                   True if modified
+         */
+        bool isModified() const {
+            return m_modified;
+        }
+
         /**
           Get left output enabled.
 
@@ -363,6 +412,45 @@ class Vcf {
             return m_unknownBits;
         }
 
+        /**
+          Get field descriptor.
+
+          Returns the bit field descriptor of the given raw data field, for use with FieldCodec.
+
+          @param[in]    field       Raw data field
+
+          @return                   Field descriptor
+         */
+        static const FieldCodec::Field& getField(Field field) {
+            return s_fields[static_cast<size_t>(field)];
+        }
+
+        /**
+          Get raw field value.
+
+          Reads the given field directly from the raw VCF data buffer, without dissecting it. Changes of the object
+          members not yet written back by update() are not seen.
+
+          @param[in]    field       Raw data field
+
+          @return                   Field value
+         */
+        int16_t getRaw(Field field) const {
+            return FieldCodec::get(m_buffer, getField(field));
+        }
+
+        /**
+          Set raw field value.
+
+          Sets the given field through the raw VCF data layout, leaving all other data untouched. The new value is
+          picked up by the object members and the object is marked modified, the raw data buffer itself is only
+          changed by update(), so the instrument store keeps its checksums up to date.
+
+          @param[in]    field       Raw data field
+          @param[in]    value       Field value
+         */
+        void setRaw(Field field, int16_t value);
+
         /**
           Get noise type name.
 
@@ -386,6 +474,8 @@ class Vcf {
         static std::string getEnvelopeModeName(EnvelopeMode mode);
 
     private:
+        static const FieldCodec::Field s_fields[];  ///< Raw data field descriptors, indexed by Field
+
         uint8_t         m_blockNum;         ///< Block number
         uint8_t*        m_buffer;           ///< Associated raw buffer
 
@@ -410,6 +500,7 @@ class Vcf {
         int8_t          m_t2Offset;         ///< T2 envelope offset
 
         uint8_t         m_unknownBits;      ///< Currently unknown bits
+        bool            m_modified;         ///< Members changed since last dissect() or update()
 };
 
 } // namespace Wersi
@@ -0,0 +1,285 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#include <wersi/voicerenderer.hh>
+#include <wersi/instrumentstore.hh>
+#include <wersi/icb.hh>
+#include <wersi/vcf.hh>
+#include <wersi/wave.hh>
+#include <exceptions.hh>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <set>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+/// Number of samples rendered with the same control values
+static const size_t s_blockSize = 64;
+
+/// Attack time of the amplitude envelope in seconds
+static const float s_attackTime = 0.01f;
+
+/// Release time constant of the amplitude envelope in seconds
+static const float s_releaseTime = 0.25f;
+
+/// Release level considered silent, layers stop rendering below it
+static const float s_silence = 0.0001f;
+
+/// Base frequency of the VCF at frequency value 0 in Hz
+static const float s_vcfBase = 1000.0f;
+
+/// VCF frequency values per octave
+static const float s_vcfStepsPerOctave = 16.0f;
+
+/// Pi, M_PI is not standard C++
+static const float s_pi = 3.14159265f;
+
+/// Maximum number of layers followed in an ICB chain
+static const size_t s_maxLayers = 16;
+
+// Create new voice renderer
+VoiceRenderer::VoiceRenderer(InstrumentStore& store, uint8_t icb, uint32_t sampleRate)
+    : m_layers()
+    , m_sampleRate(sampleRate)
+{
+    Icb* layer = store.getIcb(icb);
+    if (layer == nullptr) {
+        throw DataFormatException("Instrument not found");
+    }
+
+    // Follow the chain of layered ICBs, stopping at loops
+    std::set<uint8_t> visited;
+    while (layer != nullptr && visited.insert(icb).second && m_layers.size() < s_maxLayers) {
+        addLayer(store, *layer);
+        icb = layer->getNextIcb();
+        layer = icb != 0 ? store.getIcb(icb) : nullptr;
+    }
+}
+
+// Destroy voice renderer
+VoiceRenderer::~VoiceRenderer()
+{
+}
+
+// Add layer
+void VoiceRenderer::addLayer(InstrumentStore& store, const Icb& icb)
+{
+    Layer layer;
+    layer.m_transpose = icb.getTranspose();
+    layer.m_detune = icb.getDetune();
+
+    // Wave tables are unsigned, the mean is removed to avoid a DC offset changing with the envelope
+    const Wave* wave = store.getWave(icb.getWaveBlock());
+    if (wave != nullptr) {
+        const uint8_t* sources[4] = { wave->getBass(), wave->getTenor(), wave->getAlto(), wave->getSoprano() };
+        const size_t sizes[4] = {
+            WaveLayout::s_bassSize, WaveLayout::s_tenorSize, WaveLayout::s_altoSize, WaveLayout::s_sopranoSize
+        };
+        for (size_t i = 0; i < 4; ++i) {
+            float mean = 0.0f;
+            for (size_t j = 0; j < sizes[i]; ++j) {
+                mean += sources[i][j];
+            }
+            mean /= sizes[i];
+            layer.m_waves[i].resize(sizes[i]);
+            for (size_t j = 0; j < sizes[i]; ++j) {
+                layer.m_waves[i][j] = (sources[i][j] - mean) / 128.0f;
+            }
+        }
+        layer.m_gain = wave->getLevel() / 127.0f;
+    }
+
+    // Routing, the VCF uses its own outputs
+    Vcf* vcf = icb.getVcf() ? store.getVcf(icb.getVcfBlock()) : nullptr;
+    bool left = icb.getLeft();
+    bool right = icb.getRight();
+    if (vcf != nullptr) {
+        layer.m_vcf = true;
+        layer.m_lowPass = vcf->getLowPass();
+        layer.m_fourPoles = vcf->getFourPoles();
+        layer.m_noise = vcf->getNoise();
+        layer.m_distortion = vcf->getDistortion();
+        layer.m_tracking = vcf->getTracking();
+        layer.m_frequency = vcf->getFrequency();
+        layer.m_damping = 2.0f - 1.95f * (vcf->getQuality() / 255.0f);
+        layer.m_t1Time = vcf->getT1Time();
+        layer.m_t1Intensity = vcf->getT1Intensity();
+        layer.m_t1Offset = vcf->getT1Offset();
+        left = left || vcf->getLeft();
+        right = right || vcf->getRight();
+    }
+    if (!left && !right) {
+        left = true;
+        right = true;
+    }
+    layer.m_left = left ? (right ? 0.707f : 1.0f) : 0.0f;
+    layer.m_right = right ? (left ? 0.707f : 1.0f) : 0.0f;
+
+    m_layers.push_back(layer);
+}
+
+// Render note
+void VoiceRenderer::render(uint8_t note, size_t hold, float* left, float* right, size_t size) const
+{
+    std::fill(left, left + size, 0.0f);
+    std::fill(right, right + size, 0.0f);
+    for (auto& i : m_layers) {
+        renderLayer(i, note, hold, left, right, size);
+    }
+
+    // Layers are mixed with headroom, clip what's left
+    float gain = m_layers.size() > 1 ? 1.0f / std::sqrt(float(m_layers.size())) : 1.0f;
+    for (size_t i = 0; i < size; ++i) {
+        left[i] = std::max(-1.0f, std::min(1.0f, left[i] * gain));
+        right[i] = std::max(-1.0f, std::min(1.0f, right[i] * gain));
+    }
+}
+
+// Render layer
+void VoiceRenderer::renderLayer(const Layer& layer, uint8_t note, size_t hold, float* left, float* right,
+                                size_t size) const
+{
+    // Select wave table by key range, higher ranges have shorter tables and thus less harmonics
+    int key = int(note) + layer.m_transpose;
+    size_t range = key < 48 ? 0 : key < 60 ? 1 : key < 72 ? 2 : 3;
+    const std::vector<float>& table = layer.m_waves[range];
+    if (table.empty() || layer.m_gain <= 0.0f) {
+        return;
+    }
+
+    // Oscillator runs on a 32 bit phase accumulator, table sizes are powers of two
+    unsigned bits = 0;
+    while ((size_t(1) << bits) < table.size()) {
+        ++bits;
+    }
+    const unsigned shift = 32 - bits;
+    const uint32_t mask = uint32_t(table.size() - 1);
+    const float fracScale = 1.0f / float(uint64_t(1) << shift);
+    double pitch = 440.0 * std::pow(2.0, (key - 69) / 12.0 + layer.m_detune / 1200.0);
+    const uint32_t increment = uint32_t(std::min(pitch / m_sampleRate, 0.5) * 4294967296.0);
+    uint32_t phase = 0;
+
+    // Envelope and filter state
+    float rate = float(m_sampleRate);
+    float attackStep = 1.0f / (s_attackTime * rate);
+    float releaseFactor = std::exp(-float(s_blockSize) / (s_releaseTime * rate));
+    float level = 0.0f;
+    float t1Level = 1.0f;
+    float t1Factor = std::exp(-float(s_blockSize) / ((layer.m_t1Time + 1) * 0.005f * rate));
+    float state[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    uint32_t noise = 0x12345678;
+
+    float block[s_blockSize];
+    for (size_t pos = 0; pos < size; pos += s_blockSize) {
+        size_t count = std::min(s_blockSize, size - pos);
+
+        // Control values for this block, the gain is ramped linearly to avoid zipper noise
+        float start = level;
+        if (pos < hold) {
+            level = std::min(1.0f, level + attackStep * count);
+        }
+        else {
+            level *= releaseFactor;
+            if (level < s_silence) {
+                break;
+            }
+        }
+        float step = (level - start) / count;
+
+        // Oscillator
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t index = phase >> shift;
+            float frac = (phase & ((uint32_t(1) << shift) - 1)) * fracScale;
+            float a = table[index];
+            float b = table[(index + 1) & mask];
+            block[i] = a + (b - a) * frac;
+            phase += increment;
+        }
+
+        // VCF, coefficients of the state variable filter are calculated once per block
+        if (layer.m_vcf) {
+            float value = layer.m_frequency + layer.m_t1Offset + layer.m_t1Intensity * t1Level;
+            t1Level *= t1Factor;
+            float cutoff = s_vcfBase * std::pow(2.0f, value / s_vcfStepsPerOctave);
+            if (layer.m_tracking) {
+                cutoff *= std::pow(2.0f, (key - 60) / 12.0f);
+            }
+            cutoff = std::max(20.0f, std::min(cutoff, rate * 0.45f));
+            float g = std::tan(s_pi * cutoff / rate);
+            float k = layer.m_damping;
+            float a1 = 1.0f / (1.0f + g * (g + k));
+            float a2 = g * a1;
+            float a3 = g * a2;
+            size_t stages = layer.m_fourPoles ? 2 : 1;
+
+            for (size_t i = 0; i < count; ++i) {
+                float x = block[i];
+                if (layer.m_noise) {
+                    noise = noise * 1664525 + 1013904223;
+                    x += (int32_t(noise) / 2147483648.0f) * 0.25f;
+                }
+                if (layer.m_distortion) {
+                    x = std::tanh(x * 3.0f);
+                }
+                for (size_t j = 0; j < stages; ++j) {
+                    float* s = &state[j * 2];
+                    float v3 = x - s[1];
+                    float v1 = a1 * s[0] + a2 * v3;
+                    float v2 = s[1] + a2 * s[0] + a3 * v3;
+                    s[0] = 2.0f * v1 - s[0];
+                    s[1] = 2.0f * v2 - s[1];
+                    x = layer.m_lowPass ? v2 : v1;
+                }
+                block[i] = x;
+            }
+        }
+
+        // Amplitude and mix
+        float gainLeft = layer.m_gain * layer.m_left;
+        float gainRight = layer.m_gain * layer.m_right;
+        for (size_t i = 0; i < count; ++i) {
+            float sample = block[i] * (start + step * (i + 1));
+            left[pos + i] += sample * gainLeft;
+            right[pos + i] += sample * gainRight;
+        }
+    }
+}
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -0,0 +1,198 @@
+// vim:set ts=4 sw=4 et cin:
+
+/*
+  DMS-Toolbox - an editor, librarian and converter for the Wersi DMS system
+  (C) 2015 Michael Kukat <michael_AT_mik-music.org>
+
+  This file is part of DMS-Toolbox.
+
+  DMS-Toolbox is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  DMS-Toolbox is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with DMS-Toolbox.  If not, see <http://www.gnu.org/licenses/>.
+
+  Diese Datei ist Teil von DMS-Toolbox.
+
+  DMS-Toolbox ist Freie Software: Sie können es unter den Bedingungen
+  der GNU General Public License, wie von der Free Software Foundation,
+  Version 3 der Lizenz oder (nach Ihrer Wahl) jeder späteren
+  veröffentlichten Version, weiterverbreiten und/oder modifizieren.
+
+  DMS-Toolbox wird in der Hoffnung, dass es nützlich sein wird, aber
+  OHNE JEDE GEWÄHELEISTUNG, bereitgestellt; sogar ohne die implizite
+  Gewährleistung der MARKTFÄHIGKEIT oder EIGNUNG FÜR EINEN BESTIMMTEN ZWECK.
+  Siehe die GNU General Public License für weitere Details.
+
+  Sie sollten eine Kopie der GNU General Public License zusammen mit diesem
+  Programm erhalten haben. Wenn nicht, siehe <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <common.hh>
+#include <vector>
+
+namespace DMSToolbox {
+namespace Wersi {
+
+// Forward declarations
+class InstrumentStore;
+class Icb;
+
+/**
+  @ingroup wersi_group
+
+  Offline voice renderer.
+
+  Renders a single note of an instrument into floating point PCM samples, allowing to audition instruments without
+  a DMS-System. The renderer follows the ICB chain of layered instruments and mixes one voice per layer. Each voice
+  consists of a wave table oscillator playing the bass, tenor, alto or soprano wave of the WAVE block depending on the
+  note, an amplitude envelope and, if the ICB is routed to the VCF, a state variable filter modelled after the VCF
+  block settings.
+
+  The AMPL and FREQ envelope programs are not decoded yet, so all voices use a fixed attack / release amplitude
+  envelope and a constant pitch. The result is an approximation of the timbre only, not a sample exact emulation.
+
+  All instrument data is copied when creating the renderer, so the instrument store may be changed or closed
+  afterwards. Processing is done in blocks with control values (envelopes, filter coefficients) being updated once
+  per block. A renderer has no shared state, different renderers may be used in parallel from multiple threads.
+ */
+class VoiceRenderer {
+    public:
+        /**
+          Create new voice renderer.
+
+          Creates a new voice renderer for the given instrument, copying all data needed to render it. If the ICB
+          does not exist, a DataFormatException is thrown.
+
+          @param[in]    store       Instrument store holding the instrument
+          @param[in]    icb         ICB block number of the instrument
+          @param[in]    sampleRate  Sample rate in Hz
+         */
+        VoiceRenderer(InstrumentStore& store, uint8_t icb, uint32_t sampleRate = 44100);
+
+        /**
+          Destroy voice renderer.
+
+          Destroys the voice renderer.
+         */
+        ~VoiceRenderer();
+
+        /**
+          Get sample rate.
+
+          Returns the sample rate used for rendering.
+
+          @return                   Sample rate in Hz
+         */
+        uint32_t getSampleRate() const {
+            return m_sampleRate;
+        }
+
+        /**
+          Get number of layers.
+
+          Returns the number of layered voices rendered for each note.
+
+          @return                   Number of layers
+         */
+        size_t getNumLayers() const {
+            return m_layers.size();
+        }
+
+        /**
+          Render note.
+
+          Renders a note into stereo sample buffers. The note is held for the given number of samples, after that the
+          release phase is rendered until the end of the buffers. Samples are in the range -1.0 to 1.0 and the
+          buffers are overwritten.
+
+          @param[in]    note        MIDI note number, 60 is middle C
+          @param[in]    hold        Number of samples until the note is released
+          @param[out]   left        Left channel samples
+          @param[out]   right       Right channel samples
+          @param[in]    size        Number of samples to render
+         */
+        void render(uint8_t note, size_t hold, float* left, float* right, size_t size) const;
+
+    private:
+        /// Voice parameters of a single ICB layer
+        struct Layer {
+            /// Create empty layer
+            Layer()
+                : m_waves()
+                , m_transpose(0)
+                , m_detune(0)
+                , m_gain(0.0f)
+                , m_left(0.0f)
+                , m_right(0.0f)
+                , m_vcf(false)
+                , m_lowPass(true)
+                , m_fourPoles(false)
+                , m_noise(false)
+                , m_distortion(false)
+                , m_tracking(false)
+                , m_frequency(0)
+                , m_damping(2.0f)
+                , m_t1Time(0)
+                , m_t1Intensity(0)
+                , m_t1Offset(0) {
+            }
+
+            std::vector<float>  m_waves[4];     ///< Bass, tenor, alto and soprano wave tables, DC free
+            int8_t              m_transpose;    ///< Transposition in semitones
+            int8_t              m_detune;       ///< Detune in cents
+            float               m_gain;         ///< Wave level gain
+            float               m_left;         ///< Left output gain
+            float               m_right;        ///< Right output gain
+            bool                m_vcf;          ///< Voice is routed through the VCF
+            bool                m_lowPass;      ///< VCF is low pass, otherwise band pass
+            bool                m_fourPoles;    ///< VCF has four poles, otherwise two
+            bool                m_noise;        ///< Noise is added to the VCF input
+            bool                m_distortion;   ///< VCF input is distorted
+            bool                m_tracking;     ///< VCF frequency follows the note
+            int8_t              m_frequency;    ///< VCF frequency value
+            float               m_damping;      ///< VCF damping derived from quality
+            uint8_t             m_t1Time;       ///< VCF T1 envelope time
+            int8_t              m_t1Intensity;  ///< VCF T1 envelope intensity
+            int8_t              m_t1Offset;     ///< VCF T1 envelope offset
+        };
+
+        std::vector<Layer>  m_layers;           ///< Layers of the instrument
+        uint32_t            m_sampleRate;       ///< Sample rate in Hz
+
+        /**
+          Add layer.
+
+          Copies the voice parameters of an ICB and its VCF and WAVE blocks into a new layer.
+
+          @param[in]    store       Instrument store holding the blocks
+          @param[in]    icb         ICB of the layer
+         */
+        void addLayer(InstrumentStore& store, const Icb& icb);
+
+        /**
+          Render layer.
+
+          Renders a note of a single layer and adds it to the stereo sample buffers.
+
+          @param[in]    layer       Layer to render
+          @param[in]    note        MIDI note number
+          @param[in]    hold        Number of samples until the note is released
+          @param[in,out] left       Left channel samples
+          @param[in,out] right      Right channel samples
+          @param[in]    size        Number of samples to render
+         */
+        void renderLayer(const Layer& layer, uint8_t note, size_t hold, float* left, float* right, size_t size) const;
+};
+
+} // namespace Wersi
+} // namespace DMSToolbox
@@ -57,6 +57,7 @@ Wave::Wave(uint8_t blockNum, void* buffer, size_t size)
     , m_altoWave()
     , m_sopranoWave()
     , m_fixFormData()
+    , m_modified(false)
 {
     dissect();
 }
@@ -73,6 +74,7 @@ Wave::Wave(const Wave& source)
     , m_altoWave()
     , m_sopranoWave()
     , m_fixFormData()
+    , m_modified(false)
 {
     *this = source;
 }
@@ -94,118 +96,152 @@ Wave& Wave::operator=(const Wave& source)
     return *this;
 }
 
-// Copy wave object data
-void Wave::copy(const Wave& source)
+// Load wave part from raw data, parts not fully present in the block layout are cleared
+template<size_t size, size_t offset, size_t length>
+static inline void loadPart(uint8_t (&part)[length], const uint8_t* buffer)
 {
-    m_fixedFormants = source.m_fixedFormants;
-    m_level         = source.m_level;
-
-    if (m_size > 64) {
-        if (source.m_size > 64) {
-            memcpy(m_bassWave,    source.m_bassWave,    sizeof(m_bassWave));
-        }
-        else {
-            memset(m_bassWave,    0,                    sizeof(m_bassWave));
-        }
+    if (size >= offset + length) {
+        memcpy(part, buffer + offset, length);
     }
-    if (m_size > 128) {
-        if (source.m_size > 128) {
-            memcpy(m_tenorWave,   source.m_tenorWave,   sizeof(m_tenorWave));
-        }
-        else {
-            memset(m_tenorWave,   0,                    sizeof(m_tenorWave));
-        }
+    else {
+        memset(part, 0, length);
     }
-    if (m_size > 160) {
-        if (source.m_size > 160) {
-            memcpy(m_altoWave,    source.m_altoWave,    sizeof(m_altoWave));
-        }
-        else {
-            memset(m_altoWave,    0,                    sizeof(m_altoWave));
-        }
+}
+
+// Store wave part to raw data, if fully present in the block layout
+template<size_t size, size_t offset, size_t length>
+static inline void storePart(uint8_t* buffer, const uint8_t (&part)[length])
+{
+    if (size >= offset + length) {
+        memcpy(buffer + offset, part, length);
     }
-    if (m_size > 176) {
-        if (source.m_size > 176) {
-            memcpy(m_sopranoWave, source.m_sopranoWave, sizeof(m_sopranoWave));
+}
+
+// Copy wave part present in the destination layout, parts missing in the source layout are cleared
+template<size_t size, size_t sourceSize, size_t offset, size_t length>
+static inline void copyPart(uint8_t (&part)[length], const uint8_t (&source)[length])
+{
+    if (size >= offset + length) {
+        if (sourceSize >= offset + length) {
+            memcpy(part, source, length);
         }
         else {
-            memset(m_sopranoWave, 0,                    sizeof(m_sopranoWave));
+            memset(part, 0, length);
         }
     }
-    if (m_size > 211) {
-        if (source.m_size > 211) {
-            memcpy(m_fixFormData, source.m_fixFormData, sizeof(m_fixFormData));
-        }
-        else {
-            memset(m_fixFormData, 0,                    sizeof(m_fixFormData));
-        }
+}
+
+// Get largest layout fitting into buffer size
+Wave::Layout Wave::getLayout(size_t size)
+{
+    if (size >= FixWave) {
+        return FixWave;
     }
+    return size >= RelWave ? RelWave : LevelOnly;
 }
 
-// Dissect raw wave data
-void Wave::dissect()
+// Dissect wave parts of layout
+template<size_t size> void Wave::dissectParts()
 {
-    m_level         = m_buffer[0] & 0x7f;
-    m_fixedFormants = (m_buffer[0] & 0x80) != 0;
+    loadPart<size, WaveLayout::s_bassOffset>(m_bassWave, m_buffer);
+    loadPart<size, WaveLayout::s_tenorOffset>(m_tenorWave, m_buffer);
+    loadPart<size, WaveLayout::s_altoOffset>(m_altoWave, m_buffer);
+    loadPart<size, WaveLayout::s_sopranoOffset>(m_sopranoWave, m_buffer);
+    loadPart<size, WaveLayout::s_fixFormOffset>(m_fixFormData, m_buffer);
+}
 
-    if (m_size > 64) {
-        memcpy(m_bassWave, &(m_buffer[1]), sizeof(m_bassWave));
-    }
-    else {
-        memset(m_bassWave, 0, sizeof(m_bassWave));
-    }
+// Update wave parts of layout
+template<size_t size> void Wave::updateParts()
+{
+    storePart<size, WaveLayout::s_bassOffset>(m_buffer, m_bassWave);
+    storePart<size, WaveLayout::s_tenorOffset>(m_buffer, m_tenorWave);
+    storePart<size, WaveLayout::s_altoOffset>(m_buffer, m_altoWave);
+    storePart<size, WaveLayout::s_sopranoOffset>(m_buffer, m_sopranoWave);
+    storePart<size, WaveLayout::s_fixFormOffset>(m_buffer, m_fixFormData);
+}
 
-    if (m_size > 128) {
-        memcpy(m_tenorWave, &(m_buffer[65]), sizeof(m_tenorWave));
-    }
-    else {
-        memset(m_tenorWave, 0, sizeof(m_tenorWave));
-    }
+// Copy wave parts between layouts
+template<size_t size, size_t sourceSize> void Wave::copyParts(const Wave& source)
+{
+    copyPart<size, sourceSize, WaveLayout::s_bassOffset>(m_bassWave, source.m_bassWave);
+    copyPart<size, sourceSize, WaveLayout::s_tenorOffset>(m_tenorWave, source.m_tenorWave);
+    copyPart<size, sourceSize, WaveLayout::s_altoOffset>(m_altoWave, source.m_altoWave);
+    copyPart<size, sourceSize, WaveLayout::s_sopranoOffset>(m_sopranoWave, source.m_sopranoWave);
+    copyPart<size, sourceSize, WaveLayout::s_fixFormOffset>(m_fixFormData, source.m_fixFormData);
+}
 
-    if (m_size > 160) {
-        memcpy(m_altoWave, &(m_buffer[129]), sizeof(m_altoWave));
-    }
-    else {
-        memset(m_altoWave, 0, sizeof(m_altoWave));
+// Copy wave parts from source layout
+template<size_t size> void Wave::copyFrom(const Wave& source)
+{
+    switch (getLayout(source.m_size)) {
+        case FixWave:
+            copyParts<size, FixWave>(source);
+            break;
+        case RelWave:
+            copyParts<size, RelWave>(source);
+            break;
+        default:
+            copyParts<size, LevelOnly>(source);
+            break;
     }
+}
 
-    if (m_size > 176) {
-        memcpy(m_sopranoWave, &(m_buffer[161]), sizeof(m_sopranoWave));
-    }
-    else {
-        memset(m_sopranoWave, 0, sizeof(m_sopranoWave));
+// Copy wave object data
+void Wave::copy(const Wave& source)
+{
+    m_fixedFormants = source.m_fixedFormants;
+    m_level         = source.m_level;
+    m_modified      = true;
+
+    switch (getLayout(m_size)) {
+        case FixWave:
+            copyFrom<FixWave>(source);
+            break;
+        case RelWave:
+            copyFrom<RelWave>(source);
+            break;
+        default:
+            copyFrom<LevelOnly>(source);
+            break;
     }
+}
 
-    if (m_size > 211) {
-        memcpy(m_fixFormData, &(m_buffer[177]), sizeof(m_fixFormData));
-    }
-    else {
-        memset(m_fixFormData, 0, sizeof(m_fixFormData));
+// Dissect raw wave data
+void Wave::dissect()
+{
+    m_level         = m_buffer[WaveLayout::s_levelOffset] & 0x7f;
+    m_fixedFormants = (m_buffer[WaveLayout::s_levelOffset] & 0x80) != 0;
+    m_modified      = false;
+
+    switch (getLayout(m_size)) {
+        case FixWave:
+            dissectParts<FixWave>();
+            break;
+        case RelWave:
+            dissectParts<RelWave>();
+            break;
+        default:
+            dissectParts<LevelOnly>();
+            break;
     }
 }
 
 // Put together and update wave raw data
 void Wave::update()
 {
-    m_buffer[0] = (m_level & 0x7f) | (m_fixedFormants ? 0x80 : 0x00);
-    if (m_size > 64) {
-        memcpy(&(m_buffer[1]), m_bassWave, sizeof(m_bassWave));
-    }
-
-    if (m_size > 128) {
-        memcpy(&(m_buffer[65]), m_tenorWave, sizeof(m_tenorWave));
-    }
-
-    if (m_size > 160) {
-        memcpy(&(m_buffer[129]), m_altoWave, sizeof(m_altoWave));
-    }
-
-    if (m_size > 176) {
-        memcpy(&(m_buffer[161]), m_sopranoWave, sizeof(m_sopranoWave));
-    }
-
-    if (m_size > 211) {
-        memcpy(&(m_buffer[177]), m_fixFormData, sizeof(m_fixFormData));
+    m_buffer[WaveLayout::s_levelOffset] = (m_level & 0x7f) | (m_fixedFormants ? 0x80 : 0x00);
+    m_modified = false;
+
+    switch (getLayout(m_size)) {
+        case FixWave:
+            updateParts<FixWave>();
+            break;
+        case RelWave:
+            updateParts<RelWave>();
+            break;
+        default:
+            updateParts<LevelOnly>();
+            break;
     }
 }
 
@@ -37,7 +37,7 @@
 
 #pragma once
 
-#include <common.hh>
+#include <wersi/blocklayout.hh>
 
 namespace DMSToolbox {
 namespace Wersi {
@@ -59,7 +59,8 @@ class Wave {
           Creates a new wave object with the given block number and associates the given buffer with it. During
           creation, the data from the buffer is parsed and copied to the object members. If an explicit update()
           is called, the buffer is written back with the updated wave object data, for all other functions, it is
-          left untouched.
+          left untouched. The buffer size selects the RELWAVE or FIXWAVE layout, a buffer of any other size is
+          handled with the largest layout fitting into it.
 
           @param[in]    blockNum    Block number
           @param[in]    buffer      Raw data buffer
@@ -142,6 +143,18 @@ class Wave {
          */
         void update();
 
+        /**
+          Get modified state.
+
+          Returns true if the wave object may have been changed through a wave part pointer or by a copy since the
+          last dissect() or update(), so the object needs to be written back.
+
+          @return                   True if modified
+         */
+        bool isModified() const {
+            return m_modified;
+        }
+
         /**
           Get fixed formants state.
 
@@ -167,59 +180,158 @@ class Wave {
         /**
           Get bass wave.
 
-          Returns a pointer to the 64-byte bass wave.
+          Returns a pointer to the 64-byte bass wave, the wave counts as modified from then on.
 
           @return                   Pointer to 64-byte bass wave
          */
         uint8_t* getBass() {
+            m_modified = true;
+            return m_bassWave;
+        }
+
+        /**
+          Get bass wave for reading.
+
+          Returns a const pointer to the 64-byte bass wave.
+
+          @return                   Const pointer to 64-byte bass wave
+         */
+        const uint8_t* getBass() const {
             return m_bassWave;
         }
 
         /**
           Get tenor wave.
 
-          Returns a pointer to the 64-byte tenor wave.
+          Returns a pointer to the 64-byte tenor wave, the wave counts as modified from then on.
 
           @return                   Pointer to 64-byte tenor wave
          */
         uint8_t* getTenor() {
+            m_modified = true;
+            return m_tenorWave;
+        }
+
+        /**
+          Get tenor wave for reading.
+
+          Returns a const pointer to the 64-byte tenor wave.
+
+          @return                   Const pointer to 64-byte tenor wave
+         */
+        const uint8_t* getTenor() const {
             return m_tenorWave;
         }
 
         /**
           Get also wave.
 
-          Returns a pointer to the 32-byte alto wave.
+          Returns a pointer to the 32-byte alto wave, the wave counts as modified from then on.
 
           @return                   Pointer to 32-byte alto wave
          */
         uint8_t* getAlto() {
+            m_modified = true;
+            return m_altoWave;
+        }
+
+        /**
+          Get alto wave for reading.
+
+          Returns a const pointer to the 32-byte alto wave.
+
+          @return                   Const pointer to 32-byte alto wave
+         */
+        const uint8_t* getAlto() const {
             return m_altoWave;
         }
 
         /**
           Get soprano wave.
 
-          Returns a pointer to the 16-byte soprano wave.
+          Returns a pointer to the 16-byte soprano wave, the wave counts as modified from then on.
 
           @return                   Pointer to 16-byte soprano wave
          */
         uint8_t* getSoprano() {
+            m_modified = true;
+            return m_sopranoWave;
+        }
+
+        /**
+          Get soprano wave for reading.
+
+          Returns a const pointer to the 16-byte soprano wave.
+
+          @return                   Const pointer to 16-byte soprano wave
+         */
+        const uint8_t* getSoprano() const {
             return m_sopranoWave;
         }
 
     private:
+        /// Block sizes of the supported wave layouts
+        enum Layout {
+            LevelOnly   = 1,                                                        ///< Buffer too small for waves
+            RelWave     = BlockLayout<SysEx::BlockType::RelWaveBlock>::s_size,      ///< Relative formant wave
+            FixWave     = BlockLayout<SysEx::BlockType::FixWaveBlock>::s_size       ///< Fixed formant wave
+        };
+
+        /**
+          Get layout.
+
+          Returns the largest wave layout fitting into a buffer of the given size.
+
+          @param[in]    size        Raw buffer size
+
+          @return                   Wave layout
+         */
+        static Layout getLayout(size_t size);
+
+        /**
+          Dissect wave parts.
+
+          Parses all parts present in the given layout and clears all others.
+         */
+        template<size_t size> void dissectParts();
+
+        /**
+          Update wave parts.
+
+          Writes back all parts present in the given layout.
+         */
+        template<size_t size> void updateParts();
+
+        /**
+          Copy wave parts.
+
+          Copies all parts present in both layouts from the source and clears parts missing in the source.
+
+          @param[in]    source      Source object to copy from
+         */
+        template<size_t size, size_t sourceSize> void copyParts(const Wave& source);
+
+        /**
+          Copy wave parts.
+
+          Dispatches to the wave part copy for the layout of the source.
+
+          @param[in]    source      Source object to copy from
+         */
+        template<size_t size> void copyFrom(const Wave& source);
+
         uint8_t         m_blockNum;         ///< Block number
         uint8_t*        m_buffer;           ///< Associated raw buffer
         size_t          m_size;             ///< Size of associated raw buffer
 
         bool            m_fixedFormants;    ///< True if wave is using fixed formants
         uint8_t         m_level;            ///< Wave level
-        uint8_t         m_bassWave[64];     ///< Bass wave
-        uint8_t         m_tenorWave[64];    ///< Tenor wave
-        uint8_t         m_altoWave[32];     ///< Alto wave
-        uint8_t         m_sopranoWave[16];  ///< Soprano wave
-        uint8_t         m_fixFormData[35];  ///< Fixed formant data
+        uint8_t         m_bassWave[WaveLayout::s_bassSize];         ///< Bass wave
+        uint8_t         m_tenorWave[WaveLayout::s_tenorSize];       ///< Tenor wave
+        uint8_t         m_altoWave[WaveLayout::s_altoSize];         ///< Alto wave
+        uint8_t         m_sopranoWave[WaveLayout::s_sopranoSize];   ///< Soprano wave
+        uint8_t         m_fixFormData[WaveLayout::s_fixFormSize];   ///< Fixed formant data
+        bool            m_modified;         ///< Wave parts handed out or copied since last dissect() or update()
 };
 
 } // namespace Wersi